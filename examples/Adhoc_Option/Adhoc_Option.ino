@@ -9,7 +9,7 @@
 #define BROADCAST_INTERVAL 1000       // Broadcast interval (ms)
 #define HEARTBEAT_INTERVAL 1000       // Heartbeat send interval (ms)
 #define HEARTBEAT_TIMEOUT 5000        // Heartbeat timeout (ms)
-#define ESPNOW_DATA_SIZE 1000        // This is the internal allocation size in the library. Make sure it does not exceed the actual ESP-NOW transmission limit (device-dependent, typically ~250 or ~1470 bytes(ESP_NOW V2)). Large data should be split and sent in parts.
+#define ESPNOW_DATA_SIZE 1000        // This is the internal allocation size in the library. Make sure it does not exceed the actual ESP-NOW transmission limit (device-dependent, typically ~250 or ~1470 bytes(ESP_NOW V2)). Use sendLargeToAll() etc. for larger data (split and reassembled automatically).
 //Important!! Please add the include libraries after ESPNOW_DATA_SIZE statement.
 
 // Role setting (true: Server, false: Client) (Required)
@@ -44,12 +44,19 @@ void dataCallback(const uint8_t* mac, const espnow_message_t* msg, bool broadcas
   Serial.printf("[GET] Data received from %02X:%02X:%02X:%02X:%02X:%02X",
                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
   Serial.printf("  Command: %d", msg->cmd);
-  Serial.printf("  Data field size: %d bytes\n", ESPNOW_DATA_SIZE);
-  Serial.printf("  Data: %s\n", msg->data);
+  Serial.printf("  Data length: %d bytes\n", msg->len);
+  Serial.printf("  Data: %.*s\n", msg->len, msg->data);
 
   // Add msg->cmd, msg->data processing logic below
 }
 
+// Callback triggered when data sent with sendLarge*() has been reassembled
+void largeDataCallback(const uint8_t* mac, const uint8_t* data, size_t len) {
+  Serial.printf("[GET] Large data received from %02X:%02X:%02X:%02X:%02X:%02X (%d bytes)\n",
+                mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], len);
+  Serial.printf("  Data: %.*s\n", len, (const char*)data);
+}
+
 // Callback for notifications when peers join or leave
 void peerEventCallback(const uint8_t* mac, bool isServer, bool connected) {
   if (connected) {
@@ -83,6 +90,7 @@ void setup() {
 
   // Set callbacks
   espnow.setDataCallback(dataCallback); // (Required for receiving)
+  espnow.setLargeDataCallback(largeDataCallback);
   espnow.setPeerEventCallback(peerEventCallback);
 
   // Set Group ID (Required)
@@ -99,29 +107,22 @@ void setup() {
   Serial.printf("[SETUP] Heartbeat Timeout: %d ms\n", HEARTBEAT_TIMEOUT);
 
   // Display message size information
-  Serial.printf("[SETUP] Total Payload Size: %d bytes\n", sizeof(espnow_message_t));
+  Serial.printf("[SETUP] Header Size: %d bytes\n", espnow.getHeaderSize());
+  Serial.printf("[SETUP] Max Data Size: %d bytes\n", espnow.getMaxDataSize());
   Serial.printf("[SETUP] ESP-NOW Max Payload: %d bytes\n", espnow.getESPNOWMaxPayload());
 }
 
 // Example: Send data to specific role
 void sendDataToRole(bool targetIsServer, const char* message) {
-  espnow_message_t msg;
-  memset(&msg, 0, sizeof(msg));
-
-  strncpy(msg.group_id, GROUP_ID, sizeof(msg.group_id));
-  msg.role = ROLE;
-  msg.channel = ESPNOW_WIFI_CHANNEL;
-  msg.security = SECURITY;
-  msg.cmd = CMD_DATA;
-
-  strncpy(msg.data, message, sizeof(msg.data));
+  // Only the payload is passed (the library adds the header and sends only the used bytes)
+  size_t len = strlen(message) + 1;
 
   bool success;
   if (targetIsServer) {
-    success = espnow.sendToServer((uint8_t*)&msg, sizeof(msg));
+    success = espnow.sendToServer((const uint8_t*)message, len);
     Serial.printf("[SEND SERVER] To servers: %s\n", message);
   } else {
-    success = espnow.sendToClients((uint8_t*)&msg, sizeof(msg));
+    success = espnow.sendToClients((const uint8_t*)message, len);
     Serial.printf("[SEND CLIENT] To clients: %s\n", message);
   }
 
@@ -130,22 +131,11 @@ void sendDataToRole(bool targetIsServer, const char* message) {
   }
 }
 
-// Example: Send data to all roles
+// Example: Send data to all roles (split into several frames when it exceeds one ESP-NOW frame)
 void sendDataToAll(const char* message) {
-  espnow_message_t msg;
-  memset(&msg, 0, sizeof(msg));
-
-  strncpy(msg.group_id, GROUP_ID, sizeof(msg.group_id));
-  msg.role = ROLE;
-  msg.channel = ESPNOW_WIFI_CHANNEL;
-  msg.security = SECURITY;
-  msg.cmd = CMD_DATA;
-
-  strncpy(msg.data, message, sizeof(msg.data));
-
   bool success;
-  success = espnow.sendToAll((uint8_t*)&msg, sizeof(msg));
-  Serial.printf("[SEND ALL] To servers: %s\n", msg.data);
+  success = espnow.sendLargeToAll((const uint8_t*)message, strlen(message) + 1);
+  Serial.printf("[SEND ALL] To servers: %s\n", message);
 
   if (!success) {
     Serial.println("  No peers of target role connected");
@@ -33,8 +33,8 @@ void dataCallback(const uint8_t* mac, const espnow_message_t* msg, bool broadcas
   Serial.printf("[GET] Data received from %02X:%02X:%02X:%02X:%02X:%02X",
                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
   Serial.printf("  Command: %d", msg->cmd);
-  Serial.printf("  Data field size: %d bytes\n", ESPNOW_DATA_SIZE);
-  Serial.printf("  Data: %s\n", msg->data);
+  Serial.printf("  Data length: %d bytes\n", msg->len);
+  Serial.printf("  Data: %.*s\n", msg->len, msg->data);
 }
 
 
@@ -80,19 +80,11 @@ void loop() {
   if (currentTime - lastDataSendTime >= 3000) {
     lastDataSendTime = currentTime;
 
-    // Send example
+    // Send example (this message is longer than one ESP-NOW frame, so it is split and reassembled automatically)
     const char* message = "The Power of Small BeginningsGreat journeys often start with a single, hesitant step. A towering oak tree begins as a vulnerable acorn, and a vast, sweeping novel starts with one blank page. In our quest for monumental achievements, we frequently overlook the profound power of small beginnings. These initial moments, seemingly insignificant, contain the DNA of everything that follows. They are the quiet laboratories where courage is tested, foundations are laid, and the trajectory of a future is quietly determined.Consider the process of learning. Mastery of a complex skill—be it a language, an instrument, or a scientific discipline—does not erupt fully formed. It is painstakingly built from the basic alphabet of its domain: the first clumsy chords, the simple vocabulary words, the fundamental equations. Each small act of practice is a brick in an invisible wall. The beginner, focused only on the immediate struggle, may not see the emerging structure. Yet, without the the fundamental equations. Each small act of practice is a brick in an invisible wall. The beginner, focused only on the immediate struggle, may not see the emerging structure. Yet, without OK!";
-    espnow_message_t msg;
-    memset(&msg, 0, sizeof(msg));
-    strncpy(msg.group_id, GROUP_ID, sizeof(msg.group_id));
-    msg.role = ROLE;
-    msg.channel = ESPNOW_WIFI_CHANNEL;
-    msg.security = SECURITY;
-    msg.cmd = CMD_DATA;  // If CMD_DATA, send as data
-    strncpy(msg.data, message, sizeof(msg.data));
     bool success;
-    success = espnow.sendToAll((uint8_t*)&msg, sizeof(msg));
-    Serial.printf("[SEND ALL] To servers: %s\n", msg.data);
+    success = espnow.sendLargeToAll((const uint8_t*)message, strlen(message) + 1);  // Sent as CMD_FRAGMENT
+    Serial.printf("[SEND ALL] To servers: %s\n", message);
 
   }
 
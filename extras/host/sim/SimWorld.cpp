@@ -0,0 +1,1090 @@
+#include "SimWorld.h"
+#include <Preferences.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <mutex>
+#include <ftw.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// イベントの種類
+enum {
+    EV_FRAME,     // 受信
+    EV_TX_DONE,   // 送信完了（onSent）
+    EV_WAKE,      // ノードの loop() から update()
+    EV_TASK       // FreeRTOS タスクの再開
+};
+
+// タスクのスタック（ホストのスタック使用量は ESP32 より大きいため余裕を持たせる）
+#define SIM_TASK_STACK (256 * 1024)
+#define SIM_STACK_PAINT 0xA5
+
+SimWorld* SimWorld::_current = nullptr;
+
+struct SimWorld::Frame {
+    uint8_t src[6];
+    uint8_t dst[6];
+    std::vector<uint8_t> data;
+    uint8_t channel;
+    bool encrypted;
+    uint8_t key[ESP_NOW_KEY_LEN];
+    uint8_t pmk[ESP_NOW_KEY_LEN];
+};
+
+struct SimWorld::Node {
+    int index;
+    uint8_t mac[6];
+    uint8_t channel = 1;
+    SimClock clock;
+    uint64_t bootUs = 0;
+    std::unique_ptr<ESP_NowAdhoc> lib;
+    bool espnow = false;
+    uint8_t pmk[ESP_NOW_KEY_LEN] = {};
+    std::vector<ESP_NOW_Peer*> peers;
+    void (*newPeer)(const esp_now_recv_info_t*, const uint8_t*, int, void*) = nullptr;
+    void* newPeerArg = nullptr;
+    std::vector<SimTask*> tasks;
+    bool wakePending = false;
+    uint64_t wakeAt = 0;
+    uint64_t wakeGen = 0;
+    sim_node_stats_t stats = {};
+};
+
+// 協調的に切り替えるタスク（実行できるのは常にシミュレーターか1つのタスクだけ）
+struct SimTask {
+    int node;
+    TaskFunction_t fn;
+    void* arg;
+    pthread_t thread;
+    uint8_t* stack;
+    uint8_t* entry = nullptr;  // タスク関数を呼ぶ時点のスタック位置（上端の TLS・スレッド管理領域を除く）
+    uint32_t requested;
+    std::condition_variable cv;
+    bool turn = false;
+    bool killed = false;
+    bool done = false;
+    bool waiting = true;
+    uint32_t notify = 0;
+    uint64_t gen = 0;
+    uint64_t resumeAt = 0;
+};
+
+struct SimMutex {
+    int depth;
+};
+
+struct SimTaskKilled {};
+
+static std::mutex s_taskMutex;
+static std::condition_variable s_worldCv;
+
+static bool isBroadcast(const uint8_t* mac) {
+    static const uint8_t bc[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    return memcmp(mac, bc, 6) == 0;
+}
+
+static int removeEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return ::remove(path);
+}
+
+// ==================== ワールド ====================
+
+SimWorld::SimWorld(uint32_t seed) : _rng(seed) {
+    if (_current) {
+        fprintf(stderr, "SimWorld: only one world can exist at a time\n");
+        abort();
+    }
+    _current = this;
+
+    const char* tmp = getenv("TMPDIR");
+    std::string templ = std::string(tmp && *tmp ? tmp : "/tmp") + "/espnow_sim.XXXXXX";
+    std::vector<char> buf(templ.begin(), templ.end());
+    buf.push_back('\0');
+    if (mkdtemp(buf.data())) {
+        _nvsRoot = buf.data();
+    }
+}
+
+SimWorld::~SimWorld() {
+    // ライブラリ（ピア・タスク）を先に破棄してからワールドの状態を消す
+    for (int i = 0; i < nodeCount(); i++) {
+        powerOff(i);
+    }
+    while (!_events.empty()) {
+        _events.pop();
+    }
+    _nodes.clear();
+    if (!_nvsRoot.empty()) {
+        nftw(_nvsRoot.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+    _current = nullptr;
+}
+
+int SimWorld::addNode() {
+    std::unique_ptr<Node> node(new Node());
+    node->index = nodeCount();
+    uint16_t id = (uint16_t)(node->index + 1);
+    const uint8_t mac[6] = {0x02, 0x00, 0x00, 0x00, (uint8_t)(id >> 8), (uint8_t)id};
+    memcpy(node->mac, mac, 6);
+    _nodes.push_back(std::move(node));
+    return nodeCount() - 1;
+}
+
+int SimWorld::addNodes(int count) {
+    int first = nodeCount();
+    for (int i = 0; i < count; i++) {
+        addNode();
+    }
+    return first;
+}
+
+const uint8_t* SimWorld::mac(int node) const {
+    return _nodes[node]->mac;
+}
+
+int SimWorld::nodeOf(const uint8_t* mac) const {
+    if (mac[0] != 0x02 || mac[1] != 0 || mac[2] != 0 || mac[3] != 0) {
+        return -1;
+    }
+    int index = ((mac[4] << 8) | mac[5]) - 1;
+    return (index >= 0 && index < nodeCount()) ? index : -1;
+}
+
+bool SimWorld::isOn(int node) const {
+    return _nodes[node]->lib != nullptr;
+}
+
+ESP_NowAdhoc& SimWorld::lib(int node) {
+    return *_nodes[node]->lib;
+}
+
+void SimWorld::setClock(int node, const SimClock& clock) {
+    _nodes[node]->clock = clock;
+}
+
+const sim_node_stats_t& SimWorld::nodeStats(int node) const {
+    return _nodes[node]->stats;
+}
+
+ESP_NowAdhoc& SimWorld::boot(int node, const std::function<void(ESP_NowAdhoc&)>& setup) {
+    if (isOn(node)) {
+        powerOff(node);
+    }
+    Node& n = *_nodes[node];
+    n.bootUs = _now;
+    n.channel = 1;
+    n.stats.boots++;
+
+    Scope scope(*this, node);
+    n.lib.reset(new ESP_NowAdhoc());
+    setup(*n.lib);
+    return *n.lib;
+}
+
+void SimWorld::powerOff(int node) {
+    Node& n = *_nodes[node];
+    if (n.lib) {
+        Scope scope(*this, node);
+        n.lib.reset();
+    }
+    // ライブラリが残したタスク・ピアも電源断で消える
+    while (!n.tasks.empty()) {
+        taskDelete(n.tasks.back());
+    }
+    for (ESP_NOW_Peer* peer : n.peers) {
+        peer->_added = false;
+    }
+    n.peers.clear();
+    n.espnow = false;
+    n.newPeer = nullptr;
+    n.wakePending = false;
+    n.wakeGen++;
+}
+
+SimWorld::Node* SimWorld::self() const {
+    return _cur >= 0 ? _nodes[_cur].get() : nullptr;
+}
+
+SimWorld::Scope::Scope(SimWorld& world, int node) : _world(world), _node(node), _saved(world._cur) {
+    world._cur = node;
+}
+
+SimWorld::Scope::~Scope() {
+    _world.schedule(_node);
+    _world._cur = _saved;
+}
+
+// ==================== 実行 ====================
+
+void SimWorld::push(uint64_t t, int type, int node, uint64_t arg, std::shared_ptr<Frame> frame, SimTask* task) {
+    Event ev;
+    ev.t = t;
+    ev.seq = _seq++;
+    ev.type = type;
+    ev.node = node;
+    ev.arg = arg;
+    ev.frame = std::move(frame);
+    ev.task = task;
+    _events.push(std::move(ev));
+}
+
+void SimWorld::runUs(uint64_t us) {
+    uint64_t end = _now + us;
+    while (!_events.empty() && _events.top().t <= end) {
+        Event ev = _events.top();
+        _events.pop();
+        _now = ev.t;
+        dispatch(ev);
+    }
+    _now = end;
+}
+
+bool SimWorld::runUntil(const std::function<bool()>& pred, uint64_t maxUs) {
+    uint64_t end = _now + maxUs;
+    if (pred()) {
+        return true;
+    }
+    while (!_events.empty() && _events.top().t <= end) {
+        Event ev = _events.top();
+        _events.pop();
+        _now = ev.t;
+        dispatch(ev);
+        if (pred()) {
+            return true;
+        }
+    }
+    _now = end;
+    return pred();
+}
+
+void SimWorld::dispatch(const Event& ev) {
+    Node& n = *_nodes[ev.node];
+    switch (ev.type) {
+    case EV_FRAME:
+        if (n.lib) {
+            Scope scope(*this, ev.node);
+            deliver(ev.node, *ev.frame);
+        }
+        break;
+
+    case EV_TX_DONE: {
+        uint64_t id = ev.arg >> 1;
+        for (ESP_NOW_Peer* peer : n.peers) {
+            if (peer->_id == id) {
+                Scope scope(*this, ev.node);
+                peer->onSent((ev.arg & 1) != 0);
+                break;
+            }
+        }
+        break;
+    }
+
+    case EV_WAKE:
+        if (n.lib && ev.arg == n.wakeGen) {
+            n.wakePending = false;
+            Scope scope(*this, ev.node);
+            n.lib->update();
+        }
+        break;
+
+    case EV_TASK:
+        if (std::find(n.tasks.begin(), n.tasks.end(), ev.task) != n.tasks.end() &&
+            ev.arg == ev.task->gen && !ev.task->done) {
+            runTask(ev.task);
+        }
+        break;
+    }
+}
+
+// ノードの次の期限に loop() を起こす
+void SimWorld::schedule(int node) {
+    Node& n = *_nodes[node];
+    if (!n.lib) {
+        return;
+    }
+    if (_loopPeriodUs) {
+        if (!n.wakePending) {
+            wake(node, _now + _loopPeriodUs);
+        }
+        return;
+    }
+    unsigned long d = n.lib->nextDeadlineMs();
+    if (d == ULONG_MAX) {
+        return;
+    }
+    uint64_t delay = (d == 0) ? _wakeLatencyUs : std::min<uint64_t>(d, 1000000000ull) * 1000;
+    wake(node, _now + delay);
+}
+
+void SimWorld::wake(int node, uint64_t t) {
+    Node& n = *_nodes[node];
+    if (n.wakePending && n.wakeAt <= t) {
+        return;
+    }
+    n.wakePending = true;
+    n.wakeAt = t;
+    push(t, EV_WAKE, node, ++n.wakeGen);
+}
+
+// ==================== 時刻 ====================
+
+static int64_t localUs(const SimClock& clock, uint64_t elapsed) {
+    return clock.offsetUs + (int64_t)elapsed + (int64_t)((double)elapsed * clock.driftPpm / 1e6);
+}
+
+unsigned long SimWorld::nodeMillis() {
+    Node* n = self();
+    if (!n) {
+        return (unsigned long)(_now / 1000);
+    }
+    return (unsigned long)(localUs(n->clock, _now - n->bootUs) / 1000) + n->clock.millisBase;
+}
+
+unsigned long SimWorld::nodeMicros() {
+    Node* n = self();
+    if (!n) {
+        return (unsigned long)_now;
+    }
+    return (unsigned long)localUs(n->clock, _now - n->bootUs) + n->clock.microsBase;
+}
+
+int64_t SimWorld::nodeTimerUs() {
+    Node* n = self();
+    return n ? localUs(n->clock, _now - n->bootUs) : (int64_t)_now;
+}
+
+uint8_t SimWorld::nodeChannel() const {
+    Node* n = self();
+    return n ? n->channel : 0;
+}
+
+void SimWorld::setNodeChannel(uint8_t channel) {
+    if (Node* n = self()) {
+        n->channel = channel;
+    }
+}
+
+const uint8_t* SimWorld::nodeMac() const {
+    static const uint8_t none[6] = {};
+    Node* n = self();
+    return n ? n->mac : none;
+}
+
+// ==================== 統計 ====================
+
+void SimWorld::resetStats() {
+    _stats = {};
+    for (auto& n : _nodes) {
+        n->stats.frames = 0;
+        n->stats.bytes = 0;
+        n->stats.airtimeUs = 0;
+        n->stats.received = 0;
+    }
+    _statsStartUs = _now;
+}
+
+double SimWorld::airtimeUse() const {
+    uint64_t elapsed = _now - _statsStartUs;
+    return elapsed ? (double)_stats.airtimeUs / (double)elapsed : 0.0;
+}
+
+std::string SimWorld::nvsDir(int node) const {
+    char name[16];
+    const uint8_t* m = _nodes[node]->mac;
+    snprintf(name, sizeof(name), "%02x%02x%02x%02x%02x%02x", m[0], m[1], m[2], m[3], m[4], m[5]);
+    return _nvsRoot + "/" + name;
+}
+
+void SimWorld::noteNvsWrite() {
+    if (Node* n = self()) {
+        n->stats.nvsWrites++;
+    }
+}
+
+// ==================== チャンネル ====================
+
+uint64_t SimWorld::frameUs(size_t len) const {
+    return _channel.difsUs + _channel.preambleUs +
+           (uint64_t)(len + _channel.overheadBytes) * 8 * 1000000ull / _channel.bitrate;
+}
+
+uint64_t SimWorld::latency() {
+    uint64_t jitter = _channel.jitterUs ? _rng() % (_channel.jitterUs + 1) : 0;
+    return _channel.latencyUs + jitter;
+}
+
+bool SimWorld::chance(double p) {
+    return p > 0.0 && std::uniform_real_distribution<double>(0.0, 1.0)(_rng) < p;
+}
+
+size_t SimWorld::peerSend(ESP_NOW_Peer* peer, const uint8_t* data, int len) {
+    if (!peer->_added || len <= 0 || len > _channel.maxDataLen) {
+        _stats.rejected++;
+        return 0;
+    }
+    Node& n = *_nodes[peer->_node];
+    if (!n.espnow || (_busyUntil > _now && _busyUntil - _now > _channel.queueUs)) {
+        _stats.rejected++;
+        return 0;
+    }
+
+    bool broadcast = isBroadcast(peer->_mac);
+    std::shared_ptr<Frame> frame(new Frame());
+    memcpy(frame->src, n.mac, 6);
+    memcpy(frame->dst, peer->_mac, 6);
+    frame->data.assign(data, data + len);
+    frame->channel = n.channel;
+    frame->encrypted = !broadcast && peer->_encrypt;
+    memcpy(frame->key, peer->_key, sizeof(frame->key));
+    memcpy(frame->pmk, n.pmk, sizeof(frame->pmk));
+    if (_tap) {
+        _tap(n.index, peer->_mac, data, len);
+    }
+
+    uint64_t start = std::max(_now, _busyUntil);
+    uint64_t t = start;
+    uint64_t one = frameUs(len);
+    bool success = true;
+
+    if (broadcast) {
+        t += one;
+        for (auto& rx : _nodes) {
+            if (rx->index == n.index || !rx->lib || !rx->espnow || rx->channel != n.channel) {
+                continue;
+            }
+            if (canHear(n.index, rx->index) && !chance(_channel.loss)) {
+                push(t + latency(), EV_FRAME, rx->index, 0, frame);
+            } else {
+                _stats.lost++;
+            }
+        }
+    } else {
+        // ユニキャストはACKが返るまでドライバーが再送する（受信側は重複を捨てるため届くのは1回）
+        int dst = nodeOf(peer->_mac);
+        bool delivered = false;
+        success = false;
+        for (int attempt = 0; attempt <= _channel.macRetries; attempt++) {
+            if (attempt > 0) {
+                _stats.retries++;
+            }
+            t += one;
+            bool heard = dst >= 0 && dst != n.index && _nodes[dst]->lib && _nodes[dst]->espnow &&
+                         _nodes[dst]->channel == n.channel && canHear(n.index, dst) && !chance(_channel.loss);
+            t += _channel.ackUs;  // ACK またはACKタイムアウト
+            if (!heard) {
+                continue;
+            }
+            if (!delivered) {
+                push(t + latency(), EV_FRAME, dst, 0, frame);
+                delivered = true;
+            }
+            if (!chance(_channel.ackLoss)) {
+                success = true;
+                break;
+            }
+        }
+        if (!delivered) {
+            _stats.lost++;
+        }
+        if (!success) {
+            _stats.sendFailed++;
+        }
+    }
+
+    _busyUntil = t;
+    _stats.frames++;
+    _stats.broadcasts += broadcast ? 1 : 0;
+    _stats.bytes += len;
+    _stats.airtimeUs += t - start;
+    n.stats.frames++;
+    n.stats.bytes += len;
+    n.stats.airtimeUs += t - start;
+    push(t, EV_TX_DONE, n.index, (peer->_id << 1) | (success ? 1 : 0));
+    return len;
+}
+
+void SimWorld::inject(int dst, const uint8_t* srcMac, const uint8_t* dstMac, const uint8_t* data, size_t len,
+                      uint32_t delayUs) {
+    std::shared_ptr<Frame> frame(new Frame());
+    memcpy(frame->src, srcMac, 6);
+    memcpy(frame->dst, dstMac, 6);
+    frame->data.assign(data, data + len);
+    frame->channel = _nodes[dst]->channel;
+    frame->encrypted = false;
+    push(_now + delayUs, EV_FRAME, dst, 0, frame);
+}
+
+void SimWorld::deliver(int node, const Frame& frame) {
+    Node& n = *_nodes[node];
+    if (!n.espnow || frame.channel != n.channel) {
+        return;
+    }
+    bool broadcast = isBroadcast(frame.dst);
+    if (!broadcast && memcmp(frame.dst, n.mac, 6) != 0) {
+        return;
+    }
+
+    ESP_NOW_Peer* match = nullptr;
+    for (ESP_NOW_Peer* peer : n.peers) {
+        if (memcmp(peer->_mac, frame.src, 6) == 0) {
+            match = peer;
+            break;
+        }
+    }
+    // 暗号化フレームは送信元を同じ LMK・PMK で登録している場合のみ復号できる
+    if (frame.encrypted && (!match || !match->_encrypt || memcmp(match->_key, frame.key, sizeof(frame.key)) != 0 ||
+                            memcmp(n.pmk, frame.pmk, sizeof(frame.pmk)) != 0)) {
+        _stats.keyDrops++;
+        return;
+    }
+
+    _stats.delivered++;
+    n.stats.received++;
+    if (match) {
+        match->onReceive(frame.data.data(), frame.data.size(), broadcast);
+    } else if (n.newPeer) {
+        int from = nodeOf(frame.src);
+        wifi_pkt_rx_ctrl_t rx;
+        rx.rssi = (_rssi && from >= 0) ? _rssi(from, node) : _channel.rssi;
+        rx.noise_floor = _channel.noiseFloor;
+        uint8_t src[6];
+        uint8_t dst[6];
+        memcpy(src, frame.src, 6);
+        memcpy(dst, frame.dst, 6);
+        esp_now_recv_info_t info = {src, dst, &rx};
+        n.newPeer(&info, frame.data.data(), (int)frame.data.size(), n.newPeerArg);
+    }
+}
+
+// ==================== ESP-NOW ドライバー ====================
+
+bool SimWorld::espnowBegin(const uint8_t* pmk) {
+    Node* n = self();
+    if (!n) {
+        return false;
+    }
+    n->espnow = true;
+    memset(n->pmk, 0, sizeof(n->pmk));
+    if (pmk) {
+        memcpy(n->pmk, pmk, sizeof(n->pmk));
+    }
+    return true;
+}
+
+// esp_now_deinit() と同じく登録済みのピアもすべて外す
+bool SimWorld::espnowEnd() {
+    Node* n = self();
+    if (!n) {
+        return false;
+    }
+    for (ESP_NOW_Peer* peer : n->peers) {
+        peer->_added = false;
+    }
+    n->peers.clear();
+    n->espnow = false;
+    n->newPeer = nullptr;
+    return true;
+}
+
+int SimWorld::espnowPeerCount(bool encryptedOnly) const {
+    Node* n = self();
+    if (!n) {
+        return 0;
+    }
+    int count = 0;
+    for (ESP_NOW_Peer* peer : n->peers) {
+        count += (!encryptedOnly || peer->_encrypt) ? 1 : 0;
+    }
+    return count;
+}
+
+void SimWorld::espnowOnNewPeer(void (*cb)(const esp_now_recv_info_t*, const uint8_t*, int, void*), void* arg) {
+    if (Node* n = self()) {
+        n->newPeer = cb;
+        n->newPeerArg = arg;
+    }
+}
+
+bool SimWorld::peerAdd(ESP_NOW_Peer* peer) {
+    Node* n = self();
+    if (!n || !n->espnow) {
+        return false;
+    }
+    if (peer->_added) {
+        return true;
+    }
+    // esp_now_add_peer() と同じ上限・重複チェック
+    if (n->peers.size() >= ESP_NOW_MAX_TOTAL_PEER_NUM ||
+        (peer->_encrypt && espnowPeerCount(true) >= ESP_NOW_MAX_ENCRYPT_PEER_NUM)) {
+        return false;
+    }
+    for (ESP_NOW_Peer* other : n->peers) {
+        if (memcmp(other->_mac, peer->_mac, 6) == 0) {
+            return false;
+        }
+    }
+    n->peers.push_back(peer);
+    peer->_added = true;
+    peer->_node = n->index;
+    peer->_id = ++_peerIds;
+    return true;
+}
+
+bool SimWorld::peerRemove(ESP_NOW_Peer* peer) {
+    if (!peer->_added) {
+        return false;
+    }
+    std::vector<ESP_NOW_Peer*>& peers = _nodes[peer->_node]->peers;
+    peers.erase(std::remove(peers.begin(), peers.end(), peer), peers.end());
+    peer->_added = false;
+    return true;
+}
+
+// ==================== FreeRTOS ====================
+
+static void* taskEntry(void* p) {
+    SimTask* task = static_cast<SimTask*>(p);
+    {
+        std::unique_lock<std::mutex> lk(s_taskMutex);
+        task->cv.wait(lk, [task] { return task->turn; });
+    }
+    task->entry = static_cast<uint8_t*>(__builtin_frame_address(0));
+    if (!task->killed) {
+        try {
+            task->fn(task->arg);
+        } catch (SimTaskKilled&) {
+        }
+    }
+    std::unique_lock<std::mutex> lk(s_taskMutex);
+    task->done = true;
+    task->turn = false;
+    s_worldCv.notify_all();
+    return nullptr;
+}
+
+BaseType_t SimWorld::taskCreate(TaskFunction_t fn, uint32_t stackDepth, void* arg, TaskHandle_t* handle) {
+    Node* n = self();
+    if (!n) {
+        return pdFAIL;
+    }
+    SimTask* task = new SimTask();
+    task->node = n->index;
+    task->fn = fn;
+    task->arg = arg;
+    task->requested = stackDepth;
+    void* stack = nullptr;
+    if (posix_memalign(&stack, 4096, SIM_TASK_STACK) != 0) {
+        delete task;
+        return pdFAIL;
+    }
+    task->stack = static_cast<uint8_t*>(stack);
+    memset(task->stack, SIM_STACK_PAINT, SIM_TASK_STACK);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, task->stack, SIM_TASK_STACK);
+    int err = pthread_create(&task->thread, &attr, taskEntry, task);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        free(task->stack);
+        delete task;
+        return pdFAIL;
+    }
+
+    n->tasks.push_back(task);
+    task->resumeAt = _now + _wakeLatencyUs;
+    push(task->resumeAt, EV_TASK, task->node, ++task->gen, nullptr, task);
+    *handle = task;
+    return pdPASS;
+}
+
+void SimWorld::runTask(SimTask* task) {
+    Scope scope(*this, task->node);
+    SimTask* saved = _runningTask;
+    _runningTask = task;
+    {
+        std::unique_lock<std::mutex> lk(s_taskMutex);
+        task->turn = true;
+        task->cv.notify_all();
+        s_worldCv.wait(lk, [task] { return !task->turn; });
+    }
+    _runningTask = saved;
+}
+
+// タスクから呼ばれる：通知か期限まで処理をシミュレーターに返す
+uint32_t SimWorld::taskWait(bool clear, TickType_t ticks) {
+    SimTask* task = _runningTask;
+    if (!task) {
+        fprintf(stderr, "SimWorld: ulTaskNotifyTake() outside of a task\n");
+        abort();
+    }
+    task->waiting = true;
+    task->gen++;
+    if (task->notify > 0 || ticks != portMAX_DELAY) {
+        uint64_t delay = task->notify > 0 ? _wakeLatencyUs : std::max<uint64_t>((uint64_t)ticks * 1000, _wakeLatencyUs);
+        task->resumeAt = _now + delay;
+        push(task->resumeAt, EV_TASK, task->node, task->gen, nullptr, task);
+    } else {
+        task->resumeAt = UINT64_MAX;
+    }
+    {
+        std::unique_lock<std::mutex> lk(s_taskMutex);
+        task->turn = false;
+        s_worldCv.notify_all();
+        task->cv.wait(lk, [task] { return task->turn; });
+    }
+    task->waiting = false;
+    if (task->killed) {
+        throw SimTaskKilled();
+    }
+    uint32_t count = task->notify;
+    if (clear) {
+        task->notify = 0;
+    } else if (count > 0) {
+        task->notify--;
+    }
+    return count;
+}
+
+void SimWorld::taskNotify(TaskHandle_t task) {
+    task->notify++;
+    if (task->waiting && task != _runningTask && _now + _wakeLatencyUs < task->resumeAt) {
+        task->resumeAt = _now + _wakeLatencyUs;
+        push(task->resumeAt, EV_TASK, task->node, ++task->gen, nullptr, task);
+    }
+}
+
+void SimWorld::taskDelete(TaskHandle_t task) {
+    if (task == _runningTask) {
+        fprintf(stderr, "SimWorld: a task cannot delete itself\n");
+        abort();
+    }
+    {
+        std::unique_lock<std::mutex> lk(s_taskMutex);
+        task->killed = true;
+        task->turn = true;
+        task->cv.notify_all();
+        s_worldCv.wait(lk, [task] { return task->done; });
+    }
+    pthread_join(task->thread, nullptr);
+    std::vector<SimTask*>& tasks = _nodes[task->node]->tasks;
+    tasks.erase(std::remove(tasks.begin(), tasks.end(), task), tasks.end());
+    free(task->stack);
+    delete task;
+}
+
+// スタックの塗りつぶしが残っている分から使用量を求める
+UBaseType_t SimWorld::taskHighWaterMark(TaskHandle_t task) {
+    if (!task) {
+        task = _runningTask;
+    }
+    if (!task) {
+        return 0;
+    }
+    size_t untouched = 0;
+    while (untouched < SIM_TASK_STACK && task->stack[untouched] == SIM_STACK_PAINT) {
+        untouched++;
+    }
+    // glibc はスレッドの TLS・管理領域をスタックの上端に置くため、タスク関数を呼んだ位置から数える
+    uint8_t* top = task->entry ? task->entry : task->stack + SIM_TASK_STACK;
+    size_t used = (size_t)(top - (task->stack + untouched));
+    return task->requested > used ? (UBaseType_t)(task->requested - used) : 0;
+}
+
+// ==================== スタブの実装 ====================
+
+HardwareSerial Serial;
+EspClass ESP;
+WiFiClass WiFi;
+ESP_NOW_Class ESP_NOW;
+
+unsigned long millis() {
+    SimWorld* w = SimWorld::current();
+    return w ? w->nodeMillis() : 0;
+}
+
+unsigned long micros() {
+    SimWorld* w = SimWorld::current();
+    return w ? w->nodeMicros() : 0;
+}
+
+int64_t esp_timer_get_time() {
+    SimWorld* w = SimWorld::current();
+    return w ? w->nodeTimerUs() : 0;
+}
+
+void delay(unsigned long ms) {
+    (void)ms;
+}
+
+uint32_t esp_random() {
+    SimWorld* w = SimWorld::current();
+    return w ? w->random() : (uint32_t)rand();
+}
+
+static bool serialEnabled() {
+    SimWorld* w = SimWorld::current();
+    return !w || w->serialEnabled();
+}
+
+int HardwareSerial::printf(const char* fmt, ...) {
+    if (!serialEnabled()) {
+        return 0;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int n = vprintf(fmt, args);
+    va_end(args);
+    return n;
+}
+
+size_t HardwareSerial::print(const char* s) {
+    return serialEnabled() ? (size_t)::printf("%s", s) : 0;
+}
+
+size_t HardwareSerial::print(unsigned long v) {
+    return serialEnabled() ? (size_t)::printf("%lu", v) : 0;
+}
+
+size_t HardwareSerial::println(const char* s) {
+    return serialEnabled() ? (size_t)::printf("%s\n", s) : 0;
+}
+
+size_t HardwareSerial::println(unsigned long v) {
+    return serialEnabled() ? (size_t)::printf("%lu\n", v) : 0;
+}
+
+uint32_t EspClass::getCycleCount() {
+    uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch()).count();
+    return (uint32_t)(ns * 240 / 1000);
+}
+
+bool WiFiClass::setChannel(uint8_t channel) {
+    SimWorld* w = SimWorld::current();
+    if (w) {
+        w->setNodeChannel(channel);
+    }
+    return true;
+}
+
+uint8_t* WiFiClass::macAddress(uint8_t* mac) {
+    SimWorld* w = SimWorld::current();
+    if (w) {
+        memcpy(mac, w->nodeMac(), 6);
+    } else {
+        memset(mac, 0, 6);
+    }
+    return mac;
+}
+
+String WiFiClass::macAddress() {
+    uint8_t m[6];
+    macAddress(m);
+    char buf[18];
+    snprintf(buf, sizeof(buf), "%02X:%02X:%02X:%02X:%02X:%02X", m[0], m[1], m[2], m[3], m[4], m[5]);
+    return String(buf);
+}
+
+ESP_NOW_Peer::ESP_NOW_Peer(const uint8_t* mac_addr, uint8_t channel, wifi_interface_t iface, const uint8_t* lmk)
+    : _channel(channel), _ifc(iface), _encrypt(lmk != nullptr) {
+    memcpy(_mac, mac_addr, 6);
+    memset(_key, 0, sizeof(_key));
+    if (lmk) {
+        memcpy(_key, lmk, sizeof(_key));
+    }
+}
+
+ESP_NOW_Peer::~ESP_NOW_Peer() {
+    if (_added && SimWorld::current()) {
+        SimWorld::current()->peerRemove(this);
+    }
+}
+
+bool ESP_NOW_Peer::addr(const uint8_t* mac) {
+    if (_added) {
+        return false;
+    }
+    memcpy(_mac, mac, 6);
+    return true;
+}
+
+bool ESP_NOW_Peer::setChannel(uint8_t channel) {
+    _channel = channel;
+    return true;
+}
+
+bool ESP_NOW_Peer::setInterface(wifi_interface_t ifc) {
+    _ifc = ifc;
+    return true;
+}
+
+bool ESP_NOW_Peer::setKey(const uint8_t* lmk) {
+    _encrypt = lmk != nullptr;
+    memset(_key, 0, sizeof(_key));
+    if (lmk) {
+        memcpy(_key, lmk, sizeof(_key));
+    }
+    return true;
+}
+
+bool ESP_NOW_Peer::add() {
+    SimWorld* w = SimWorld::current();
+    return w && w->peerAdd(this);
+}
+
+bool ESP_NOW_Peer::remove() {
+    SimWorld* w = SimWorld::current();
+    return w && w->peerRemove(this);
+}
+
+size_t ESP_NOW_Peer::send(const uint8_t* data, int len) {
+    SimWorld* w = SimWorld::current();
+    return w ? w->peerSend(this, data, len) : 0;
+}
+
+bool ESP_NOW_Class::begin(const uint8_t* pmk) {
+    SimWorld* w = SimWorld::current();
+    return w && w->espnowBegin(pmk);
+}
+
+bool ESP_NOW_Class::end() {
+    SimWorld* w = SimWorld::current();
+    return w && w->espnowEnd();
+}
+
+int ESP_NOW_Class::getTotalPeerCount() {
+    SimWorld* w = SimWorld::current();
+    return w ? w->espnowPeerCount(false) : 0;
+}
+
+int ESP_NOW_Class::getEncryptedPeerCount() {
+    SimWorld* w = SimWorld::current();
+    return w ? w->espnowPeerCount(true) : 0;
+}
+
+int ESP_NOW_Class::getMaxDataLen() {
+    SimWorld* w = SimWorld::current();
+    return w ? w->channel().maxDataLen : ESP_NOW_MAX_DATA_LEN;
+}
+
+int ESP_NOW_Class::getVersion() {
+    return 1;
+}
+
+void ESP_NOW_Class::onNewPeer(void (*cb)(const esp_now_recv_info_t*, const uint8_t*, int, void*), void* arg) {
+    SimWorld* w = SimWorld::current();
+    if (w) {
+        w->espnowOnNewPeer(cb, arg);
+    }
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stackDepth, void* arg,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+    (void)name;
+    (void)priority;
+    (void)core;
+    SimWorld* w = SimWorld::current();
+    return w ? w->taskCreate(fn, stackDepth, arg, handle) : pdFAIL;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    SimWorld::current()->taskDelete(task);
+}
+
+void xTaskNotifyGive(TaskHandle_t task) {
+    SimWorld::current()->taskNotify(task);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+    return SimWorld::current()->taskWait(clearOnExit == pdTRUE, ticks);
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    SimWorld* w = SimWorld::current();
+    return w ? w->taskHighWaterMark(task) : 0;
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() {
+    return new SimMutex();
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t mutex) {
+    delete mutex;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t ticks) {
+    (void)ticks;
+    mutex->depth++;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex) {
+    mutex->depth--;
+    return pdTRUE;
+}
+
+// ==================== Preferences ====================
+
+bool Preferences::begin(const char* name, bool readOnly) {
+    SimWorld* w = SimWorld::current();
+    if (!w || w->currentNode() < 0) {
+        return false;
+    }
+    std::string nodeDir = w->nvsDir(w->currentNode());
+    mkdir(nodeDir.c_str(), 0700);
+    _dir = nodeDir + "/" + name;
+    mkdir(_dir.c_str(), 0700);
+    _readOnly = readOnly;
+    _open = true;
+    return true;
+}
+
+void Preferences::end() {
+    _open = false;
+}
+
+std::string Preferences::path(const char* key) const {
+    return _dir + "/" + key;
+}
+
+size_t Preferences::getBytes(const char* key, void* buf, size_t maxLen) {
+    if (!_open) {
+        return 0;
+    }
+    FILE* f = fopen(path(key).c_str(), "rb");
+    if (!f) {
+        return 0;
+    }
+    // NVS と同じく、バッファに収まらない値は読まない
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    size_t n = 0;
+    if (size >= 0 && (size_t)size <= maxLen) {
+        n = fread(buf, 1, (size_t)size, f);
+    }
+    fclose(f);
+    return n;
+}
+
+size_t Preferences::putBytes(const char* key, const void* value, size_t len) {
+    if (!_open || _readOnly) {
+        return 0;
+    }
+    FILE* f = fopen(path(key).c_str(), "wb");
+    if (!f) {
+        return 0;
+    }
+    size_t n = fwrite(value, 1, len, f);
+    fclose(f);
+    SimWorld::current()->noteNvsWrite();
+    return n;
+}
+
+bool Preferences::remove(const char* key) {
+    return _open && !_readOnly && ::remove(path(key).c_str()) == 0;
+}
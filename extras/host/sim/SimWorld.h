@@ -0,0 +1,224 @@
+#ifndef ESP_NowAdhocSim_H
+#define ESP_NowAdhocSim_H
+
+// ホスト上の複数ノードシミュレーター
+// ライブラリのソースをそのままビルドし、ノードごとに ESP_NowAdhoc を1つ動かす
+// 時刻は仮想時間（us）で、ノードは次の期限（nextDeadlineMs()）・受信・送信完了で起こす
+// 乱数はシードで決まるため、同じシード・同じ操作なら同じ結果になる
+
+#include "ESP_NowAdhoc.h"
+#include <functional>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+// 共有チャンネル（1つの衝突ドメイン）
+// 送信は空くまで待って順に電波を占有し、未送信の合計が queueUs を超えると send() が失敗する
+struct SimChannel {
+    double loss = 0.0;               // 受信ノードごと・送信試行ごとの損失率
+    double ackLoss = 0.0;            // ユニキャストが届いたのにACKを失う率（送信側は再送・失敗）
+    uint8_t macRetries = 0;          // ドライバーによるユニキャストの再送回数
+    uint32_t latencyUs = 200;        // 送信完了から受信コールバックまでの遅延
+    uint32_t jitterUs = 0;           // 遅延に加える一様乱数 (0..jitterUs)。受信順が入れ替わる
+    uint32_t bitrate = 1000000;      // 物理層のビットレート (bps)。ESP-NOW の既定は 1Mbps
+    uint32_t overheadBytes = 43;     // MACヘッダー・カテゴリ・ベンダー固有IE・FCS
+    uint32_t preambleUs = 192;       // 長プリアンブル + PLCPヘッダー
+    uint32_t difsUs = 50;            // 送信前の待ち
+    uint32_t ackUs = 314;            // SIFS + ACK
+    uint32_t queueUs = 50000;        // エアタイムの予算
+    int maxDataLen = ESP_NOW_MAX_DATA_LEN;
+    int8_t rssi = -50;
+    int8_t noiseFloor = -95;
+};
+
+// ノードの水晶（millis()・micros()・esp_timer_get_time() に反映）
+struct SimClock {
+    int64_t offsetUs = 0;            // 起動時のローカル時刻
+    double driftPpm = 0.0;           // 仮想時間に対する進み (ppm)
+    unsigned long millisBase = 0;    // millis() に加える値（桁あふれの確認用）
+    unsigned long microsBase = 0;    // micros() に加える値
+};
+
+typedef struct {
+    uint64_t frames;        // 送信したフレーム（再送を除く）
+    uint64_t broadcasts;
+    uint64_t bytes;         // ESP-NOW のペイロード
+    uint64_t airtimeUs;     // 電波を占有した時間（再送・ACKを含む）
+    uint64_t retries;       // ドライバーの再送
+    uint64_t delivered;     // 受信コールバックに渡したフレーム
+    uint64_t lost;          // 損失・聞こえないノードのため届かなかった受信
+    uint64_t sendFailed;    // onSent(false)
+    uint64_t rejected;      // send() が失敗した（予算超過・長さ超過・未登録）
+    uint64_t keyDrops;      // 暗号化の設定が合わず捨てた受信
+} sim_stats_t;
+
+typedef struct {
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t airtimeUs;
+    uint64_t received;
+    uint32_t nvsWrites;
+    uint32_t boots;
+} sim_node_stats_t;
+
+class SimWorld {
+public:
+    explicit SimWorld(uint32_t seed = 1);
+    ~SimWorld();
+    SimWorld(const SimWorld&) = delete;
+    SimWorld& operator=(const SimWorld&) = delete;
+
+    static SimWorld* current() { return _current; }
+
+    // ==================== ノード ====================
+
+    int addNode();                       // MAC は 02:00:00:00:hi:lo（番号 + 1）
+    int addNodes(int count);             // 最初に追加したノードの番号
+    int nodeCount() const { return (int)_nodes.size(); }
+    const uint8_t* mac(int node) const;
+    int nodeOf(const uint8_t* mac) const;
+
+    // 電源を入れて ESP_NowAdhoc を作り、setup() を呼ぶ（begin() などの設定）
+    ESP_NowAdhoc& boot(int node, const std::function<void(ESP_NowAdhoc&)>& setup);
+    // ESP_NowAdhoc を破棄して電源を切る（NVS のファイルは残る）
+    void powerOff(int node);
+    bool isOn(int node) const;
+    ESP_NowAdhoc& lib(int node);
+
+    // ノードの処理として f(lib) を呼ぶ（送信などのAPI呼び出し）。戻り値はそのまま返す
+    template <typename F>
+    auto at(int node, F&& f) {
+        Scope scope(*this, node);
+        return f(lib(node));
+    }
+
+    void setClock(int node, const SimClock& clock);
+    // 0 以外ではノードの loop() を一定間隔で回す（既定は次の期限まで眠る）
+    void setLoopPeriodUs(uint32_t us) { _loopPeriodUs = us; }
+    // 受信・期限から update() を呼ぶまでの遅延
+    void setWakeLatencyUs(uint32_t us) { _wakeLatencyUs = us ? us : 1; }
+
+    // ==================== チャンネル ====================
+
+    SimChannel& channel() { return _channel; }
+    // src の送信が dst に届くか（隠れ端末・マルチホップの構成）。未設定なら全ノードが聞こえる
+    void setLink(std::function<bool(int src, int dst)> canHear) { _canHear = std::move(canHear); }
+    void setRssi(std::function<int8_t(int src, int dst)> rssi) { _rssi = std::move(rssi); }
+    // 電波に出るフレームをすべて観測する（宛先は MAC。ブロードキャストは FF:FF:FF:FF:FF:FF）
+    void setTap(std::function<void(int src, const uint8_t* dst, const uint8_t* data, size_t len)> tap) {
+        _tap = std::move(tap);
+    }
+    // src から dst ノードへ任意のフレームを届ける（再送・改ざんの確認用。電波は占有しない）
+    void inject(int dst, const uint8_t* srcMac, const uint8_t* dstMac, const uint8_t* data, size_t len,
+                uint32_t delayUs = 0);
+
+    // ==================== 実行 ====================
+
+    uint64_t nowUs() const { return _now; }
+    void runUs(uint64_t us);
+    void runMs(uint64_t ms) { runUs(ms * 1000); }
+    // pred() が true になるまで進める（最大 maxUs）。なった場合は true
+    bool runUntil(const std::function<bool()>& pred, uint64_t maxUs);
+
+    // ==================== 統計 ====================
+
+    const sim_stats_t& stats() const { return _stats; }
+    const sim_node_stats_t& nodeStats(int node) const;
+    void resetStats();
+    // 統計をリセットしてからの電波の使用率 (0..1)
+    double airtimeUse() const;
+    // ノードの Serial 出力を表示する（既定では捨てる）
+    void setSerial(bool enable) { _serial = enable; }
+    bool serialEnabled() const { return _serial; }
+    std::string nvsDir(int node) const;
+
+    // ==================== スタブから呼ばれる ====================
+
+    int currentNode() const { return _cur; }
+    unsigned long nodeMillis();
+    unsigned long nodeMicros();
+    int64_t nodeTimerUs();
+    uint32_t random() { return (uint32_t)_rng(); }
+    uint8_t nodeChannel() const;
+    void setNodeChannel(uint8_t channel);
+    const uint8_t* nodeMac() const;
+    void noteNvsWrite();
+
+    bool peerAdd(ESP_NOW_Peer* peer);
+    bool peerRemove(ESP_NOW_Peer* peer);
+    size_t peerSend(ESP_NOW_Peer* peer, const uint8_t* data, int len);
+    bool espnowBegin(const uint8_t* pmk);
+    bool espnowEnd();
+    int espnowPeerCount(bool encryptedOnly) const;
+    void espnowOnNewPeer(void (*cb)(const esp_now_recv_info_t*, const uint8_t*, int, void*), void* arg);
+
+    BaseType_t taskCreate(TaskFunction_t fn, uint32_t stackDepth, void* arg, TaskHandle_t* handle);
+    void taskDelete(TaskHandle_t task);
+    void taskNotify(TaskHandle_t task);
+    uint32_t taskWait(bool clear, TickType_t ticks);
+    UBaseType_t taskHighWaterMark(TaskHandle_t task);
+
+private:
+    struct Frame;
+    struct Node;
+    struct Event {
+        uint64_t t;
+        uint64_t seq;
+        int type;
+        int node;
+        uint64_t arg;
+        std::shared_ptr<Frame> frame;
+        SimTask* task;
+        bool operator>(const Event& o) const { return t != o.t ? t > o.t : seq > o.seq; }
+    };
+
+    // ノードの処理中（millis() などがそのノードの値を返す）。抜けるときに次の期限を設定する
+    class Scope {
+    public:
+        Scope(SimWorld& world, int node);
+        ~Scope();
+    private:
+        SimWorld& _world;
+        int _node;
+        int _saved;
+    };
+
+    void push(uint64_t t, int type, int node, uint64_t arg, std::shared_ptr<Frame> frame = nullptr,
+              SimTask* task = nullptr);
+    void dispatch(const Event& ev);
+    void deliver(int node, const Frame& frame);
+    void schedule(int node);
+    void wake(int node, uint64_t t);
+    void runTask(SimTask* task);
+    uint64_t frameUs(size_t len) const;
+    uint64_t latency();
+    bool chance(double p);
+    bool canHear(int src, int dst) const { return !_canHear || _canHear(src, dst); }
+    Node* self() const;
+
+    static SimWorld* _current;
+
+    std::vector<std::unique_ptr<Node>> _nodes;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> _events;
+    std::mt19937 _rng;
+    SimChannel _channel;
+    std::function<bool(int, int)> _canHear;
+    std::function<int8_t(int, int)> _rssi;
+    std::function<void(int, const uint8_t*, const uint8_t*, size_t)> _tap;
+    sim_stats_t _stats = {};
+    uint64_t _now = 0;
+    uint64_t _statsStartUs = 0;
+    uint64_t _seq = 0;
+    uint64_t _busyUntil = 0;
+    uint64_t _peerIds = 0;
+    uint32_t _loopPeriodUs = 0;
+    uint32_t _wakeLatencyUs = 100;
+    int _cur = -1;
+    bool _serial = false;
+    std::string _nvsRoot;
+    SimTask* _runningTask = nullptr;
+};
+
+#endif
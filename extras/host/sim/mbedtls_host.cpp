@@ -0,0 +1,76 @@
+// ESP-IDF の mbedtls の代わりに OpenSSL で AES-GCM・HMAC-SHA256 を実装する
+
+#include "mbedtls/gcm.h"
+#include "mbedtls/md.h"
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <string.h>
+
+void mbedtls_gcm_init(mbedtls_gcm_context* ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_gcm_free(mbedtls_gcm_context* ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+int mbedtls_gcm_setkey(mbedtls_gcm_context* ctx, mbedtls_cipher_id_t cipher, const unsigned char* key,
+                       unsigned int keybits) {
+    (void)cipher;
+    if (keybits != 128 && keybits != 256) {
+        return -1;
+    }
+    memcpy(ctx->key, key, keybits / 8);
+    ctx->keybits = keybits;
+    return 0;
+}
+
+static int gcmRun(mbedtls_gcm_context* ctx, bool encrypt, size_t length, const unsigned char* iv, size_t ivLen,
+                  const unsigned char* add, size_t addLen, const unsigned char* input, unsigned char* output,
+                  size_t tagLen, unsigned char* tag) {
+    const EVP_CIPHER* cipher = ctx->keybits == 256 ? EVP_aes_256_gcm() : EVP_aes_128_gcm();
+    EVP_CIPHER_CTX* c = EVP_CIPHER_CTX_new();
+    int n = 0;
+    int ok = EVP_CipherInit_ex(c, cipher, nullptr, nullptr, nullptr, encrypt ? 1 : 0) &&
+             EVP_CIPHER_CTX_ctrl(c, EVP_CTRL_GCM_SET_IVLEN, (int)ivLen, nullptr) &&
+             EVP_CipherInit_ex(c, nullptr, nullptr, ctx->key, iv, encrypt ? 1 : 0) &&
+             (addLen == 0 || EVP_CipherUpdate(c, nullptr, &n, add, (int)addLen)) &&
+             (length == 0 || EVP_CipherUpdate(c, output, &n, input, (int)length));
+    if (ok && !encrypt) {
+        ok = EVP_CIPHER_CTX_ctrl(c, EVP_CTRL_GCM_SET_TAG, (int)tagLen, tag);
+    }
+    ok = ok && EVP_CipherFinal_ex(c, output + length, &n) > 0;
+    if (ok && encrypt) {
+        ok = EVP_CIPHER_CTX_ctrl(c, EVP_CTRL_GCM_GET_TAG, (int)tagLen, tag);
+    }
+    EVP_CIPHER_CTX_free(c);
+    return ok ? 0 : MBEDTLS_ERR_GCM_AUTH_FAILED;
+}
+
+int mbedtls_gcm_crypt_and_tag(mbedtls_gcm_context* ctx, int mode, size_t length, const unsigned char* iv,
+                              size_t iv_len, const unsigned char* add, size_t add_len, const unsigned char* input,
+                              unsigned char* output, size_t tag_len, unsigned char* tag) {
+    return gcmRun(ctx, mode == MBEDTLS_GCM_ENCRYPT, length, iv, iv_len, add, add_len, input, output, tag_len, tag);
+}
+
+int mbedtls_gcm_auth_decrypt(mbedtls_gcm_context* ctx, size_t length, const unsigned char* iv, size_t iv_len,
+                             const unsigned char* add, size_t add_len, const unsigned char* tag, size_t tag_len,
+                             const unsigned char* input, unsigned char* output) {
+    unsigned char check[16];
+    memcpy(check, tag, tag_len < sizeof(check) ? tag_len : sizeof(check));
+    return gcmRun(ctx, false, length, iv, iv_len, add, add_len, input, output, tag_len, check);
+}
+
+const mbedtls_md_info_t* mbedtls_md_info_from_type(mbedtls_md_type_t md_type) {
+    return md_type == MBEDTLS_MD_SHA256 ? reinterpret_cast<const mbedtls_md_info_t*>(EVP_sha256()) : nullptr;
+}
+
+int mbedtls_md_hmac(const mbedtls_md_info_t* md_info, const unsigned char* key, size_t keylen,
+                    const unsigned char* input, size_t ilen, unsigned char* output) {
+    if (!md_info) {
+        return -1;
+    }
+    unsigned int outLen = 0;
+    const EVP_MD* md = reinterpret_cast<const EVP_MD*>(md_info);
+    return HMAC(md, key, (int)keylen, input, ilen, output, &outLen) ? 0 : -1;
+}
@@ -0,0 +1,94 @@
+#ifndef ESP_NowAdhocHost_Arduino_H
+#define ESP_NowAdhocHost_Arduino_H
+
+// ホスト（Linux）でライブラリをビルドするための Arduino-ESP32 の最小限の代替
+// 時刻・乱数・FreeRTOS は sim/SimWorld.cpp が仮想時間の上で実装する
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <string>
+#include <esp_timer.h>
+
+// ==================== 時刻・乱数 ====================
+
+// 現在処理中のノードのローカル時刻（ノードごとのオフセット・ドリフトを含む）
+unsigned long millis();
+unsigned long micros();
+// 仮想時間は進めない（ノードの処理は瞬時に終わるものとして扱う）
+void delay(unsigned long ms);
+// シード付きの擬似乱数（同じシードなら同じ結果になる）
+uint32_t esp_random();
+
+// ==================== String / Serial / ESP ====================
+
+class String {
+public:
+    String(const char* s = "") : _s(s ? s : "") {}
+    String(const std::string& s) : _s(s) {}
+    const char* c_str() const { return _s.c_str(); }
+    size_t length() const { return _s.size(); }
+    String operator+(const String& o) const { return String(_s + o._s); }
+    String operator+(const char* o) const { return String(_s + o); }
+    friend String operator+(const char* a, const String& b) { return String(std::string(a) + b._s); }
+private:
+    std::string _s;
+};
+
+// 出力は SimWorld::setSerial() で有効にした場合のみ（既定では捨てる）
+class HardwareSerial {
+public:
+    int printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+    size_t print(const char* s);
+    size_t print(const String& s) { return print(s.c_str()); }
+    size_t print(unsigned long v);
+    size_t println(const char* s = "");
+    size_t println(const String& s) { return println(s.c_str()); }
+    size_t println(unsigned long v);
+};
+extern HardwareSerial Serial;
+
+// サイクルカウンターはホストの経過時間を公称 240MHz で換算する
+class EspClass {
+public:
+    uint32_t getCycleCount();
+};
+extern EspClass ESP;
+
+// ==================== FreeRTOS ====================
+
+// タスクは仮想時間に合わせて1つずつ実行する（協調的に切り替えるため結果は再現できる）
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef struct SimTask* TaskHandle_t;
+typedef struct SimMutex* SemaphoreHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+#define pdPASS 1
+#define pdFAIL 0
+#define pdTRUE 1
+#define pdFALSE 0
+#define portMAX_DELAY 0xFFFFFFFFu
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stackDepth, void* arg,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
+void xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks);
+// ホストのスタック使用量からの推定値（bytes。ESP32の実測値とは一致しない）
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+// 同時に動くタスクは1つだけのため、排他は何もしない
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex();
+void vSemaphoreDelete(SemaphoreHandle_t mutex);
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t ticks);
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef ESP_NowAdhocHost_ESP32_NOW_H
+#define ESP_NowAdhocHost_ESP32_NOW_H
+
+// Arduino-ESP32 の ESP32_NOW.h と同じインターフェース
+// 送信は sim/SimWorld.cpp のチャンネルモデルに渡し、受信・送信完了は仮想時間で届ける
+
+#include "WiFi.h"
+
+#define ESP_NOW_ETH_ALEN 6
+#define ESP_NOW_KEY_LEN 16
+#define ESP_NOW_MAX_TOTAL_PEER_NUM 20
+#define ESP_NOW_MAX_ENCRYPT_PEER_NUM 6
+#define ESP_NOW_MAX_DATA_LEN 250
+
+typedef struct {
+    int8_t rssi;
+    int8_t noise_floor;
+} wifi_pkt_rx_ctrl_t;
+
+typedef struct {
+    uint8_t* src_addr;
+    uint8_t* des_addr;
+    wifi_pkt_rx_ctrl_t* rx_ctrl;
+} esp_now_recv_info_t;
+
+class ESP_NOW_Peer {
+public:
+    virtual ~ESP_NOW_Peer();
+
+    const uint8_t* addr() const { return _mac; }
+    bool addr(const uint8_t* mac);
+    uint8_t getChannel() const { return _channel; }
+    bool setChannel(uint8_t channel);
+    wifi_interface_t getInterface() const { return _ifc; }
+    bool setInterface(wifi_interface_t ifc);
+    bool isEncrypted() const { return _encrypt; }
+    bool setKey(const uint8_t* lmk);
+
+    operator bool() const { return _added; }
+
+    virtual void onReceive(const uint8_t* data, size_t len, bool broadcast) { (void)data; (void)len; (void)broadcast; }
+    virtual void onSent(bool success) { (void)success; }
+
+protected:
+    ESP_NOW_Peer(const uint8_t* mac_addr, uint8_t channel = 0, wifi_interface_t iface = WIFI_IF_AUTO,
+                 const uint8_t* lmk = nullptr);
+    bool add();
+    bool remove();
+    size_t send(const uint8_t* data, int len);
+
+private:
+    friend class SimWorld;
+    uint8_t _mac[6];
+    uint8_t _channel;
+    wifi_interface_t _ifc;
+    bool _encrypt;
+    uint8_t _key[ESP_NOW_KEY_LEN];
+    bool _added = false;
+    int _node = -1;      // 登録したノード
+    uint64_t _id = 0;    // 送信完了を届ける先の識別（削除後に届いた完了は捨てる）
+};
+
+class ESP_NOW_Class {
+public:
+    const uint8_t BROADCAST_ADDR[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    bool begin(const uint8_t* pmk = nullptr);
+    bool end();
+    int getTotalPeerCount();
+    int getEncryptedPeerCount();
+    int getMaxDataLen();
+    int getVersion();
+    void onNewPeer(void (*cb)(const esp_now_recv_info_t* info, const uint8_t* data, int len, void* arg), void* arg);
+};
+extern ESP_NOW_Class ESP_NOW;
+
+#endif
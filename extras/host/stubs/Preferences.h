@@ -0,0 +1,22 @@
+#ifndef ESP_NowAdhocHost_Preferences_H
+#define ESP_NowAdhocHost_Preferences_H
+
+#include <stddef.h>
+#include <string>
+
+// NVS の代わりにファイルへ保存する（ノードごとのディレクトリ。SimWorld::nvsDir()）
+class Preferences {
+public:
+    bool begin(const char* name, bool readOnly = false);
+    void end();
+    size_t getBytes(const char* key, void* buf, size_t maxLen);
+    size_t putBytes(const char* key, const void* value, size_t len);
+    bool remove(const char* key);
+private:
+    std::string path(const char* key) const;
+    std::string _dir;
+    bool _readOnly = false;
+    bool _open = false;
+};
+
+#endif
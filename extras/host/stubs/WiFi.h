@@ -0,0 +1,28 @@
+#ifndef ESP_NowAdhocHost_WiFi_H
+#define ESP_NowAdhocHost_WiFi_H
+
+#include "Arduino.h"
+
+typedef enum { WIFI_IF_STA = 0, WIFI_IF_AP, WIFI_IF_AUTO } wifi_interface_t;
+
+#define WIFI_STA 1
+#define WIFI_POWER_17dBm 68
+
+class STAClass {
+public:
+    bool started() { return true; }
+};
+
+// MAC アドレス・チャンネルは現在処理中のノードのもの
+class WiFiClass {
+public:
+    bool mode(int m) { (void)m; return true; }
+    bool setChannel(uint8_t channel);
+    bool setTxPower(int power) { (void)power; return true; }
+    uint8_t* macAddress(uint8_t* mac);
+    String macAddress();
+    STAClass STA;
+};
+extern WiFiClass WiFi;
+
+#endif
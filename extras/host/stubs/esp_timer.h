@@ -0,0 +1,9 @@
+#ifndef ESP_NowAdhocHost_esp_timer_H
+#define ESP_NowAdhocHost_esp_timer_H
+
+#include <stdint.h>
+
+// 現在処理中のノードのローカル時刻 (us)
+int64_t esp_timer_get_time();
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef ESP_NowAdhocSimTest_H
+#define ESP_NowAdhocSimTest_H
+
+// シミュレーター上のテストの共通部分
+
+#include "SimWorld.h"
+#include <stdio.h>
+
+static int s_simFailures = 0;
+
+// 失敗しても続け、最後に simTestResult() で終了コードを返す
+#define SIM_CHECK(cond)                                                            \
+    do {                                                                           \
+        if (!(cond)) {                                                             \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            s_simFailures++;                                                       \
+        }                                                                          \
+    } while (0)
+
+static inline int simTestResult() {
+    if (s_simFailures == 0) {
+        printf("OK\n");
+    }
+    return s_simFailures == 0 ? 0 : 1;
+}
+
+// サーバー servers 台 + クライアントのグループを起動する（setup はノードごとの追加設定）
+static inline void simBootGroup(SimWorld& world, int servers, const std::function<void(int, ESP_NowAdhoc&)>& setup =
+                                                                  nullptr) {
+    for (int i = 0; i < world.nodeCount(); i++) {
+        world.boot(i, [&](ESP_NowAdhoc& lib) {
+            lib.setDebug(false);
+            if (setup) {
+                setup(i, lib);
+            }
+            lib.begin(i < servers, false);
+        });
+    }
+}
+
+// すべてのクライアントがすべてのサーバーを、サーバーがすべてのノードを認識した
+static inline bool simJoined(SimWorld& world, int servers) {
+    int n = world.nodeCount();
+    for (int i = 0; i < n; i++) {
+        ESP_NowAdhoc& lib = world.lib(i);
+        bool ok = (i < servers) ? lib.getTotalPeerCount() >= std::min(n - 1, ESPNOW_MAX_PEERS)
+                                : lib.getServerPeerCount() >= std::min(servers, ESPNOW_MAX_PEERS);
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,81 @@
+// グループ時刻：水晶のずれ・オフセットが異なる6台が基準のサーバーに揃う
+// 無通信時、各クライアントがデータを送り続ける通信中、経路広告が同じ送信クラスに積まれるメッシュ + セキュリティモードで確認する
+
+#include "SimTest.h"
+#include <algorithm>
+#include <cmath>
+
+#define NODES 6
+#define SERVERS 2
+
+struct Result {
+    bool synced;
+    double maxErrorUs;
+    double maxDriftErrorPpm;
+};
+
+static Result run(bool traffic, bool meshSecure) {
+    SimWorld world(21);
+    world.addNodes(NODES);
+    world.channel().jitterUs = 20;
+    std::vector<double> drift(NODES);
+    for (int i = 0; i < NODES; i++) {
+        SimClock clock;
+        clock.offsetUs = (int64_t)(world.random() % 5000000);
+        clock.driftPpm = (double)((int)(world.random() % 241) - 120);
+        world.setClock(i, clock);
+        drift[i] = clock.driftPpm;
+    }
+    for (int i = 0; i < NODES; i++) {
+        world.boot(i, [&](ESP_NowAdhoc& lib) {
+            lib.setDebug(false);
+            lib.setPeerCache(false);
+            lib.setMesh(meshSecure);
+            lib.begin(i < SERVERS, meshSecure, "pmk-0123456789ab", "lmk-0123456789ab");
+        });
+        // 同時に起動するとハートビートの周期が揃うため散らす
+        world.runUs(world.random() % 100000);
+    }
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, SERVERS); }, 10000000));
+
+    // 通信中は各クライアントが 50ms ごとに（クライアントごとにずらして）サーバーへ送る
+    uint8_t payload[8] = {};
+    uint64_t end = world.nowUs() + 60000000;
+    std::vector<uint64_t> next(NODES);
+    for (int i = SERVERS; i < NODES; i++) {
+        next[i] = world.nowUs() + world.random() % 50000;
+    }
+    while (traffic && world.nowUs() < end) {
+        int i = (int)(std::min_element(next.begin() + SERVERS, next.end()) - next.begin());
+        world.runUs(next[i] - world.nowUs());
+        world.at(i, [&](ESP_NowAdhoc& lib) { return lib.sendToServer(payload, sizeof(payload)); });
+        next[i] += 50000;
+    }
+    world.runUs(end - world.nowUs());
+
+    // 同じ瞬間の各ノードのグループ時刻と基準（MACが最も小さいサーバー = ノード0）の差
+    Result r = {true, 0, 0};
+    int64_t ref = (int64_t)world.at(0, [](ESP_NowAdhoc& lib) { return lib.groupTimeUs(); });
+    for (int i = 1; i < NODES; i++) {
+        r.synced = r.synced && world.at(i, [](ESP_NowAdhoc& lib) { return lib.isClockSynced(); });
+        int64_t t = (int64_t)world.at(i, [](ESP_NowAdhoc& lib) { return lib.groupTimeUs(); });
+        r.maxErrorUs = std::max(r.maxErrorUs, std::fabs((double)(t - ref)));
+        float est = world.at(i, [](ESP_NowAdhoc& lib) { return lib.getClockDriftPpm(); });
+        // 推定値は基準に対するローカル時刻の補正（符号が逆）
+        r.maxDriftErrorPpm = std::max(r.maxDriftErrorPpm, std::fabs(est + (drift[i] - drift[0])));
+        printf("  node %d error %lld us, drift %.2f est %.2f ppm\n", i, (long long)(t - ref), drift[i] - drift[0], est);
+    }
+    printf("%s%s: max error %.0f us, drift %.2f ppm\n", traffic ? "traffic" : "idle", meshSecure ? " mesh+security" : "",
+           r.maxErrorUs, r.maxDriftErrorPpm);
+    return r;
+}
+
+int main() {
+    Result idle = run(false, false);
+    SIM_CHECK(idle.synced && idle.maxErrorUs < 50 && idle.maxDriftErrorPpm < 2);
+    Result busy = run(true, false);
+    SIM_CHECK(busy.synced && busy.maxErrorUs < 50 && busy.maxDriftErrorPpm < 2);
+    Result mesh = run(false, true);
+    SIM_CHECK(mesh.synced && mesh.maxErrorUs < 50 && mesh.maxDriftErrorPpm < 2);
+    return simTestResult();
+}
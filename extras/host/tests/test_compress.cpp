@@ -0,0 +1,102 @@
+// ペイロード圧縮：少しずつ変わるテレメトリが小さくなって電波上のバイト数が減り、
+// 損失があっても誤ったペイロードは渡されない
+
+#include "SimTest.h"
+
+#include <algorithm>
+
+#define RECORDS 200
+
+static char s_expect[RECORDS][128];
+static int s_received;
+static int s_corrupt;
+
+static int makeRecord(char* buf, size_t size, int n) {
+    return snprintf(buf, size,
+                    "{\"id\":7,\"count\":%d,\"temperature\":%.1f,\"humidity\":%.1f,\"battery\":%d,\"state\":\"ok\"}",
+                    n, 21.0 + (n % 40) * 0.1, 45.0 + (n % 13) * 0.5, 100 - n / 20);
+}
+
+static void onData(const uint8_t* mac, const espnow_message_t* msg, bool broadcast) {
+    (void)mac;
+    (void)broadcast;
+    if (msg->cmd != CMD_DATA || msg->len < 16) {
+        return;
+    }
+    // "count":n から番号を取り出して、送った内容と照らし合わせる
+    char text[128] = {0};
+    memcpy(text, msg->data, std::min<size_t>(msg->len, sizeof(text) - 1));
+    const char* count = strstr(text, "\"count\":");
+    int n = count ? atoi(count + 8) : -1;
+    bool ok = n >= 0 && n < RECORDS && msg->len == strlen(s_expect[n]) &&
+              memcmp(msg->data, s_expect[n], msg->len) == 0;
+    s_corrupt += !ok;
+    s_received++;
+}
+
+struct Result {
+    uint64_t airBytes;  // データフレームの電波上のバイト数（ヘッダーを含む）
+    int received;
+    espnow_compress_stats_t tx;
+    espnow_compress_stats_t rx;
+};
+
+static Result run(bool compress, double loss) {
+    SimWorld world(21);
+    world.addNodes(2);
+    simBootGroup(world, 1, [&](int, ESP_NowAdhoc& lib) {
+        lib.setPeerCache(false);
+        lib.setCompression(compress);
+        lib.setDataCallback(onData);
+    });
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 1); }, 5000000));
+    world.channel().loss = loss;
+    world.channel().macRetries = 0;
+
+    Result r = {};
+    world.setTap([&](int src, const uint8_t* dst, const uint8_t* frame, size_t len) {
+        (void)dst;
+        const espnow_message_t* msg = reinterpret_cast<const espnow_message_t*>(frame);
+        if (src == 1 && len >= ESPNOW_HEADER_SIZE && msg->cmd == CMD_DATA) {
+            r.airBytes += len;
+        }
+    });
+    s_received = 0;
+    s_corrupt = 0;
+    for (int n = 0; n < RECORDS; n++) {
+        int len = makeRecord(s_expect[n], sizeof(s_expect[n]), n);
+        SIM_CHECK(world.at(1, [&](ESP_NowAdhoc& lib) { return lib.sendToServer((const uint8_t*)s_expect[n], len); }));
+        world.runMs(100);
+    }
+    world.setTap(nullptr);
+    r.received = s_received;
+    r.tx = world.lib(1).getCompressStats();
+    r.rx = world.lib(0).getCompressStats();
+    SIM_CHECK(s_corrupt == 0);
+    return r;
+}
+
+int main() {
+    Result plain = run(false, 0);
+    Result packed = run(true, 0);
+    SIM_CHECK(plain.received == RECORDS && packed.received == RECORDS);
+    SIM_CHECK(packed.tx.frames > 0 && packed.rx.decodeErrors == 0);
+    double ratio = packed.tx.codedBytes ? (double)packed.tx.rawBytes / packed.tx.codedBytes : 0;
+    SIM_CHECK(ratio > 2.0);
+    SIM_CHECK(packed.airBytes * 2 < plain.airBytes);
+    // サイクル数はホストの時間を 240MHz で換算した目安（ESP32 の実測値ではない）
+    double encodeCpb = packed.tx.rawBytes ? (double)packed.tx.encodeCycles / packed.tx.rawBytes : 0;
+    double decodeCpb = packed.rx.decodedBytes ? (double)packed.rx.decodeCycles / packed.rx.decodedBytes : 0;
+    printf("no loss: payload ratio %.2f (%u of %u frames delta), %llu bytes on air vs %llu uncompressed, "
+           "encode %.1f / decode %.1f cycles per byte\n", ratio, (unsigned)packed.tx.deltaFrames,
+           (unsigned)packed.tx.frames, (unsigned long long)packed.airBytes, (unsigned long long)plain.airBytes,
+           encodeCpb, decodeCpb);
+
+    // MAC の再送なしで 10% の損失：基準を失ったフレームは破棄され、次の基準なしのフレームで戻る
+    Result lossy = run(true, 0.1);
+    SIM_CHECK(lossy.received >= RECORDS * 8 / 10);
+    printf("10%% loss: %d / %d delivered, %u dropped as undecodable, payload ratio %.2f\n", lossy.received, RECORDS,
+           (unsigned)lossy.rx.decodeErrors,
+           lossy.tx.codedBytes ? (double)lossy.tx.rawBytes / lossy.tx.codedBytes : 0.0);
+    return simTestResult();
+}
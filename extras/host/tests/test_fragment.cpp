@@ -0,0 +1,77 @@
+// 分割送信：受信順が入れ替わっても再構築でき、欠けたメッセージはタイムアウトで破棄されて
+// 再構築バッファが残らない
+
+#include "SimTest.h"
+
+#define MESSAGE_LEN 3000
+#define MESSAGES 20
+
+static int s_delivered;
+static int s_corrupt;
+
+static void fill(uint8_t* buf, int n) {
+    for (int i = 0; i < MESSAGE_LEN; i++) {
+        buf[i] = (uint8_t)(i * 7 + n);
+    }
+}
+
+static void onLarge(const uint8_t* mac, const uint8_t* data, size_t len) {
+    (void)mac;
+    uint8_t expect[MESSAGE_LEN];
+    fill(expect, data[0]);  // 先頭のバイトがメッセージ番号
+    if (len != MESSAGE_LEN || memcmp(data, expect, len) != 0) {
+        s_corrupt++;
+    }
+    s_delivered++;
+}
+
+// クライアントからサーバーへ count 個のメッセージを順に送る（前の送信が終わるのを待つ）
+static void sendMessages(SimWorld& world, int first, int count) {
+    uint8_t buf[MESSAGE_LEN];
+    for (int n = first; n < first + count; n++) {
+        fill(buf, n);
+        SIM_CHECK(world.runUntil([&] {
+            return world.at(1, [&](ESP_NowAdhoc& lib) { return lib.sendLargeToServer(buf, sizeof(buf)); });
+        }, 5000000));
+    }
+    world.runMs(ESPNOW_REASSEMBLY_TIMEOUT * 2);
+}
+
+static void run(double loss, uint8_t macRetries) {
+    SimWorld world(4);
+    world.addNodes(2);
+    simBootGroup(world, 1, [](int, ESP_NowAdhoc& lib) {
+        lib.setPeerCache(false);
+        lib.setLargeDataCallback(onLarge);
+    });
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 1); }, 5000000));
+
+    // フレームの間隔（約3ms）より大きい揺らぎで受信順が入れ替わる
+    world.channel().jitterUs = 10000;
+    world.channel().loss = loss;
+    world.channel().macRetries = macRetries;
+    s_delivered = 0;
+    s_corrupt = 0;
+    sendMessages(world, 0, MESSAGES);
+    int delivered = s_delivered;
+    SIM_CHECK(s_corrupt == 0);
+    if (loss == 0 || macRetries > 0) {
+        SIM_CHECK(delivered == MESSAGES);
+    }
+
+    // 欠けたメッセージの再構築バッファが解放され、続けて受信できる
+    world.channel().loss = 0;
+    sendMessages(world, MESSAGES, ESPNOW_REASSEMBLY_SLOTS + 1);
+    SIM_CHECK(s_delivered == delivered + ESPNOW_REASSEMBLY_SLOTS + 1);
+    SIM_CHECK(s_corrupt == 0);
+
+    printf("loss %.0f%%, MAC retries %u: %d / %d messages of %d bytes reassembled, %d afterwards\n", loss * 100,
+           (unsigned)macRetries, delivered, MESSAGES, MESSAGE_LEN, s_delivered - delivered);
+}
+
+int main() {
+    run(0.0, 0);
+    run(0.05, 0);
+    run(0.1, 4);
+    return simTestResult();
+}
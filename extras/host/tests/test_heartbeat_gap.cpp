@@ -0,0 +1,38 @@
+// ハートビートの抑制：データを送っているピアへもフレームの間隔がハートビート間隔の1.5倍を超えない
+
+#include "SimTest.h"
+
+int main() {
+    SimWorld world(5);
+    world.addNodes(2);
+    simBootGroup(world, 1, [](int i, ESP_NowAdhoc& lib) {
+        (void)i;
+        lib.setPeerCache(false);
+        lib.setClockSync(false);  // 同期要求のハートビートで間隔が埋まらないようにする
+    });
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 1); }, 5000000));
+
+    // クライアントからサーバーへ届いたフレームの最大間隔
+    uint64_t last = world.nowUs();
+    uint64_t maxGap = 0;
+    world.setTap([&](int src, const uint8_t* dst, const uint8_t* frame, size_t len) {
+        (void)frame;
+        (void)len;
+        if (src == 1 && (memcmp(dst, world.mac(0), 6) == 0 || dst[0] == 0xFF)) {
+            maxGap = std::max(maxGap, world.nowUs() - last);
+            last = world.nowUs();
+        }
+    });
+
+    // ハートビート間隔の2倍より少し短い周期で送ると、ティックとの位相が一周する
+    uint8_t payload[4] = {};
+    for (int t = 0; t < 60000; t += 1950) {
+        world.at(1, [&](ESP_NowAdhoc& lib) { return lib.sendToServer(payload, sizeof(payload)); });
+        world.runMs(1950);
+    }
+    world.setTap(nullptr);
+
+    printf("max gap %.1f ms\n", maxGap / 1000.0);
+    SIM_CHECK(maxGap < (uint64_t)HEARTBEAT_INTERVAL * 1550);  // 1.5間隔 + 送信待ち
+    return simTestResult();
+}
@@ -0,0 +1,80 @@
+// ユニキャストのハートビート：送信キューの空きがハートビートを待つピアより少なくても、
+// 毎回同じピアが漏れてタイムアウトすることがない
+
+#include "SimTest.h"
+
+#include <algorithm>
+
+#define CLIENTS 18
+#define SUBSCRIBERS 7    // 発行を受け取るクライアント 1..7（残りはハートビートを待つ）
+#define TOPIC 1
+#define FREE_ENTRIES 2  // 発行で埋めた後に残す最小の空き
+
+static int s_disconnects;
+
+static void onPeer(const uint8_t* mac, bool isServer, bool connected) {
+    (void)mac;
+    (void)isServer;
+    s_disconnects += !connected;
+}
+
+int main() {
+    SimWorld world(16);
+    world.addNodes(1 + CLIENTS);
+    simBootGroup(world, 1, [](int i, ESP_NowAdhoc& lib) {
+        lib.setPeerCache(false);
+        lib.setPeerEventCallback(onPeer);
+        lib.setClockSync(false);  // 時刻の要求への応答で送信時刻が更新されないようにする
+        if (i == 0) {
+            lib.setHeartbeatBeacon(false);  // ピアごとのユニキャストで送る
+        } else if (i <= SUBSCRIBERS) {
+            lib.subscribe(TOPIC);
+        }
+    });
+    SIM_CHECK(world.runUntil([&] {
+        return simJoined(world, 1) && world.lib(0).getSubscriberCount(TOPIC) == SUBSCRIBERS;
+    }, 5000000));
+    s_disconnects = 0;
+
+    // 待っているクライアントごとに、サーバーからのフレームが途切れた最長の間隔を測る
+    uint64_t lastUs[1 + CLIENTS];
+    uint64_t maxGapUs = 0;
+    for (int i = 0; i <= CLIENTS; i++) {
+        lastUs[i] = world.nowUs();
+    }
+    world.setTap([&](int src, const uint8_t* dst, const uint8_t* frame, size_t len) {
+        (void)frame;
+        (void)len;
+        int client = world.nodeOf(dst);
+        if (src == 0 && client > SUBSCRIBERS) {
+            maxGapUs = std::max(maxGapUs, world.nowUs() - lastUs[client]);
+            lastUs[client] = world.nowUs();
+        }
+    });
+    // サーバーは購読者への発行でキューを埋め続ける
+    // 購読者にはデータが届くため、ハートビートを待つのは残りのクライアント（空きより多い）
+    const uint8_t data[200] = {};
+    uint32_t published = 0;
+    for (int ms = 0; ms < HEARTBEAT_TIMEOUT * 4; ms++) {
+        world.at(0, [&](ESP_NowAdhoc& lib) {
+            while (lib.getTxQueueDepth() + SUBSCRIBERS + FREE_ENTRIES <= ESPNOW_TX_QUEUE_SIZE &&
+                   lib.publish(TOPIC, data, sizeof(data))) {
+                published++;
+            }
+            return 0;
+        });
+        world.runMs(1);
+    }
+    world.setTap(nullptr);
+    for (int i = SUBSCRIBERS + 1; i <= CLIENTS; i++) {
+        maxGapUs = std::max(maxGapUs, world.nowUs() - lastUs[i]);
+    }
+    SIM_CHECK(published > 0);
+    SIM_CHECK(maxGapUs < (uint64_t)HEARTBEAT_TIMEOUT * 1000);
+    SIM_CHECK(s_disconnects == 0);
+    SIM_CHECK(simJoined(world, 1));
+    printf("%d clients (%d waiting for heartbeats), at least %d free TX entries, %u publishes: "
+           "longest silence %.0f ms, %d disconnects in %d ms\n", CLIENTS, CLIENTS - SUBSCRIBERS, FREE_ENTRIES,
+           (unsigned)published, maxGapUs / 1000.0, s_disconnects, HEARTBEAT_TIMEOUT * 4);
+    return simTestResult();
+}
@@ -0,0 +1,69 @@
+// ハートビートのビーコン・経路広告：一覧に収まらない数のクライアントでも広告が続かず、全員が順に一覧に載る
+
+#include "SimTest.h"
+#include <set>
+
+#define CLIENTS 60
+
+static void run(bool mesh) {
+    SimWorld world(5);
+    world.addNodes(CLIENTS + 1);
+    // 同時に起動するとハートビートの周期が揃うため、100ms に散らして起動する
+    for (int i = 0; i <= CLIENTS; i++) {
+        world.boot(i, [&](ESP_NowAdhoc& lib) {
+            lib.setDebug(false);
+            lib.setPeerCache(false);
+            lib.setMesh(mesh);
+            lib.begin(i == 0, false);
+        });
+        world.runUs(100000 / CLIENTS);
+    }
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 1); }, 20000000));
+    world.runMs(5000);
+
+    // 参加後のクライアントの広告と、ビーコン（経路広告）に直接のピアとして載ったクライアント
+    uint8_t listCmd = mesh ? CMD_ROUTE : CMD_BEACON;
+    size_t entrySize = mesh ? sizeof(espnow_route_entry_t) : 6;
+    uint64_t adverts = 0;
+    uint64_t lists = 0;
+    uint64_t partial = 0;
+    std::set<int> listed;
+    world.setTap([&](int src, const uint8_t* dst, const uint8_t* frame, size_t len) {
+        (void)dst;
+        const espnow_message_t* msg = reinterpret_cast<const espnow_message_t*>(frame);
+        if (len < ESPNOW_HEADER_SIZE) {
+            return;
+        }
+        if (src > 0 && (msg->cmd == CMD_REGISTER || msg->cmd == CMD_PROBE)) {
+            adverts++;
+        }
+        if (src == 0 && msg->cmd == listCmd) {
+            lists++;
+            partial += (msg->flags & ESPNOW_FLAG_PARTIAL) != 0;
+            for (uint8_t i = 0; i < msg->data[0]; i++) {
+                const uint8_t* entry = (const uint8_t*)msg->data + 1 + i * entrySize;
+                if (!mesh || entry[6] == 1) {
+                    listed.insert(world.nodeOf(entry));
+                }
+            }
+        }
+    });
+    world.runMs(10000);
+    world.setTap(nullptr);
+
+    SIM_CHECK(lists >= 9);
+    SIM_CHECK(partial == lists);
+    SIM_CHECK((int)listed.size() == CLIENTS);
+    // Trickle で間隔が伸びた広告のみ（各クライアント 10 秒で数回まで）
+    SIM_CHECK(adverts <= (uint64_t)CLIENTS * 3);
+    SIM_CHECK(simJoined(world, 1));
+
+    printf("%s: %llu lists (partial %llu), listed %zu, client adverts %llu in 10 s\n", mesh ? "route" : "beacon",
+           (unsigned long long)lists, (unsigned long long)partial, listed.size(), (unsigned long long)adverts);
+}
+
+int main() {
+    run(false);
+    run(true);
+    return simTestResult();
+}
@@ -0,0 +1,83 @@
+// ブロードキャストへの集約：sendToClients() のエアタイムがクライアント数によらず一定になる
+// （ユニキャストでも送信キューは ESPNOW_MAX_PEERS から決まるため、全クライアントに届く）
+
+#include "SimTest.h"
+
+#define MESSAGES 20
+#define PAYLOAD_LEN 64
+
+static int s_received;
+
+static void onData(const uint8_t* mac, const espnow_message_t* msg, bool broadcast) {
+    (void)mac;
+    (void)broadcast;
+    if (msg->cmd == CMD_DATA && SimWorld::current()->currentNode() != 0) {
+        s_received++;
+    }
+}
+
+struct Result {
+    double airtimeMs;  // データフレームのエアタイム（ACKを含む）
+    uint64_t frames;
+    int accepted;      // sendToClients() が true を返した回数
+    double delivery;   // 届いた割合
+};
+
+static Result run(int clients, bool fanout, double loss) {
+    SimWorld world(8);
+    world.addNodes(clients + 1);
+    for (int i = 0; i <= clients; i++) {
+        world.runUs(world.random() % 100000);
+        world.boot(i, [&](ESP_NowAdhoc& lib) {
+            lib.setDebug(false);
+            lib.setPeerCache(false);
+            lib.setFanoutThreshold(fanout ? 2 : 0);
+            lib.setDataCallback(onData);
+            lib.begin(i == 0, false);
+        });
+    }
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 1); }, 30000000));
+    world.channel().loss = loss;
+
+    Result r = {};
+    const SimChannel& ch = world.channel();
+    world.setTap([&](int src, const uint8_t* dst, const uint8_t* frame, size_t len) {
+        const espnow_message_t* msg = reinterpret_cast<const espnow_message_t*>(frame);
+        if (src != 0 || len < ESPNOW_HEADER_SIZE || msg->cmd != CMD_DATA) {
+            return;
+        }
+        bool broadcast = memcmp(dst, "\xff\xff\xff\xff\xff\xff", 6) == 0;
+        uint64_t us = ch.difsUs + ch.preambleUs + (uint64_t)(len + ch.overheadBytes) * 8 * 1000000ull / ch.bitrate;
+        r.airtimeMs += (us + (broadcast ? 0 : ch.ackUs)) / 1000.0;
+        r.frames++;
+    });
+    s_received = 0;
+    uint8_t payload[PAYLOAD_LEN];
+    memset(payload, 0x5a, sizeof(payload));
+    for (int k = 0; k < MESSAGES; k++) {
+        r.accepted += world.at(0, [&](ESP_NowAdhoc& lib) { return lib.sendToClients(payload, sizeof(payload)); });
+        world.runMs(200);
+    }
+    r.delivery = (double)s_received / (MESSAGES * clients);
+    return r;
+}
+
+int main() {
+    printf("clients,unicast_airtime_ms,fanout_airtime_ms,unicast_accepted,fanout_accepted,unicast_delivery,"
+           "fanout_delivery,unicast_delivery_2pct_loss,fanout_delivery_2pct_loss\n");
+    const int sizes[] = {5, 10, 20, 40};
+    for (int n : sizes) {
+        Result uni = run(n, false, 0);
+        Result fan = run(n, true, 0);
+        Result uniLoss = run(n, false, 0.02);
+        Result fanLoss = run(n, true, 0.02);
+        SIM_CHECK(fan.accepted == MESSAGES && fan.frames == MESSAGES && fan.delivery == 1.0);
+        SIM_CHECK(fanLoss.delivery > 0.9);
+        SIM_CHECK(uni.accepted == MESSAGES && uni.delivery == 1.0);
+        SIM_CHECK(uni.frames <= (uint64_t)MESSAGES * n);
+        SIM_CHECK(fan.airtimeMs * n * 0.8 < uni.airtimeMs);
+        printf("%d,%.1f,%.1f,%d,%d,%.3f,%.3f,%.3f,%.3f\n", n, uni.airtimeMs, fan.airtimeMs, uni.accepted,
+               fan.accepted, uni.delivery, fan.delivery, uniLoss.delivery, fanLoss.delivery);
+    }
+    return simTestResult();
+}
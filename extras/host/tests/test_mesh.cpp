@@ -0,0 +1,144 @@
+// メッシュの中継：一列に並んだサーバーを経由して端のクライアント同士が sendToMac() で届き、
+// 送信元が再起動した後のメッセージも重複として捨てられない
+
+#include "SimTest.h"
+
+#include <map>
+#include <vector>
+
+#define SERVERS 4                 // サーバー 0..3 が一列に並ぶ
+#define SRC SERVERS               // サーバー0だけが聞こえるクライアント
+#define DST (SERVERS + 1)         // 最後のサーバーだけが聞こえるクライアント
+#define MESSAGES 20
+#define PERIOD_MS 200
+
+static std::map<uint32_t, uint64_t> s_deliveredUs;  // メッセージ番号 → 届いた時刻
+
+static void onData(const uint8_t* mac, const espnow_message_t* msg, bool broadcast) {
+    (void)broadcast;
+    SimWorld* world = SimWorld::current();
+    if (world->currentNode() != DST || msg->cmd != CMD_DATA || msg->len != sizeof(uint32_t) ||
+        world->nodeOf(mac) != SRC) {
+        return;
+    }
+    uint32_t n;
+    memcpy(&n, msg->data, sizeof(n));
+    s_deliveredUs.emplace(n, world->nowUs());
+}
+
+static bool canHear(int src, int dst) {
+    if (src >= SERVERS || dst >= SERVERS) {
+        int client = src >= SERVERS ? src : dst;
+        int server = src >= SERVERS ? dst : src;
+        return server == (client == SRC ? 0 : SERVERS - 1);
+    }
+    return src - dst == 1 || dst - src == 1;
+}
+
+static void bootNode(SimWorld& world, int i) {
+    world.boot(i, [&](ESP_NowAdhoc& lib) {
+        lib.setDebug(false);
+        lib.setPeerCache(false);
+        lib.setMesh(true);
+        lib.setDataCallback(onData);
+        lib.begin(i < SERVERS, false);
+    });
+}
+
+// 両端のクライアントがつながり、端のサーバー同士が互いのクライアントへの経路を持つ
+static bool routed(SimWorld& world) {
+    return world.lib(SRC).getServerPeerCount() >= 1 && world.lib(DST).getServerPeerCount() >= 1 &&
+           world.lib(0).getRouteHops(world.mac(DST)) > 0 &&
+           world.lib(SERVERS - 1).getRouteHops(world.mac(SRC)) > 0;
+}
+
+int main() {
+    SimWorld world(14);
+    world.addNodes(SERVERS + 2);
+    world.setLink(canHear);
+    for (int i = 0; i < world.nodeCount(); i++) {
+        world.runUs(world.random() % 100000);
+        bootNode(world, i);
+    }
+    SIM_CHECK(world.runUntil([&] { return routed(world); }, 30000000));
+
+    // 中継フレームの送信時刻（送信元・番号ごとに、ホップ数 → 時刻）
+    std::map<std::pair<int, uint16_t>, std::map<uint8_t, uint64_t>> hopUs;
+    std::map<uint32_t, std::pair<int, uint16_t>> keyOf;
+    world.setTap([&](int src, const uint8_t* dst, const uint8_t* frame, size_t len) {
+        (void)src;
+        (void)dst;
+        const espnow_message_t* msg = reinterpret_cast<const espnow_message_t*>(frame);
+        if (len < ESPNOW_HEADER_SIZE + sizeof(espnow_relay_hdr_t) + sizeof(uint32_t) || msg->cmd != CMD_RELAY) {
+            return;
+        }
+        espnow_relay_hdr_t hdr;
+        memcpy(&hdr, msg->data, sizeof(hdr));
+        std::pair<int, uint16_t> key(world.nodeOf(hdr.src), (uint16_t)hdr.seq);
+        hopUs[key].emplace(hdr.hops, world.nowUs());
+        uint32_t n;
+        memcpy(&n, msg->data + sizeof(hdr), sizeof(n));
+        keyOf.emplace(n, key);
+    });
+
+    auto sendBatch = [&](uint32_t first, uint32_t count) {
+        for (uint32_t n = first; n < first + count; n++) {
+            SIM_CHECK(world.at(SRC, [&](ESP_NowAdhoc& lib) {
+                return lib.sendToMac(world.mac(DST), (const uint8_t*)&n, sizeof(n));
+            }));
+            world.runMs(PERIOD_MS);
+        }
+        world.runMs(500);
+    };
+    sendBatch(0, MESSAGES);
+
+    // 届いたメッセージのホップごとの遅延（ホップ h はホップ数 h のフレームの送信から次の送信、
+    // 最後のホップは受信まで）
+    const espnow_mesh_stats_t& stats = world.lib(DST).getMeshStats();
+    std::vector<double> perHop(SERVERS + 2, 0);
+    std::vector<int> perHopCount(SERVERS + 2, 0);
+    double endToEnd = 0;
+    for (const auto& d : s_deliveredUs) {
+        const std::map<uint8_t, uint64_t>& times = hopUs[keyOf[d.first]];
+        if (times.empty() || times.rbegin()->first > SERVERS + 1) {
+            continue;
+        }
+        for (auto t = times.begin(); t != times.end(); ++t) {
+            auto next = std::next(t);
+            uint64_t end = next != times.end() ? next->second : d.second;
+            perHop[t->first] += (end - t->second) / 1000.0;
+            perHopCount[t->first]++;
+        }
+        endToEnd += (d.second - times.begin()->second) / 1000.0;
+    }
+    uint32_t delivered = (uint32_t)s_deliveredUs.size();
+    SIM_CHECK(delivered == MESSAGES);
+    SIM_CHECK(stats.delivered == MESSAGES && stats.hops == (uint32_t)MESSAGES * (SERVERS + 1));
+    printf("%d servers in a line: %u / %d delivered, %.1f hops, %.1f ms end to end, per hop (ms):", SERVERS,
+           (unsigned)delivered, MESSAGES, stats.delivered ? (double)stats.hops / stats.delivered : 0.0,
+           delivered ? endToEnd / delivered : 0.0);
+    for (int h = 1; h <= SERVERS + 1; h++) {
+        printf(" %.1f", perHopCount[h] ? perHop[h] / perHopCount[h] : 0.0);
+    }
+    printf("\n");
+
+    // 送信元の再起動：番号が最初からやり直しても、中継側・宛先に残る記録と重ならない
+    world.powerOff(SRC);
+    world.runMs(100);
+    bootNode(world, SRC);
+    SIM_CHECK(world.runUntil([&] { return routed(world); }, 30000000));
+    uint32_t duplicates = 0;
+    for (int i = 0; i < SERVERS; i++) {
+        duplicates += world.lib(i).getMeshStats().duplicates;
+    }
+    sendBatch(MESSAGES, 5);
+    uint32_t after = 0;
+    for (int i = 0; i < SERVERS; i++) {
+        after += world.lib(i).getMeshStats().duplicates;
+    }
+    SIM_CHECK(s_deliveredUs.size() == MESSAGES + 5);
+    SIM_CHECK(after == duplicates);
+    printf("after the sender reboots: %u / 5 delivered, %u duplicates\n", (unsigned)(s_deliveredUs.size() - delivered),
+           (unsigned)(after - duplicates));
+    return simTestResult();
+}
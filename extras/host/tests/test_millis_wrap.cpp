@@ -0,0 +1,105 @@
+// millis()・micros() の桁あふれ：期限の表が途切れず、ハートビート・データ・ピアのタイムアウトが
+// 桁あふれの前後で同じように動く
+
+#include "SimTest.h"
+
+#include <climits>
+
+#define CLIENTS 3
+#define WRAP_IN_MS 20000   // 起動から桁あふれまで（ノードごとに少しずらす）
+
+static int s_disconnects;
+static int s_received;
+
+static void onPeer(const uint8_t* mac, bool isServer, bool connected) {
+    (void)mac;
+    (void)isServer;
+    s_disconnects += !connected;
+}
+
+static void onData(const uint8_t* mac, const espnow_message_t* msg, bool broadcast) {
+    (void)mac;
+    (void)broadcast;
+    s_received += msg->cmd == CMD_DATA;
+}
+
+struct Result {
+    uint64_t heartbeats;
+    double timeoutMs;
+};
+
+// limit: 桁あふれする値（unsigned long の最大値、または ESP32 の millis() と同じ 32 ビットの最大値）
+// 0 の場合は桁あふれしない比較用
+static Result run(unsigned long limit, const char* name) {
+    SimWorld world(12);
+    world.addNodes(1 + CLIENTS);
+    for (int i = 0; limit && i <= CLIENTS; i++) {
+        SimClock clock;
+        clock.millisBase = limit - WRAP_IN_MS - 3000 * i;
+        clock.microsBase = limit - (WRAP_IN_MS + 1000 * i) * 1000UL;
+        world.setClock(i, clock);
+    }
+    simBootGroup(world, 1, [](int, ESP_NowAdhoc& lib) {
+        lib.setPeerCache(false);
+        lib.setDataCallback(onData);
+        lib.setPeerEventCallback(onPeer);
+    });
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 1); }, 5000000));
+    s_disconnects = 0;
+    s_received = 0;
+
+    // 全ノードが桁あふれを越えるまで、各クライアントが 500ms ごとに送りながら期限を確かめる
+    const uint8_t data[4] = {1, 2, 3, 4};
+    unsigned long maxWait = 0;
+    uint64_t heartbeats = 0;
+    world.setTap([&](int src, const uint8_t* dst, const uint8_t* frame, size_t len) {
+        (void)src;
+        (void)dst;
+        const espnow_message_t* msg = reinterpret_cast<const espnow_message_t*>(frame);
+        if (len >= ESPNOW_HEADER_SIZE && (msg->cmd == CMD_HEARTBEAT || msg->cmd == CMD_BEACON)) {
+            heartbeats++;
+        }
+    });
+    int sent = 0;
+    const int rounds = (WRAP_IN_MS + 3000 * CLIENTS) * 2 / 500;
+    for (int k = 0; k < rounds; k++) {
+        for (int i = 1; i <= CLIENTS; i++) {
+            sent += world.at(i, [&](ESP_NowAdhoc& lib) { return lib.sendToServer(data, sizeof(data)); });
+        }
+        for (int i = 0; i <= CLIENTS; i++) {
+            maxWait = std::max(maxWait, world.at(i, [](ESP_NowAdhoc& lib) { return lib.nextDeadlineMs(); }));
+        }
+        world.runMs(500);
+    }
+    world.setTap(nullptr);
+    if (limit == ULONG_MAX) {
+        SIM_CHECK(world.at(CLIENTS, [](ESP_NowAdhoc&) { return millis(); }) < WRAP_IN_MS * 2UL);
+    }
+    SIM_CHECK(s_disconnects == 0);
+    SIM_CHECK(s_received == sent);
+    SIM_CHECK(maxWait <= BROADCAST_INTERVAL_MAX);
+
+    // 桁あふれの後もピアのタイムアウトは期限どおりに来る
+    world.powerOff(CLIENTS);
+    uint64_t off = world.nowUs();
+    SIM_CHECK(world.runUntil([&] { return s_disconnects > 0; }, (uint64_t)HEARTBEAT_TIMEOUT * 3000));
+    double timeoutMs = (world.nowUs() - off) / 1000.0;
+    SIM_CHECK(timeoutMs >= HEARTBEAT_TIMEOUT - HEARTBEAT_INTERVAL && timeoutMs <= HEARTBEAT_TIMEOUT + 1000);
+
+    printf("%s: %d / %d delivered, %d disconnects, %llu heartbeats, longest wait %lu ms, "
+           "peer timeout after %.0f ms\n", name, s_received, sent, s_disconnects - 1,
+           (unsigned long long)heartbeats, maxWait, timeoutMs);
+    return {heartbeats, timeoutMs};
+}
+
+int main() {
+    Result base = run(0, "no wrap");
+    const unsigned long limits[] = {ULONG_MAX, 0xFFFFFFFFUL};
+    const char* names[] = {"unsigned long wrap", "32-bit wrap"};
+    for (int i = 0; i < 2; i++) {
+        // 桁あふれしない場合と同じ頻度でハートビートが出る
+        Result r = run(limits[i], names[i]);
+        SIM_CHECK(r.heartbeats * 20 >= base.heartbeats * 19 && r.heartbeats * 20 <= base.heartbeats * 21);
+    }
+    return simTestResult();
+}
@@ -0,0 +1,80 @@
+// ピアキャッシュ：再起動後すぐにサーバーへ届く・安定した構成ではリンクの統計の保存が間隔で制限される
+
+#include "SimTest.h"
+
+#define CLIENTS 4
+#define HOURS 6
+
+static int s_received;
+
+static void onData(const uint8_t* mac, const espnow_message_t* msg, bool broadcast) {
+    (void)mac;
+    (void)msg;
+    (void)broadcast;
+    if (SimWorld::current()->currentNode() == 0) {
+        s_received++;
+    }
+}
+
+static void setup(ESP_NowAdhoc& lib, bool cache, bool session) {
+    lib.setPeerCache(cache);
+    if (session) {
+        lib.setSessionKey("adhoc-test-secret");
+    }
+    lib.setDataCallback(onData);
+}
+
+// クライアント1を再起動し、1ms ごとに送ったデータが最初にサーバーへ届くまでの時間 (ms)
+static double rebootDeliverMs(SimWorld& world, bool cache, bool session) {
+    world.powerOff(1);
+    world.runMs(100);
+    uint64_t start = world.nowUs();
+    world.boot(1, [&](ESP_NowAdhoc& lib) {
+        lib.setDebug(false);
+        setup(lib, cache, session);
+        lib.begin(false, false);
+    });
+    int received = s_received;
+    const uint8_t ping[4] = {'p', 'i', 'n', 'g'};
+    for (int ms = 0; ms < 10000 && s_received == received; ms++) {
+        world.at(1, [&](ESP_NowAdhoc& lib) { return lib.sendToServer(ping, sizeof(ping)); });
+        world.runMs(1);
+    }
+    SIM_CHECK(s_received > received);
+    return (world.nowUs() - start) / 1000.0;
+}
+
+static void run(bool cache, bool session) {
+    SimWorld world(25);
+    world.addNodes(CLIENTS + 1);
+    // リンクの統計（サーバーへの送信成功率）が少しずつ変わるよう、損失を入れる
+    world.channel().loss = 0.05;
+    simBootGroup(world, 1, [&](int, ESP_NowAdhoc& lib) { setup(lib, cache, session); });
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 1); }, 5000000));
+    world.runMs(ESPNOW_PEER_CACHE_DELAY + 1000);
+
+    // 構成が変わらない間の書き込みは ESPNOW_PEER_CACHE_REFRESH ごとに1回まで
+    uint32_t before = world.nodeStats(1).nvsWrites;
+    world.runMs((uint64_t)HOURS * 3600000);
+    uint32_t writes = world.nodeStats(1).nvsWrites - before;
+    if (cache) {
+        SIM_CHECK(writes >= 1);
+        SIM_CHECK(writes <= HOURS * 3600000UL / ESPNOW_PEER_CACHE_REFRESH + 1);
+    } else {
+        SIM_CHECK(writes == 0);
+    }
+
+    world.channel().loss = 0;
+    double deliverMs = rebootDeliverMs(world, cache, session);
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 1); }, 5000000));
+    printf("%s, %s: %u NVS writes in %d h, first delivery %.0f ms after reboot\n", session ? "session" : "plain",
+           cache ? "cache" : "no cache", (unsigned)writes, HOURS, deliverMs);
+}
+
+int main() {
+    run(true, false);
+    run(false, false);
+    run(true, true);
+    run(false, true);
+    return simTestResult();
+}
@@ -0,0 +1,63 @@
+// ピアハンドル：切断したピアのスロットを後から参加したピアが使っても、
+// アプリが持ち続けた古いハンドルでは新しいピアへ送れない
+
+#include "SimTest.h"
+
+#define CLIENTS ESPNOW_MAX_PEERS  // サーバーのプールを満杯にする
+#define LATE (CLIENTS + 1)        // 満杯の間は参加できず、1台が切断した後に参加する
+
+static int s_received[LATE + 1];
+
+static void onData(const uint8_t* mac, const espnow_message_t* msg, bool broadcast) {
+    (void)mac;
+    (void)broadcast;
+    s_received[SimWorld::current()->currentNode()] += msg->cmd == CMD_DATA;
+}
+
+static void bootNode(SimWorld& world, int i) {
+    world.boot(i, [&](ESP_NowAdhoc& lib) {
+        lib.setDebug(false);
+        lib.setPeerCache(false);
+        lib.setDataCallback(onData);
+        lib.begin(i == 0, false);
+    });
+}
+
+int main() {
+    SimWorld world(17);
+    world.addNodes(LATE + 1);
+    for (int i = 0; i < LATE; i++) {
+        bootNode(world, i);
+    }
+    SIM_CHECK(world.runUntil([&] { return world.lib(0).getTotalPeerCount() == CLIENTS; }, 10000000));
+
+    // アプリはクライアント1のハンドルを持ち続ける
+    espnow_peer_handle_t stale = world.lib(0).getPeerHandle(world.mac(1));
+    SIM_CHECK(stale != ESPNOW_INVALID_PEER);
+    world.powerOff(1);
+    bootNode(world, LATE);
+    SIM_CHECK(world.runUntil([&] {
+        return world.lib(0).getPeerHandle(world.mac(LATE)) != ESPNOW_INVALID_PEER;
+    }, (uint64_t)HEARTBEAT_TIMEOUT * 3000));
+
+    // 空きスロットは1つだけのため、後から参加したピアはクライアント1のスロットを使う
+    espnow_peer_handle_t late = world.lib(0).getPeerHandle(world.mac(LATE));
+    SIM_CHECK(world.lib(0).getPeerHandle(world.mac(1)) == ESPNOW_INVALID_PEER);
+    SIM_CHECK(late != stale);
+    SIM_CHECK(world.lib(0).getPeer(stale) == nullptr);
+
+    const uint8_t data[4] = {1, 2, 3, 4};
+    bool staleSent = world.at(0, [&](ESP_NowAdhoc& lib) { return lib.sendToPeer(stale, data, sizeof(data)); });
+    world.runMs(100);
+    SIM_CHECK(!staleSent);
+    SIM_CHECK(s_received[LATE] == 0);
+
+    // 新しいハンドルでは届く
+    SIM_CHECK(world.at(0, [&](ESP_NowAdhoc& lib) { return lib.sendToPeer(late, data, sizeof(data)); }));
+    world.runMs(100);
+    SIM_CHECK(s_received[LATE] == 1);
+
+    printf("stale handle 0x%04X, reused slot handle 0x%04X: stale send %s, %d frame(s) at the new peer\n",
+           (unsigned)stale, (unsigned)late, staleSent ? "accepted" : "rejected", s_received[LATE]);
+    return simTestResult();
+}
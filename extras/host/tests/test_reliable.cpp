@@ -0,0 +1,100 @@
+// 信頼性モード：損失があっても順序通りにすべて届き、届かない場合は送信失敗として通知される
+
+#include "SimTest.h"
+
+#include <algorithm>
+
+#define MESSAGES 300
+
+static uint32_t s_next;      // 次に届くべき番号
+static bool s_inOrder = true;
+static int s_failures;
+static uint16_t s_dropped;
+
+static void onData(const uint8_t* mac, const espnow_message_t* msg, bool broadcast) {
+    (void)mac;
+    (void)broadcast;
+    if (SimWorld::current()->currentNode() != 0 || !(msg->flags & ESPNOW_FLAG_RELIABLE)) {
+        return;
+    }
+    uint32_t n;
+    memcpy(&n, msg->data, sizeof(n));
+    s_inOrder = s_inOrder && n == s_next;
+    s_next = n + 1;
+}
+
+static void onFail(const uint8_t* mac, uint16_t dropped) {
+    (void)mac;
+    s_failures++;
+    s_dropped += dropped;
+}
+
+static bool sendNumber(SimWorld& world, uint32_t n) {
+    return world.at(1, [&](ESP_NowAdhoc& lib) {
+        return lib.sendReliable(lib.getPeerHandle(world.mac(0)), (const uint8_t*)&n, sizeof(n));
+    });
+}
+
+static const espnow_reliable_t& senderState(SimWorld& world) {
+    ESP_NowAdhoc& lib = world.lib(1);
+    return lib.getPeer(lib.getPeerHandle(world.mac(0)))->getReliableState();
+}
+
+int main() {
+    SimWorld world(5);
+    world.addNodes(2);
+    simBootGroup(world, 1, [](int, ESP_NowAdhoc& lib) {
+        lib.setPeerCache(false);
+        lib.setDataCallback(onData);
+        lib.setReliableFailCallback(onFail);
+    });
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 1); }, 5000000));
+
+    // 20% の損失：ウィンドウに空きがあれば送る
+    // 送信・再送・ACKも送信キューを通るため、同時送信数は上限を超えない
+    world.channel().loss = 0.2;
+    uint64_t start = world.nowUs();
+    uint32_t sent = 0;
+    size_t maxInflight = 0;
+    while (sent < MESSAGES && world.nowUs() - start < 60000000) {
+        bool queued = sendNumber(world, sent);
+        for (int i = 0; i < 2; i++) {
+            maxInflight = std::max(maxInflight, world.lib(i).getTxInflight());
+        }
+        if (!queued) {
+            world.runMs(1);
+            continue;
+        }
+        sent++;
+    }
+    SIM_CHECK(world.runUntil([&] { return s_next == MESSAGES; }, 10000000));
+    SIM_CHECK(world.runUntil([&] { return senderState(world).base == senderState(world).nextSeq; }, 10000000));
+    SIM_CHECK(s_inOrder);
+    SIM_CHECK(s_failures == 0);
+    SIM_CHECK(maxInflight <= ESPNOW_TX_MAX_INFLIGHT);
+    printf("20%% loss: %u / %d in order in %.0f ms, %u retransmits, %u failed, at most %u frames in flight\n",
+           (unsigned)s_next, MESSAGES, (world.nowUs() - start) / 1000.0, (unsigned)senderState(world).retransmits,
+           (unsigned)senderState(world).failed, (unsigned)maxInflight);
+
+    // リンクを切ると、再送の上限かピアのタイムアウトで未確認のフレームが送信失敗として通知される
+    world.channel().loss = 0;
+    bool cut = true;
+    world.setLink([&](int, int) { return !cut; });
+    for (uint32_t n = 0; n < 4; n++) {
+        SIM_CHECK(sendNumber(world, MESSAGES + n));
+    }
+    start = world.nowUs();
+    SIM_CHECK(world.runUntil([&] { return s_failures == 1; }, (uint64_t)(HEARTBEAT_TIMEOUT + 1000) * 1000));
+    SIM_CHECK(s_dropped == 4);
+    printf("link cut: %d failure, %u frames reported after %.0f ms\n", s_failures, (unsigned)s_dropped,
+           (world.nowUs() - start) / 1000.0);
+
+    // つなぎ直すと新しいセッションで送り直せる
+    cut = false;
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 1); }, 10000000));
+    s_next = MESSAGES + 4;
+    SIM_CHECK(sendNumber(world, MESSAGES + 4));
+    SIM_CHECK(world.runUntil([&] { return s_next == MESSAGES + 5; }, 2000000));
+    SIM_CHECK(s_inOrder);
+    return simTestResult();
+}
@@ -0,0 +1,25 @@
+// 受信の破棄：受信スロットに収まらない長いフレーム・短すぎるフレームを数える
+
+#include "SimTest.h"
+
+int main() {
+    SimWorld world(13);
+    world.addNodes(2);
+    simBootGroup(world, 1, [](int, ESP_NowAdhoc& lib) { lib.setPeerCache(false); });
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 1); }, 5000000));
+
+    // 登録済みのピアから（ESP-NOW v2 の長さのフレーム）と未登録のノードから
+    uint8_t frame[sizeof(espnow_message_t) + 64];
+    memset(frame, 0, sizeof(frame));
+    const uint8_t stranger[6] = {0x02, 0x00, 0x00, 0x00, 0x7f, 0x7f};
+    uint32_t before = world.lib(0).getStats().drops.shortFrames;
+    world.inject(0, world.mac(1), world.mac(0), frame, sizeof(frame));
+    world.inject(0, stranger, world.mac(0), frame, sizeof(frame));
+    world.inject(0, world.mac(1), world.mac(0), frame, 4);
+    world.runMs(10);
+    uint32_t drops = world.lib(0).getStats().drops.shortFrames - before;
+    SIM_CHECK(drops == 3);
+
+    printf("short/oversized drops %u\n", (unsigned)drops);
+    return simTestResult();
+}
@@ -0,0 +1,224 @@
+// 主サーバーの選択：僅差では少しずつ移って負荷が分かれ、大きく良いサーバーにはすぐに移る
+// 主サーバーが止まると、数回の送信失敗で残りのサーバーへ切り替わる
+// 参加時に測ったきりの受信強度は時間が経つと評価から外れ、負荷で分かれる
+
+#include "SimTest.h"
+
+#include <set>
+
+#define CLIENTS 8
+#define DATA_PERIOD_MS 200
+
+static std::set<std::pair<int, uint32_t>> s_uplink;  // サーバーが受け取った（クライアント, 番号）
+
+static void onData(const uint8_t* mac, const espnow_message_t* msg, bool broadcast) {
+    (void)broadcast;
+    SimWorld* world = SimWorld::current();
+    if (world->currentNode() >= 2 || msg->cmd != CMD_DATA || msg->len != sizeof(uint32_t)) {
+        return;
+    }
+    uint32_t n;
+    memcpy(&n, msg->data, sizeof(n));
+    s_uplink.emplace(world->nodeOf(mac), n);
+}
+
+static int primaryOf(SimWorld& world, int client) {
+    ESP_NowAdhoc& lib = world.lib(client);
+    espnow_peer_handle_t primary = lib.getPrimaryServer();
+    for (int s = 0; s < 2; s++) {
+        if (primary != ESPNOW_INVALID_PEER && primary == lib.getPeerHandle(world.mac(s))) {
+            return s;
+        }
+    }
+    return -1;
+}
+
+static int countOn(SimWorld& world, int server) {
+    int n = 0;
+    for (int i = 2; i < world.nodeCount(); i++) {
+        n += primaryOf(world, i) == server;
+    }
+    return n;
+}
+
+// 各クライアントがランダムな位相で DATA_PERIOD_MS ごとに送りながら ms 進める
+static void runTraffic(SimWorld& world, uint64_t ms, const std::function<bool()>& done = nullptr) {
+    const uint8_t data[8] = {0};
+    uint64_t end = world.nowUs() + ms * 1000;
+    while (world.nowUs() < end && !(done && done())) {
+        world.runMs(DATA_PERIOD_MS / CLIENTS);
+        int i = 2 + (int)(world.nowUs() / 1000 / (DATA_PERIOD_MS / CLIENTS)) % CLIENTS;
+        world.at(i, [&](ESP_NowAdhoc& lib) { return lib.sendToServer(data, sizeof(data)); });
+    }
+}
+
+// strong: サーバー1がどのクライアントからもサーバー0より 30dB 強く聞こえる
+static void run(bool strong) {
+    SimWorld world(24);
+    world.addNodes(2 + CLIENTS);  // サーバー 0・1、クライアント 2..
+    world.setRssi([&](int src, int dst) { return (int8_t)((strong && (src == 1 || dst == 1)) ? -40 : -70); });
+    for (int i = 0; i < world.nodeCount(); i++) {
+        if (i == 1) {
+            continue;
+        }
+        world.runUs(world.random() % 100000);
+        world.boot(i, [&](ESP_NowAdhoc& lib) {
+            lib.setDebug(false);
+            lib.setPeerCache(false);
+            lib.begin(i == 0, false);
+        });
+    }
+    SIM_CHECK(world.runUntil([&] { return countOn(world, 0) == CLIENTS; }, 5000000));
+    runTraffic(world, 5000);
+
+    // 2台目のサーバーを起動し、全クライアントが見つけるまで待つ
+    world.boot(1, [](ESP_NowAdhoc& lib) {
+        lib.setDebug(false);
+        lib.setPeerCache(false);
+        lib.begin(true, false);
+    });
+    uint64_t start = world.nowUs();
+    runTraffic(world, 30000, [&] { return simJoined(world, 2); });
+    uint64_t joined = world.nowUs();
+
+    uint32_t changes = 0;
+    if (strong) {
+        // 評価の差が大きいため、次の評価の更新で全員が移る
+        runTraffic(world, 20000, [&] { return countOn(world, 1) == CLIENTS; });
+        double moveMs = (world.nowUs() - joined) / 1000.0;
+        SIM_CHECK(countOn(world, 1) == CLIENTS);
+        SIM_CHECK(moveMs < HEARTBEAT_INTERVAL * 2.5);
+        printf("strong: all %d clients moved %.0f ms after discovery (%.0f ms after boot)\n", CLIENTS, moveMs,
+               (world.nowUs() - start) / 1000.0);
+    } else {
+        // 僅差では一斉に移らず、負荷が2台に分かれて落ち着く
+        runTraffic(world, 30000);
+        int on1 = countOn(world, 1);
+        for (int i = 2; i < world.nodeCount(); i++) {
+            changes += world.lib(i).getServerSelectStats().changes;
+        }
+        SIM_CHECK(on1 >= CLIENTS / 4 && on1 <= CLIENTS * 3 / 4);
+        SIM_CHECK(changes <= CLIENTS);
+        printf("close: %d / %d clients on the new server, %u changes\n", on1, CLIENTS, (unsigned)changes);
+    }
+}
+
+// 主サーバーの電源を切る：切り替えまでの時間、失われたメッセージ、メッセージあたりのフレーム数
+static void failover() {
+    SimWorld world(25);
+    world.addNodes(2 + CLIENTS);
+    for (int i = 0; i < world.nodeCount(); i++) {
+        world.runUs(world.random() % 100000);
+        world.boot(i, [&](ESP_NowAdhoc& lib) {
+            lib.setDebug(false);
+            lib.setPeerCache(false);
+            lib.setDataCallback(onData);
+            lib.begin(i < 2, false);
+        });
+    }
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 2); }, 10000000));
+
+    uint64_t dataFrames = 0;
+    world.setTap([&](int src, const uint8_t* dst, const uint8_t* frame, size_t len) {
+        (void)dst;
+        const espnow_message_t* msg = reinterpret_cast<const espnow_message_t*>(frame);
+        if (src >= 2 && len >= ESPNOW_HEADER_SIZE && (msg->cmd == CMD_DATA || msg->cmd == CMD_BATCH)) {
+            dataFrames++;
+        }
+    });
+
+    // 各クライアントが番号付きのメッセージを DATA_PERIOD_MS ごとに送る（位相はクライアントごとにずらす）
+    uint32_t sent[2 + CLIENTS] = {};
+    auto traffic = [&](uint64_t ms, const std::function<void()>& poll) {
+        for (uint64_t t = 0; t < ms; t += DATA_PERIOD_MS / CLIENTS) {
+            int i = 2 + (int)(world.nowUs() / 1000 / (DATA_PERIOD_MS / CLIENTS)) % CLIENTS;
+            uint32_t n = sent[i];
+            sent[i] += world.at(i, [&](ESP_NowAdhoc& lib) { return lib.sendToServer((const uint8_t*)&n, sizeof(n)); });
+            world.runMs(DATA_PERIOD_MS / CLIENTS);
+            if (poll) {
+                poll();
+            }
+        }
+    };
+    traffic(5000, nullptr);
+
+    // クライアントの多い方の主サーバーを止める
+    int dead = countOn(world, 0) >= countOn(world, 1) ? 0 : 1;
+    int moved = countOn(world, dead);
+    SIM_CHECK(moved > 0);
+    uint64_t off = world.nowUs();
+    double latencyMs[2 + CLIENTS] = {};
+    bool onDead[2 + CLIENTS] = {};
+    for (int i = 2; i < world.nodeCount(); i++) {
+        onDead[i] = primaryOf(world, i) == dead;
+    }
+    world.powerOff(dead);
+    traffic(5000, [&] {
+        for (int i = 2; i < world.nodeCount(); i++) {
+            if (onDead[i] && latencyMs[i] == 0 && primaryOf(world, i) == 1 - dead) {
+                latencyMs[i] = (world.nowUs() - off) / 1000.0;
+            }
+        }
+    });
+    world.runMs(500);
+    world.setTap(nullptr);
+
+    uint32_t total = 0;
+    for (int i = 2; i < world.nodeCount(); i++) {
+        total += sent[i];
+    }
+    uint32_t lost = total - (uint32_t)s_uplink.size();
+    double maxLatency = 0;
+    double sumLatency = 0;
+    for (int i = 2; i < world.nodeCount(); i++) {
+        if (onDead[i]) {
+            SIM_CHECK(latencyMs[i] > 0);
+            maxLatency = std::max(maxLatency, latencyMs[i]);
+            sumLatency += latencyMs[i];
+        }
+    }
+    double framesPerMessage = total ? (double)dataFrames / total : 0;
+    SIM_CHECK(countOn(world, 1 - dead) == CLIENTS);
+    // 切り替えまでに失われるのは、連続した送信失敗として数えたメッセージまで
+    SIM_CHECK(maxLatency < ESPNOW_FAILOVER_FAILURES * DATA_PERIOD_MS + HEARTBEAT_INTERVAL);
+    SIM_CHECK(lost <= (uint32_t)(moved * ESPNOW_FAILOVER_FAILURES));
+    // 主サーバー1台にだけ送るため、メッセージあたり1フレーム強（2台へ送る場合は2）
+    SIM_CHECK(framesPerMessage < 1.2);
+    printf("failover: %d clients moved, %.0f ms on average (max %.0f ms), %u / %u messages lost, "
+           "%.2f data frames per uplink message\n", moved, sumLatency / moved, maxLatency, (unsigned)lost,
+           (unsigned)total, framesPerMessage);
+}
+
+// サーバー0は参加時にだけ 30dB 強く聞こえ、その後はドライバー登録のため受信強度が更新されない
+static void staleRssi() {
+    SimWorld world(26);
+    world.addNodes(2 + CLIENTS);
+    world.setRssi([&](int src, int dst) { return (int8_t)((src == 0 || dst == 0) ? -40 : -70); });
+    for (int i = 0; i < world.nodeCount(); i++) {
+        world.runUs(world.random() % 100000);
+        world.boot(i, [&](ESP_NowAdhoc& lib) {
+            lib.setDebug(false);
+            lib.setPeerCache(false);
+            lib.begin(i < 2, false);
+        });
+    }
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 2); }, 10000000));
+    runTraffic(world, 5000);
+    // 測ったばかりの受信強度の差は負荷より大きく、全員がサーバー0に残る
+    int fresh0 = countOn(world, 0);
+    SIM_CHECK(fresh0 == CLIENTS);
+
+    runTraffic(world, ESPNOW_SERVER_RSSI_MAX_AGE + 20000);
+    int on1 = countOn(world, 1);
+    SIM_CHECK(on1 >= CLIENTS / 4 && on1 <= CLIENTS * 3 / 4);
+    printf("stale rssi: %d / %d clients on the stronger server while fresh, %d / %d on the other after %u ms\n",
+           fresh0, CLIENTS, on1, CLIENTS, (unsigned)ESPNOW_SERVER_RSSI_MAX_AGE);
+}
+
+int main() {
+    run(false);
+    run(true);
+    failover();
+    staleRssi();
+    return simTestResult();
+}
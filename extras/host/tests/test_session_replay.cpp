@@ -0,0 +1,83 @@
+// セッションモード：再起動前の登録フレーム・データフレームを再送しても受け付けない
+
+#include "SimTest.h"
+
+static int s_received;
+
+static void onData(const uint8_t* mac, const espnow_message_t* msg, bool broadcast) {
+    (void)mac;
+    (void)msg;
+    (void)broadcast;
+    if (SimWorld::current()->currentNode() == 0) {
+        s_received++;
+    }
+}
+
+static void setup(ESP_NowAdhoc& lib, bool server) {
+    lib.setDebug(false);
+    lib.setPeerCache(false);
+    lib.setSessionKey("adhoc-test-secret");
+    lib.setDataCallback(onData);
+    lib.begin(server, false);
+}
+
+static bool sendPing(SimWorld& world) {
+    return world.at(1, [](ESP_NowAdhoc& lib) { return lib.sendToServer((const uint8_t*)"ping", 4); });
+}
+
+int main() {
+    SimWorld world(3);
+    world.addNodes(2);
+
+    // 1回目の起動のクライアントの登録フレームとデータフレームを記録する
+    std::vector<uint8_t> oldHello;
+    std::vector<uint8_t> oldData;
+    world.setTap([&](int src, const uint8_t* dst, const uint8_t* frame, size_t len) {
+        (void)dst;
+        const espnow_message_t* msg = reinterpret_cast<const espnow_message_t*>(frame);
+        if (src != 1 || len < ESPNOW_HEADER_SIZE || !(msg->flags & ESPNOW_FLAG_SESSION)) {
+            return;
+        }
+        if ((msg->cmd == CMD_REGISTER || msg->cmd == CMD_PROBE) && oldHello.empty()) {
+            oldHello.assign(frame, frame + len);
+        } else if (msg->cmd == CMD_DATA && oldData.empty()) {
+            oldData.assign(frame, frame + len);
+        }
+    });
+    world.boot(0, [](ESP_NowAdhoc& lib) { setup(lib, true); });
+    world.boot(1, [](ESP_NowAdhoc& lib) { setup(lib, false); });
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 1); }, 5000000));
+    SIM_CHECK(sendPing(world));
+    world.runMs(200);
+    SIM_CHECK(s_received == 1);
+    SIM_CHECK(!oldHello.empty() && !oldData.empty());
+    world.setTap(nullptr);
+
+    // クライアントを再起動し、サーバーが新しい鍵に切り替えるまで待つ
+    world.powerOff(1);
+    world.boot(1, [](ESP_NowAdhoc& lib) { setup(lib, false); });
+    SIM_CHECK(world.runUntil([&] { return world.lib(0).getSessionStats().rekeys == 1; }, 5000000));
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 1); }, 5000000));
+    SIM_CHECK(sendPing(world));
+    world.runMs(200);
+    SIM_CHECK(s_received == 2);
+
+    // 古い登録フレームで鍵・受信ウィンドウが戻らず、古いデータフレームも受け付けない
+    uint32_t replays = world.lib(0).getSessionStats().replays;
+    world.inject(0, world.mac(1), world.mac(0), oldHello.data(), oldHello.size());
+    world.runMs(10);
+    SIM_CHECK(world.lib(0).getSessionStats().rekeys == 1);
+    SIM_CHECK(world.lib(0).getSessionStats().replays == replays + 1);
+    world.inject(0, world.mac(1), world.mac(0), oldData.data(), oldData.size());
+    world.runMs(10);
+    SIM_CHECK(s_received == 2);
+
+    // 現在のセッションはそのまま使える
+    SIM_CHECK(sendPing(world));
+    world.runMs(200);
+    SIM_CHECK(s_received == 3);
+
+    printf("rekeys %u, replays %u\n", (unsigned)world.lib(0).getSessionStats().rekeys,
+           (unsigned)world.lib(0).getSessionStats().replays);
+    return simTestResult();
+}
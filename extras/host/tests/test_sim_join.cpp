@@ -0,0 +1,58 @@
+// シミュレーターの動作確認：参加・データの配送・同じシードでの再現性
+
+#include "SimTest.h"
+
+static int s_received[8];
+
+static void onData(const uint8_t* mac, const espnow_message_t* msg, bool broadcast) {
+    (void)mac;
+    (void)msg;
+    (void)broadcast;
+    s_received[SimWorld::current()->currentNode()]++;
+}
+
+struct Result {
+    bool joined;
+    uint64_t joinUs;
+    int received;
+    sim_stats_t stats;
+};
+
+static Result runOnce(uint32_t seed) {
+    memset(s_received, 0, sizeof(s_received));
+    SimWorld world(seed);
+    world.addNodes(4);
+    simBootGroup(world, 1, [](int, ESP_NowAdhoc& lib) { lib.setDataCallback(onData); });
+
+    Result r = {};
+    r.joined = world.runUntil([&] { return simJoined(world, 1); }, 5000000);
+    r.joinUs = world.nowUs();
+    for (int k = 0; k < 10; k++) {
+        for (int i = 1; i < 4; i++) {
+            world.at(i, [](ESP_NowAdhoc& lib) { return lib.sendToServer((const uint8_t*)"ping", 4); });
+        }
+        world.runMs(100);
+    }
+    world.runMs(500);
+    r.received = s_received[0];
+    r.stats = world.stats();
+    return r;
+}
+
+int main() {
+    Result a = runOnce(7);
+    SIM_CHECK(a.joined);
+    SIM_CHECK(a.joinUs < 3000000);
+    SIM_CHECK(a.received == 30);
+    SIM_CHECK(a.stats.frames > 0 && a.stats.airtimeUs > 0);
+
+    // 同じシードなら同じ結果
+    Result b = runOnce(7);
+    SIM_CHECK(b.joinUs == a.joinUs);
+    SIM_CHECK(b.stats.frames == a.stats.frames);
+    SIM_CHECK(b.stats.airtimeUs == a.stats.airtimeUs);
+
+    printf("join %.1f ms, frames %llu, airtime %llu us\n", a.joinUs / 1000.0, (unsigned long long)a.stats.frames,
+           (unsigned long long)a.stats.airtimeUs);
+    return simTestResult();
+}
@@ -0,0 +1,61 @@
+// エンジンタスクのスタック使用量：セッション・圧縮・分割送信・信頼性モード・メッシュの中継・ピア一覧の保存を通す
+// （ホストの x86-64 での値。ESP32 とは ABI が異なるため目安）
+
+#include "SimTest.h"
+
+#define CLIENTS 3
+#define TOPIC 1
+
+static uint32_t run(bool mesh) {
+    SimWorld world(7);
+    world.addNodes(CLIENTS + 1);
+    for (int i = 0; i <= CLIENTS; i++) {
+        world.boot(i, [&](ESP_NowAdhoc& lib) {
+            lib.setDebug(false);
+            lib.setSessionKey("adhoc-test-secret");
+            lib.setCompression(true);
+            lib.setMesh(mesh);
+            lib.subscribe(TOPIC);
+            lib.begin(i == 0, false);
+            lib.beginTask();
+        });
+        world.runUs(world.random() % 100000);
+    }
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 1); }, 10000000));
+
+    uint8_t large[1000];
+    for (size_t i = 0; i < sizeof(large); i++) {
+        large[i] = (uint8_t)(i * 7);
+    }
+    for (int round = 0; round < 20; round++) {
+        for (int i = 1; i <= CLIENTS; i++) {
+            world.at(i, [&](ESP_NowAdhoc& lib) {
+                lib.sendToServer(large, 32);
+                lib.sendLargeToServer(large, sizeof(large));
+                lib.sendReliable(lib.getPrimaryServer(), large, 64);
+                return lib.publish(TOPIC, large, 16);
+            });
+        }
+        world.runMs(500);
+    }
+    // ピア一覧の保存（保存済みとの比較を含む）もエンジンタスクで行われる
+    world.runMs(ESPNOW_PEER_CACHE_DELAY);
+
+    uint32_t minFree = ESPNOW_TASK_STACK_SIZE;
+    for (int i = 0; i <= CLIENTS; i++) {
+        uint32_t free = world.at(i, [](ESP_NowAdhoc& lib) { return lib.getTaskStackFree(); });
+        SIM_CHECK(world.at(i, [](ESP_NowAdhoc& lib) { return lib.isTaskRunning(); }));
+        SIM_CHECK(world.lib(i).getPeerCacheStats().writes > 0);
+        minFree = std::min(minFree, free);
+    }
+    printf("%s: max stack used %u of %u bytes\n", mesh ? "mesh" : "star",
+           (unsigned)(ESPNOW_TASK_STACK_SIZE - minFree), (unsigned)ESPNOW_TASK_STACK_SIZE);
+    return ESPNOW_TASK_STACK_SIZE - minFree;
+}
+
+int main() {
+    // ESP32 では割り込みなどの分が上乗せされるため、1/4 は空けておく
+    SIM_CHECK(run(false) < ESPNOW_TASK_STACK_SIZE * 3 / 4);
+    SIM_CHECK(run(true) < ESPNOW_TASK_STACK_SIZE * 3 / 4);
+    return simTestResult();
+}
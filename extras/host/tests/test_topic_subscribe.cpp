@@ -0,0 +1,87 @@
+// 購読の通知：参加直後・サーバーの再起動後にすべてのクライアントの購読がサーバーに届き、
+// 発行元が再起動した後の発行も重複として捨てられない
+
+#include "SimTest.h"
+
+#define CLIENTS 4
+#define TOPIC 3
+
+static int s_delivered;
+
+static void onTopic(const uint8_t* mac, uint8_t topic, const uint8_t* data, size_t len) {
+    (void)mac;
+    (void)data;
+    (void)len;
+    s_delivered += topic == TOPIC;
+}
+
+// クライアント1から count 回発行し、他のクライアントに届いた数を返す
+static int publishBatch(SimWorld& world, int count) {
+    s_delivered = 0;
+    const uint8_t data[4] = {1, 2, 3, 4};
+    for (int n = 0; n < count; n++) {
+        SIM_CHECK(world.at(1, [&](ESP_NowAdhoc& lib) { return lib.publish(TOPIC, data, sizeof(data)); }));
+        world.runMs(100);
+    }
+    return s_delivered;
+}
+
+static bool allSubscribed(SimWorld& world) {
+    return world.lib(0).getSubscriberCount(TOPIC) == CLIENTS;
+}
+
+static void run(bool session) {
+    SimWorld world(11);
+    world.addNodes(CLIENTS + 1);
+    auto setup = [&](int i, ESP_NowAdhoc& lib) {
+        lib.setPeerCache(false);
+        if (session) {
+            lib.setSessionKey("adhoc-test-secret");
+        }
+        if (i > 0) {
+            lib.subscribe(TOPIC);
+        }
+        lib.setTopicCallback(onTopic);
+    };
+    simBootGroup(world, 1, setup);
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 1); }, 5000000));
+    SIM_CHECK(world.runUntil([&] { return allSubscribed(world); }, 5000000));
+
+    // サーバーの再起動（参加要求に応答して通知し直す）
+    world.powerOff(0);
+    world.runMs(100);
+    world.boot(0, [&](ESP_NowAdhoc& lib) {
+        lib.setDebug(false);
+        setup(0, lib);
+        lib.begin(true, false);
+    });
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 1) && allSubscribed(world); }, 5000000));
+
+    double resubscribedMs = world.nowUs() / 1000.0;
+
+    // 発行元の再起動：番号が最初からやり直しても、サーバー・購読者に残る記録と重ならない
+    int before = publishBatch(world, 5);
+    SIM_CHECK(before == 5 * (CLIENTS - 1));
+    world.powerOff(1);
+    world.runMs(100);
+    world.boot(1, [&](ESP_NowAdhoc& lib) {
+        lib.setDebug(false);
+        setup(1, lib);
+        lib.begin(false, false);
+    });
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 1) && allSubscribed(world); }, 5000000));
+    uint32_t duplicates = world.lib(0).getTopicStats().duplicates;
+    int after = publishBatch(world, 5);
+    SIM_CHECK(after == 5 * (CLIENTS - 1));
+    SIM_CHECK(world.lib(0).getTopicStats().duplicates == duplicates);
+
+    printf("%s: subscribers %u after %.1f ms, %d / %d publishes delivered before and %d after the publisher "
+           "reboots\n", session ? "session" : "plain", (unsigned)world.lib(0).getSubscriberCount(TOPIC),
+           resubscribedMs, before, 5 * (CLIENTS - 1), after);
+}
+
+int main() {
+    run(false);
+    run(true);
+    return simTestResult();
+}
@@ -0,0 +1,82 @@
+// Trickle方式の広告：ピア構成が落ち着くと広告の頻度が下がり、後から起動したノードは
+// 参加要求への応答ですぐに参加できる
+
+#include "SimTest.h"
+
+#define NODES 7        // サーバー 0、クライアント 1..
+#define LATE NODES     // 後から起動するクライアント
+
+static bool isBroadcast(const uint8_t* mac) {
+    return memcmp(mac, "\xff\xff\xff\xff\xff\xff", 6) == 0;
+}
+
+static void bootNode(SimWorld& world, int i, bool trickle) {
+    world.boot(i, [&](ESP_NowAdhoc& lib) {
+        lib.setDebug(false);
+        lib.setPeerCache(false);
+        if (!trickle) {
+            lib.setBroadcastIntervalMax(BROADCAST_INTERVAL);  // 固定間隔の広告
+        }
+        lib.begin(i == 0, false);
+    });
+}
+
+static bool lateJoined(SimWorld& world) {
+    return world.lib(LATE).getServerPeerCount() >= 1 && world.lib(0).getTotalPeerCount() >= NODES;
+}
+
+static void run(bool trickle) {
+    SimWorld world(10);
+    world.addNodes(NODES + 1);
+    uint64_t start = 0;
+    for (int i = 0; i < NODES; i++) {
+        world.runUs(world.random() % 100000);
+        start = start ? start : world.nowUs();
+        bootNode(world, i, trickle);
+    }
+    SIM_CHECK(world.runUntil([&] {
+        for (int i = 1; i < NODES; i++) {
+            if (world.lib(i).getServerPeerCount() < 1) {
+                return false;
+            }
+        }
+        return world.lib(0).getTotalPeerCount() >= NODES - 1;
+    }, 10000000));
+    double joinMs = (world.nowUs() - start) / 1000.0;
+
+    // 間隔が上限まで延びるのを待ってから1分間の広告を数える
+    world.runMs(BROADCAST_INTERVAL_MAX * 4);
+    uint64_t adverts = 0;
+    world.setTap([&](int src, const uint8_t* dst, const uint8_t* frame, size_t len) {
+        const espnow_message_t* msg = reinterpret_cast<const espnow_message_t*>(frame);
+        if (src < NODES && len >= ESPNOW_HEADER_SIZE && isBroadcast(dst) &&
+            (msg->cmd == CMD_REGISTER || msg->cmd == CMD_PROBE)) {
+            adverts++;
+        }
+    });
+    world.runMs(60000);
+    world.setTap(nullptr);
+    double perMinute = (double)adverts / NODES;
+    if (trickle) {
+        SIM_CHECK(world.lib(0).getBroadcastInterval() == BROADCAST_INTERVAL_MAX);
+        SIM_CHECK(perMinute <= 60000.0 / BROADCAST_INTERVAL_MAX * 1.5);
+    } else {
+        SIM_CHECK(perMinute >= 60000.0 / BROADCAST_INTERVAL * 0.9);
+    }
+
+    // 落ち着いた後に起動したノードも最短の広告間隔より早く参加できる
+    uint64_t lateBoot = world.nowUs();
+    bootNode(world, LATE, trickle);
+    SIM_CHECK(world.runUntil([&] { return lateJoined(world); }, 10000000));
+    double lateMs = (world.nowUs() - lateBoot) / 1000.0;
+    SIM_CHECK(lateMs < BROADCAST_INTERVAL);
+
+    printf("%s: all joined %.0f ms after the first boot, %.1f advertisements/min per node, late join %.0f ms\n",
+           trickle ? "trickle" : "fixed", joinMs, perMinute, lateMs);
+}
+
+int main() {
+    run(false);
+    run(true);
+    return simTestResult();
+}
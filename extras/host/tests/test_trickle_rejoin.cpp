@@ -0,0 +1,28 @@
+// Trickle：切断されたサーバーが再び聞こえたら、広告の間隔が伸びていても次のビーコンで再登録する
+
+#include "SimTest.h"
+
+int main() {
+    SimWorld world(9);
+    world.addNodes(3);  // サーバー 0・1、クライアント 2
+    simBootGroup(world, 2, [](int, ESP_NowAdhoc& lib) { lib.setPeerCache(false); });
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 2); }, 5000000));
+    world.runMs(40000);  // 広告の間隔が最大まで伸びる
+
+    // サーバー1とクライアントの間をタイムアウトより長く切る（サーバー0とはつながったまま）
+    bool cut = true;
+    world.setLink([&](int src, int dst) { return !(cut && (src + dst == 3)); });
+    SIM_CHECK(world.runUntil([&] { return world.lib(2).getServerPeerCount() == 1; }, 10000000));
+    SIM_CHECK(world.runUntil([&] { return world.lib(1).getClientPeerCount() == 0; }, 10000000));
+    world.runMs(10000);
+    cut = false;
+
+    uint64_t start = world.nowUs();
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 2); }, 30000000));
+    double rejoinMs = (world.nowUs() - start) / 1000.0;
+    // ビーコンの間隔（ハートビート間隔）+ 応答の時間
+    SIM_CHECK(rejoinMs < HEARTBEAT_INTERVAL * 2.5);
+
+    printf("rejoin %.1f ms\n", rejoinMs);
+    return simTestResult();
+}
@@ -0,0 +1,41 @@
+// 型付きメッセージ：送信できる最大の型（セッションモードの保護を含めて1フレーム）がセッションモードでも届く
+
+#include "SimTest.h"
+
+struct MaxMessage {
+    static constexpr uint8_t MESSAGE_ID = 1;
+    uint8_t data[ESPNOW_FRAME_LIMIT - ESPNOW_HEADER_SIZE - ESPNOW_SESSION_OVERHEAD];
+};
+
+static int s_received;
+static bool s_intact = true;
+
+static void onMax(const uint8_t* mac, const MaxMessage& msg) {
+    (void)mac;
+    for (size_t i = 0; i < sizeof(msg.data); i++) {
+        s_intact = s_intact && msg.data[i] == (uint8_t)i;
+    }
+    s_received++;
+}
+
+int main() {
+    SimWorld world(7);
+    world.addNodes(2);
+    simBootGroup(world, 1, [](int, ESP_NowAdhoc& lib) {
+        lib.setPeerCache(false);
+        lib.setSessionKey("adhoc-test-secret");
+        lib.on<MaxMessage>(onMax);
+    });
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 1); }, 5000000));
+
+    MaxMessage msg;
+    for (size_t i = 0; i < sizeof(msg.data); i++) {
+        msg.data[i] = (uint8_t)i;
+    }
+    SIM_CHECK(world.at(1, [&](ESP_NowAdhoc& lib) { return lib.send(ESPNOW_TARGET_SERVERS, msg); }));
+    SIM_CHECK(world.runUntil([&] { return s_received == 1; }, 1000000));
+    SIM_CHECK(s_intact);
+
+    printf("%u-byte typed message delivered in session mode\n", (unsigned)sizeof(MaxMessage));
+    return simTestResult();
+}
@@ -0,0 +1,64 @@
+// 可変長のワイヤー形式：ハートビートの電波上のバイト数が固定長の構造体の1/10未満で、
+// 受信側には実際のペイロード長が渡される
+
+#include "SimTest.h"
+
+// 可変長化する前の espnow_message_t（group_id[37]・role・channel・security・cmd・data[1000]）
+#define FIXED_MESSAGE_SIZE (37 + 4 + 1000)
+#define PAYLOAD "telemetry:temp=23.5,hum=41.0,volt=3.29"
+
+static size_t s_len;
+static bool s_match;
+
+static void onData(const uint8_t* mac, const espnow_message_t* msg, bool broadcast) {
+    (void)mac;
+    (void)broadcast;
+    s_len = msg->len;
+    s_match = msg->len == strlen(PAYLOAD) && memcmp(msg->data, PAYLOAD, msg->len) == 0;
+}
+
+int main() {
+    SimWorld world(1);
+    world.addNodes(2);
+    simBootGroup(world, 1, [](int, ESP_NowAdhoc& lib) {
+        lib.setPeerCache(false);
+        lib.setDataCallback(onData);
+    });
+    SIM_CHECK(world.runUntil([&] { return simJoined(world, 1); }, 5000000));
+
+    // 参加後の10秒間のハートビート・ビーコン
+    uint64_t heartbeats = 0;
+    uint64_t heartbeatBytes = 0;
+    size_t dataLen = 0;
+    world.setTap([&](int src, const uint8_t* dst, const uint8_t* frame, size_t len) {
+        (void)src;
+        (void)dst;
+        const espnow_message_t* msg = reinterpret_cast<const espnow_message_t*>(frame);
+        if (len < ESPNOW_HEADER_SIZE) {
+            return;
+        }
+        if (msg->cmd == CMD_HEARTBEAT || msg->cmd == CMD_BEACON) {
+            heartbeats++;
+            heartbeatBytes += len;
+        } else if (msg->cmd == CMD_DATA) {
+            dataLen = len;
+        }
+    });
+    world.runMs(10000);
+    SIM_CHECK(heartbeats > 0);
+    double perHeartbeat = heartbeats ? (double)heartbeatBytes / heartbeats : 0;
+    SIM_CHECK(perHeartbeat * 10 < FIXED_MESSAGE_SIZE);
+
+    // データはヘッダー + ペイロードのみ送られ、受信側に長さがそのまま渡される
+    SIM_CHECK(world.at(1, [](ESP_NowAdhoc& lib) {
+        return lib.sendToServer((const uint8_t*)PAYLOAD, strlen(PAYLOAD));
+    }));
+    world.runMs(100);
+    SIM_CHECK(dataLen == ESPNOW_HEADER_SIZE + strlen(PAYLOAD));
+    SIM_CHECK(s_match);
+
+    printf("heartbeat %.1f bytes on air (fixed struct %d, %.0fx smaller), %u-byte payload sent in %u bytes\n",
+           perHeartbeat, FIXED_MESSAGE_SIZE, perHeartbeat ? FIXED_MESSAGE_SIZE / perHeartbeat : 0.0,
+           (unsigned)s_len, (unsigned)dataLen);
+    return simTestResult();
+}
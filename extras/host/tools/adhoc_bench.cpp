@@ -0,0 +1,334 @@
+// エンジンの処理ごとのマイクロベンチマーク
+//
+//   adhoc_bench [--peers 1,10,50,100,200] [--min-time MS] [--seed S] [--format json|csv]
+//
+// サーバー1台にクライアント K 台をシミュレーター上で参加させ、サーバーの状態のまま
+// 各処理を繰り返し呼んでホストでの1回あたりの時間 (ns) を測る
+// cycles_per_op は 240MHz で換算した参考値（ESP32 の実測値ではない）
+// session_seal・session_open はセッションモードのサーバーとクライアント1台で測り、cycles_per_op は
+// getSessionStats() の sealCycles / sealed・openCycles / opened（暗号処理の部分のみ）
+
+#include "SimWorld.h"
+#include <getopt.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+struct BenchResult {
+    std::string scenario;
+    int peers;
+    uint64_t iterations;
+    double nsPerOp;
+    double cyclesPerOp;
+};
+
+static double s_minTimeMs = 200;
+
+static BenchResult result(const char* scenario, int peers, uint64_t iterations, double totalNs) {
+    BenchResult r;
+    r.scenario = scenario;
+    r.peers = peers;
+    r.iterations = iterations;
+    r.nsPerOp = totalNs / iterations;
+    r.cyclesPerOp = r.nsPerOp * 0.24;
+    return r;
+}
+
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// f() を minTime の間まとめて繰り返す（状態を戻す必要のない処理）
+template <typename F>
+static BenchResult measure(const char* scenario, int peers, F&& f) {
+    typedef std::chrono::steady_clock clock;
+    for (int i = 0; i < 100; i++) {
+        f();
+    }
+    uint64_t iterations = 0;
+    clock::time_point start = clock::now();
+    do {
+        for (int i = 0; i < 256; i++) {
+            f();
+        }
+        iterations += 256;
+    } while (elapsedMs(start) < s_minTimeMs);
+    return result(scenario, peers, iterations, elapsedMs(start) * 1e6);
+}
+
+// 毎回 prepare() で状態を戻してから f() を1回ずつ測る（prepare() は計測に含めない）
+template <typename Prepare, typename F>
+static BenchResult measureEach(const char* scenario, int peers, Prepare&& prepare, F&& f) {
+    typedef std::chrono::steady_clock clock;
+    uint64_t iterations = 0;
+    double totalNs = 0;
+    clock::time_point wallStart = clock::now();
+    do {
+        prepare();
+        clock::time_point start = clock::now();
+        f();
+        totalNs += std::chrono::duration<double, std::nano>(clock::now() - start).count();
+        iterations++;
+    } while (elapsedMs(wallStart) < s_minTimeMs);
+    return result(scenario, peers, iterations, totalNs);
+}
+
+class ESP_NowAdhocBench {
+public:
+    static void run(int clients, uint32_t seed, std::vector<BenchResult>& out);
+    static void runSession(uint32_t seed, std::vector<BenchResult>& out);
+};
+
+void ESP_NowAdhocBench::run(int clients, uint32_t seed, std::vector<BenchResult>& out) {
+    SimWorld world(seed);
+    world.addNodes(clients + 1);
+    for (int i = 0; i <= clients; i++) {
+        world.boot(i, [&](ESP_NowAdhoc& lib) {
+            lib.setDebug(false);
+            lib.setPeerCache(false);
+            lib.begin(i == 0, false);
+        });
+    }
+
+    // クライアント1の登録フレーム・データフレームを捕まえる
+    std::vector<uint8_t> reg;
+    std::vector<uint8_t> data;
+    world.setTap([&](int src, const uint8_t* dst, const uint8_t* frame, size_t len) {
+        (void)dst;
+        if (src != 1 || len < ESPNOW_HEADER_SIZE) {
+            return;
+        }
+        const espnow_message_t* msg = reinterpret_cast<const espnow_message_t*>(frame);
+        if (msg->cmd == CMD_REGISTER && reg.empty()) {
+            reg.assign(frame, frame + len);
+        } else if (msg->cmd == CMD_DATA && data.empty()) {
+            data.assign(frame, frame + len);
+        }
+    });
+    // 大規模構成では参加しきれないクライアントが残ることがあるため、参加できた数で測る
+    world.runUntil([&] { return world.lib(0).getTotalPeerCount() == clients && !reg.empty(); }, 300000000);
+    int peers = world.lib(0).getTotalPeerCount();
+    if (peers < clients) {
+        fprintf(stderr, "adhoc_bench: %d of %d clients joined\n", peers, clients);
+    }
+    if (reg.empty() || world.lib(0)._peers.find(world.mac(1)) == ESPNOW_INVALID_PEER) {
+        fprintf(stderr, "adhoc_bench: client 1 did not join\n");
+        return;
+    }
+    uint8_t payload[16];
+    memset(payload, 0x5a, sizeof(payload));
+    world.at(1, [&](ESP_NowAdhoc& lib) { return lib.sendToServer(payload, sizeof(payload)); });
+    world.runMs(100);
+    world.setTap(nullptr);
+    if (data.empty()) {
+        fprintf(stderr, "adhoc_bench: no data frame captured\n");
+        return;
+    }
+
+    std::vector<uint8_t> wrongGroup = data;
+    reinterpret_cast<espnow_message_t*>(wrongGroup.data())->group_token ^= 0x5a5a5a5a;
+    const uint8_t* clientMac = world.mac(1);
+
+    world.at(0, [&](ESP_NowAdhoc& lib) {
+        ESP_NowAdhocPeer* peer = lib._peers.get(lib._peers.find(clientMac));
+
+        // 受信処理：データ（コールバックなし）・グループ違い・短すぎるフレーム
+        out.push_back(measure("rx_data", peers, [&] {
+            peer->processReceivedMessage(data.data(), data.size(), false);
+        }));
+        out.push_back(measure("rx_wrong_group", peers, [&] {
+            peer->processReceivedMessage(wrongGroup.data(), wrongGroup.size(), false);
+        }));
+        out.push_back(measure("rx_short", peers, [&] {
+            peer->processReceivedMessage(data.data(), 4, false);
+        }));
+
+        // グループの照合のみ：トークンの比較と、トークン導入前の UUID 文字列の比較（最後の1文字だけ違う）
+        const espnow_message_t* frame = reinterpret_cast<const espnow_message_t*>(wrongGroup.data());
+        char otherID[sizeof(lib._groupID)];
+        memcpy(otherID, lib._groupID, sizeof(otherID));
+        otherID[strlen(otherID) - 1] ^= 1;
+        volatile const char* otherPtr = otherID;
+        volatile bool match = false;
+        out.push_back(measure("group_filter_token", peers, [&] {
+            match = *(volatile const uint32_t*)&frame->group_token == lib._groupToken;
+        }));
+        out.push_back(measure("group_filter_strcmp", peers, [&] {
+            match = strcmp((const char*)otherPtr, lib._groupID) == 0;
+        }));
+        (void)match;
+
+        // 登録済みピアの広告
+        out.push_back(measure("registration_known", peers, [&] {
+            lib.processRegistration(clientMac, reg.data(), reg.size());
+        }));
+
+        // ハートビートの組み立て（全ピアが送信対象になる状態に戻し、積んだフレームは捨てる）
+        auto makeDue = [&] {
+            for (uint8_t q = 0; q < ESP_NowAdhoc::TX_QUEUE_COUNT; q++) {
+                lib.dropTxQueue(q);
+            }
+            unsigned long now = millis();
+            lib._lastGroupBroadcastMs = now - lib._heartbeatInterval;
+            for (size_t i = 0; i < lib._peers.size(); i++) {
+                lib._peers.at(i)->lastSentMs = now - lib._heartbeatInterval;
+            }
+        };
+        out.push_back(measureEach("heartbeat_beacon", peers, makeDue, [&] { lib.sendHeartbeats(); }));
+        lib.setHeartbeatBeacon(false);
+        out.push_back(measureEach("heartbeat_unicast", peers, makeDue, [&] { lib.sendHeartbeats(); }));
+        lib.setHeartbeatBeacon(true);
+        makeDue();
+
+        // タイムアウトの確認（タイムアウトしたピアはない）
+        out.push_back(measure("peer_timeouts", peers, [&] {
+            lib.checkPeerTimeouts(millis());
+        }));
+
+        volatile int sink = 0;
+        out.push_back(measure("peer_counts", peers, [&] {
+            sink = sink + lib.getServerPeerCount() + lib.getClientPeerCount();
+        }));
+        return 0;
+    });
+}
+
+// セッションの保護と検証（クライアント1台。処理はピア数によらない）
+void ESP_NowAdhocBench::runSession(uint32_t seed, std::vector<BenchResult>& out) {
+    SimWorld world(seed);
+    world.addNodes(2);
+    for (int i = 0; i < 2; i++) {
+        world.boot(i, [&](ESP_NowAdhoc& lib) {
+            lib.setDebug(false);
+            lib.setPeerCache(false);
+            lib.setSessionKey("adhoc-bench-secret");
+            lib.begin(i == 0, false);
+        });
+    }
+    world.runUntil([&] {
+        ESP_NowAdhocPeer* peer = world.lib(0)._peers.get(world.lib(0)._peers.find(world.mac(1)));
+        return peer && peer->hasSession() && world.lib(1).getServerPeerCount() == 1;
+    }, 10000000);
+
+    // クライアントが保護したデータフレームを捕まえる
+    std::vector<uint8_t> sealed;
+    world.setTap([&](int src, const uint8_t* dst, const uint8_t* frame, size_t len) {
+        (void)dst;
+        const espnow_message_t* msg = reinterpret_cast<const espnow_message_t*>(frame);
+        if (src == 1 && len >= ESPNOW_HEADER_SIZE && msg->cmd == CMD_DATA && (msg->flags & ESPNOW_FLAG_SESSION) &&
+            sealed.empty()) {
+            sealed.assign(frame, frame + len);
+        }
+    });
+    uint8_t payload[16];
+    memset(payload, 0x5a, sizeof(payload));
+    world.at(1, [&](ESP_NowAdhoc& lib) { return lib.sendToServer(payload, sizeof(payload)); });
+    world.runMs(100);
+    world.setTap(nullptr);
+    if (sealed.empty()) {
+        fprintf(stderr, "adhoc_bench: no session data frame captured\n");
+        return;
+    }
+
+    const uint8_t* clientMac = world.mac(1);
+    world.at(0, [&](ESP_NowAdhoc& lib) {
+        ESP_NowAdhocPeer* peer = lib._peers.get(lib._peers.find(clientMac));
+        const espnow_message_t* frame = reinterpret_cast<const espnow_message_t*>(sealed.data());
+
+        // 検証と復号（毎回受信ウィンドウを戻し、同じフレームを新しいものとして受け取らせる）
+        espnow_session_stats_t before = lib._sessionStats;
+        auto rewind = [&] { memset(&peer->_session.rx, 0, sizeof(peer->_session.rx)); };
+        BenchResult open = measureEach("session_open", 1, rewind, [&] { lib.openFrame(peer, frame, false); });
+        uint32_t opened = lib._sessionStats.opened - before.opened;
+        if (opened > 0) {
+            open.cyclesPerOp = (double)(lib._sessionStats.openCycles - before.openCycles) / opened;
+        }
+
+        // 復号した平文のフレームをクライアント宛に保護する
+        std::vector<uint8_t> plain((const uint8_t*)&lib._sessionRxBuf,
+                                   (const uint8_t*)&lib._sessionRxBuf + ESPNOW_HEADER_SIZE + lib._sessionRxBuf.len);
+        before = lib._sessionStats;
+        BenchResult seal = measure("session_seal", 1, [&] {
+            size_t len = plain.size();
+            lib.sealFrame(peer, plain.data(), &len);
+        });
+        uint32_t sealedCount = lib._sessionStats.sealed - before.sealed;
+        if (sealedCount > 0) {
+            seal.cyclesPerOp = (double)(lib._sessionStats.sealCycles - before.sealCycles) / sealedCount;
+        }
+        if (opened > 0 && sealedCount > 0) {
+            out.push_back(seal);
+            out.push_back(open);
+        }
+        return 0;
+    });
+}
+
+static std::vector<int> parseList(const char* s) {
+    std::vector<int> v;
+    std::string str(s);
+    size_t pos = 0;
+    while (pos < str.size()) {
+        size_t comma = str.find(',', pos);
+        v.push_back(atoi(str.substr(pos, comma - pos).c_str()));
+        pos = (comma == std::string::npos) ? str.size() : comma + 1;
+    }
+    return v;
+}
+
+int main(int argc, char** argv) {
+    std::vector<int> peers = {1, 10, 50, 100, 200};
+    uint32_t seed = 1;
+    bool json = true;
+    static const struct option longOpts[] = {
+        {"peers", required_argument, nullptr, 'p'}, {"min-time", required_argument, nullptr, 't'},
+        {"seed", required_argument, nullptr, 'r'},  {"format", required_argument, nullptr, 'f'},
+        {"help", no_argument, nullptr, 'h'},        {nullptr, 0, nullptr, 0}};
+    int c;
+    while ((c = getopt_long(argc, argv, "", longOpts, nullptr)) != -1) {
+        switch (c) {
+        case 'p': peers = parseList(optarg); break;
+        case 't': s_minTimeMs = atof(optarg); break;
+        case 'r': seed = (uint32_t)strtoul(optarg, nullptr, 0); break;
+        case 'f': json = std::string(optarg) != "csv"; break;
+        default:
+            fprintf(stderr, "usage: adhoc_bench [--peers N1,N2,...] [--min-time MS] [--seed S] [--format json|csv]\n");
+            return c == 'h' ? 0 : 2;
+        }
+    }
+    for (int k : peers) {
+        if (k < 1 || k > ESPNOW_MAX_PEERS) {
+            fprintf(stderr, "adhoc_bench: peers must be 1..%d\n", ESPNOW_MAX_PEERS);
+            return 2;
+        }
+    }
+
+    std::vector<BenchResult> results;
+    for (int k : peers) {
+        ESP_NowAdhocBench::run(k, seed, results);
+    }
+    ESP_NowAdhocBench::runSession(seed, results);
+
+    if (json) {
+        printf("[\n");
+    } else {
+        printf("scenario,peers,iterations,ns_per_op,cycles_per_op\n");
+    }
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        if (json) {
+            printf("  {\"scenario\": \"%s\", \"peers\": %d, \"iterations\": %llu, \"ns_per_op\": %.1f, "
+                   "\"cycles_per_op\": %.0f}%s\n",
+                   r.scenario.c_str(), r.peers, (unsigned long long)r.iterations, r.nsPerOp, r.cyclesPerOp,
+                   i + 1 < results.size() ? "," : "");
+        } else {
+            printf("%s,%d,%llu,%.1f,%.0f\n", r.scenario.c_str(), r.peers, (unsigned long long)r.iterations,
+                   r.nsPerOp, r.cyclesPerOp);
+        }
+    }
+    if (json) {
+        printf("]\n");
+    }
+    return results.size() == peers.size() * 10 + 2 ? 0 : 1;
+}
@@ -0,0 +1,261 @@
+// 複数ノードのシミュレーション結果をレポートする
+//
+//   adhoc_sim [--nodes N | --sweep LIST] [--servers S] [--loss P] [--seed S]
+//             [--duration MS] [--rate MSG/S] [--session] [--mesh] [--format csv|json]
+//
+// 各構成で次を順に行い、1行（1オブジェクト）を出力する
+//   1. 全ノードを 0..100ms に散らして起動し、全員が参加するまでの時間を測る
+//   2. 参加後、トラフィックなしで IDLE_MS の間のエアタイム（制御フレームの負荷）を測る
+//   3. 各クライアントが --rate で sendToServer() し、サーバーに届いた数とエアタイムを測る
+// 同じ引数・シードなら同じ結果になる
+
+#include "SimWorld.h"
+#include <getopt.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define JOIN_TIMEOUT_MS 60000
+#define IDLE_MS 10000
+
+struct Options {
+    std::vector<int> nodes = {2, 5, 10, 20, 50, 100, 200};
+    int servers = 1;
+    double loss = 0.0;
+    uint32_t seed = 1;
+    uint32_t durationMs = 10000;
+    double rate = 1.0;         // クライアントごとのメッセージ数/秒
+    bool session = false;
+    bool mesh = false;
+    bool json = false;
+};
+
+struct Report {
+    int nodes;
+    int joined;
+    double joinP50Ms;
+    double joinMaxMs;
+    double idleAirtime;
+    double idleFramesPerSec;
+    uint64_t sent;
+    uint64_t accepted;
+    uint64_t delivered;
+    double deliveredPerSec;
+    double airtime;
+    double framesPerSec;
+    double bytesPerSec;
+    uint64_t rejected;
+    uint64_t sendFailed;
+};
+
+static std::vector<uint64_t> s_received;
+
+static void onData(const uint8_t* mac, const espnow_message_t* msg, bool broadcast) {
+    (void)mac;
+    (void)msg;
+    (void)broadcast;
+    s_received[SimWorld::current()->currentNode()]++;
+}
+
+static bool nodeJoined(SimWorld& world, int i, int servers) {
+    int n = world.nodeCount();
+    ESP_NowAdhoc& lib = world.lib(i);
+    if (i < servers) {
+        return lib.getTotalPeerCount() >= std::min(n - 1, ESPNOW_MAX_PEERS);
+    }
+    return lib.getServerPeerCount() >= std::min(servers, ESPNOW_MAX_PEERS);
+}
+
+static Report runScenario(const Options& opt, int nodes) {
+    SimWorld world(opt.seed);
+    world.channel().loss = opt.loss;
+    world.addNodes(nodes);
+    s_received.assign(nodes, 0);
+
+    Report r = {};
+    r.nodes = nodes;
+    int servers = std::min(opt.servers, nodes - 1);
+
+    // 0..100ms に散らして起動する
+    std::vector<uint64_t> bootUs(nodes);
+    std::vector<uint64_t> joinUs(nodes, 0);
+    for (int i = 0; i < nodes; i++) {
+        bootUs[i] = world.random() % 100000;
+    }
+    std::vector<int> order(nodes);
+    for (int i = 0; i < nodes; i++) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return bootUs[a] < bootUs[b]; });
+    for (int i : order) {
+        world.runUs(bootUs[i] - world.nowUs());
+        world.boot(i, [&](ESP_NowAdhoc& lib) {
+            lib.setDebug(false);
+            lib.setPeerCache(false);
+            if (opt.session) {
+                lib.setSessionKey("adhoc-sim-secret");
+            }
+            lib.setMesh(opt.mesh);
+            lib.setDataCallback(onData);
+            lib.begin(i < servers, false);
+        });
+    }
+
+    // 1. 参加
+    int joined = 0;
+    world.runUntil([&] {
+        for (int i = 0; i < nodes; i++) {
+            if (joinUs[i] == 0 && nodeJoined(world, i, servers)) {
+                joinUs[i] = world.nowUs() - bootUs[i] + 1;
+                joined++;
+            }
+        }
+        return joined == nodes;
+    }, (uint64_t)JOIN_TIMEOUT_MS * 1000);
+    r.joined = joined;
+    std::vector<double> times;
+    for (int i = 0; i < nodes; i++) {
+        if (joinUs[i]) {
+            times.push_back(joinUs[i] / 1000.0);
+        }
+    }
+    std::sort(times.begin(), times.end());
+    if (!times.empty()) {
+        r.joinP50Ms = times[times.size() / 2];
+        r.joinMaxMs = times.back();
+    }
+
+    // 2. 無通信時の制御フレーム
+    world.resetStats();
+    world.runMs(IDLE_MS);
+    r.idleAirtime = world.airtimeUse();
+    r.idleFramesPerSec = world.stats().frames * 1000.0 / IDLE_MS;
+
+    // 3. クライアントからサーバーへのトラフィック
+    world.resetStats();
+    std::fill(s_received.begin(), s_received.end(), 0);
+    uint64_t intervalUs = opt.rate > 0 ? (uint64_t)(1000000.0 / opt.rate) : 0;
+    uint64_t end = world.nowUs() + (uint64_t)opt.durationMs * 1000;
+    std::vector<uint64_t> nextUs(nodes);
+    for (int i = servers; i < nodes; i++) {
+        nextUs[i] = world.nowUs() + (intervalUs ? world.random() % intervalUs : 0);
+    }
+    uint8_t payload[16];
+    memset(payload, 0x5a, sizeof(payload));
+    while (intervalUs && world.nowUs() < end) {
+        uint64_t next = end;
+        for (int i = servers; i < nodes; i++) {
+            next = std::min(next, nextUs[i]);
+        }
+        world.runUs(next - world.nowUs());
+        for (int i = servers; i < nodes && world.nowUs() < end; i++) {
+            if (nextUs[i] != world.nowUs()) {
+                continue;
+            }
+            r.sent++;
+            if (world.at(i, [&](ESP_NowAdhoc& lib) { return lib.sendToServer(payload, sizeof(payload)); })) {
+                r.accepted++;
+            }
+            nextUs[i] += intervalUs;
+        }
+    }
+    world.runUs(end - world.nowUs());
+    world.runMs(500);  // 送信中のフレームを届ける
+
+    for (int i = 0; i < servers; i++) {
+        r.delivered += s_received[i];
+    }
+    double seconds = opt.durationMs / 1000.0 + 0.5;
+    r.deliveredPerSec = r.delivered / seconds;
+    r.airtime = world.airtimeUse();
+    r.framesPerSec = world.stats().frames / seconds;
+    r.bytesPerSec = world.stats().bytes / seconds;
+    r.rejected = world.stats().rejected;
+    r.sendFailed = world.stats().sendFailed;
+    return r;
+}
+
+static std::vector<int> parseList(const char* s) {
+    std::vector<int> v;
+    std::string str(s);
+    size_t pos = 0;
+    while (pos < str.size()) {
+        size_t comma = str.find(',', pos);
+        v.push_back(atoi(str.substr(pos, comma - pos).c_str()));
+        pos = (comma == std::string::npos) ? str.size() : comma + 1;
+    }
+    return v;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: adhoc_sim [--nodes N | --sweep N1,N2,...] [--servers S] [--loss P] [--seed S]\n"
+            "                 [--duration MS] [--rate MSG/S] [--session] [--mesh] [--format csv|json]\n");
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    static const struct option longOpts[] = {
+        {"nodes", required_argument, nullptr, 'n'},   {"sweep", required_argument, nullptr, 'w'},
+        {"servers", required_argument, nullptr, 's'}, {"loss", required_argument, nullptr, 'l'},
+        {"seed", required_argument, nullptr, 'r'},    {"duration", required_argument, nullptr, 'd'},
+        {"rate", required_argument, nullptr, 't'},    {"session", no_argument, nullptr, 'k'},
+        {"mesh", no_argument, nullptr, 'm'},          {"format", required_argument, nullptr, 'f'},
+        {"help", no_argument, nullptr, 'h'},          {nullptr, 0, nullptr, 0}};
+    int c;
+    while ((c = getopt_long(argc, argv, "", longOpts, nullptr)) != -1) {
+        switch (c) {
+        case 'n': opt.nodes = {atoi(optarg)}; break;
+        case 'w': opt.nodes = parseList(optarg); break;
+        case 's': opt.servers = atoi(optarg); break;
+        case 'l': opt.loss = atof(optarg); break;
+        case 'r': opt.seed = (uint32_t)strtoul(optarg, nullptr, 0); break;
+        case 'd': opt.durationMs = (uint32_t)strtoul(optarg, nullptr, 0); break;
+        case 't': opt.rate = atof(optarg); break;
+        case 'k': opt.session = true; break;
+        case 'm': opt.mesh = true; break;
+        case 'f': opt.json = std::string(optarg) == "json"; break;
+        default: usage(); return c == 'h' ? 0 : 2;
+        }
+    }
+    for (int n : opt.nodes) {
+        if (n < 2 || n > ESPNOW_MAX_PEERS + 1 || opt.servers < 1) {
+            fprintf(stderr, "adhoc_sim: nodes must be 2..%d and servers >= 1\n", ESPNOW_MAX_PEERS + 1);
+            return 2;
+        }
+    }
+
+    if (opt.json) {
+        printf("[\n");
+    } else {
+        printf("nodes,servers,seed,loss,joined,join_p50_ms,join_max_ms,idle_airtime,idle_frames_per_s,"
+               "sent,accepted,delivered,delivered_per_s,airtime,frames_per_s,bytes_per_s,rejected,send_failed\n");
+    }
+    for (size_t k = 0; k < opt.nodes.size(); k++) {
+        Report r = runScenario(opt, opt.nodes[k]);
+        int servers = std::min(opt.servers, r.nodes - 1);
+        if (opt.json) {
+            printf("  {\"nodes\": %d, \"servers\": %d, \"seed\": %u, \"loss\": %.3f, \"joined\": %d, "
+                   "\"join_p50_ms\": %.1f, \"join_max_ms\": %.1f, \"idle_airtime\": %.4f, "
+                   "\"idle_frames_per_s\": %.1f, \"sent\": %llu, \"accepted\": %llu, \"delivered\": %llu, "
+                   "\"delivered_per_s\": %.1f, \"airtime\": %.4f, \"frames_per_s\": %.1f, \"bytes_per_s\": %.1f, "
+                   "\"rejected\": %llu, \"send_failed\": %llu}%s\n",
+                   r.nodes, servers, opt.seed, opt.loss, r.joined, r.joinP50Ms, r.joinMaxMs, r.idleAirtime,
+                   r.idleFramesPerSec, (unsigned long long)r.sent, (unsigned long long)r.accepted,
+                   (unsigned long long)r.delivered, r.deliveredPerSec, r.airtime, r.framesPerSec, r.bytesPerSec,
+                   (unsigned long long)r.rejected, (unsigned long long)r.sendFailed,
+                   k + 1 < opt.nodes.size() ? "," : "");
+        } else {
+            printf("%d,%d,%u,%.3f,%d,%.1f,%.1f,%.4f,%.1f,%llu,%llu,%llu,%.1f,%.4f,%.1f,%.1f,%llu,%llu\n", r.nodes,
+                   servers, opt.seed, opt.loss, r.joined, r.joinP50Ms, r.joinMaxMs, r.idleAirtime, r.idleFramesPerSec,
+                   (unsigned long long)r.sent, (unsigned long long)r.accepted, (unsigned long long)r.delivered,
+                   r.deliveredPerSec, r.airtime, r.framesPerSec, r.bytesPerSec, (unsigned long long)r.rejected,
+                   (unsigned long long)r.sendFailed);
+        }
+        fflush(stdout);
+    }
+    if (opt.json) {
+        printf("]\n");
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+"""ESP_NowAdhoc のトレースダンプ（drainTrace() のレコードを並べたバイナリ）をテキストに変換する
+
+使い方:
+    python3 trace_decode.py dump.bin
+    python3 trace_decode.py < dump.bin
+
+レコード形式は src/ESP_NowAdhocTrace.h の espnow_trace_record_t（16バイト、リトルエンディアン）
+"""
+
+import struct
+import sys
+
+RECORD = struct.Struct("<IB6sBI")
+
+DROP_REASONS = {
+    0: "short",
+    1: "wrong-group",
+    2: "security",
+    3: "unknown-peer",
+    4: "decompress",
+    5: "auth",
+    6: "replay",
+}
+
+COMMANDS = {
+    1: "REGISTER",
+    4: "PROBE",
+}
+
+
+def fmt_drop(arg0, arg1):
+    return "reason=%s len=%u" % (DROP_REASONS.get(arg0, arg0), arg1)
+
+
+# イベントID -> (名前, 引数の整形)
+EVENTS = {
+    0x00: ("RX_HEARTBEAT", lambda a0, a1: "broadcast" if a0 else "unicast"),
+    0x01: ("RX_DROP", fmt_drop),
+    0x02: ("RX_OVERFLOW", lambda a0, a1: "len=%u" % a1),
+    0x10: ("TX_DONE", lambda a0, a1: "%s %u us" % ("ok" if a0 else "FAILED", a1)),
+    0x11: ("TX_HEARTBEAT", None),
+    0x12: ("TX_FAILED", lambda a0, a1: "dropped=%u" % a1),
+    0x20: ("PEER_ADDED", lambda a0, a1: "SERVER" if a0 else "CLIENT"),
+    0x21: ("PEER_TIMEOUT", lambda a0, a1: "SERVER" if a0 else "CLIENT"),
+    0x22: ("PEER_EVICTED", None),
+    0x23: ("PEER_CACHE", lambda a0, a1: "saved peers=%u" % a1),
+    0x30: ("ADV", lambda a0, a1: "%s interval=%u ms" % (COMMANDS.get(a0, a0), a1)),
+    0x31: ("BEACON", lambda a0, a1: "peers=%u" % a1),
+    0x40: ("REASSEMBLY_TIMEOUT", lambda a0, a1: "msg=%u received=%u" % (a1, a0)),
+    0x41: ("REASSEMBLY_EVICTED", lambda a0, a1: "msg=%u" % a1),
+    0x50: ("RELAY_FORWARD", lambda a0, a1: "seq=%u ttl=%u" % (a1, a0)),
+    0x51: ("RELAY_NO_ROUTE", lambda a0, a1: "seq=%u" % a1),
+}
+
+
+def decode(data, out):
+    first = None
+    for offset in range(0, len(data) - RECORD.size + 1, RECORD.size):
+        time_us, event, mac, arg0, arg1 = RECORD.unpack_from(data, offset)
+        if first is None:
+            first = time_us
+        rel = (time_us - first) & 0xFFFFFFFF
+
+        name, formatter = EVENTS.get(event, ("EVENT_%02X" % event, None))
+        if formatter:
+            args = formatter(arg0, arg1)
+        else:
+            args = "arg0=%u arg1=%u" % (arg0, arg1)
+
+        peer = ":".join("%02X" % b for b in mac) if any(mac) else "-" * 17
+        out.write("%12.3f ms  %s  %-18s %s\n" % (rel / 1000.0, peer, name, args))
+
+    if len(data) % RECORD.size:
+        out.write("(%u trailing bytes ignored)\n" % (len(data) % RECORD.size))
+
+
+def main():
+    if len(sys.argv) > 1:
+        with open(sys.argv[1], "rb") as f:
+            data = f.read()
+    else:
+        data = sys.stdin.buffer.read()
+    decode(data, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,5 +1,6 @@
 #include "ESP_NowAdhoc.h"
 #include <WiFi.h>
+#include <limits.h>
 
 // ==================== ESP_NowAdhocPeer クラス ====================
 
@@ -7,16 +8,45 @@ ESP_NowAdhocPeer::ESP_NowAdhocPeer(const uint8_t *mac_addr, uint8_t channel, wif
                                ESP_NowAdhoc* parent, const uint8_t *lmk)
     : ESP_NOW_Peer(mac_addr, channel, iface, lmk), _parent(parent) {
     lastGetMs = millis();
+    lastSentMs = 0;
+    driverUse = 0;
     isServer = false;
     isSecure = (lmk != nullptr);
+    canCompress = false;
+    topics = 0;
+    txAttempts = 0;
+    txSuccess.store(0);
+    txFailed.store(0);
+    rxFrames = 0;
+    rxBytes = 0;
+    rssi = 0;
+    noiseFloor = 0;
+    _txStartUs.store(0);
+    _linkRttUs.store(0);
+    _sentTopics = 0;
+    _topicsLost.store(false);
+    _registered = false;
+    _rxUs = 0;
+    memset(&_clock, 0, sizeof(_clock));
+    memset(&_session, 0, sizeof(_session));
+    memset(&_score, 0, sizeof(_score));
+    _score.success = 256;
+    _txFailStreak.store(0);
+    _uplinkMs = 0;
+    _cached = false;
+    resetReliable();
 }
 
 ESP_NowAdhocPeer::~ESP_NowAdhocPeer() {
+    releaseReliable();
     remove();
 }
 
 bool ESP_NowAdhocPeer::begin() {
-    return add();
+    if (!_parent || this == _parent->_broadcastPeer) {
+        return add();
+    }
+    return _parent->acquireDriverSlot(this);
 }
 
 bool ESP_NowAdhocPeer::removePeer() {
@@ -24,37 +54,147 @@ bool ESP_NowAdhocPeer::removePeer() {
 }
 
 bool ESP_NowAdhocPeer::sendData(const uint8_t *data, size_t len) {
-    return send(data, len);
+    if (!_parent) {
+        return send(data, len);
+    }
+    
+    // ドライバーから外されている場合は登録し直す
+    if (this != _parent->_broadcastPeer && !_parent->acquireDriverSlot(this)) {
+        return false;
+    }
+    
+    // グループ宛のフレームはセッション鍵で保護して送る（登録フレームは平文）
+    const espnow_message_t *msg = (const espnow_message_t *)data;
+    bool group = len >= ESPNOW_HEADER_SIZE && msg->group_token == _parent->getGroupToken();
+    if (group && _parent->_sessionMode) {
+        data = _parent->sealFrame(this, data, &len);
+        if (!data) {
+            return false;
+        }
+    }
+    
+    // onSent は send() から戻る前に呼ばれることがあるため先に送信中として数える
+    _parent->_txInflight.fetch_add(1);
+    _parent->_txLastActivityMs.store(millis());
+    _txStartUs.store((uint32_t)micros());
+    if (send(data, len)) {
+        // 送信完了（txSuccess + txFailed）と対応させるため、ドライバーが受け付けたものだけ数える
+        txAttempts++;
+        
+        // グループ宛のフレームは相手側で生存確認を兼ねる（ブロードキャストは全ピア分）
+        if (group) {
+            if (this == _parent->_broadcastPeer) {
+                _parent->_lastGroupBroadcastMs = millis();
+            } else {
+                lastSentMs = millis();
+            }
+        }
+        return true;
+    }
+    _parent->onTxComplete();
+    return false;
 }
 
 void ESP_NowAdhocPeer::onSent(bool success) {
-    if (_parent && _parent->debugEnabled()) {
-        Serial.print("[ESP_NowAdhocPeer] Send ");
-        Serial.println(success ? "Success" : "Failed");
+    // 送信からリンク層のACK（または再送の打ち切り）までの時間を平滑化（1/8）
+    uint32_t sample = (uint32_t)micros() - _txStartUs.load();
+    uint32_t rtt = _linkRttUs.load();
+    _linkRttUs.store(rtt ? rtt - (rtt >> 3) + (sample >> 3) : sample);
+    if (success) {
+        txSuccess.fetch_add(1, std::memory_order_relaxed);
+        _txFailStreak.store(0);
+    } else {
+        txFailed.fetch_add(1, std::memory_order_relaxed);
+        // サーバーへの送信が続けて失敗したら主サーバーを切り替える（判定は update() で行う）
+        uint8_t streak = _txFailStreak.load();
+        if (streak < 255) {
+            _txFailStreak.store(streak + 1);
+        }
+        if (streak + 1 == ESPNOW_FAILOVER_FAILURES && isServer && _parent) {
+            _parent->_failoverKick.store(true);
+        }
+        // 購読の通知が届いていないかもしれないため、次のハートビートで通知し直す
+        _topicsLost.store(true);
+    }
+    
+    // WiFiタスクから呼ばれるため Serial には出力せずトレースに記録する
+    if (_parent) {
+        _parent->trace(ESPNOW_TRACE_EV_TX_DONE, addr(), success, sample);
+    }
+    
+    // リンク層の送信失敗は信頼性モードの早期ロス検出に使う
+    if (!success) {
+        _reliable.linkLoss.store(true);
+        if (_parent) {
+            _parent->_reliableKick.store(true);
+        }
+    }
+    
+    // 送信スケジューラーのペーシング
+    if (_parent) {
+        _parent->onTxComplete();
     }
 }
 
 void ESP_NowAdhocPeer::onReceive(const uint8_t *data, size_t len, bool broadcast) {
-    processReceivedMessage(data, len, broadcast);
+    // WiFiタスクではキューへのコピーのみ行い、処理は update() で行う
+    if (_parent) {
+        _parent->enqueueReceived(addr(), data, len, broadcast, false);
+    }
 }
 
-void ESP_NowAdhocPeer::processReceivedMessage(const uint8_t *data, size_t len, bool broadcast) {
-    if (!_parent || len < sizeof(espnow_message_t)) {
+void ESP_NowAdhocPeer::processReceivedMessage(const uint8_t *data, size_t len, bool broadcast, bool inner) {
+    if (!_parent) {
+        return;
+    }
+    
+    const espnow_message_t *msg = ESP_NowAdhoc::parseMessage(data, len);
+    if (!msg) {
+        _parent->_dropShort.fetch_add(1, std::memory_order_relaxed);
+        _parent->trace(ESPNOW_TRACE_EV_RX_DROP, addr(), ESPNOW_TRACE_DROP_SHORT, len);
         return;
     }
     
-    espnow_message_t *msg = (espnow_message_t *)data;
+    // 登録済みのピアが再起動して送ってきた参加要求には登録フレームで応答する
+    // セッションモードでは広告も処理し、再起動したピアの乱数の変化を鍵に反映する
+    // NVSから復元したピアの登録フレームは復元の確認として処理する
+    if (msg->cmd == CMD_PROBE ||
+        (msg->cmd == CMD_REGISTER && (_parent->_sessionMode || _cached) && msg->group_token == _parent->_advGroupToken)) {
+        _parent->processRegistration(addr(), data, len);
+        return;
+    }
     
-    // グループIDチェック
-    if (strcmp(msg->group_id, _parent->getGroupID()) != 0) {
+    // グループチェック（トークン比較のみ。登録済みのピアの広告も届くため破棄として数えない）
+    if (msg->group_token != _parent->getGroupToken()) {
+        if (msg->group_token != _parent->_advGroupToken) {
+            _parent->_dropWrongGroup.fetch_add(1, std::memory_order_relaxed);
+            _parent->trace(ESPNOW_TRACE_EV_RX_DROP, addr(), ESPNOW_TRACE_DROP_WRONG_GROUP, len);
+        }
         return;
     }
     
     // セキュリティモードチェック
     if (msg->security != isSecure) {
+        _parent->_dropSecurity.fetch_add(1, std::memory_order_relaxed);
+        _parent->trace(ESPNOW_TRACE_EV_RX_DROP, addr(), ESPNOW_TRACE_DROP_SECURITY, len);
         return;
     }
     
+    // セッションモードでは認証できたフレームのみ処理する（結合フレームの中身は外側で検証済み）
+    if (!inner) {
+        if (((msg->flags & ESPNOW_FLAG_SESSION) != 0) != _parent->_sessionMode) {
+            _parent->_dropSecurity.fetch_add(1, std::memory_order_relaxed);
+            _parent->trace(ESPNOW_TRACE_EV_RX_DROP, addr(), ESPNOW_TRACE_DROP_SECURITY, len);
+            return;
+        }
+        if (_parent->_sessionMode) {
+            msg = _parent->openFrame(this, msg, broadcast);
+            if (!msg) {
+                return;
+            }
+        }
+    }
+    
     // サーバーロールチェック（クライアントはサーバーからのみ受信）
    // if (!_parent->isServerMode() && !msg->role) {
    //     return;
@@ -62,32 +202,111 @@ void ESP_NowAdhocPeer::processReceivedMessage(const uint8_t *data, size_t len, b
 
     
     lastGetMs = millis();
+    // 自分宛のグループのフレームを送ってくるサーバーは自分を登録済み
+    if (!broadcast && isServer) {
+        _parent->confirmRegistered(this);
+    }
+    // サーバーが通知する負荷（このサーバーへ送信しているクライアント）
+    if (!broadcast && msg->cmd >= CMD_DATA && msg->cmd != CMD_ACK) {
+        _uplinkMs = lastGetMs;
+    }
+    
+    // 宛先ロール付きのブロードキャストは自分のロール宛のみ受け取る
+    uint8_t roleMask = msg->flags & (ESPNOW_FLAG_TO_SERVER | ESPNOW_FLAG_TO_CLIENT);
+    if (roleMask && !(roleMask & (_parent->isServerMode() ? ESPNOW_FLAG_TO_SERVER : ESPNOW_FLAG_TO_CLIENT))) {
+        return;
+    }
+    
+    // 圧縮されたデータは展開してから渡す
+    if ((msg->flags & ESPNOW_FLAG_COMPRESSED) && (msg->cmd == CMD_DATA || msg->cmd >= CMD_TYPED_BASE)) {
+        msg = _parent->decompressMessage(_parent->_peers.find(addr()), msg);
+        if (!msg) {
+            return;
+        }
+    }
+    
+    // 型付きメッセージはIDで引くテーブルから直接ハンドラーへ
+    if (msg->cmd >= CMD_TYPED_BASE) {
+        _parent->deliverMessage(addr(), msg, broadcast);
+        return;
+    }
     
     switch (msg->cmd) {
         case CMD_HEARTBEAT:
-            if (_parent && _parent->debugEnabled()) {
-                const uint8_t *mac = addr();
-                Serial.printf("[GET] [%s] (%02X:%02X:%02X:%02X:%02X:%02X) CMD_HEARTBEAT\n",
-                    broadcast ? "Broadcast" : "Unicast",
-                    mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-            }
+            _parent->trace(ESPNOW_TRACE_EV_RX_HEARTBEAT, addr(), broadcast);
+            _parent->processClock(this, msg);
+            _parent->processServerLoad(this, msg, msg->len >= sizeof(espnow_clock_t) ? sizeof(espnow_clock_t) : 0);
+            break;
+            
+        case CMD_BEACON:
+            _parent->processBeacon(this, msg);
             break;
             
         case CMD_DATA:
-            if (_parent && _parent->getDataCallback()) {
-                _parent->getDataCallback()(addr(), msg, broadcast);
-            }
+            _parent->deliverMessage(addr(), msg, broadcast);
+            break;
+            
+        case CMD_FRAGMENT:
+            _parent->processFragment(addr(), msg);
+            break;
+            
+        case CMD_RELIABLE:
+            processReliable(msg);
+            break;
+            
+        case CMD_ACK:
+            processAck(msg);
+            break;
+            
+        case CMD_BATCH:
+            processBatch(msg, broadcast);
+            break;
+            
+        case CMD_ROUTE:
+            _parent->processRoute(_parent->_peers.find(addr()), msg);
+            break;
+            
+        case CMD_RELAY:
+            _parent->processRelay(_parent->_peers.find(addr()), msg);
+            break;
+            
+        case CMD_SUBSCRIBE:
+            _parent->processSubscribe(_parent->_peers.find(addr()), msg);
+            break;
+            
+        case CMD_PUBLISH:
+            _parent->processPublish(_parent->_peers.find(addr()), msg, broadcast);
             break;
             
         default:
             // その他のコマンド
-            if (_parent && _parent->getDataCallback()) {
-                _parent->getDataCallback()(addr(), msg, broadcast);
-            }
+            _parent->deliverMessage(addr(), msg, broadcast);
             break;
     }
 }
 
+void ESP_NowAdhocPeer::processBatch(const espnow_message_t *msg, bool broadcast) {
+    // [長さ(2バイト)][フレーム] の並びを分解して個別に処理（入れ子の結合フレームは無視）
+    const uint8_t *p = (const uint8_t *)msg->data;
+    size_t remaining = msg->len;
+    while (remaining >= 2) {
+        uint16_t len;
+        memcpy(&len, p, 2);
+        p += 2;
+        remaining -= 2;
+        if (len > remaining) {
+            break;
+        }
+        
+        const espnow_message_t *inner = ESP_NowAdhoc::parseMessage(p, len);
+        if (inner && inner->cmd != CMD_BATCH) {
+            processReceivedMessage(p, len, broadcast, true);
+        }
+        p += len;
+        remaining -= len;
+    }
+}
+
 // ==================== ESP_NowAdhoc クラス ====================
 
 ESP_NowAdhoc::ESP_NowAdhoc() {
@@ -96,42 +315,216 @@ ESP_NowAdhoc::ESP_NowAdhoc() {
     _debugEnabled = true;
     _wifiChannel = ESPNOW_WIFI_CHANNEL;
     
-    strncpy(_advGroupID, ADV_GROUP_ID, sizeof(_advGroupID));
-    strncpy(_groupID, GROUP_ID, sizeof(_groupID));
+    _advGroupToken = 0;
+    _groupToken = 0;
+    setGroupID(ADV_GROUP_ID, GROUP_ID);
     
     _pmk = nullptr;
     _lmk = nullptr;
     
-    _lastBroadcastTime = 0;
-    _lastHeartbeatTime = 0;
-    _lastStatusDisplayTime = 0;
+    memset(_timerDue, 0, sizeof(_timerDue));
+    _timerArmed = 0;
+    _reliableKick.store(false);
     
     _broadcastInterval = BROADCAST_INTERVAL;
+    _broadcastIntervalMax = BROADCAST_INTERVAL_MAX;
+    _advInterval = _broadcastInterval;
+    _advIntervalStart = 0;
+    _advFireOffset = 0;
+    _advFired = false;
+    _advCount = 0;
+    _probeNext = false;
     _heartbeatInterval = HEARTBEAT_INTERVAL;
     _heartbeatTimeout = HEARTBEAT_TIMEOUT;
     _statusDisplayInterval = STATUS_DISPLAY_INTERVAL;
+    _fanoutThreshold = ESPNOW_FANOUT_THRESHOLD;
+    _heartbeatBeacon = ESPNOW_HEARTBEAT_BEACON;
+    _lastGroupBroadcastMs = 0;
+    _beaconCursor = 0;
+    _heartbeatCursor = 0;
+    memset(_selfMac, 0, sizeof(_selfMac));
     
     _broadcastPeer = nullptr;
+    _serverPeerCount = 0;
+    _driverClock = 0;
+    memset(&_driverStats, 0, sizeof(_driverStats));
+    _rxOverflows.store(0);
+    _dropShort.store(0);
+    _dropWrongGroup.store(0);
+    _dropSecurity.store(0);
+    _dropUnknownPeer.store(0);
+    _traceMask.store(0);
     _dataCallback = nullptr;
+    memset(_typedHandlers, 0, sizeof(_typedHandlers));
     _peerEventCallback = nullptr;
+    _largeDataCallback = nullptr;
+    _topicCallback = nullptr;
+    _reliableFailCallback = nullptr;
+    
+    for (size_t i = 0; i < ESPNOW_TX_QUEUE_SIZE; i++) {
+        _txEntryFree[i] = i;
+    }
+    _txEntryFreeCount = ESPNOW_TX_QUEUE_SIZE;
+    memset(_txHead, ESPNOW_TX_NONE, sizeof(_txHead));
+    memset(_txTail, ESPNOW_TX_NONE, sizeof(_txTail));
+    memset(_txDepth, 0, sizeof(_txDepth));
+    memset(_txCursor, 0, sizeof(_txCursor));
+    for (size_t i = 0; i < ESPNOW_TX_BUFFERS; i++) {
+        _txBufFree[i] = i;
+        _txRefs[i] = 0;
+        _txLen[i] = 0;
+    }
+    _txBufFreeCount = ESPNOW_TX_BUFFERS;
+    memset(&_txStats, 0, sizeof(_txStats));
+    _txInflight.store(0);
+    _txHeld = false;
+    _txLastActivityMs.store(0);
+    
+    _nextLargeMsgId = 0;
+    _largeTx.active = false;
+    memset(_reassembly, 0, sizeof(_reassembly));
+    
+    for (size_t i = 0; i < ESPNOW_RELIABLE_TX_BUFFERS; i++) {
+        _reliableTxFree[i] = i;
+    }
+    _reliableTxFreeCount = ESPNOW_RELIABLE_TX_BUFFERS;
+    for (size_t i = 0; i < ESPNOW_RELIABLE_RX_BUFFERS; i++) {
+        _reliableRxFree[i] = i;
+    }
+    _reliableRxFreeCount = ESPNOW_RELIABLE_RX_BUFFERS;
+    
+    _mesh = ESPNOW_MESH;
+    _routeCount = 0;
+    memset(_relaySeen, 0, sizeof(_relaySeen));
+    _relaySeenNext = 0;
+    _relaySeq = 0;
+    memset(&_meshStats, 0, sizeof(_meshStats));
+    
+    _clockSync = ESPNOW_CLOCK_SYNC;
+    _clockSource = ESPNOW_INVALID_PEER;
+    _clockOffset = 0;
+    _clockDrift = 0;
+    _clockRefUs = 0;
+    _clockSamples = 0;
+    _clockPoll = 0;
+    _clockQuietUntil = 0;
+    memset(_clockHistory, 0, sizeof(_clockHistory));
+    _clockNext = 0;
+    
+    _topics = 0;
+    memset(_topicPeers, 0, sizeof(_topicPeers));
+    memset(_topicSeen, 0, sizeof(_topicSeen));
+    _topicSeenNext = 0;
+    _topicSeq = 0;
+    memset(&_topicStats, 0, sizeof(_topicStats));
+    
+    _compress = ESPNOW_COMPRESS;
+    for (size_t i = 0; i < ESPNOW_COMPRESS_CONTEXTS; i++) {
+        _txCompress[i].handle = ESPNOW_INVALID_PEER;
+        _rxCompress[i].handle = ESPNOW_INVALID_PEER;
+    }
+    _compressClock = 0;
+    memset(&_compressStats, 0, sizeof(_compressStats));
+    
+    _sessionMode = false;
+    memset(_sessionSecret, 0, sizeof(_sessionSecret));
+    memset(_sessionNonce, 0, sizeof(_sessionNonce));
+    memset(_sessionBcastKey, 0, sizeof(_sessionBcastKey));
+    _sessionTxSeq = 0;
+    _sessionEpoch = 0;
+    mbedtls_gcm_init(&_gcm);
+    memset(&_sessionStats, 0, sizeof(_sessionStats));
+    
+    _serverSelect = ESPNOW_SERVER_SELECT;
+    _primaryServer = ESPNOW_INVALID_PEER;
+    _failoverKick.store(false);
+    memset(&_serverSelectStats, 0, sizeof(_serverSelectStats));
+    
+    _peerCache = ESPNOW_PEER_CACHE;
+    memset(&_peerCacheStats, 0, sizeof(_peerCacheStats));
+    _peerCacheSavedMs = 0;
+    
+    _task = nullptr;
+    _lock = nullptr;
+    _appOverflows.store(0);
     
     memset(_pmkString, 0, sizeof(_pmkString));
     memset(_lmkString, 0, sizeof(_lmkString));
 }
 
 ESP_NowAdhoc::~ESP_NowAdhoc() {
+    endTask();
+    if (_lock) {
+        vSemaphoreDelete(_lock);
+    }
+    
     if (_broadcastPeer) {
         delete _broadcastPeer;
     }
     
-    for (auto peer : _peers) {
-        if (peer) {
-            delete peer;
-        }
-    }
     _peers.clear();
     
     ESP_NOW.end();
+    mbedtls_gcm_free(&_gcm);
+    memset(_sessionSecret, 0, sizeof(_sessionSecret));
+}
+
+const espnow_message_t* ESP_NowAdhoc::parseMessage(const uint8_t *data, size_t len) {
+    if (!data || len < ESPNOW_HEADER_SIZE) {
+        return nullptr;
+    }
+    
+    const espnow_message_t *msg = (const espnow_message_t *)data;
+    
+    // バージョンとペイロード長チェック
+    if (msg->version != ESPNOW_PROTOCOL_VERSION) {
+        return nullptr;
+    }
+    if (msg->len > ESPNOW_DATA_SIZE || ESPNOW_HEADER_SIZE + msg->len > len) {
+        return nullptr;
+    }
+    
+    return msg;
+}
+
+uint32_t ESP_NowAdhoc::groupToken(const char* groupID) {
+    uint32_t hash = 2166136261UL;
+    
+    const char* key = GROUP_TOKEN_KEY;
+    while (*key) {
+        hash = (hash ^ (uint8_t)*key++) * 16777619UL;
+    }
+    hash = (hash ^ 0xFF) * 16777619UL;  // キーとUUIDの区切り
+    for (size_t i = 0; i < 36 && groupID[i]; i++) {
+        hash = (hash ^ (uint8_t)groupID[i]) * 16777619UL;
+    }
+    
+    return hash ? hash : 1;
+}
+
+size_t ESP_NowAdhoc::buildMessage(espnow_message_t *msg, uint8_t cmd, uint32_t groupToken,
+                                  const uint8_t *data, size_t len) const {
+    if (len > ESPNOW_DATA_SIZE || ESPNOW_HEADER_SIZE + len > getESPNOWMaxPayload()) {
+        if (_debugEnabled) {
+            Serial.printf("[ESP_NowAdhoc] Payload too large: %u bytes\n", (unsigned)len);
+        }
+        return 0;
+    }
+    
+    // ヘッダーのみ初期化（data は使用分だけコピー）
+    memset(msg, 0, ESPNOW_HEADER_SIZE);
+    msg->version = ESPNOW_PROTOCOL_VERSION;
+    msg->group_token = groupToken;
+    msg->role = _isServer;
+    msg->channel = _wifiChannel;
+    msg->security = _useSecurity;
+    msg->cmd = cmd;
+    msg->len = len;
+    if (len > 0) {
+        memcpy(msg->data, data, len);
+    }
+    
+    return ESPNOW_HEADER_SIZE + len;
 }
 
 bool ESP_NowAdhoc::begin(bool isServerRole, bool useSecurity, const char* pmk, const char* lmk) {
@@ -151,6 +544,12 @@ bool ESP_NowAdhoc::begin(bool isServerRole, bool useSecurity, const char* pmk, c
     }
     
     setupWiFi();
+    // 再起動前の番号が中継側・宛先・購読者の重複検出に残っていても捨てられないよう、乱数から始める
+    _relaySeq = (uint16_t)esp_random();
+    _topicSeq = (uint16_t)esp_random();
+    if (_sessionMode) {
+        beginSession();
+    }
     
     if (!setupESPNow()) {
         return false;
@@ -166,13 +565,22 @@ bool ESP_NowAdhoc::begin(bool isServerRole, bool useSecurity, const char* pmk, c
     // 登録コールバックの設定
     ESP_NOW.onNewPeer(registrationCallback, this);
     
+    // 前回の起動で保存したピアを登録し直し、最初の update() で参加要求を送る
+    restorePeerCache();
+    resetAdvertisement(true);
+    armTimer(TIMER_HEARTBEAT, millis() + _heartbeatInterval);
+    if (_debugEnabled) {
+        armTimer(TIMER_STATUS, millis() + _statusDisplayInterval);
+    }
+    
     if (_debugEnabled) {
         Serial.println("[ESP_NowAdhoc] Initialization complete");
         Serial.printf("  Role: %s\n", _isServer ? "SERVER" : "CLIENT");
         Serial.printf("  Security: %s\n", _useSecurity ? "ENABLED" : "DISABLED");
+        Serial.printf("  Session: %s\n", _sessionMode ? "ENABLED" : "DISABLED");
         Serial.printf("  Channel: %d\n", _wifiChannel);
-        Serial.printf("  Adv Group: %s\n", _advGroupID);
-        Serial.printf("  Group: %s\n", _groupID);
+        Serial.printf("  Adv Group: %s (%08lX)\n", _advGroupID, (unsigned long)_advGroupToken);
+        Serial.printf("  Group: %s (%08lX)\n", _groupID, (unsigned long)_groupToken);
         Serial.printf("  Heartbeat Interval: %lu ms\n", _heartbeatInterval);
         Serial.printf("  Heartbeat Timeout: %lu ms\n", _heartbeatTimeout);
     }
@@ -185,9 +593,11 @@ void ESP_NowAdhoc::setupWiFi() {
     WiFi.setChannel(_wifiChannel);
     WiFi.setTxPower(WIFI_POWER_17dBm);
     
+    // 起動の完了を短い間隔で確認する（begin() から送信できるまでの時間に直接効く）
     while (!WiFi.STA.started()) {
-        delay(100);
+        delay(1);
     }
+    WiFi.macAddress(_selfMac);
     
     if (_debugEnabled) {
         Serial.println("[ESP_NowAdhoc] WiFi initialized");
@@ -220,28 +630,164 @@ bool ESP_NowAdhoc::setupESPNow() {
 }
 
 void ESP_NowAdhoc::update() {
+    // beginTask() 時はエンジンタスクから届いたメッセージとイベントのみ処理
+    // （endTask() 後に残ったものもここで処理する）
+    processAppQueue();
+    if (_task) {
+        return;
+    }
+    runEngine();
+}
+
+void ESP_NowAdhoc::runEngine() {
+    // 受信キューの処理（コールバックは update() を呼んだタスクから呼ばれる）
+    processReceiveQueue();
+    
+    // 以降は期限の来た処理のみ行う（何もなければピア数に依らず定数時間）
     unsigned long currentTime = millis();
     
-    // ブロードキャスト広告の送信
-    if (currentTime - _lastBroadcastTime >= _broadcastInterval) {
-        sendBroadcastAdvertisement();
-        _lastBroadcastTime = currentTime;
+    // ブロードキャスト広告の送信（間隔内のランダムな時点で1回）
+    if (timerDue(TIMER_ADVERTISE, currentTime)) {
+        if (!_advFired) {
+            sendBroadcastAdvertisement();
+            _advFired = true;
+            armTimer(TIMER_ADVERTISE, _advIntervalStart + _advInterval);
+        } else {
+            _advInterval = (_advInterval * 2 < _broadcastIntervalMax) ? _advInterval * 2 : _broadcastIntervalMax;
+            startAdvertisementInterval(currentTime);
+        }
     }
     
     // ハートビートの送信
-    if (currentTime - _lastHeartbeatTime >= _heartbeatInterval) {
+    if (timerDue(TIMER_HEARTBEAT, currentTime)) {
+        // メッシュモードのサーバーは経路広告を先に送る（ブロードキャストのためハートビートを兼ねる）
+        if (_mesh && _isServer) {
+            expireRoutes(currentTime);
+            sendRoutes();
+        }
+        updateServerScores();
+        scheduleClockRequest();
+        sendSubscriptions();
         sendHeartbeats();
-        _lastHeartbeatTime = currentTime;
+        armTimer(TIMER_HEARTBEAT, currentTime + _heartbeatInterval);
+    }
+    
+    // 時刻の同期要求
+    if (timerDue(TIMER_CLOCK, currentTime)) {
+        disarmTimer(TIMER_CLOCK);
+        sendClockRequest();
     }
     
     // ピアタイムアウトチェック
-    checkPeerTimeouts();
+    if (timerDue(TIMER_PEER_TIMEOUT, currentTime)) {
+        checkPeerTimeouts(currentTime);
+    }
+    
+    // 未完成の分割メッセージを破棄
+    if (timerDue(TIMER_REASSEMBLY, currentTime)) {
+        checkReassemblyTimeouts(currentTime);
+    }
+    
+    // 主サーバーへの送信が続けて失敗していれば切り替える
+    if (_failoverKick.exchange(false)) {
+        checkFailover();
+    }
+    
+    // 信頼性モードのACK処理と再送
+    if (_reliableKick.load() || timerDue(TIMER_RELIABLE, currentTime)) {
+        serviceReliable(currentTime);
+    }
+    
+    // 送信キューの処理（送信中フレーム数に空きがある分だけ送る）
+    if (getTxQueueDepth() > 0 || _largeTx.active) {
+        serviceTx();
+    }
+    
+    // ピア構成の変化をまとめてNVSへ保存
+    if (timerDue(TIMER_PEER_CACHE, currentTime)) {
+        savePeerCache();
+    }
     
     // ステータス表示
-    if (_debugEnabled && currentTime - _lastStatusDisplayTime >= _statusDisplayInterval) {
-        displayStatus();
-        _lastStatusDisplayTime = currentTime;
+    if (timerDue(TIMER_STATUS, currentTime)) {
+        if (_debugEnabled) {
+            displayStatus();
+            armTimer(TIMER_STATUS, currentTime + _statusDisplayInterval);
+        } else {
+            disarmTimer(TIMER_STATUS);
+        }
+    }
+}
+
+unsigned long ESP_NowAdhoc::nextDeadlineMs() const {
+    if (_task) {
+        return _appQueue.size() > 0 ? 0 : ULONG_MAX;
     }
+    return engineDeadlineMs();
+}
+
+unsigned long ESP_NowAdhoc::engineDeadlineMs() const {
+    if (_rxQueue.size() > 0 || _reliableKick.load() || _failoverKick.load()) {
+        return 0;
+    }
+    
+    unsigned long now = millis();
+    unsigned long wait = ULONG_MAX;
+    
+    // 送信待ちがある場合は送信完了（onSent）または取りこぼし検出まで
+    if (getTxQueueDepth() > 0 || _largeTx.active) {
+        if (_txInflight.load() < ESPNOW_TX_MAX_INFLIGHT && !_txHeld) {
+            return 0;
+        }
+        if (_txInflight.load() > 0) {
+            long d = (int32_t)(_txLastActivityMs.load() + ESPNOW_TX_INFLIGHT_TIMEOUT + 1 - (uint32_t)now);
+            if (d <= 0) {
+                return 0;
+            }
+            wait = d;
+        }
+        // 同期の応答待ちで止めている場合はその期限まで
+        if (_txHeld && _clockQuietUntil != 0) {
+            long d = (long)((_clockQuietUntil - esp_timer_get_time()) / 1000) + 1;
+            if (d <= 0) {
+                return 0;
+            }
+            if ((unsigned long)d < wait) {
+                wait = d;
+            }
+        }
+    }
+    
+    // 差分で比較するため millis() の桁あふれをまたいでも正しく動作する
+    for (uint8_t i = 0; i < TIMER_COUNT; i++) {
+        if (!(_timerArmed & (1 << i))) {
+            continue;
+        }
+        long d = (long)(_timerDue[i] - now);
+        if (d <= 0) {
+            return 0;
+        }
+        if ((unsigned long)d < wait) {
+            wait = d;
+        }
+    }
+    return wait;
+}
+
+void ESP_NowAdhoc::armTimer(uint8_t timer, unsigned long due) {
+    _timerDue[timer] = due;
+    _timerArmed |= (1 << timer);
+}
+
+// 既存の期限より早い場合のみ更新
+void ESP_NowAdhoc::armTimerBefore(uint8_t timer, unsigned long due) {
+    if (!(_timerArmed & (1 << timer)) || (long)(due - _timerDue[timer]) < 0) {
+        armTimer(timer, due);
+    }
+}
+
+bool ESP_NowAdhoc::timerDue(uint8_t timer, unsigned long now) const {
+    return (_timerArmed & (1 << timer)) && (long)(now - _timerDue[timer]) >= 0;
 }
 
 void ESP_NowAdhoc::sendBroadcastAdvertisement() {
@@ -249,76 +795,244 @@ void ESP_NowAdhoc::sendBroadcastAdvertisement() {
         return;
     }
     
-    espnow_message_t msg;
-    memset(&msg, 0, sizeof(msg));
-    
-    strncpy(msg.group_id, _advGroupID, sizeof(msg.group_id));
-    msg.role = _isServer;
-    msg.channel = _wifiChannel;
-    msg.security = _useSecurity;
-    msg.cmd = CMD_REGISTER;
+    // 前回の広告がまだ送信待ちなら重ねない
+    if (_txHead[TX_BROADCAST_QUEUE][ESPNOW_TX_PRIO_CONTROL] != ESPNOW_TX_NONE) {
+        return;
+    }
     
-    String dataStr = String("Register request from ") + 
-                    (_isServer ? "SERVER" : "CLIENT") + 
-                    " MAC: " + WiFi.macAddress();
-    strncpy(msg.data, dataStr.c_str(), sizeof(msg.data));
+    // 登録フレームのみ完全な広告グループUUIDを載せる（トークン衝突時の確認用）
+    // ピアがいない間と起動後の最初の広告は参加要求として送り、受信側に即時応答させる
+    // （NVSから復元したピア以外も通常どおりすぐに見つかる）
+    uint8_t cmd = (_peers.size() == 0 || _advCount == 0 || _probeNext) ? CMD_PROBE : CMD_REGISTER;
+    uint8_t buf = prepareTxBuffer(cmd, _advGroupToken,
+                                  (const uint8_t*)_advGroupID, strlen(_advGroupID));
+    if (buf == ESPNOW_NO_BUFFER) {
+        return;
+    }
+    if (_compress) {
+        _txBuf[buf].flags |= ESPNOW_FLAG_COMPRESSED;
+    }
+    if (_sessionMode) {
+        appendSessionHello(buf);
+    }
     
-    if (_broadcastPeer->sendData((uint8_t*)&msg, sizeof(msg))) {
-        if (_debugEnabled) {
-            Serial.println("[ESP_NowAdhoc] Broadcast advertisement sent");
-        }
+    if (enqueueTx(TX_BROADCAST_QUEUE, ESPNOW_TX_PRIO_CONTROL, buf)) {
+        _advCount++;
+        _probeNext = false;
+        trace(ESPNOW_TRACE_EV_ADV, nullptr, cmd, _advInterval);
     }
+    releaseTxBuffer(buf);
+}
+
+void ESP_NowAdhoc::startAdvertisementInterval(unsigned long now) {
+    // Trickle: 間隔の後半のランダムな時点で送信（同時に起動したノードの衝突を避ける）
+    _advIntervalStart = now;
+    _advFireOffset = _advInterval / 2 + (_advInterval > 1 ? esp_random() % (_advInterval / 2) : 0);
+    _advFired = false;
+    armTimer(TIMER_ADVERTISE, now + _advFireOffset);
+}
+
+// ピア構成の変化時に広告間隔を最短に戻す（immediate の場合はすぐに送信）
+void ESP_NowAdhoc::resetAdvertisement(bool immediate) {
+    unsigned long now = millis();
+    if (_advInterval != _broadcastInterval || immediate) {
+        _advInterval = _broadcastInterval;
+        startAdvertisementInterval(now);
+    }
+    if (immediate) {
+        _advFireOffset = 0;
+        armTimer(TIMER_ADVERTISE, now);
+    }
+}
+
+// cmd: CMD_PROBE の場合は相手にも登録フレームで応答させる
+void ESP_NowAdhoc::sendRegistration(espnow_peer_handle_t handle, uint8_t cmd) {
+    uint8_t buf = prepareTxBuffer(cmd, _advGroupToken,
+                                  (const uint8_t*)_advGroupID, strlen(_advGroupID));
+    if (buf == ESPNOW_NO_BUFFER) {
+        return;
+    }
+    if (_compress) {
+        _txBuf[buf].flags |= ESPNOW_FLAG_COMPRESSED;
+    }
+    if (_sessionMode) {
+        appendSessionHello(buf);
+    }
+    enqueueTx(_peers.slot(handle), ESPNOW_TX_PRIO_CONTROL, buf);
+    releaseTxBuffer(buf);
+    serviceTx();
 }
 
 void ESP_NowAdhoc::sendHeartbeats() {
+    if (_peers.size() == 0) {
+        return;
+    }
+    
+    // 直近の半間隔内にグループ宛のフレームを送ったピアには送らない
+    // （受信側はどのフレームでも lastGetMs を更新する。間隔いっぱいまで抑制すると、直前に送った
+    // フレームから次のハートビートまでが間隔の2倍近くになり、タイムアウトまでの余裕が半分になる）
+    unsigned long now = millis();
+    unsigned long fresh = _heartbeatInterval / 2;
+    bool broadcastFresh = now - _lastGroupBroadcastMs < fresh;
+    size_t pending = 0;
     for (size_t i = 0; i < _peers.size(); i++) {
-        if (_peers[i]) {
-            espnow_message_t msg;
-            memset(&msg, 0, sizeof(msg));
-            
-            strncpy(msg.group_id, _groupID, sizeof(msg.group_id));
-            msg.role = _isServer;
-            msg.channel = _wifiChannel;
-            msg.security = _useSecurity;
-            msg.cmd = CMD_HEARTBEAT;
-            
-            String dataStr = String("Heartbeat from ") + 
-                            (_isServer ? "SERVER" : "CLIENT") + 
-                            " to " + 
-                            (_peers[i]->isServer ? "SERVER" : "CLIENT");
-            strncpy(msg.data, dataStr.c_str(), sizeof(msg.data));
-            
-            _peers[i]->sendData((uint8_t*)&msg, sizeof(msg));
-            
-            if (_debugEnabled) {
-                const uint8_t* mac = _peers[i]->addr();
-                Serial.printf("[ESP_NowAdhoc] Heartbeat sent to %02X:%02X:%02X:%02X:%02X:%02X\n",
-                    mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-            }
+        if (!broadcastFresh && now - _peers.at(i)->lastSentMs >= fresh) {
+            pending++;
         }
     }
+    if (pending == 0) {
+        return;
+    }
+    
+    // サーバーは全ピア分をビーコン1フレームで済ませる
+    if (_isServer && _heartbeatBeacon && !_useSecurity && _broadcastPeer) {
+        sendBeacon();
+        return;
+    }
+    
+    // ハートビートはヘッダーと時刻のみ（全ピアで1つのバッファを共有し、時刻は送信時に記入）
+    espnow_clock_t clock = {};
+    uint8_t buf = prepareTxBuffer(CMD_HEARTBEAT, _groupToken, (const uint8_t *)&clock,
+                                  _clockSync ? sizeof(clock) : 0);
+    if (buf == ESPNOW_NO_BUFFER) {
+        return;
+    }
+    appendServerLoad(buf);
+    
+    // キューが足りない場合は入らなかったピアから次の回を始める（同じピアが毎回漏れないようにする）
+    size_t peers = _peers.size();
+    size_t start = _heartbeatCursor < peers ? _heartbeatCursor : 0;
+    for (size_t k = 0; k < peers; k++) {
+        size_t i = (start + k) % peers;
+        espnow_peer_handle_t handle = _peers.handleAt(i);
+        if (now - _peers.at(i)->lastSentMs < fresh) {
+            continue;
+        }
+        // 前回のハートビートが送信待ちのピアには重ねない
+        if (_txHead[_peers.slot(handle)][ESPNOW_TX_PRIO_HEARTBEAT] != ESPNOW_TX_NONE) {
+            continue;
+        }
+        if (!enqueueTx(_peers.slot(handle), ESPNOW_TX_PRIO_HEARTBEAT, buf)) {
+            _heartbeatCursor = i;
+            break;
+        }
+        
+        trace(ESPNOW_TRACE_EV_TX_HEARTBEAT, _peers.at(i)->addr());
+    }
+    releaseTxBuffer(buf);
+}
+
+void ESP_NowAdhoc::sendBeacon() {
+    if (_txHead[TX_BROADCAST_QUEUE][ESPNOW_TX_PRIO_HEARTBEAT] != ESPNOW_TX_NONE) {
+        return;
+    }
+    
+    // data: ピア数(1バイト) + 認識しているピアのMAC（フレームに収まる分） + espnow_server_load_t
+    // 収まらない場合は ESPNOW_FLAG_PARTIAL を付け、次のビーコンは続きのピアから載せる
+    uint8_t buf = prepareTxBuffer(CMD_BEACON, _groupToken, nullptr, 0);
+    if (buf == ESPNOW_NO_BUFFER) {
+        return;
+    }
+    
+    espnow_message_t *msg = &_txBuf[buf];
+    size_t maxLen = getESPNOWMaxPayload() - ESPNOW_HEADER_SIZE;
+    if (maxLen > ESPNOW_DATA_SIZE) {
+        maxLen = ESPNOW_DATA_SIZE;
+    }
+    size_t peers = _peers.size();
+    size_t start = _beaconCursor < peers ? _beaconCursor : 0;
+    uint8_t count = 0;
+    while (count < peers && 1 + (size_t)(count + 1) * 6 + sizeof(espnow_server_load_t) <= maxLen) {
+        memcpy(msg->data + 1 + count * 6, _peers.at((start + count) % peers)->addr(), 6);
+        count++;
+    }
+    if (count < peers) {
+        msg->flags |= ESPNOW_FLAG_PARTIAL;
+        _beaconCursor = (start + count) % peers;
+    }
+    msg->data[0] = count;
+    msg->len = 1 + count * 6;
+    _txLen[buf] = ESPNOW_HEADER_SIZE + msg->len;
+    appendServerLoad(buf);
+    
+    if (enqueueTx(TX_BROADCAST_QUEUE, ESPNOW_TX_PRIO_HEARTBEAT, buf)) {
+        trace(ESPNOW_TRACE_EV_BEACON, nullptr, 0, count);
+    }
+    releaseTxBuffer(buf);
+}
+
+void ESP_NowAdhoc::processBeacon(ESP_NowAdhocPeer* peer, const espnow_message_t* msg) {
+    if (msg->len < 1) {
+        return;
+    }
+    
+    uint8_t count = msg->data[0];
+    if (msg->len < 1 + count * 6) {
+        return;
+    }
+    processServerLoad(peer, msg, 1 + count * 6);
+    for (uint8_t i = 0; i < count; i++) {
+        if (memcmp(msg->data + 1 + i * 6, _selfMac, 6) == 0) {
+            confirmRegistered(peer);
+            return;
+        }
+    }
+    
+    // 全ピアを載せた一覧に載っていない（相手からは切断済み）場合は
+    // 次の update() で広告を送り、すぐに再登録されるようにする
+    // 一部のみの一覧では判断せず、続きを載せた次のビーコンを待つ
+    if (!(msg->flags & ESPNOW_FLAG_PARTIAL)) {
+        resetAdvertisement(true);
+    }
 }
 
-void ESP_NowAdhoc::checkPeerTimeouts() {
-    for (auto it = _peers.begin(); it != _peers.end();) {
-        ESP_NowAdhocPeer* peer = *it;
+void ESP_NowAdhoc::checkPeerTimeouts(unsigned long now) {
+    // 残ったピアの中で最も早いタイムアウト時刻を次の期限にする
+    disarmTimer(TIMER_PEER_TIMEOUT);
+    
+    // 削除時は末尾要素と入れ替わるため後ろから走査
+    for (size_t i = _peers.size(); i-- > 0;) {
+        ESP_NowAdhocPeer* peer = _peers.at(i);
         
-        if (millis() - peer->lastGetMs > _heartbeatTimeout) {
+        if (now - peer->lastGetMs <= _heartbeatTimeout) {
+            armTimerBefore(TIMER_PEER_TIMEOUT, peer->lastGetMs + _heartbeatTimeout + 1);
+        } else {
+            trace(ESPNOW_TRACE_EV_PEER_TIMEOUT, peer->addr(), peer->isServer);
             if (_debugEnabled) {
                 const uint8_t* mac = peer->addr();
                 Serial.printf("[ESP_NowAdhoc] Peer timeout: %02X:%02X:%02X:%02X:%02X:%02X\n",
                     mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
             }
             
-            if (_peerEventCallback) {
-                _peerEventCallback(peer->addr(), peer->isServer, false);
+            notifyPeerEvent(peer->addr(), peer->isServer, false);
+            // 未確認の信頼性モードのフレームは届かないまま破棄されるため送信失敗として通知する
+            if (peer->_reliable.base != peer->_reliable.nextSeq) {
+                peer->failReliable();
             }
             
+            if (peer->isServer) {
+                _serverPeerCount--;
+            }
+            if (peer->_cached) {
+                _peerCacheStats.expired++;
+            }
+            bool wasPrimary = (_peers.handleAt(i) == _primaryServer);
+            unsigned long silentMs = now - peer->lastGetMs;
             peer->removePeer();
-            delete peer;
-            it = _peers.erase(it);
-        } else {
-            ++it;
+            dropTxQueue(_peers.slot(_peers.handleAt(i)));
+            dropRoutes(_peers.handleAt(i));
+            dropCompress(_peers.handleAt(i));
+            dropTopics(_peers.handleAt(i));
+            if (_peers.handleAt(i) == _clockSource) {
+                _clockSource = ESPNOW_INVALID_PEER;
+                _clockSamples = 0;
+            }
+            _peers.remove(_peers.handleAt(i));
+            if (wasPrimary) {
+                failoverPrimary(silentMs);
+            }
+            markPeerCacheDirty();
+            resetAdvertisement(_peers.size() == 0);
         }
     }
 }
@@ -333,77 +1047,255 @@ void ESP_NowAdhoc::displayStatus() {
     Serial.printf("  Total Peers: %d\n", getTotalPeerCount());
     Serial.printf("  Server Peers: %d\n", getServerPeerCount());
     Serial.printf("  Client Peers: %d\n", getClientPeerCount());
+    if (_task) {
+        Serial.printf("  Task Stack: %lu / %u bytes free (min)\n", (unsigned long)getTaskStackFree(),
+            (unsigned)ESPNOW_TASK_STACK_SIZE);
+    }
     
     // 各ピアの状態を表示
     for (size_t i = 0; i < _peers.size(); i++) {
-        const uint8_t* mac = _peers[i]->addr();
-        unsigned long lastSeen = millis() - _peers[i]->lastGetMs;
+        ESP_NowAdhocPeer* peer = _peers.at(i);
+        const uint8_t* mac = peer->addr();
+        unsigned long lastSeen = millis() - peer->lastGetMs;
         Serial.printf("  Peer %d: %02X:%02X:%02X:%02X:%02X:%02X [%s] Last seen: %lu ms ago\n",
-            i, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
-            _peers[i]->isServer ? "SERVER" : "CLIENT", lastSeen);
+            _peers.slot(_peers.handleAt(i)), mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+            peer->isServer ? "SERVER" : "CLIENT", lastSeen);
     }
     Serial.println("=============================\n");
 }
 
 void ESP_NowAdhoc::registrationCallback(const esp_now_recv_info_t *info, const uint8_t *data, int len, void *arg) {
     ESP_NowAdhoc* instance = static_cast<ESP_NowAdhoc*>(arg);
-    if (instance && len >= sizeof(espnow_message_t)) {
-        instance->processRegistration(info, data);
+    if (!instance || len <= 0) {
+        return;
+    }
+    
+    const espnow_message_t *msg = parseMessage(data, (size_t)len);
+    if (!msg) {
+        instance->_dropShort.fetch_add(1, std::memory_order_relaxed);
+        instance->trace(ESPNOW_TRACE_EV_RX_DROP, info->src_addr, ESPNOW_TRACE_DROP_SHORT, len);
+        return;
     }
+    
+    int8_t rssi = info->rx_ctrl ? info->rx_ctrl->rssi : 0;
+    int8_t noiseFloor = info->rx_ctrl ? info->rx_ctrl->noise_floor : 0;
+    
+    // ドライバーから外したピアのフレームもここに届く（ピアの検索は update() 側で行う）
+    if (msg->group_token == instance->_groupToken) {
+        bool broadcast = memcmp(info->des_addr, ESP_NOW.BROADCAST_ADDR, 6) == 0;
+        instance->enqueueReceived(info->src_addr, data, (size_t)len, broadcast, false, rssi, noiseFloor);
+        return;
+    }
+    
+    // 登録フレーム以外と他グループの広告はキューに入れる前に除外
+    if ((msg->cmd != CMD_REGISTER && msg->cmd != CMD_PROBE) ||
+        msg->group_token != instance->_advGroupToken) {
+        instance->_dropWrongGroup.fetch_add(1, std::memory_order_relaxed);
+        instance->trace(ESPNOW_TRACE_EV_RX_DROP, info->src_addr, ESPNOW_TRACE_DROP_WRONG_GROUP, len);
+        return;
+    }
+    
+    instance->enqueueReceived(info->src_addr, data, (size_t)len, false, true, rssi, noiseFloor);
 }
 
-void ESP_NowAdhoc::processRegistration(const esp_now_recv_info_t *info, const uint8_t *data) {
-    espnow_message_t *msg = (espnow_message_t *)data;
+void ESP_NowAdhoc::enqueueReceived(const uint8_t* mac, const uint8_t *data, size_t len, bool broadcast, bool registration,
+                                   int8_t rssi, int8_t noiseFloor) {
+    // ESP-NOW v2 のノードからの長いフレームなど、受信スロットに収まらないフレーム
+    if (len > sizeof(espnow_message_t)) {
+        _dropShort.fetch_add(1, std::memory_order_relaxed);
+        trace(ESPNOW_TRACE_EV_RX_DROP, mac, ESPNOW_TRACE_DROP_SHORT, len);
+        return;
+    }
+    
+    espnow_rx_slot_t *slot = _rxQueue.acquire();
+    if (!slot) {
+        _rxOverflows.fetch_add(1, std::memory_order_relaxed);
+        trace(ESPNOW_TRACE_EV_RX_OVERFLOW, mac, 0, len);
+        return;
+    }
+    
+    memcpy(slot->mac, mac, 6);
+    slot->broadcast = broadcast;
+    slot->registration = registration;
+    slot->rssi = rssi;
+    slot->noiseFloor = noiseFloor;
+    slot->len = len;
+    slot->rxUs = esp_timer_get_time();
+    memcpy(slot->data, data, len);
+    _rxQueue.publish();
+    wakeEngine();
+}
+
+const espnow_rx_slot_t* ESP_NowAdhoc::borrowRxSlot() {
+    return _rxQueue.peek();
+}
+
+void ESP_NowAdhoc::releaseRxSlot() {
+    _rxQueue.release();
+}
+
+void ESP_NowAdhoc::dispatchRxSlot(const espnow_rx_slot_t* slot) {
+    if (slot->registration) {
+        processRegistration(slot->mac, slot->data, slot->len);
+    }
     
-    // 広告グループIDチェック
-    if (strcmp(msg->group_id, _advGroupID) != 0) {
+    // キュー投入後に削除されたピアからのフレームは破棄
+    ESP_NowAdhocPeer* peer = _peers.get(_peers.find(slot->mac));
+    if (!peer) {
+        if (!slot->registration) {
+            _dropUnknownPeer.fetch_add(1, std::memory_order_relaxed);
+            trace(ESPNOW_TRACE_EV_RX_DROP, slot->mac, ESPNOW_TRACE_DROP_UNKNOWN_PEER, slot->len);
+            probeUnknownServer(slot);
+        }
         return;
     }
     
-    // セキュリティモードチェック（異なるモードとは接続しない）
-    if (msg->security != _useSecurity) {
+    peer->rxFrames++;
+    peer->rxBytes += slot->len;
+    peer->_rxUs = slot->rxUs;
+    if (slot->rssi) {
+        peer->rssi = slot->rssi;
+        peer->noiseFloor = slot->noiseFloor;
+        peer->_score.rssiMs = millis();
+    }
+    if (!slot->registration) {
+        peer->processReceivedMessage(slot->data, slot->len, slot->broadcast);
+    }
+}
+
+// 未登録のサーバーのビーコン・経路広告（相手の一覧の内容によらず、まだ互いに登録していない）
+// 相手の広告を待たず、次の広告を参加要求にしてすぐに送り、ユニキャストの登録フレームで応答させる
+// （偽のビーコンで参加要求を繰り返させないよう、最短の広告間隔に1回まで）
+void ESP_NowAdhoc::probeUnknownServer(const espnow_rx_slot_t* slot) {
+    const espnow_message_t* msg = parseMessage(slot->data, slot->len);
+    if (!msg || (msg->cmd != CMD_BEACON && msg->cmd != CMD_ROUTE) || !msg->role || _peers.full()) {
+        return;
+    }
+    if (_probeNext || millis() - _advIntervalStart < _broadcastInterval) {
+        return;
+    }
+    _probeNext = true;
+    resetAdvertisement(true);
+}
+
+void ESP_NowAdhoc::processReceiveQueue() {
+    const espnow_rx_slot_t* slot;
+    while ((slot = borrowRxSlot()) != nullptr) {
+        dispatchRxSlot(slot);
+        releaseRxSlot();
+    }
+}
+
+void ESP_NowAdhoc::processRegistration(const uint8_t* mac, const uint8_t *data, size_t len) {
+    const espnow_message_t *msg = parseMessage(data, len);
+    if (!msg || (msg->cmd != CMD_REGISTER && msg->cmd != CMD_PROBE)) {
+        return;
+    }
+    
+    // 広告グループチェック（トークンで高速に除外し、一致時のみUUIDを比較）
+    if (msg->group_token != _advGroupToken) {
+        return;
+    }
+    size_t idLen = strlen(_advGroupID);
+    size_t helloLen = (msg->flags & ESPNOW_FLAG_SESSION) ? sizeof(espnow_session_hello_t) : 0;
+    if (msg->len != idLen + helloLen || memcmp(msg->data, _advGroupID, idLen) != 0) {
+        _dropWrongGroup.fetch_add(1, std::memory_order_relaxed);
+        trace(ESPNOW_TRACE_EV_RX_DROP, mac, ESPNOW_TRACE_DROP_WRONG_GROUP, len);
+        if (_debugEnabled) {
+            Serial.println("[ESP_NowAdhoc] Group token collision, ignoring registration");
+        }
+        return;
+    }
+    
+    // セキュリティモードチェック（異なるモード・セッションモードの有無が異なるノードとは接続しない）
+    if (msg->security != _useSecurity || (helloLen > 0) != _sessionMode) {
+        _dropSecurity.fetch_add(1, std::memory_order_relaxed);
+        trace(ESPNOW_TRACE_EV_RX_DROP, mac, ESPNOW_TRACE_DROP_SECURITY, len);
         if (_debugEnabled) {
             Serial.println("[ESP_NowAdhoc] Security mode mismatch, ignoring registration");
         }
         return;
     }
     
-    // 既存ピアチェック
-    for (auto peer : _peers) {
-        const uint8_t* peerMac = peer->addr();
-        if (memcmp(peerMac, info->src_addr, 6) == 0) {
-            // 既に登録済み
+    // セッションモードでは共通鍵で認証できた登録フレームのみ受け付ける
+    espnow_session_hello_t hello;
+    if (_sessionMode && !checkSessionHello(mac, msg, &hello)) {
+        _dropSecurity.fetch_add(1, std::memory_order_relaxed);
+        trace(ESPNOW_TRACE_EV_RX_DROP, mac, ESPNOW_TRACE_DROP_AUTH, len);
+        if (_debugEnabled) {
+            Serial.println("[ESP_NowAdhoc] Session key mismatch, ignoring registration");
+        }
+        return;
+    }
+    
+    // 既存ピアチェック（MAC索引によるO(1)検索）
+    espnow_peer_handle_t handle = _peers.find(mac);
+    if (handle == ESPNOW_INVALID_PEER) {
+        // ロールによる登録条件チェック
+        // サーバーはすべてのロールを受け入れ、クライアントはサーバーのみ受け入れる
+        if (!_isServer && !msg->role) {
             return;
         }
+        addPeer(mac, msg->role, msg->security, _sessionMode ? &hello : nullptr);
+        handle = _peers.find(mac);
     }
     
-    // ロールによる登録条件チェック
-    if (_isServer) {
-        // サーバーはすべてのロールを受け入れる
-        addPeer(info->src_addr, msg->role, msg->security);
-    } else {
-        // クライアントはサーバーのみ受け入れる
-        if (msg->role) { // 相手がサーバー
-            addPeer(info->src_addr, msg->role, msg->security);
+    // 再起動で設定が変わることもあるため、登録フレームを受け取るたびに更新する
+    // 参加要求を送ってきたサーバーは購読を忘れているため通知し直す
+    // （参加要求への応答を先に送り、相手が登録してから購読の通知が届くようにする）
+    if (handle != ESPNOW_INVALID_PEER) {
+        ESP_NowAdhocPeer* peer = _peers.get(handle);
+        peer->canCompress = (msg->flags & ESPNOW_FLAG_COMPRESSED) != 0;
+        if (_sessionMode && !updateSession(peer, &hello)) {
+            _dropSecurity.fetch_add(1, std::memory_order_relaxed);
+            trace(ESPNOW_TRACE_EV_RX_DROP, mac, ESPNOW_TRACE_DROP_REPLAY, len);
+            if (_debugEnabled) {
+                Serial.println("[ESP_NowAdhoc] Stale session hello, ignoring registration");
+            }
+            return;
+        }
+        if (msg->cmd == CMD_PROBE) {
+            peer->_sentTopics = 0;
+            peer->_registered = false;
+            // 参加要求には次の広告を待たせず、ユニキャストの登録フレームで応答する
+            sendRegistration(handle);
+        }
+        confirmCachedPeer(peer);
+        if (peer->isServer) {
+            sendSubscriptions();
         }
     }
 }
 
-void ESP_NowAdhoc::addPeer(const uint8_t* mac, bool peerIsServer, bool peerIsSecure) {
-    ESP_NowAdhocPeer* newPeer;
+void ESP_NowAdhoc::addPeer(const uint8_t* mac, bool peerIsServer, bool peerIsSecure,
+                          const espnow_session_hello_t* hello) {
+    if (_peers.full()) {
+        Serial.println("[ESP_NowAdhoc] Peer table full");
+        return;
+    }
     
-    if (_useSecurity) {
-        newPeer = new ESP_NowAdhocPeer(mac, _wifiChannel, WIFI_IF_STA, this, _lmk);
-    } else {
-        newPeer = new ESP_NowAdhocPeer(mac, _wifiChannel, WIFI_IF_STA, this, nullptr);
+    // プール内に直接構築（ヒープ確保なし）
+    espnow_peer_handle_t handle = _peers.insert(mac, mac, _wifiChannel, WIFI_IF_STA, this,
+                                                _useSecurity ? _lmk : nullptr);
+    ESP_NowAdhocPeer* newPeer = _peers.get(handle);
+    if (!newPeer) {
+        return;
     }
     
     if (newPeer->begin()) {
         newPeer->isServer = peerIsServer;
         newPeer->isSecure = peerIsSecure;
         newPeer->lastGetMs = millis();
-        
-        _peers.push_back(newPeer);
+        // 接続通知のコールバックから送れるよう、通知の前に鍵を導出する
+        if (hello) {
+            updateSession(newPeer, hello);
+        }
+        if (peerIsServer) {
+            _serverPeerCount++;
+            selectPrimaryServer(false);
+        }
+        armTimerBefore(TIMER_PEER_TIMEOUT, newPeer->lastGetMs + _heartbeatTimeout + 1);
+        trace(ESPNOW_TRACE_EV_PEER_ADDED, mac, peerIsServer);
         
         if (_debugEnabled) {
             Serial.printf("[ESP_NowAdhoc] New peer registered: %02X:%02X:%02X:%02X:%02X:%02X (%s)\n",
@@ -411,97 +1303,321 @@ void ESP_NowAdhoc::addPeer(const uint8_t* mac, bool peerIsServer, bool peerIsSec
                 peerIsServer ? "SERVER" : "CLIENT");
         }
         
-        if (_peerEventCallback) {
-            _peerEventCallback(mac, peerIsServer, true);
-        }
+        notifyPeerEvent(mac, peerIsServer, true);
+        resetAdvertisement(false);
+        markPeerCacheDirty();
     } else {
-        delete newPeer;
+        _peers.remove(handle);
         Serial.println("[ESP_NowAdhoc] Failed to add peer");
     }
 }
 
+// 送信前にピアをドライバーへ登録する（空きがなければ最も長く使っていないピアを外す）
+bool ESP_NowAdhoc::acquireDriverSlot(ESP_NowAdhocPeer* peer) {
+    peer->driverUse = ++_driverClock;
+    if (*peer) {
+        _driverStats.hits++;
+        return true;
+    }
+    _driverStats.misses++;
+    
+    size_t added = 0;
+    ESP_NowAdhocPeer* lru = nullptr;
+    for (size_t i = 0; i < _peers.size(); i++) {
+        ESP_NowAdhocPeer* p = _peers.at(i);
+        if (p == peer || !*p) {
+            continue;
+        }
+        added++;
+        if (!lru || (int32_t)(p->driverUse - lru->driverUse) < 0) {
+            lru = p;
+        }
+    }
+    
+    if (added >= ESPNOW_DRIVER_PEERS) {
+        if (_useSecurity || !lru) {
+            _driverStats.failures++;
+            return false;
+        }
+        lru->removePeer();
+        _driverStats.evictions++;
+        trace(ESPNOW_TRACE_EV_PEER_EVICTED, lru->addr());
+    }
+    
+    if (!peer->add()) {
+        _driverStats.failures++;
+        return false;
+    }
+    _driverStats.adds++;
+    return true;
+}
+
+size_t ESP_NowAdhoc::getESPNOWMaxPayload() const {
+    size_t len = ESP_NOW.getMaxDataLen();
+    if (_sessionMode) {
+        // 保護したフレームも受信バッファ（espnow_message_t）に収まる長さにする
+        if (len > sizeof(espnow_message_t)) {
+            len = sizeof(espnow_message_t);
+        }
+        len -= ESPNOW_SESSION_OVERHEAD;
+    }
+    return len;
+}
+
+size_t ESP_NowAdhoc::getDriverPeerCount() const {
+    size_t count = 0;
+    for (size_t i = 0; i < _peers.size(); i++) {
+        if (*_peers.at(i)) {
+            count++;
+        }
+    }
+    return count;
+}
+
 // ==================== 公開メソッド ====================
 
+espnow_stats_t ESP_NowAdhoc::getStats() const {
+    ESP_NowAdhocLock lock(_lock);
+    espnow_stats_t stats;
+    stats.peers = _peers.size();
+    stats.servers = _serverPeerCount;
+    stats.clients = _peers.size() - _serverPeerCount;
+    stats.driverPeers = getDriverPeerCount();
+    stats.rxOverflows = _rxOverflows.load();
+    stats.appOverflows = _appOverflows.load();
+    stats.drops.shortFrames = _dropShort.load();
+    stats.drops.wrongGroup = _dropWrongGroup.load();
+    stats.drops.security = _dropSecurity.load();
+    stats.drops.unknownPeer = _dropUnknownPeer.load();
+    stats.tx = _txStats;
+    return stats;
+}
+
+bool ESP_NowAdhoc::getPeerStats(espnow_peer_handle_t handle, espnow_peer_stats_t* stats) const {
+    ESP_NowAdhocLock lock(_lock);
+    const ESP_NowAdhocPeer* peer = _peers.get(handle);
+    if (!peer || !stats) {
+        return false;
+    }
+    stats->txAttempts = peer->txAttempts;
+    stats->txSuccess = peer->txSuccess.load();
+    stats->txFailed = peer->txFailed.load();
+    stats->rxFrames = peer->rxFrames;
+    stats->rxBytes = peer->rxBytes;
+    stats->rssi = peer->rssi;
+    stats->noiseFloor = peer->noiseFloor;
+    stats->linkRttUs = peer->_linkRttUs.load();
+    stats->rttUs = peer->_clock.srtt;
+    stats->jitterUs = peer->_clock.jitter;
+    stats->lastSeenMs = millis() - peer->lastGetMs;
+    return true;
+}
+
 void ESP_NowAdhoc::setDebug(bool enable) {
+    ESP_NowAdhocLock lock(_lock, _task);
     _debugEnabled = enable;
+    if (enable && _broadcastPeer) {
+        armTimer(TIMER_STATUS, millis() + _statusDisplayInterval);
+    }
 }
 
 void ESP_NowAdhoc::setBroadcastInterval(unsigned long interval) {
+    ESP_NowAdhocLock lock(_lock, _task);
     _broadcastInterval = interval;
+    if (_broadcastIntervalMax < interval) {
+        _broadcastIntervalMax = interval;
+    }
+    resetAdvertisement(false);
+}
+
+void ESP_NowAdhoc::setBroadcastIntervalMax(unsigned long interval) {
+    ESP_NowAdhocLock lock(_lock);
+    _broadcastIntervalMax = (interval < _broadcastInterval) ? _broadcastInterval : interval;
 }
 
 void ESP_NowAdhoc::setHeartbeatInterval(unsigned long interval) {
+    ESP_NowAdhocLock lock(_lock, _task);
     _heartbeatInterval = interval;
+    if (_timerArmed & (1 << TIMER_HEARTBEAT)) {
+        armTimer(TIMER_HEARTBEAT, millis() + interval);
+    }
 }
 
 void ESP_NowAdhoc::setHeartbeatTimeout(unsigned long timeout) {
+    ESP_NowAdhocLock lock(_lock, _task);
     _heartbeatTimeout = timeout;
+    if (_peers.size() > 0) {
+        armTimer(TIMER_PEER_TIMEOUT, millis());  // 期限を再計算
+    }
 }
 
 void ESP_NowAdhoc::setStatusDisplayInterval(unsigned long interval) {
+    ESP_NowAdhocLock lock(_lock, _task);
     _statusDisplayInterval = interval;
+    if (_timerArmed & (1 << TIMER_STATUS)) {
+        armTimer(TIMER_STATUS, millis() + interval);
+    }
+}
+
+void ESP_NowAdhoc::setFanoutThreshold(size_t threshold) {
+    _fanoutThreshold = threshold;
 }
 
+void ESP_NowAdhoc::setHeartbeatBeacon(bool enable) {
+    _heartbeatBeacon = enable;
+}
+
+// ロール別のピア数は登録・削除時に数えておく（呼び出しごとの走査なし）
 int ESP_NowAdhoc::getServerPeerCount() const {
-    int count = 0;
-    for (auto peer : _peers) {
-        if (peer->isServer) {
-            count++;
-        }
-    }
-    return count;
+    return _serverPeerCount;
 }
 
 int ESP_NowAdhoc::getClientPeerCount() const {
-    int count = 0;
-    for (auto peer : _peers) {
-        if (!peer->isServer) {
-            count++;
-        }
-    }
-    return count;
+    return (int)_peers.size() - _serverPeerCount;
 }
 
 int ESP_NowAdhoc::getTotalPeerCount() const {
     return _peers.size();
 }
 
-bool ESP_NowAdhoc::sendToAll(const uint8_t *data, size_t len) {
-    bool allSuccess = true;
-    for (auto peer : _peers) {
-        if (!peer->sendData(data, len)) {
-            allSuccess = false;
+bool ESP_NowAdhoc::sendToPeers(const uint8_t *data, size_t len, uint8_t cmd, bool toServer, bool toClient) {
+    ESP_NowAdhocLock lock(_lock, _task);
+    // クライアントのサーバー宛は主サーバーにのみ送る
+    espnow_peer_handle_t primary = uplinkServer(toServer, toClient);
+    if (primary != ESPNOW_INVALID_PEER) {
+        return sendToPeer(primary, data, len, cmd);
+    }
+    
+    size_t targets = 0;
+    for (size_t i = 0; i < _peers.size(); i++) {
+        if (_peers.at(i)->isServer ? toServer : toClient) {
+            targets++;
+        }
+    }
+    if (targets == 0) {
+        return true;
+    }
+    
+    // 宛先が多い場合はロールを付けたブロードキャスト1フレームで送る
+    if (useFanout(targets)) {
+        uint8_t buf = prepareTxBuffer(cmd, _groupToken, data, len);
+        if (buf == ESPNOW_NO_BUFFER) {
+            _txStats.dropped++;
+            return false;
+        }
+        _txBuf[buf].flags |= (toServer ? ESPNOW_FLAG_TO_SERVER : 0) | (toClient ? ESPNOW_FLAG_TO_CLIENT : 0);
+        bool queued = enqueueTx(TX_BROADCAST_QUEUE, ESPNOW_TX_PRIO_DATA, buf);
+        releaseTxBuffer(buf);
+        if (queued) {
+            _txStats.fanout++;
         }
+        serviceTx();
+        return queued;
     }
-    return allSuccess;
+    
+    // 一部の宛先だけに送られることがないよう、全宛先分のエントリを確認してから入れる
+    if (targets > _txEntryFreeCount) {
+        _txStats.dropped += targets;
+        return false;
+    }
+    uint8_t buf = prepareTxBuffer(cmd, _groupToken, data, len);
+    if (buf == ESPNOW_NO_BUFFER) {
+        _txStats.dropped += targets;
+        return false;
+    }
+    
+    for (size_t i = 0; i < _peers.size(); i++) {
+        if (_peers.at(i)->isServer ? toServer : toClient) {
+            enqueueTx(_peers.slot(_peers.handleAt(i)), ESPNOW_TX_PRIO_DATA, buf);
+        }
+    }
+    releaseTxBuffer(buf);
+    
+    serviceTx();
+    return true;
 }
 
-bool ESP_NowAdhoc::sendToServer(const uint8_t *data, size_t len) {
-    bool allSuccess = true;
-    for (auto peer : _peers) {
-        if (peer->isServer && !peer->sendData(data, len)) {
-            allSuccess = false;
-        }
+bool ESP_NowAdhoc::sendTo(espnow_peer_handle_t target, const uint8_t *data, size_t len, uint8_t cmd) {
+    switch (target) {
+        case ESPNOW_TARGET_ALL:
+            return sendToPeers(data, len, cmd, true, true);
+        case ESPNOW_TARGET_SERVERS:
+            return sendToPeers(data, len, cmd, true, false);
+        case ESPNOW_TARGET_CLIENTS:
+            return sendToPeers(data, len, cmd, false, true);
+        default:
+            return sendToPeer(target, data, len, cmd);
     }
-    return allSuccess;
 }
 
-bool ESP_NowAdhoc::sendToClients(const uint8_t *data, size_t len) {
-    bool allSuccess = true;
-    for (auto peer : _peers) {
-        if (!peer->isServer && !peer->sendData(data, len)) {
-            allSuccess = false;
+void ESP_NowAdhoc::dispatchTyped(const uint8_t* mac, const espnow_message_t* msg, bool broadcast) {
+    uint8_t id = msg->cmd - CMD_TYPED_BASE;
+    const espnow_typed_entry_t* entry = (id < ESPNOW_TYPED_MESSAGES) ? &_typedHandlers[id] : nullptr;
+    
+    // ハンドラー未登録のIDは従来どおり DataCallback へ
+    if (!entry || !entry->thunk) {
+        if (_dataCallback) {
+            _dataCallback(mac, msg, broadcast);
         }
+        return;
+    }
+    
+    // 型の大きさが一致しないもの（送信側と定義が異なる）は破棄
+    if (msg->len != entry->size) {
+        if (_debugEnabled) {
+            Serial.printf("[ESP_NowAdhoc] Typed message %u size mismatch (%u != %u)\n",
+                id, msg->len, entry->size);
+        }
+        return;
+    }
+    
+    entry->thunk(entry->handler, mac, msg->data);
+}
+
+bool ESP_NowAdhoc::useFanout(size_t targets) const {
+    return _fanoutThreshold > 0 && targets >= _fanoutThreshold && !_useSecurity && _broadcastPeer;
+}
+
+bool ESP_NowAdhoc::sendToPeer(espnow_peer_handle_t handle, const uint8_t *data, size_t len, uint8_t cmd) {
+    ESP_NowAdhocLock lock(_lock, _task);
+    if (!_peers.get(handle)) {
+        return false;
+    }
+    
+    uint8_t buf = prepareTxBuffer(cmd, _groupToken, data, len);
+    if (buf == ESPNOW_NO_BUFFER) {
+        _txStats.dropped++;
+        return false;
     }
-    return allSuccess;
+    bool queued = enqueueTx(_peers.slot(handle), ESPNOW_TX_PRIO_DATA, buf);
+    releaseTxBuffer(buf);
+    
+    serviceTx();
+    return queued;
+}
+
+bool ESP_NowAdhoc::sendToAll(const uint8_t *data, size_t len, uint8_t cmd) {
+    return sendToPeers(data, len, cmd, true, true);
+}
+
+bool ESP_NowAdhoc::sendToServer(const uint8_t *data, size_t len, uint8_t cmd) {
+    return sendToPeers(data, len, cmd, true, false);
+}
+
+bool ESP_NowAdhoc::sendToClients(const uint8_t *data, size_t len, uint8_t cmd) {
+    return sendToPeers(data, len, cmd, false, true);
 }
 
 void ESP_NowAdhoc::setGroupID(const char* advGroupID, const char* groupID) {
     if (advGroupID) {
-        strncpy(_advGroupID, advGroupID, sizeof(_advGroupID));
+        strncpy(_advGroupID, advGroupID, sizeof(_advGroupID) - 1);
+        _advGroupID[sizeof(_advGroupID) - 1] = '\0';
+        _advGroupToken = groupToken(_advGroupID);
     }
     if (groupID) {
-        strncpy(_groupID, groupID, sizeof(_groupID));
+        strncpy(_groupID, groupID, sizeof(_groupID) - 1);
+        _groupID[sizeof(_groupID) - 1] = '\0';
+        _groupToken = groupToken(_groupID);
     }
 }
 
@@ -514,6 +1630,10 @@ void ESP_NowAdhoc::setDataCallback(DataCallback callback) {
     _dataCallback = callback;
 }
 
+void ESP_NowAdhoc::setLargeDataCallback(LargeDataCallback callback) {
+    _largeDataCallback = callback;
+}
+
 void ESP_NowAdhoc::setPeerEventCallback(PeerEventCallback callback) {
     _peerEventCallback = callback;
 }
\ No newline at end of file
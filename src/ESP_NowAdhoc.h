@@ -3,9 +3,26 @@
 
 #include <Arduino.h>
 #include <WiFi.h>
-#include <vector>
 #include <string>
 #include "ESP32_NOW.h"
+#include "ESP_NowAdhocPool.h"
+#include "ESP_NowAdhocFragment.h"
+#include "ESP_NowAdhocReliable.h"
+#include "ESP_NowAdhocRing.h"
+#include "ESP_NowAdhocTx.h"
+#include "ESP_NowAdhocTyped.h"
+#include "ESP_NowAdhocTask.h"
+#include "ESP_NowAdhocMesh.h"
+#include "ESP_NowAdhocStats.h"
+#include "ESP_NowAdhocTrace.h"
+#include "ESP_NowAdhocClock.h"
+#include "ESP_NowAdhocCompress.h"
+#include "ESP_NowAdhocTopic.h"
+#include "ESP_NowAdhocSession.h"
+#include "ESP_NowAdhocServerSelect.h"
+#include "ESP_NowAdhocPeerCache.h"
+#include "mbedtls/gcm.h"
+#include "mbedtls/md.h"
 
 // デフォルト設定
 #ifndef ESPNOW_WIFI_CHANNEL
@@ -20,6 +37,11 @@
 #define GROUP_ID "73f8e3bb-aab2-4808-8efe-c061c88e48c2"
 #endif
 
+// グループトークン算出用のキー
+#ifndef GROUP_TOKEN_KEY
+#define GROUP_TOKEN_KEY "ESP_NowAdhoc"
+#endif
+
 #ifndef HEARTBEAT_TIMEOUT
 #define HEARTBEAT_TIMEOUT 5000
 #endif
@@ -28,33 +50,172 @@
 #define HEARTBEAT_INTERVAL 1000
 #endif
 
+// サーバーはピアごとのハートビートの代わりに、認識しているピア一覧を載せた
+// ブロードキャストビーコンを1つ送る（セキュリティモードでは常にユニキャスト）
+#ifndef ESPNOW_HEARTBEAT_BEACON
+#define ESPNOW_HEARTBEAT_BEACON true
+#endif
+
+// 広告間隔（Trickle方式）：BROADCAST_INTERVAL から始め、ピア構成が変わらない間は
+// BROADCAST_INTERVAL_MAX まで倍々に延ばし、ピアの追加・削除で最短に戻す
 #ifndef BROADCAST_INTERVAL
 #define BROADCAST_INTERVAL 1000
 #endif
 
+#ifndef BROADCAST_INTERVAL_MAX
+#define BROADCAST_INTERVAL_MAX 16000
+#endif
+
 #ifndef STATUS_DISPLAY_INTERVAL
 #define STATUS_DISPLAY_INTERVAL 5000
 #endif
 
+// 登録できるピアの最大数（ブロードキャストピアを除く）
+// ESPNOW_DRIVER_PEERS を超える分は送信時にドライバーへ登録し、最も長く使っていないピアを外す
+#ifndef ESPNOW_MAX_PEERS
+#define ESPNOW_MAX_PEERS 19
+#endif
+
+// ESP-NOWドライバーに同時に登録するピア数（ドライバーの上限20からブロードキャストピア分を除く）
+// セキュリティモードでは外したピアからの暗号化フレームを受信できないため、入れ替えは行わない
+#ifndef ESPNOW_DRIVER_PEERS
+#define ESPNOW_DRIVER_PEERS 19
+#endif
+
+// 宛先がこの数以上なら1つのブロードキャストフレームで送る（0: 常にユニキャスト）
+// ブロードキャストはリンク層の再送がなく、セキュリティモードでは使用しない
+#ifndef ESPNOW_FANOUT_THRESHOLD
+#define ESPNOW_FANOUT_THRESHOLD 0
+#endif
+
+// 受信キューのスロット数（2のべき乗）
+#ifndef ESPNOW_RX_QUEUE_SIZE
+#define ESPNOW_RX_QUEUE_SIZE 16
+#endif
+
 #ifndef ESPNOW_DATA_SIZE
 #define ESPNOW_DATA_SIZE 1000  // Set to 1000 bytes
 #endif
 
+// プロトコルバージョン（ワイヤーフォーマット変更時に更新）
+#define ESPNOW_PROTOCOL_VERSION 3
+
 // コマンド定義
 #define CMD_REGISTER 1
-#define CMD_HEARTBEAT 2
+#define CMD_HEARTBEAT 2  // data: espnow_clock_t（時刻同期が無効の場合は空）
+#define CMD_BEACON 3  // サーバーの集約ハートビート（data: ピア数 + MAC一覧。多い場合はビーコンごとに順に載せる）
+#define CMD_PROBE 4   // ピアがいないノードの参加要求（受信側は登録してユニキャストで CMD_REGISTER を返す）
+#define CMD_ROUTE 5   // メッシュモードのサーバーの経路広告（ビーコンを兼ねる）
+#define CMD_SUBSCRIBE 6  // 購読するトピックの通知（data: espnow_subscribe_t。サーバー宛のみ）
 #define CMD_DATA 11
+#define CMD_FRAGMENT 12
+#define CMD_RELIABLE 13
+#define CMD_ACK 14
+#define CMD_BATCH 15  // 同じピア宛の複数メッセージを1フレームに結合
+#define CMD_RELAY 16  // 宛先MAC指定の中継データ（data: espnow_relay_hdr_t + ペイロード）
+#define CMD_PUBLISH 17  // トピックへの発行（data: espnow_publish_hdr_t + ペイロード）
+
+// フラグ定義（espnow_message_t::flags）
+#define ESPNOW_FLAG_RELIABLE 0x01  // 信頼性モードで順序通りに届いたデータ
+#define ESPNOW_FLAG_TO_SERVER 0x02  // ブロードキャストの宛先ロール（どちらも無い場合は全員宛）
+#define ESPNOW_FLAG_TO_CLIENT 0x04
+#define ESPNOW_FLAG_CLOCK_REQUEST 0x08  // CMD_HEARTBEAT: 受信側はすぐにハートビートで応答する
+#define ESPNOW_FLAG_CLOCK_ECHO 0x10     // CMD_HEARTBEAT: espnow_clock_t の echoUs と holdUs が有効
+#define ESPNOW_FLAG_COMPRESSED 0x20     // CMD_DATA・型付き: data は espnow_compress_hdr_t + LZの符号
+                                        // CMD_REGISTER・CMD_PROBE: 送信元は圧縮フレームを展開できる
+#define ESPNOW_FLAG_SESSION 0x40        // グループ宛: data はセッション鍵で保護したもの（ESP_NowAdhocSession.h）
+                                        // CMD_REGISTER・CMD_PROBE: data の末尾に espnow_session_hello_t
+#define ESPNOW_FLAG_PARTIAL 0x80        // CMD_BEACON・CMD_ROUTE: 一覧がフレームに収まらず一部のみ（載っていなくても切断ではない）
 
 // メッセージ構造体
+// 送信時はヘッダーと data の有効部分（len バイト）のみを送る
 typedef struct __attribute__((packed)) {
-    char group_id[37];
+    uint8_t version;  // ESPNOW_PROTOCOL_VERSION
+    uint32_t group_token;  // グループUUIDのハッシュ（ESP_NowAdhoc::groupToken）
     bool role;
     uint8_t channel;
     bool security;  // セキュリティモードかどうか
     uint8_t cmd;
+    uint8_t flags;  // ESPNOW_FLAG_*
+    uint16_t len;   // data の有効バイト数
     char data[ESPNOW_DATA_SIZE];
 } espnow_message_t;
 
+// ヘッダー部（data より前）のサイズ
+#define ESPNOW_HEADER_SIZE (sizeof(espnow_message_t) - ESPNOW_DATA_SIZE)
+
+static_assert(ESPNOW_HEADER_SIZE + ESPNOW_COMPRESS_MAX_LEN == 250, "ESPNOW_COMPRESS_MAX_LEN must follow the header size");
+
+// 受信キューのスロット（WiFiタスクで受信フレームをコピーし、update() で処理する）
+// フレームを先頭に4バイト境界で置き、ペイロード（msg.data）も4バイト境界に揃える
+typedef struct {
+    union alignas(4) {
+        espnow_message_t msg;
+        uint8_t data[sizeof(espnow_message_t)];
+    };
+    uint8_t mac[6];
+    bool broadcast;
+    bool registration;  // 未登録の送信元からのフレーム（登録処理へ回す）
+    int8_t rssi;        // 受信強度 (dBm)。0 は不明（ピアの onReceive には rx_ctrl がない）
+    int8_t noiseFloor;
+    uint16_t len;
+    int64_t rxUs;       // 受信時刻（esp_timer_get_time()）
+} espnow_rx_slot_t;
+
+// アプリケーションキューのスロット（beginTask() 時にエンジンタスクからユーザー側へ渡す）
+typedef struct {
+    union alignas(4) {
+        espnow_message_t msg;  // ESPNOW_APP_MESSAGE
+        uint8_t data[sizeof(espnow_message_t)];
+    };
+    uint8_t kind;  // ESPNOW_APP_*
+    uint8_t mac[6];
+    bool broadcast;  // ESPNOW_APP_MESSAGE
+    bool isServer;   // ESPNOW_APP_PEER_EVENT
+    bool connected;  // ESPNOW_APP_PEER_EVENT
+    uint8_t slot;    // ESPNOW_APP_LARGE_DATA: 再構築バッファ番号
+    uint16_t dropped;  // ESPNOW_APP_RELIABLE_FAIL: 破棄したフレーム数
+} espnow_app_slot_t;
+
+// beginTask() 時にユーザー側のAPI呼び出しとエンジンタスクを排他する（未使用時は何もしない）
+// wake を指定すると解放時にエンジンタスクを起こし、送信や期限の変更をすぐに反映させる
+class ESP_NowAdhocLock {
+public:
+    explicit ESP_NowAdhocLock(SemaphoreHandle_t mutex, TaskHandle_t wake = nullptr)
+        : _mutex(mutex), _wake(wake) {
+        if (_mutex) {
+            xSemaphoreTakeRecursive(_mutex, portMAX_DELAY);
+        }
+    }
+    ~ESP_NowAdhocLock() {
+        if (_mutex) {
+            xSemaphoreGiveRecursive(_mutex);
+        }
+        if (_wake) {
+            xTaskNotifyGive(_wake);
+        }
+    }
+private:
+    SemaphoreHandle_t _mutex;
+    TaskHandle_t _wake;
+};
+
+static_assert(ESPNOW_HEADER_SIZE % 4 == 0, "Header size must keep the payload 4-byte aligned");
+static_assert(ESPNOW_MAX_PEERS < ESPNOW_TARGET_CLIENTS, "ESPNOW_MAX_PEERS overlaps the send<T>() targets");
+static_assert(ESPNOW_TX_QUEUE_SIZE < 0xFF, "Too many TX entries");
+static_assert(ESPNOW_TX_QUEUE_SIZE >= ESPNOW_MAX_PEERS, "ESPNOW_TX_QUEUE_SIZE must hold one entry per peer");
+static_assert(ESPNOW_DRIVER_PEERS >= 1 && ESPNOW_DRIVER_PEERS < ESP_NOW_MAX_TOTAL_PEER_NUM,
+              "ESPNOW_DRIVER_PEERS must leave one driver slot for the broadcast peer");
+
+// ドライバーのピア登録の統計（ヒット率は hits / (hits + misses)）
+typedef struct {
+    uint32_t hits;       // 送信時に登録済みだった回数
+    uint32_t misses;     // 送信時に登録が必要だった回数
+    uint32_t adds;       // ドライバーへの登録回数
+    uint32_t evictions;  // 空きを作るために外した回数
+    uint32_t failures;   // 登録できず送信できなかった回数
+} espnow_driver_stats_t;
+
 // 前方宣言
 class ESP_NowAdhoc;
 
@@ -68,18 +229,71 @@ public:
     bool removePeer();
     bool sendData(const uint8_t *data, size_t len);
     
+    // 信頼性モード：シーケンス番号・スライディングウィンドウ・選択ACK・再送で
+    // 順序通りの到達を保証する（ウィンドウまたはバッファが満杯の場合は false）
+    // 再送が ESPNOW_RELIABLE_MAX_RETRIES 回を超えると未確認のフレームを破棄して
+    // ReliableFailCallback に通知し、以降の送信は新しいセッションで続ける
+    bool sendReliable(const uint8_t *data, size_t len);
+    size_t reliableWindowAvailable() const;
+    const espnow_reliable_t& getReliableState() const { return _reliable; }
+    
     void onSent(bool success) override;
     void onReceive(const uint8_t *data, size_t len, bool broadcast) override;
     
     unsigned long lastGetMs;
+    unsigned long lastSentMs;  // グループ宛フレームを最後に送信した時刻（ハートビート抑制用）
+    uint32_t driverUse;        // ドライバー登録の最終使用（LRUの順序）
     bool isServer;
     bool isSecure;
+    bool canCompress;  // 登録フレームで圧縮フレームの展開に対応していると通知した
+    uint32_t topics;   // このピアが購読しているトピック（CMD_SUBSCRIBE で受け取ったもの）
+    bool hasSession() const { return _session.ready; }
+    
+    // リンク統計（getPeerStats()。送信完了は WiFiタスクから更新される）
+    uint32_t txAttempts;
+    std::atomic<uint32_t> txSuccess;
+    std::atomic<uint32_t> txFailed;
+    uint32_t rxFrames;
+    uint32_t rxBytes;
+    int8_t rssi;
+    int8_t noiseFloor;
     
     void setParent(ESP_NowAdhoc* parent) { _parent = parent; }
     
 private:
-    void processReceivedMessage(const uint8_t *data, size_t len, bool broadcast);
+    void processReceivedMessage(const uint8_t *data, size_t len, bool broadcast, bool inner = false);
+    void processBatch(const espnow_message_t *msg, bool broadcast);
+    
+    // 信頼性モード（ESP_NowAdhocReliable.cpp）
+    void resetReliable();
+    void releaseReliable();
+    void processReliable(const espnow_message_t *msg);
+    void processAck(const espnow_message_t *msg);
+    void sendAck();
+    void serviceReliable(unsigned long now);
+    void handleAck(uint16_t cumAck, uint16_t sack, unsigned long now);
+    void updateRtt(unsigned long sample);
+    void deliverReliable(const espnow_message_t *msg);
+    bool nextReliableDeadline(unsigned long *due) const;
+    void failReliable();
+    
     ESP_NowAdhoc* _parent;
+    espnow_reliable_t _reliable;
+    std::atomic<uint32_t> _txStartUs;  // 最後に send() を呼んだ時刻
+    std::atomic<uint32_t> _linkRttUs;
+    uint32_t _sentTopics;             // このサーバーへ最後に通知した購読
+    std::atomic<bool> _topicsLost;    // 送信失敗があったため購読を通知し直す
+    bool _registered;                 // このサーバーが自分を登録済みと確認できた
+    int64_t _rxUs;  // 処理中のフレームの受信時刻
+    espnow_peer_clock_t _clock;
+    espnow_session_peer_t _session;
+    espnow_server_score_t _score;           // サーバーとしての評価（クライアント側）
+    std::atomic<uint8_t> _txFailStreak;     // 続けて送信に失敗した回数
+    unsigned long _uplinkMs;                // 最後にユニキャストのデータを受信した時刻（サーバー側）
+    bool _cached;                           // NVSから復元し、まだ登録フレームで確認していない
+    
+    friend class ESP_NowAdhoc;
+    friend class ESP_NowAdhocBench;
 };
 
 class ESP_NowAdhoc {
@@ -89,54 +303,362 @@ public:
     
     bool begin(bool isServerRole, bool useSecurity, const char* pmk = nullptr, const char* lmk = nullptr);
     void update();
+    
+    // プロトコル処理を専用のFreeRTOSタスクで行う（begin() の後に呼ぶ）
+    // タスクは受信・送信完了の通知と次の期限で起床する。コールバックは引き続き
+    // update() を呼んだタスクから呼ばれ、メッセージはキュー経由で渡される
+    bool beginTask(BaseType_t core = tskNO_AFFINITY, UBaseType_t priority = 2);
+    void endTask();
+    bool isTaskRunning() const { return _task != nullptr; }
+    // エンジンタスクのスタックの最小空き (bytes)。タスクなしは 0
+    uint32_t getTaskStackFree() const { return _task ? (uint32_t)uxTaskGetStackHighWaterMark(_task) : 0; }
+    size_t getAppQueueDepth() const { return _appQueue.size(); }
+    uint32_t getAppOverflowCount() const { return _appOverflows.load(); }
+    
+    // 次に update() で処理が必要になるまでの時間 (ms)。0 はすぐに処理が必要
+    // update() はこの時間まで呼ばなくてよい（受信フレームはキューに溜まる）
+    // beginTask() 時はアプリケーションキューにメッセージがあれば 0、なければ ULONG_MAX
+    unsigned long nextDeadlineMs() const;
     void setDebug(bool enable);
     
     void setBroadcastInterval(unsigned long interval);
+    void setBroadcastIntervalMax(unsigned long interval);
     void setHeartbeatInterval(unsigned long interval);
     void setHeartbeatTimeout(unsigned long timeout);
     void setStatusDisplayInterval(unsigned long interval);
     
+    // 宛先数がこの値以上の送信をブロードキャスト1フレームにまとめる（0で無効）
+    void setFanoutThreshold(size_t threshold);
+    
+    // サーバーのハートビートをブロードキャストビーコン1つにまとめる
+    void setHeartbeatBeacon(bool enable);
+    
     int getServerPeerCount() const;
     int getClientPeerCount() const;
     int getTotalPeerCount() const;
     
-    bool sendToAll(const uint8_t *data, size_t len);
-    bool sendToServer(const uint8_t *data, size_t len);
-    bool sendToClients(const uint8_t *data, size_t len);
+    // 広告の状態（現在のTrickle間隔と送信回数）
+    unsigned long getBroadcastInterval() const { return _advInterval; }
+    uint32_t getAdvertisementCount() const { return _advCount; }
+    
+    // data はペイロードのみ（ヘッダーはライブラリが付加する）
+    // 送信キューへ入れるだけで、実際の送信は送信完了に合わせて update() で行う
+    // （キューまたはバッファが満杯の場合は false）
+    bool sendToAll(const uint8_t *data, size_t len, uint8_t cmd = CMD_DATA);
+    bool sendToServer(const uint8_t *data, size_t len, uint8_t cmd = CMD_DATA);
+    bool sendToClients(const uint8_t *data, size_t len, uint8_t cmd = CMD_DATA);
+    bool sendToPeer(espnow_peer_handle_t handle, const uint8_t *data, size_t len, uint8_t cmd = CMD_DATA);
+    
+    // 型付きメッセージの送信（target はピアハンドルまたは ESPNOW_TARGET_*）
+    // ペイロードは sizeof(T) バイトのみ送られる（セッションモードの保護の分も含めて1フレームに収まる型のみ）
+    template <typename T>
+    bool send(espnow_peer_handle_t target, const T& msg) {
+        static_assert(ESP_NowAdhocTypedCheck<T>::value, "");
+        static_assert(sizeof(T) <= ESPNOW_DATA_SIZE &&
+                          ESPNOW_HEADER_SIZE + sizeof(T) + ESPNOW_SESSION_OVERHEAD <= ESPNOW_FRAME_LIMIT,
+                      "Typed message does not fit in one ESP-NOW frame with session protection");
+        return sendTo(target, (const uint8_t*)&msg, sizeof(T), CMD_TYPED_BASE + T::MESSAGE_ID);
+    }
+    
+    // 型付きメッセージの受信ハンドラー登録（nullptr で解除。同じIDは上書き）
+    template <typename T>
+    void on(void (*handler)(const uint8_t* mac, const T& msg)) {
+        static_assert(ESP_NowAdhocTypedCheck<T>::value, "");
+        espnow_typed_entry_t& entry = _typedHandlers[T::MESSAGE_ID];
+        entry.thunk = handler ? &ESP_NowAdhocTypedThunk<T> : nullptr;
+        entry.handler = reinterpret_cast<espnow_typed_fn_t>(handler);
+        entry.size = sizeof(T);
+    }
+    
+    // ESP-NOWの1フレームを超えるデータを分割送信（最大 ESPNOW_LARGE_DATA_SIZE）
+    // データはコピーされ、フラグメントは送信キューの空きに応じて順に送られる
+    // （前の分割送信が終わるまでは false）
+    bool sendLarge(espnow_peer_handle_t handle, const uint8_t *data, size_t len);
+    bool sendLargeToAll(const uint8_t *data, size_t len);
+    bool sendLargeToServer(const uint8_t *data, size_t len);
+    bool sendLargeToClients(const uint8_t *data, size_t len);
+    bool isSendingLarge() const { return _largeTx.active; }
+    
+    // 信頼性モードで送信（ESP_NowAdhocPeer::sendReliable）
+    bool sendReliable(espnow_peer_handle_t handle, const uint8_t *data, size_t len);
+    
+    // 宛先MACを指定して送信（直接のピアでなければメッシュモードのサーバーが中継する）
+    // 受信側の DataCallback には送信元のMACが渡される（経路がない場合は false）
+    bool sendToMac(const uint8_t* mac, const uint8_t *data, size_t len, uint8_t cmd = CMD_DATA);
+    
+    // メッシュモード（ESP_NowAdhocMesh.cpp）
+    void setMesh(bool enable);
+    bool isMesh() const { return _mesh; }
+    size_t getRouteCount() const { return _routeCount; }
+    uint8_t getRouteHops(const uint8_t* mac) const;  // 直接のピアは1、経路がなければ0
+    const espnow_mesh_stats_t& getMeshStats() const { return _meshStats; }
+    
+    // ドライバーに登録中のピア数と登録の入れ替えの統計
+    size_t getDriverPeerCount() const;
+    const espnow_driver_stats_t& getDriverStats() const { return _driverStats; }
+    
+    // グループ時刻 (us)。基準のサーバーの時刻に合わせたもので、同期前はローカル時刻
+    // （ESP_NowAdhocClock.cpp）
+    uint64_t groupTimeUs() const;
+    bool isClockSynced() const;
+    void setClockSync(bool enable);
+    int64_t getClockOffsetUs() const { return _clockOffset; }
+    float getClockDriftPpm() const { return _clockDrift * 1e6f; }
+    
+    // トピック（ESP_NowAdhocTopic.cpp）
+    // 購読はサーバーへ通知され、クライアントの発行はサーバーを経由して購読者にのみ届く
+    // 受信は setTopicCallback() に、未設定の場合は cmd = CMD_PUBLISH、data = [トピック][ペイロード] で
+    // DataCallback に渡される（発行元のMAC付き）
+    bool subscribe(uint8_t topic);
+    bool unsubscribe(uint8_t topic);
+    uint32_t getSubscriptions() const { return _topics; }
+    bool publish(uint8_t topic, const uint8_t *data, size_t len);
+    size_t getSubscriberCount(uint8_t topic) const;  // サーバー: このトピックを購読している直接のピア数
+    const espnow_topic_stats_t& getTopicStats() const { return _topicStats; }
+    
+    // ペイロード圧縮（ESP_NowAdhocCompress.cpp）。有効時は登録フレームで対応を通知し、
+    // 同じく対応しているピア宛のユニキャストのみ圧縮する（展開は設定によらず行う）
+    void setCompression(bool enable);
+    bool isCompression() const { return _compress; }
+    const espnow_compress_stats_t& getCompressStats() const { return _compressStats; }
+    float getCompressionRatio() const;  // 圧縮したペイロードの 元のバイト数 / 圧縮後のバイト数
+    
+    // 認証付き暗号のセッション（ESP_NowAdhocSession.cpp）。begin() の前に共通鍵を設定すると、
+    // グループ宛のフレームをピアごとの鍵で保護する（nullptr で無効。グループの全ノードで同じ設定にする）
+    // ドライバーの暗号化と異なりピア数の制限がなく、ブロードキャストも保護される
+    bool setSessionKey(const char* secret);
+    bool isSessionMode() const { return _sessionMode; }
+    const espnow_session_stats_t& getSessionStats() const { return _sessionStats; }
+    
+    // クライアントの主サーバー（ESP_NowAdhocServerSelect.cpp）。有効時はサーバー宛の送信を
+    // 評価の最も良いサーバー1台にのみ送り、タイムアウト・連続した送信失敗で次のサーバーへ切り替える
+    void setServerSelect(bool enable);
+    bool isServerSelect() const { return _serverSelect; }
+    espnow_peer_handle_t getPrimaryServer() const;  // 主サーバーがない・無効・サーバーの場合は ESPNOW_INVALID_PEER
+    const espnow_server_select_stats_t& getServerSelectStats() const { return _serverSelectStats; }
+    
+    // ピア一覧のNVSへの保存（ESP_NowAdhocPeerCache.cpp）。begin() の前に設定する
+    void setPeerCache(bool enable);
+    bool isPeerCache() const { return _peerCache; }
+    bool clearPeerCache();  // 保存したピア一覧を消去する
+    const espnow_peer_cache_stats_t& getPeerCacheStats() const { return _peerCacheStats; }
+    
+    // 統計のスナップショット（Serial出力なし。displayStatus() の代わりに定期的に取得して送れる）
+    espnow_stats_t getStats() const;
+    bool getPeerStats(espnow_peer_handle_t handle, espnow_peer_stats_t* stats) const;
+    
+    // バイナリトレース（ESP_NowAdhocTrace.h）
+    // 記録はリングバッファへの書き込みのみで、Serial出力を伴わない。drainTrace() で取り出した
+    // レコードをそのまま書き出し、extras/trace_decode.py でテキストに変換する
+    void setTraceMask(uint8_t mask) { _traceMask.store(mask & ESPNOW_TRACE); }
+    uint8_t getTraceMask() const { return _traceMask.load(); }
+    size_t drainTrace(espnow_trace_record_t* out, size_t max) { return _trace.drain(out, max); }
+    size_t getTraceDepth() const { return _trace.size(); }
+    uint32_t getTraceLostCount() const { return _trace.lost(); }
+    
+    // 送信キューの状態
+    size_t getTxQueueDepth() const { return ESPNOW_TX_QUEUE_SIZE - _txEntryFreeCount; }
+    size_t getTxQueueDepth(espnow_peer_handle_t handle) const;
+    size_t getTxInflight() const { return _txInflight.load() > 0 ? _txInflight.load() : 0; }
+    const espnow_tx_stats_t& getTxStats() const { return _txStats; }
+    float getTxCoalescingRatio() const;
+    
+    // 受信キュー（単一コンシューマー用。update() も内部でこれらを使って処理する）
+    // borrowRxSlot() で最も古い受信フレームを直接参照し、dispatchRxSlot() で
+    // ライブラリの受信処理を行い、releaseRxSlot() でスロットを返却する
+    const espnow_rx_slot_t* borrowRxSlot();
+    void releaseRxSlot();
+    void dispatchRxSlot(const espnow_rx_slot_t* slot);
+    void probeUnknownServer(const espnow_rx_slot_t* slot);
+    size_t getRxQueueDepth() const { return _rxQueue.size(); }
+    uint32_t getRxOverflowCount() const { return _rxOverflows.load(); }
+    
+    // ピアハンドル（ピアが切断されるまで有効。PeerEventCallback内からも取得可能）
+    espnow_peer_handle_t getPeerHandle(const uint8_t* mac) const { return _peers.find(mac); }
+    ESP_NowAdhocPeer* getPeer(espnow_peer_handle_t handle) const { return _peers.get(handle); }
     
     void setGroupID(const char* advGroupID, const char* groupID);
     void setChannel(uint8_t channel);
     
-    // コールバック設定用
+    // コールバック設定用（msg->len が実際のペイロード長）
     typedef void (*DataCallback)(const uint8_t* mac, const espnow_message_t* msg, bool broadcast);
     void setDataCallback(DataCallback callback);
     
+    // 分割送信されたデータの再構築完了時に呼ばれる
+    typedef void (*LargeDataCallback)(const uint8_t* mac, const uint8_t* data, size_t len);
+    void setLargeDataCallback(LargeDataCallback callback);
+    
     typedef void (*PeerEventCallback)(const uint8_t* mac, bool isServer, bool connected);
     void setPeerEventCallback(PeerEventCallback callback);
     
+    // 購読しているトピックへの発行を受け取る（mac は発行元）
+    typedef void (*TopicCallback)(const uint8_t* mac, uint8_t topic, const uint8_t* data, size_t len);
+    void setTopicCallback(TopicCallback callback);
+    
+    // 信頼性モードの送信が再送の上限を超えた（mac は宛先、dropped は破棄した未確認のフレーム数）
+    typedef void (*ReliableFailCallback)(const uint8_t* mac, uint16_t dropped);
+    void setReliableFailCallback(ReliableFailCallback callback);
+    
     // ピアクラスからアクセスするためのゲッター
     bool isServerMode() const { return _isServer; }
     bool debugEnabled() const { return _debugEnabled; }
     DataCallback getDataCallback() const { return _dataCallback; }
     const char* getGroupID() const { return _groupID; }
+    uint32_t getGroupToken() const { return _groupToken; }
+    
+    // グループUUIDからワイヤー上のトークンを算出（キー付きFNV-1a、0は予約）
+    static uint32_t groupToken(const char* groupID);
     void displayStatus();
     
     // 新しいメソッド
     size_t getMaxDataSize() const { return ESPNOW_DATA_SIZE; }
     size_t getMessageSize() const { return sizeof(espnow_message_t); }
-    size_t getESPNOWMaxPayload() const { return ESP_NOW.getMaxDataLen(); }
+    size_t getHeaderSize() const { return ESPNOW_HEADER_SIZE; }
+    
+    // 受信フレームの検証（不正な場合は nullptr）
+    static const espnow_message_t* parseMessage(const uint8_t *data, size_t len);
+    size_t getESPNOWMaxPayload() const;  // 1フレームのヘッダー込みの最大長（セッションの保護で増える分を除く）
 
 private:
     void setupWiFi();
     bool setupESPNow();
     void sendBroadcastAdvertisement();
+    void startAdvertisementInterval(unsigned long now);
+    void resetAdvertisement(bool immediate);
+    void sendRegistration(espnow_peer_handle_t handle, uint8_t cmd = CMD_REGISTER);
     void sendHeartbeats();
-    void checkPeerTimeouts();
+    void sendBeacon();
+    void processBeacon(ESP_NowAdhocPeer* peer, const espnow_message_t* msg);
+    void checkPeerTimeouts(unsigned long now);
+    
+    size_t buildMessage(espnow_message_t *msg, uint8_t cmd, uint32_t groupToken,
+                        const uint8_t *data, size_t len) const;
+    bool sendToPeers(const uint8_t *data, size_t len, uint8_t cmd, bool toServer, bool toClient);
+    bool useFanout(size_t targets) const;
+    bool sendTo(espnow_peer_handle_t target, const uint8_t *data, size_t len, uint8_t cmd);
+    void dispatchTyped(const uint8_t* mac, const espnow_message_t* msg, bool broadcast);
+    
+    // コンパイル時に除外したカテゴリは定数として消える
+    void trace(uint8_t event, const uint8_t* mac = nullptr, uint8_t arg0 = 0, uint32_t arg1 = 0) {
+        if ((ESPNOW_TRACE & ESPNOW_TRACE_CATEGORY(event)) &&
+            (_traceMask.load(std::memory_order_relaxed) & ESPNOW_TRACE_CATEGORY(event))) {
+            _trace.record((uint32_t)micros(), event, mac, arg0, arg1);
+        }
+    }
+    
+    // エンジンとアプリケーションの受け渡し（ESP_NowAdhocTask.cpp）
+    void runEngine();
+    unsigned long engineDeadlineMs() const;
+    static void engineTask(void* arg);
+    void wakeEngine();
+    void deliverMessage(const uint8_t* mac, const espnow_message_t* msg, bool broadcast);
+    void invokeMessage(const uint8_t* mac, const espnow_message_t* msg, bool broadcast);
+    void notifyPeerEvent(const uint8_t* mac, bool isServer, bool connected);
+    void deliverLarge(espnow_reassembly_t* slot);
+    void notifyReliableFail(const uint8_t* mac, uint16_t dropped);
+    void processAppQueue();
+    
+    // 送信スケジューラー（ESP_NowAdhocTx.cpp）
+    uint8_t prepareTxBuffer(uint8_t cmd, uint32_t groupToken, const uint8_t *data, size_t len);
+    void releaseTxBuffer(uint8_t buf);
+    bool enqueueTx(uint8_t queue, uint8_t prio, uint8_t buf);
+    void popTx(uint8_t queue, uint8_t prio);
+    void dropTxQueue(uint8_t queue);
+    bool nextTxQueue(uint8_t *queue, uint8_t *prio);
+    void transmitTx(uint8_t queue, uint8_t prio);
+    void serviceTx();
+    void onTxComplete();
+    
+    // 分割送信・再構築（ESP_NowAdhocFragment.cpp）
+    size_t getFragmentPayloadSize() const;
+    bool sendLargeToPeers(const uint8_t *data, size_t len, espnow_peer_handle_t handle,
+                          bool toServer, bool toClient);
+    void feedLargeTx();
+    void processFragment(const uint8_t* mac, const espnow_message_t* msg);
+    void checkReassemblyTimeouts(unsigned long now);
+    
+    // メッシュモードの経路表と中継（ESP_NowAdhocMesh.cpp）
+    void sendRoutes();
+    void processRoute(espnow_peer_handle_t from, const espnow_message_t* msg);
+    void processRelay(espnow_peer_handle_t from, const espnow_message_t* msg);
+    void expireRoutes(unsigned long now);
+    void dropRoutes(espnow_peer_handle_t via);
+    espnow_route_t* findRoute(const uint8_t* mac);
+    espnow_peer_handle_t nextHop(const uint8_t* mac);
+    bool relaySeen(const uint8_t* src, uint16_t seq);
+    
+    // ハートビートによる時刻同期（ESP_NowAdhocClock.cpp）
+    espnow_peer_handle_t selectClockSource() const;
+    int64_t groupTimeAt(int64_t localUs) const;
+    void scheduleClockRequest();
+    void sendClockRequest();
+    void queueClockHeartbeat(espnow_peer_handle_t handle);
+    void stampClock(ESP_NowAdhocPeer* peer, espnow_message_t* msg);
+    bool isClockExchange(uint8_t queue, uint8_t entry) const;
+    void processClock(ESP_NowAdhocPeer* peer, const espnow_message_t* msg);
+    void adjustClock(int64_t sample, int64_t localUs);
     
+    // トピックの購読管理と転送（ESP_NowAdhocTopic.cpp）
+    uint32_t announcedTopics() const;
+    void sendSubscriptions();
+    void confirmRegistered(ESP_NowAdhocPeer* peer);
+    void processSubscribe(espnow_peer_handle_t from, const espnow_message_t* msg);
+    void processPublish(espnow_peer_handle_t from, const espnow_message_t* msg, bool broadcast);
+    bool fanoutPublish(uint8_t buf, uint8_t topic, espnow_peer_handle_t from, const uint8_t* src);
+    bool topicSeen(const uint8_t* src, uint16_t seq);
+    void dropTopics(espnow_peer_handle_t handle);
+    
+    // ペイロード圧縮（ESP_NowAdhocCompress.cpp）
+    espnow_compress_ctx_t* compressContext(espnow_compress_ctx_t* table, espnow_peer_handle_t handle,
+                                           uint8_t cmd, bool create);
+    size_t compressFrame(ESP_NowAdhocPeer* peer, espnow_peer_handle_t handle, const espnow_message_t* msg,
+                         espnow_message_t* out, espnow_compress_ctx_t** ctx);
+    void commitCompress(ESP_NowAdhocPeer* peer, espnow_compress_ctx_t* ctx, const espnow_message_t* msg,
+                        bool sent);
+    const espnow_message_t* decompressMessage(espnow_peer_handle_t handle, const espnow_message_t* msg);
+    void dropCompress(espnow_peer_handle_t handle);
+    
+    // 認証付き暗号のセッション（ESP_NowAdhocSession.cpp）
+    void beginSession();
+    void sessionDigest(const uint8_t* in, size_t len, uint8_t* out, size_t outLen) const;
+    void appendSessionHello(uint8_t buf);
+    bool checkSessionHello(const uint8_t* mac, const espnow_message_t* msg, espnow_session_hello_t* hello) const;
+    bool updateSession(ESP_NowAdhocPeer* peer, const espnow_session_hello_t* hello);
+    const uint8_t* sealFrame(ESP_NowAdhocPeer* peer, const uint8_t* data, size_t* len);
+    const espnow_message_t* openFrame(ESP_NowAdhocPeer* peer, const espnow_message_t* msg, bool broadcast);
+    
+    // 主サーバーの選択と負荷の通知（ESP_NowAdhocServerSelect.cpp）
+    espnow_peer_handle_t uplinkServer(bool toServer, bool toClient) const;
+    int32_t serverScore(const ESP_NowAdhocPeer* peer, bool joining, bool useRssi) const;
+    void selectPrimaryServer(bool failover);
+    void updateServerScores();
+    void checkFailover();
+    void failoverPrimary(unsigned long silentMs);
+    void appendServerLoad(uint8_t buf);
+    void processServerLoad(ESP_NowAdhocPeer* peer, const espnow_message_t* msg, size_t offset);
+    
+    // ピア一覧の保存と復元（ESP_NowAdhocPeerCache.cpp）
+    void restorePeerCache();
+    void confirmCachedPeer(ESP_NowAdhocPeer* peer);
+    void markPeerCacheDirty();
+    void savePeerCache();
+    
+    // 信頼性モードのバッファ管理（ESP_NowAdhocReliable.cpp）
+    uint8_t allocReliableTxBuffer();
+    void freeReliableTxBuffer(uint8_t buf);
+    uint8_t allocReliableRxBuffer();
+    void freeReliableRxBuffer(uint8_t buf);
+    void serviceReliable(unsigned long now);
+    bool queueReliable(ESP_NowAdhocPeer* peer, uint8_t prio, uint8_t cmd, const uint8_t *data, size_t len);
     
     static void registrationCallback(const esp_now_recv_info_t *info, const uint8_t *data, int len, void *arg);
-    void processRegistration(const esp_now_recv_info_t *info, const uint8_t *data);
-    void addPeer(const uint8_t* mac, bool peerIsServer, bool peerIsSecure);
+    void enqueueReceived(const uint8_t* mac, const uint8_t *data, size_t len, bool broadcast, bool registration,
+                         int8_t rssi = 0, int8_t noiseFloor = 0);
+    void processReceiveQueue();
+    void processRegistration(const uint8_t* mac, const uint8_t *data, size_t len);
+    void addPeer(const uint8_t* mac, bool peerIsServer, bool peerIsSecure,
+                 const espnow_session_hello_t* hello = nullptr);
+    bool acquireDriverSlot(ESP_NowAdhocPeer* peer);
     
     bool _isServer;
     bool _useSecurity;
@@ -145,30 +667,184 @@ private:
     uint8_t _wifiChannel;
     char _advGroupID[37];
     char _groupID[37];
+    uint32_t _advGroupToken;
+    uint32_t _groupToken;
     
     const uint8_t* _pmk;
     const uint8_t* _lmk;
     
-    unsigned long _lastBroadcastTime;
-    unsigned long _lastHeartbeatTime;
-    unsigned long _lastStatusDisplayTime;
+    // 周期処理の期限（update() は期限の来たものだけを処理する）
+    enum {
+        TIMER_ADVERTISE,
+        TIMER_HEARTBEAT,
+        TIMER_PEER_TIMEOUT,  // 最も早くタイムアウトし得る時刻（lastGetMs は増える一方なので下限）
+        TIMER_REASSEMBLY,
+        TIMER_RELIABLE,
+        TIMER_STATUS,
+        TIMER_PEER_CACHE,    // ピア構成の変化をまとめてNVSへ保存する時刻
+        TIMER_CLOCK,         // 時刻の同期要求（ハートビート間隔内のランダムな時点）
+        TIMER_COUNT
+    };
+    unsigned long _timerDue[TIMER_COUNT];
+    uint8_t _timerArmed;  // bit i: TIMER_i が有効
+    void armTimer(uint8_t timer, unsigned long due);
+    void armTimerBefore(uint8_t timer, unsigned long due);
+    void disarmTimer(uint8_t timer) { _timerArmed &= ~(1 << timer); }
+    bool timerDue(uint8_t timer, unsigned long now) const;
+    
+    // 受信コンテキスト・WiFiタスクからの信頼性モードの処理要求（ACK受信・送信失敗）
+    std::atomic<bool> _reliableKick;
     
     unsigned long _broadcastInterval;
+    unsigned long _broadcastIntervalMax;
+    
+    // Trickle方式の広告タイマー
+    unsigned long _advInterval;
+    unsigned long _advIntervalStart;
+    unsigned long _advFireOffset;
+    bool _advFired;
+    uint32_t _advCount;
+    bool _probeNext;  // 次の広告を参加要求として送る（未登録のサーバーのビーコンを受け取った）
     unsigned long _heartbeatInterval;
     unsigned long _heartbeatTimeout;
     unsigned long _statusDisplayInterval;
+    size_t _fanoutThreshold;
+    bool _heartbeatBeacon;
+    unsigned long _lastGroupBroadcastMs;  // グループ宛ブロードキャストの最終送信時刻
+    size_t _beaconCursor;                 // 次のビーコン・経路広告の一覧の先頭（収まらない場合に巡回する）
+    size_t _heartbeatCursor;              // 次のユニキャストのハートビートの開始位置（キューが足りない場合に巡回する）
+    uint8_t _selfMac[6];
     
-    std::vector<ESP_NowAdhocPeer*> _peers;
+    ESP_NowAdhocPool<ESP_NowAdhocPeer, ESPNOW_MAX_PEERS> _peers;
     ESP_NowAdhocPeer* _broadcastPeer;
+    int _serverPeerCount;
+    uint32_t _driverClock;
+    espnow_driver_stats_t _driverStats;
+    
+    ESP_NowAdhocRing<espnow_rx_slot_t, ESPNOW_RX_QUEUE_SIZE> _rxQueue;
+    std::atomic<uint32_t> _rxOverflows;
+    
+    // 受信時の破棄（WiFiタスクの受信コールバックからも更新される）
+    std::atomic<uint32_t> _dropShort;
+    std::atomic<uint32_t> _dropWrongGroup;
+    std::atomic<uint32_t> _dropSecurity;
+    std::atomic<uint32_t> _dropUnknownPeer;
+    
+    ESP_NowAdhocTraceBuffer<ESPNOW_TRACE ? ESPNOW_TRACE_SIZE : 2> _trace;
+    std::atomic<uint8_t> _traceMask;
     
     DataCallback _dataCallback;
+    espnow_typed_entry_t _typedHandlers[ESPNOW_TYPED_MESSAGES];
     PeerEventCallback _peerEventCallback;
+    LargeDataCallback _largeDataCallback;
+    TopicCallback _topicCallback;
+    ReliableFailCallback _reliableFailCallback;
+    
+    // 送信キュー（ピアハンドルごと、末尾はブロードキャスト用）と共有フレームバッファ
+    static const uint8_t TX_BROADCAST_QUEUE = ESPNOW_MAX_PEERS;
+    static const uint8_t TX_QUEUE_COUNT = ESPNOW_MAX_PEERS + 1;
+    espnow_tx_entry_t _txEntries[ESPNOW_TX_QUEUE_SIZE];
+    uint8_t _txEntryFree[ESPNOW_TX_QUEUE_SIZE];
+    uint8_t _txEntryFreeCount;
+    uint8_t _txHead[TX_QUEUE_COUNT][ESPNOW_TX_PRIO_COUNT];
+    uint8_t _txTail[TX_QUEUE_COUNT][ESPNOW_TX_PRIO_COUNT];
+    uint8_t _txDepth[TX_QUEUE_COUNT];
+    uint8_t _txCursor[ESPNOW_TX_PRIO_COUNT];
+    espnow_message_t _txBuf[ESPNOW_TX_BUFFERS];
+    uint16_t _txLen[ESPNOW_TX_BUFFERS];
+    uint8_t _txRefs[ESPNOW_TX_BUFFERS];
+    uint8_t _txBufFree[ESPNOW_TX_BUFFERS];
+    uint8_t _txBufFreeCount;
+    espnow_message_t _txBatch;
+    espnow_tx_stats_t _txStats;
+    
+    // 送信中フレーム数（onSent で減算。WiFiタスクからも更新される）
+    std::atomic<int32_t> _txInflight;
+    bool _txHeld;  // 時刻同期のために送信を止めている（送信完了または期限まで待つ）
+    std::atomic<uint32_t> _txLastActivityMs;
+    
+    uint16_t _nextLargeMsgId;
+    espnow_large_tx_t _largeTx;
+    espnow_reassembly_t _reassembly[ESPNOW_REASSEMBLY_SLOTS];
+    
+    // 信頼性モードのフレームバッファ（送信は再送用、受信は順序待ち用）
+    espnow_message_t _reliableTxBuf[ESPNOW_RELIABLE_TX_BUFFERS];
+    uint8_t _reliableTxFree[ESPNOW_RELIABLE_TX_BUFFERS];
+    uint8_t _reliableTxFreeCount;
+    espnow_message_t _reliableRxBuf[ESPNOW_RELIABLE_RX_BUFFERS];
+    uint8_t _reliableRxFree[ESPNOW_RELIABLE_RX_BUFFERS];
+    uint8_t _reliableRxFreeCount;
+    espnow_message_t _reliableDeliverBuf;
+    
+    bool _mesh;
+    espnow_route_t _routes[ESPNOW_MESH_ROUTES];
+    uint8_t _routeCount;
+    espnow_relay_seen_t _relaySeen[ESPNOW_MESH_DUP_CACHE];
+    uint8_t _relaySeenNext;
+    uint16_t _relaySeq;
+    espnow_message_t _relayDeliverBuf;
+    espnow_mesh_stats_t _meshStats;
+    
+    bool _clockSync;
+    espnow_peer_handle_t _clockSource;
+    int64_t _clockOffset;  // グループ時刻 - ローカル時刻（_clockRefUs の時点）
+    float _clockDrift;     // ローカル時刻1us あたりのずれ
+    int64_t _clockRefUs;
+    uint16_t _clockSamples;
+    uint8_t _clockPoll;  // 次の同期要求までのハートビート回数
+    int64_t _clockQuietUntil;  // 同期の応答待ちで送信を止める期限（0 は止めない）
+    espnow_clock_sample_t _clockHistory[ESPNOW_CLOCK_HISTORY];
+    uint8_t _clockNext;
+    
+    uint32_t _topics;
+    uint32_t _topicPeers[ESPNOW_TOPICS][(ESPNOW_MAX_PEERS + 31) / 32];  // トピックごとの購読ピア（スロット番号のビット）
+    espnow_topic_seen_t _topicSeen[ESPNOW_TOPIC_DUP_CACHE];
+    uint8_t _topicSeenNext;
+    uint16_t _topicSeq;
+    espnow_message_t _topicDeliverBuf;
+    espnow_topic_stats_t _topicStats;
+    
+    bool _compress;
+    espnow_compress_ctx_t _txCompress[ESPNOW_COMPRESS_CONTEXTS];
+    espnow_compress_ctx_t _rxCompress[ESPNOW_COMPRESS_CONTEXTS];
+    uint32_t _compressClock;  // 差分の状態の最終使用（LRUの順序）
+    espnow_lz_state_t _lz;
+    espnow_message_t _compressDeliverBuf;
+    espnow_compress_stats_t _compressStats;
+    
+    bool _sessionMode;
+    char _sessionSecret[ESPNOW_SESSION_SECRET_MAX + 1];
+    uint8_t _sessionNonce[ESPNOW_SESSION_NONCE_SIZE];    // 起動ごとの乱数
+    uint8_t _sessionBcastKey[ESPNOW_SESSION_KEY_SIZE];   // 自分が送るブロードキャストの鍵
+    uint32_t _sessionTxSeq;  // 全フレームで共有するシーケンス番号（最後に使ったもの）
+    uint32_t _sessionEpoch;  // 起動回数（NVSに保存）
+    mbedtls_gcm_context _gcm;
+    espnow_message_t _sessionTxBuf;
+    espnow_message_t _sessionRxBuf;
+    espnow_session_stats_t _sessionStats;
+    
+    bool _serverSelect;
+    espnow_peer_handle_t _primaryServer;
+    std::atomic<bool> _failoverKick;  // WiFiタスクからの主サーバーの送信失敗の通知
+    espnow_server_select_stats_t _serverSelectStats;
+    
+    bool _peerCache;
+    espnow_peer_cache_stats_t _peerCacheStats;
+    unsigned long _peerCacheSavedMs;  // 最後にNVSへ書き込んだ（または読み込んだ）時刻
+    uint8_t _peerCacheBlob[ESPNOW_PEER_CACHE_BLOB_SIZE];  // 読み書きの作業領域（エンジンタスクのスタックに置かない）
+    
+    TaskHandle_t _task;
+    SemaphoreHandle_t _lock;
+    ESP_NowAdhocRing<espnow_app_slot_t, ESPNOW_APP_QUEUE_SIZE> _appQueue;
+    std::atomic<uint32_t> _appOverflows;
     
     char _pmkString[33];
     char _lmkString[33];
     
     // フレンドクラスとしてESP_NowAdhocPeerを宣言
     friend class ESP_NowAdhocPeer;
+    // ホストのベンチマーク（extras/host/tools/adhoc_bench.cpp）
+    friend class ESP_NowAdhocBench;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,249 @@
+#include "ESP_NowAdhoc.h"
+
+// ==================== グループ時刻 ====================
+
+// 時刻の基準: MACが最も小さいサーバー（自分がサーバーで最も小さい場合は ESPNOW_INVALID_PEER）
+espnow_peer_handle_t ESP_NowAdhoc::selectClockSource() const {
+    espnow_peer_handle_t best = ESPNOW_INVALID_PEER;
+    const uint8_t* bestMac = _isServer ? _selfMac : nullptr;
+    for (size_t i = 0; i < _peers.size(); i++) {
+        ESP_NowAdhocPeer* peer = _peers.at(i);
+        if (!peer->isServer) {
+            continue;
+        }
+        if (!bestMac || memcmp(peer->addr(), bestMac, 6) < 0) {
+            best = _peers.handleAt(i);
+            bestMac = peer->addr();
+        }
+    }
+    return best;
+}
+
+// 基準を持たない間（自分が基準・ピアなし）は最後の推定のまま進める
+int64_t ESP_NowAdhoc::groupTimeAt(int64_t localUs) const {
+    return localUs + _clockOffset + (int64_t)(_clockDrift * (float)(localUs - _clockRefUs));
+}
+
+uint64_t ESP_NowAdhoc::groupTimeUs() const {
+    ESP_NowAdhocLock lock(_lock);
+    return (uint64_t)groupTimeAt(esp_timer_get_time());
+}
+
+bool ESP_NowAdhoc::isClockSynced() const {
+    if (_clockSource == ESPNOW_INVALID_PEER) {
+        return _isServer && _clockSync;
+    }
+    return _clockSamples >= ESPNOW_CLOCK_MIN_SAMPLES;
+}
+
+void ESP_NowAdhoc::setClockSync(bool enable) {
+    ESP_NowAdhocLock lock(_lock, _task);
+    _clockSync = enable;
+    _clockSource = ESPNOW_INVALID_PEER;
+    _clockSamples = 0;
+    _clockPoll = 0;
+    _clockQuietUntil = 0;
+}
+
+// ハートビートのタイマーから呼ばれ、要求する回なら間隔内のランダムな時点に送る
+// （他の周期的なフレームと毎回同じ位相で重なると、すべてのサンプルが同じ向きに偏る）
+void ESP_NowAdhoc::scheduleClockRequest() {
+    if (!_clockSync) {
+        return;
+    }
+
+    espnow_peer_handle_t source = selectClockSource();
+    if (source != _clockSource) {
+        _clockSource = source;
+        _clockSamples = 0;
+        _clockPoll = 0;
+    }
+    if (source == ESPNOW_INVALID_PEER) {
+        return;
+    }
+
+    // 同期後は周波数のずれを補正して進めるため、要求の間隔を空ける
+    if (_clockPoll > 0) {
+        _clockPoll--;
+        return;
+    }
+    _clockPoll = isClockSynced() ? ESPNOW_CLOCK_POLL - 1 : 0;
+    armTimer(TIMER_CLOCK, millis() + (_heartbeatInterval > 1 ? esp_random() % _heartbeatInterval : 0));
+}
+
+// 他のフレームを送っていても基準のピアには送る（待つ間に基準が変わっていれば次の回にする）
+void ESP_NowAdhoc::sendClockRequest() {
+    if (!_clockSync || _clockSource == ESPNOW_INVALID_PEER || selectClockSource() != _clockSource) {
+        return;
+    }
+    _peers.get(_clockSource)->_clock.request = true;
+    queueClockHeartbeat(_clockSource);
+}
+
+void ESP_NowAdhoc::queueClockHeartbeat(espnow_peer_handle_t handle) {
+    // 送信待ちのハートビートがあれば、送信時にそちらへ記入される
+    // （同じクラスの他のフレーム（経路広告など）には記入されないため、その場合は積む）
+    for (uint8_t e = _txHead[_peers.slot(handle)][ESPNOW_TX_PRIO_HEARTBEAT]; e != ESPNOW_TX_NONE; e = _txEntries[e].next) {
+        if (_txBuf[_txEntries[e].buf].cmd == CMD_HEARTBEAT) {
+            return;
+        }
+    }
+
+    espnow_clock_t clock = {};
+    uint8_t buf = prepareTxBuffer(CMD_HEARTBEAT, _groupToken, (const uint8_t *)&clock, sizeof(clock));
+    if (buf == ESPNOW_NO_BUFFER) {
+        return;
+    }
+    appendServerLoad(buf);
+    if (enqueueTx(_peers.slot(handle), ESPNOW_TX_PRIO_HEARTBEAT, buf)) {
+        trace(ESPNOW_TRACE_EV_TX_HEARTBEAT, _peers.get(handle)->addr());
+    }
+    releaseTxBuffer(buf);
+}
+
+// 送信直前に時刻を記入する（バッファは複数のピアで共有されるため宛先ごとに書き換える）
+void ESP_NowAdhoc::stampClock(ESP_NowAdhocPeer* peer, espnow_message_t* msg) {
+    if (msg->len < sizeof(espnow_clock_t)) {
+        return;
+    }
+
+    espnow_peer_clock_t& state = peer->_clock;
+    int64_t now = esp_timer_get_time();
+    espnow_clock_t clock;
+    clock.txUs = (uint64_t)groupTimeAt(now);
+    clock.echoUs = state.echoUs;
+    clock.holdUs = state.echoPending ? (uint32_t)(now - state.echoRxUs) : 0;
+
+    msg->flags &= ~(ESPNOW_FLAG_CLOCK_REQUEST | ESPNOW_FLAG_CLOCK_ECHO);
+    state.sentRequest = state.request;
+    if (state.echoPending) {
+        msg->flags |= ESPNOW_FLAG_CLOCK_ECHO;
+        state.echoPending = false;
+    }
+    if (state.request) {
+        msg->flags |= ESPNOW_FLAG_CLOCK_REQUEST;
+        state.request = false;
+        // 応答が届くまで他のフレームを送らない（計測前は上限まで）
+        uint32_t quiet = state.rttValid ? state.minRtt + ESPNOW_CLOCK_RTT_MARGIN_US : ESPNOW_CLOCK_QUIET_US;
+        _clockQuietUntil = now + (quiet < ESPNOW_CLOCK_QUIET_US ? quiet : ESPNOW_CLOCK_QUIET_US);
+    }
+    state.echoRequested = false;
+    memcpy(msg->data, &clock, sizeof(clock));
+
+    state.sentUs = (uint32_t)clock.txUs;
+    state.sentLocalUs = now;
+}
+
+void ESP_NowAdhoc::processClock(ESP_NowAdhocPeer* peer, const espnow_message_t* msg) {
+    if (msg->len < sizeof(espnow_clock_t)) {
+        return;
+    }
+
+    espnow_clock_t clock;
+    memcpy(&clock, msg->data, sizeof(clock));
+    espnow_peer_clock_t& state = peer->_clock;
+    int64_t rxUs = peer->_rxUs;
+
+    // 自分が送った時刻のエコーなら往復時間を求める（1回の送信につき1回だけ使う）
+    // t1: 送信 t2: 相手の受信 t3: 相手の送信 t4: 受信（t3 - t2 = holdUs）
+    if ((msg->flags & ESPNOW_FLAG_CLOCK_ECHO) && state.sentLocalUs != 0 && clock.echoUs == state.sentUs) {
+        int64_t rtt = (rxUs - state.sentLocalUs) - (int64_t)clock.holdUs;
+        state.sentLocalUs = 0;
+        if (_peers.find(peer->addr()) == _clockSource) {
+            _clockQuietUntil = 0;
+        }
+        if (rtt >= 0 && rtt < (int64_t)_heartbeatTimeout * 1000) {
+            // 片道だけ待たされたサンプル（RTTが最小より大きい）は時刻の誤差が大きいため同期に使わない
+            // （平滑RTTは通信中に膨らみ、待たされたサンプルまで通してしまう）
+            uint32_t sample = (uint32_t)rtt;
+            bool usable = !state.rttValid || sample <= state.minRtt + ESPNOW_CLOCK_RTT_MARGIN_US;
+
+            if (!state.rttValid) {
+                state.srtt = sample;
+                state.jitter = sample / 2;
+                state.minRtt = sample;
+                state.rttValid = true;
+            } else {
+                // 経路の変化に追従するため、長いサンプルでも少しずつ引き上げる
+                // （要求していない応答は相手の周期的なハートビートで返るため、片道の待ちが大きく引き上げに使わない）
+                if (sample < state.minRtt) {
+                    state.minRtt = sample;
+                } else if (state.sentRequest) {
+                    state.minRtt += (sample - state.minRtt) / 16;
+                }
+                uint32_t delta = (state.srtt > sample) ? state.srtt - sample : sample - state.srtt;
+                state.jitter = (3 * state.jitter + delta) / 4;
+                state.srtt = (7 * state.srtt + sample) / 8;
+            }
+
+            if (usable && _clockSync && _peers.find(peer->addr()) == _clockSource) {
+                adjustClock((int64_t)clock.txUs + rtt / 2 - rxUs, rxUs);
+            }
+        }
+    }
+
+    // 相手の送信時刻は次にこのピアへ送るハートビートで返す
+    state.echoUs = (uint32_t)clock.txUs;
+    state.echoRxUs = rxUs;
+    state.echoPending = true;
+
+    if (msg->flags & ESPNOW_FLAG_CLOCK_REQUEST) {
+        state.echoRequested = true;
+        queueClockHeartbeat(_peers.find(peer->addr()));
+    }
+}
+
+// 同期の要求・応答になるハートビートか（送信の順序と結合の判断に使う）
+bool ESP_NowAdhoc::isClockExchange(uint8_t queue, uint8_t entry) const {
+    if (!_clockSync || queue == TX_BROADCAST_QUEUE || _txBuf[_txEntries[entry].buf].cmd != CMD_HEARTBEAT) {
+        return false;
+    }
+    const ESP_NowAdhocPeer* peer = _peers.atSlot(queue);
+    return peer && (peer->_clock.request || peer->_clock.echoRequested);
+}
+
+// sample: 基準のグループ時刻 - ローカル時刻（localUs の時点）
+// 直近のサンプルに直線を当てはめ、傾きを周波数のずれ、localUs での値をオフセットとする
+void ESP_NowAdhoc::adjustClock(int64_t sample, int64_t localUs) {
+    int64_t error = sample - (groupTimeAt(localUs) - localUs);
+    if (_clockSamples == 0 || error > ESPNOW_CLOCK_STEP_US || error < -ESPNOW_CLOCK_STEP_US) {
+        _clockOffset = sample;
+        _clockDrift = 0;
+        _clockRefUs = localUs;
+        _clockSamples = 0;
+        _clockNext = 0;
+    }
+
+    _clockHistory[_clockNext] = {localUs, sample};
+    _clockNext = (_clockNext + 1) % ESPNOW_CLOCK_HISTORY;
+    if (_clockSamples < 0xFFFF) {
+        _clockSamples++;
+    }
+    size_t count = _clockSamples < ESPNOW_CLOCK_HISTORY ? _clockSamples : ESPNOW_CLOCK_HISTORY;
+    if (count < 2) {
+        return;
+    }
+
+    // 最新のサンプルからの差で計算する（数秒分の us は double で誤差なく扱える）
+    double sumX = 0, sumY = 0;
+    for (size_t i = 0; i < count; i++) {
+        sumX += (double)(_clockHistory[i].localUs - localUs);
+        sumY += (double)(_clockHistory[i].offsetUs - sample);
+    }
+    double meanX = sumX / count;
+    double meanY = sumY / count;
+    double sxx = 0, sxy = 0;
+    for (size_t i = 0; i < count; i++) {
+        double dx = (double)(_clockHistory[i].localUs - localUs) - meanX;
+        sxy += dx * ((double)(_clockHistory[i].offsetUs - sample) - meanY);
+        sxx += dx * dx;
+    }
+    if (sxx <= 0) {
+        return;
+    }
+
+    double slope = sxy / sxx;
+    _clockDrift = (float)slope;
+    _clockOffset = sample + (int64_t)(meanY - slope * meanX);
+    _clockRefUs = localUs;
+}
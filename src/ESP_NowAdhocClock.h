@@ -0,0 +1,76 @@
+#ifndef ESP_NowAdhocClock_H
+#define ESP_NowAdhocClock_H
+
+#include <stdint.h>
+#include <esp_timer.h>
+
+// ハートビートによるRTT計測とグループ時刻の同期
+// ハートビートに送信時刻と、相手から受け取った送信時刻のエコーを載せる（NTPと同じ4時刻の計算）
+// 各ノードはMACが最も小さいサーバー（自分がサーバーでより小さい場合は自分）を時刻の基準とし、
+// 基準のピアへハートビート間隔ごとに同期要求を送る。setClockSync() でも切り替え可能
+#ifndef ESPNOW_CLOCK_SYNC
+#define ESPNOW_CLOCK_SYNC true
+#endif
+
+// 推定値との差がこれを超えるサンプルは補正せず、時刻をその値に合わせ直す (us)
+#ifndef ESPNOW_CLOCK_STEP_US
+#define ESPNOW_CLOCK_STEP_US 5000
+#endif
+
+// 同期後の同期要求の間隔（ハートビート間隔の倍数。同期前は毎回送る）
+#ifndef ESPNOW_CLOCK_POLL
+#define ESPNOW_CLOCK_POLL 4
+#endif
+
+// オフセットと周波数のずれを最小二乗で求めるサンプル数
+#ifndef ESPNOW_CLOCK_HISTORY
+#define ESPNOW_CLOCK_HISTORY 8
+#endif
+
+// 同期済みとみなすまでのサンプル数
+#ifndef ESPNOW_CLOCK_MIN_SAMPLES
+#define ESPNOW_CLOCK_MIN_SAMPLES 4
+#endif
+
+// 最小RTTからこれ以上長いサンプルは片道だけ待たされたとみなし同期に使わない (us)
+// （時刻の誤差はこの半分まで。最小RTTは長いサンプルが続くと少しずつ引き上げる）
+#ifndef ESPNOW_CLOCK_RTT_MARGIN_US
+#define ESPNOW_CLOCK_RTT_MARGIN_US 200
+#endif
+
+// 同期要求を送ってから応答が届くまで他のフレームを送らない時間の上限 (us)
+// （最小RTT + ESPNOW_CLOCK_RTT_MARGIN_US まで。自分の後続のフレームで応答が待たされないようにする）
+#ifndef ESPNOW_CLOCK_QUIET_US
+#define ESPNOW_CLOCK_QUIET_US 10000
+#endif
+
+// CMD_HEARTBEAT の data（送信直前に記入する）
+typedef struct __attribute__((packed)) {
+    uint64_t txUs;    // 送信時のグループ時刻
+    uint32_t echoUs;  // 相手から最後に受け取った txUs の下位32ビット
+    uint32_t holdUs;  // echoUs の受信からこのフレームの送信までの時間
+} espnow_clock_t;
+
+// 時刻同期のサンプル（基準のグループ時刻 - ローカル時刻）
+typedef struct {
+    int64_t localUs;
+    int64_t offsetUs;
+} espnow_clock_sample_t;
+
+// ピアごとの時刻の交換状態
+typedef struct {
+    uint32_t echoUs;
+    int64_t echoRxUs;     // echoUs を受信した時刻（ローカル）
+    bool echoPending;
+    uint32_t sentUs;      // 最後に送った txUs の下位32ビット
+    int64_t sentLocalUs;  // その送信時刻（ローカル。0 は応答待ちなし）
+    bool sentRequest;     // その送信が同期要求だった（応答がすぐ返るため最小RTTの追従に使える）
+    uint32_t srtt;        // 平滑RTT (us)
+    uint32_t jitter;      // RTTの平均偏差 (us)
+    uint32_t minRtt;      // 最小RTT (us)
+    bool rttValid;
+    bool request;         // 次のハートビートで応答を求める
+    bool echoRequested;   // 相手から応答を求められている（次のハートビートは同期に使われる）
+} espnow_peer_clock_t;
+
+#endif
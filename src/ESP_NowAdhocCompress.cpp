@@ -0,0 +1,338 @@
+#include "ESP_NowAdhoc.h"
+
+static const uint8_t LZ_DICT[] = ESPNOW_COMPRESS_DICT;
+static const uint16_t LZ_NONE = 0xFFFF;
+
+// ==================== LZ符号 ====================
+
+// 窓は辞書の後ろに入力を続けたもの
+static inline uint8_t lzAt(const uint8_t* src, size_t pos) {
+    return pos < ESPNOW_COMPRESS_DICT_LEN ? LZ_DICT[pos] : src[pos - ESPNOW_COMPRESS_DICT_LEN];
+}
+
+static inline uint32_t lzHash(const uint8_t* src, size_t pos) {
+    uint32_t v = lzAt(src, pos) | (lzAt(src, pos + 1) << 8) | (lzAt(src, pos + 2) << 16);
+    return (v * 2654435761u) >> (32 - ESPNOW_LZ_HASH_BITS);
+}
+
+static inline void lzInsert(espnow_lz_state_t* lz, const uint8_t* src, size_t pos, size_t total) {
+    if (pos + ESPNOW_LZ_MIN_MATCH > total) {
+        return;
+    }
+    uint32_t h = lzHash(src, pos);
+    lz->prev[pos] = lz->head[h];
+    lz->head[h] = pos;
+}
+
+static bool lzLiterals(const uint8_t* src, size_t from, size_t to, uint8_t* out, size_t* o, size_t cap) {
+    while (from < to) {
+        size_t n = to - from > 128 ? 128 : to - from;
+        if (*o + 1 + n > cap) {
+            return false;
+        }
+        out[(*o)++] = n - 1;
+        for (size_t i = 0; i < n; i++) {
+            out[(*o)++] = lzAt(src, from + i);
+        }
+        from += n;
+    }
+    return true;
+}
+
+// 符号の長さを返す（cap に収まらない場合は 0）
+static size_t lzEncode(espnow_lz_state_t* lz, const uint8_t* src, size_t len, uint8_t* out, size_t cap) {
+    size_t total = ESPNOW_COMPRESS_DICT_LEN + len;
+    memset(lz->head, 0xFF, sizeof(lz->head));
+    for (size_t pos = 0; pos < ESPNOW_COMPRESS_DICT_LEN; pos++) {
+        lzInsert(lz, src, pos, total);
+    }
+
+    size_t o = 0;
+    size_t pos = ESPNOW_COMPRESS_DICT_LEN;
+    size_t literal = pos;
+    while (pos < total) {
+        size_t best = 0;
+        size_t bestOffset = 0;
+        if (pos + ESPNOW_LZ_MIN_MATCH <= total) {
+            size_t max = total - pos < ESPNOW_LZ_MAX_MATCH ? total - pos : ESPNOW_LZ_MAX_MATCH;
+            uint16_t cand = lz->head[lzHash(src, pos)];
+            for (int depth = 0; cand != LZ_NONE && depth < ESPNOW_LZ_CHAIN; depth++, cand = lz->prev[cand]) {
+                size_t offset = pos - cand;
+                if (offset > ESPNOW_LZ_MAX_OFFSET) {
+                    break;
+                }
+                // 距離より長い一致は展開側で1バイトずつコピーするため重なってよい
+                size_t n = 0;
+                while (n < max && lzAt(src, cand + n) == lzAt(src, pos + n)) {
+                    n++;
+                }
+                if (n > best) {
+                    best = n;
+                    bestOffset = offset;
+                    if (n == max) {
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (best < ESPNOW_LZ_MIN_MATCH) {
+            lzInsert(lz, src, pos, total);
+            pos++;
+            continue;
+        }
+
+        if (!lzLiterals(src, literal, pos, out, &o, cap)) {
+            return 0;
+        }
+        size_t extra = best - ESPNOW_LZ_MIN_MATCH;
+        if (o + (extra >= 31 ? 3 : 2) > cap) {
+            return 0;
+        }
+        out[o++] = 0x80 | ((bestOffset >> 8) << 5) | (extra >= 31 ? 31 : extra);
+        out[o++] = bestOffset & 0xFF;
+        if (extra >= 31) {
+            out[o++] = extra - 31;
+        }
+        for (size_t i = 0; i < best; i++) {
+            lzInsert(lz, src, pos + i, total);
+        }
+        pos += best;
+        literal = pos;
+    }
+
+    if (!lzLiterals(src, literal, pos, out, &o, cap)) {
+        return 0;
+    }
+    return o;
+}
+
+// 展開した長さを返す（符号が壊れている場合は -1）
+static int lzDecode(const uint8_t* src, size_t len, uint8_t* out, size_t cap) {
+    size_t i = 0;
+    size_t o = 0;
+    while (i < len) {
+        uint8_t c = src[i++];
+        if (!(c & 0x80)) {
+            size_t n = c + 1;
+            if (i + n > len || o + n > cap) {
+                return -1;
+            }
+            memcpy(out + o, src + i, n);
+            i += n;
+            o += n;
+            continue;
+        }
+
+        if (i >= len) {
+            return -1;
+        }
+        size_t offset = ((size_t)((c >> 5) & 0x03) << 8) | src[i++];
+        size_t n = ESPNOW_LZ_MIN_MATCH + (c & 0x1F);
+        if ((c & 0x1F) == 31) {
+            if (i >= len) {
+                return -1;
+            }
+            n += src[i++];
+        }
+        if (offset == 0 || offset > ESPNOW_COMPRESS_DICT_LEN + o || o + n > cap) {
+            return -1;
+        }
+        for (size_t k = 0; k < n; k++, o++) {
+            size_t pos = ESPNOW_COMPRESS_DICT_LEN + o - offset;
+            out[o] = pos < ESPNOW_COMPRESS_DICT_LEN ? LZ_DICT[pos] : out[pos - ESPNOW_COMPRESS_DICT_LEN];
+        }
+    }
+    return (int)o;
+}
+
+// ==================== 差分の状態 ====================
+
+void ESP_NowAdhoc::setCompression(bool enable) {
+    ESP_NowAdhocLock lock(_lock);
+    _compress = enable;
+}
+
+float ESP_NowAdhoc::getCompressionRatio() const {
+    return _compressStats.codedBytes ? (float)_compressStats.rawBytes / _compressStats.codedBytes : 1.0f;
+}
+
+espnow_compress_ctx_t* ESP_NowAdhoc::compressContext(espnow_compress_ctx_t* table, espnow_peer_handle_t handle,
+                                                     uint8_t cmd, bool create) {
+    espnow_compress_ctx_t* lru = &table[0];
+    for (size_t i = 0; i < ESPNOW_COMPRESS_CONTEXTS; i++) {
+        espnow_compress_ctx_t* ctx = &table[i];
+        if (ctx->handle == handle && ctx->cmd == cmd) {
+            ctx->lastUse = ++_compressClock;
+            return ctx;
+        }
+        if (lru->handle != ESPNOW_INVALID_PEER &&
+            (ctx->handle == ESPNOW_INVALID_PEER || (int32_t)(ctx->lastUse - lru->lastUse) < 0)) {
+            lru = ctx;
+        }
+    }
+    if (!create) {
+        return nullptr;
+    }
+
+    memset(lru, 0, sizeof(*lru));
+    lru->handle = handle;
+    lru->cmd = cmd;
+    lru->lastUse = ++_compressClock;
+    return lru;
+}
+
+// 切断したピアの状態を捨てる（ハンドルは再利用される）
+void ESP_NowAdhoc::dropCompress(espnow_peer_handle_t handle) {
+    for (size_t i = 0; i < ESPNOW_COMPRESS_CONTEXTS; i++) {
+        if (_txCompress[i].handle == handle) {
+            _txCompress[i].handle = ESPNOW_INVALID_PEER;
+        }
+        if (_rxCompress[i].handle == handle) {
+            _rxCompress[i].handle = ESPNOW_INVALID_PEER;
+        }
+    }
+}
+
+// ==================== 送信 ====================
+
+// 送信直前に out へ圧縮したフレームを作る（圧縮しない場合は 0）
+// 差分の基準は送信完了（リンク層のACK）を確認できたフレームのうち新しいもの。そのフレーム以降に
+// このピアへの送信失敗があれば使わず、基準なしで送り直す
+size_t ESP_NowAdhoc::compressFrame(ESP_NowAdhocPeer* peer, espnow_peer_handle_t handle, const espnow_message_t* msg,
+                                   espnow_message_t* out, espnow_compress_ctx_t** ctxOut) {
+    if (!_compress || !peer->canCompress ||
+        msg->len <= sizeof(espnow_compress_hdr_t) + 1 || msg->len > ESPNOW_COMPRESS_MAX_LEN ||
+        (msg->cmd != CMD_DATA && msg->cmd < CMD_TYPED_BASE)) {
+        return 0;
+    }
+
+    uint32_t start = ESP.getCycleCount();
+    espnow_compress_ctx_t* ctx = compressContext(_txCompress, handle, msg->cmd, true);
+    uint32_t failed = peer->txFailed.load();
+    uint32_t done = peer->txSuccess.load() + failed;
+
+    const espnow_compress_base_t* base = nullptr;
+    if (ctx->sinceKey < ESPNOW_COMPRESS_KEYFRAME) {
+        for (uint8_t k = 0; k < 2; k++) {
+            const espnow_compress_base_t* b = &ctx->base[k == 0 ? ctx->newest : ctx->newest ^ 1];
+            if (b->len && (int32_t)(done - b->txIndex) >= 0 && b->txFailed == failed) {
+                base = b;
+                break;
+            }
+        }
+    }
+
+    uint8_t delta[ESPNOW_COMPRESS_MAX_LEN];
+    const uint8_t* src = (const uint8_t*)msg->data;
+    if (base) {
+        for (size_t i = 0; i < msg->len; i++) {
+            delta[i] = src[i] ^ (i < base->len ? base->data[i] : 0);
+        }
+        src = delta;
+    }
+
+    // 元より短くならなければ圧縮しない（受信側の基準も更新されない）
+    espnow_compress_hdr_t hdr = {ctx->nextSeq, base ? base->seq : (uint8_t)ESPNOW_COMPRESS_NO_BASE};
+    size_t coded = lzEncode(&_lz, src, msg->len, (uint8_t*)out->data + sizeof(hdr),
+                            msg->len - sizeof(hdr) - 1);
+    _compressStats.encodeCycles += ESP.getCycleCount() - start;
+    if (coded == 0) {
+        _compressStats.skipped++;
+        return 0;
+    }
+
+    memcpy(out, msg, ESPNOW_HEADER_SIZE);
+    memcpy(out->data, &hdr, sizeof(hdr));
+    out->flags |= ESPNOW_FLAG_COMPRESSED;
+    out->len = sizeof(hdr) + coded;
+
+    ctx->delta = (base != nullptr);
+    ctx->txFailed = failed;
+    *ctxOut = ctx;
+
+    _compressStats.frames++;
+    _compressStats.rawBytes += msg->len;
+    _compressStats.codedBytes += out->len;
+    if (base) {
+        _compressStats.deltaFrames++;
+    }
+    return ESPNOW_HEADER_SIZE + out->len;
+}
+
+// 送信後に元のペイロードを基準として保持する（受信側と同じく直近の2フレーム）
+void ESP_NowAdhoc::commitCompress(ESP_NowAdhocPeer* peer, espnow_compress_ctx_t* ctx, const espnow_message_t* msg,
+                                  bool sent) {
+    if (!sent) {
+        return;
+    }
+
+    uint8_t slot = ctx->newest ^ 1;
+    espnow_compress_base_t* b = &ctx->base[slot];
+    b->seq = ctx->nextSeq;
+    b->len = msg->len;
+    b->txIndex = peer->txAttempts;
+    b->txFailed = ctx->txFailed;
+    memcpy(b->data, msg->data, msg->len);
+    ctx->newest = slot;
+    ctx->nextSeq = (ctx->nextSeq + 1) % ESPNOW_COMPRESS_NO_BASE;
+    ctx->sinceKey = ctx->delta ? ctx->sinceKey + 1 : 0;
+}
+
+// ==================== 受信 ====================
+
+// 展開したメッセージを返す（展開できない場合は nullptr。次の基準なしのフレームで復帰する）
+const espnow_message_t* ESP_NowAdhoc::decompressMessage(espnow_peer_handle_t handle, const espnow_message_t* msg) {
+    espnow_compress_hdr_t hdr;
+    if (msg->len < sizeof(hdr)) {
+        _compressStats.decodeErrors++;
+        return nullptr;
+    }
+    memcpy(&hdr, msg->data, sizeof(hdr));
+
+    uint32_t start = ESP.getCycleCount();
+    bool keyframe = (hdr.base == ESPNOW_COMPRESS_NO_BASE);
+    espnow_compress_ctx_t* ctx = compressContext(_rxCompress, handle, msg->cmd, keyframe);
+    const espnow_compress_base_t* base = nullptr;
+    if (ctx && !keyframe) {
+        for (uint8_t k = 0; k < 2; k++) {
+            if (ctx->base[k].len && ctx->base[k].seq == hdr.base) {
+                base = &ctx->base[k];
+            }
+        }
+    }
+
+    espnow_message_t* out = &_compressDeliverBuf;
+    int len = -1;
+    if (ctx && (keyframe || base)) {
+        len = lzDecode((const uint8_t*)msg->data + sizeof(hdr), msg->len - sizeof(hdr),
+                       (uint8_t*)out->data, ESPNOW_COMPRESS_MAX_LEN);
+    }
+    if (len <= 0) {
+        _compressStats.decodeErrors++;
+        trace(ESPNOW_TRACE_EV_RX_DROP, _peers.get(handle)->addr(), ESPNOW_TRACE_DROP_DECOMPRESS, msg->len);
+        return nullptr;
+    }
+
+    if (base) {
+        for (int i = 0; i < len && i < base->len; i++) {
+            out->data[i] ^= base->data[i];
+        }
+    }
+
+    uint8_t slot = ctx->newest ^ 1;
+    espnow_compress_base_t* b = &ctx->base[slot];
+    b->seq = hdr.seq;
+    b->len = len;
+    memcpy(b->data, out->data, len);
+    ctx->newest = slot;
+
+    memcpy(out, msg, ESPNOW_HEADER_SIZE);
+    out->flags &= ~ESPNOW_FLAG_COMPRESSED;
+    out->len = len;
+
+    _compressStats.decodeCycles += ESP.getCycleCount() - start;
+    _compressStats.decoded++;
+    _compressStats.decodedBytes += len;
+    return out;
+}
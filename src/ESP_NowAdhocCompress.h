@@ -0,0 +1,101 @@
+#ifndef ESP_NowAdhocCompress_H
+#define ESP_NowAdhocCompress_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "ESP_NowAdhocPool.h"
+
+// CMD_DATA・型付きメッセージのペイロード圧縮（ユニキャストで単独のフレームのみ）
+// 同じピア・同じコマンドで前に送ったペイロードとのXOR差分を取り、静的辞書付きのLZで符号化する
+// 登録フレームで展開に対応していると通知したピアにのみ使う。setCompression() でも切り替え可能
+#ifndef ESPNOW_COMPRESS
+#define ESPNOW_COMPRESS false
+#endif
+
+// 差分の基準を保持する（ピア, コマンド）の組の数（送信・受信それぞれ。足りない場合は
+// 最も長く使っていない組を入れ替え、受信側で入れ替えられた組は次の基準なしのフレームまで展開できない）
+#ifndef ESPNOW_COMPRESS_CONTEXTS
+#define ESPNOW_COMPRESS_CONTEXTS 4
+#endif
+
+// この数のフレームごとに基準なしで送る（受信キューの溢れなど、送信側で検出できない基準の欠落からの復帰用）
+#ifndef ESPNOW_COMPRESS_KEYFRAME
+#define ESPNOW_COMPRESS_KEYFRAME 16
+#endif
+
+// LZの静的辞書（送受信で同じものを使う。最大 ESPNOW_LZ_MAX_DICT バイト）
+#ifndef ESPNOW_COMPRESS_DICT
+#define ESPNOW_COMPRESS_DICT \
+    "{\"id\":\"type\":\"name\":\"value\":\"state\":\"status\":\"time\":\"count\":" \
+    "\"temperature\":\"humidity\":\"pressure\":\"battery\":\"voltage\":\"current\":\"rssi\":true,false,null}"
+#endif
+
+#define ESPNOW_COMPRESS_DICT_LEN (sizeof(ESPNOW_COMPRESS_DICT) - 1)
+
+// 圧縮するペイロードの最大長（ESP-NOW v1 の1フレーム 250 - ESPNOW_HEADER_SIZE。これより長いものはそのまま送る）
+#define ESPNOW_COMPRESS_MAX_LEN 238
+
+// LZの符号
+// 0xxxxxxx: 続く x+1 バイトはリテラル
+// 1ooLLLLL oooooooo: 距離 o（辞書 + 出力済みの末尾から、1..1023）の L+3 バイトをコピー
+//                   （L = 31 のときは続く1バイトを長さに加える）
+#define ESPNOW_LZ_MIN_MATCH 3
+#define ESPNOW_LZ_MAX_MATCH (ESPNOW_LZ_MIN_MATCH + 31 + 255)
+#define ESPNOW_LZ_MAX_OFFSET 1023
+#define ESPNOW_LZ_MAX_DICT 512
+#define ESPNOW_LZ_HASH_BITS 8
+#define ESPNOW_LZ_CHAIN 16  // 一致を探す候補の最大数
+
+static_assert(ESPNOW_COMPRESS_DICT_LEN <= ESPNOW_LZ_MAX_DICT, "ESPNOW_COMPRESS_DICT is too long");
+
+// 圧縮したフレームの data 先頭（続いてLZの符号）
+typedef struct __attribute__((packed)) {
+    uint8_t seq;   // 送信側の番号（受信側は展開したペイロードをこの番号で保持する）
+    uint8_t base;  // 差分の基準にしたフレームの seq（ESPNOW_COMPRESS_NO_BASE は差分なし）
+} espnow_compress_hdr_t;
+
+#define ESPNOW_COMPRESS_NO_BASE 0xFF
+
+// 差分の基準（送受信とも直近の2フレームを保持する）
+typedef struct {
+    uint8_t seq;
+    uint8_t len;        // 0 は無効
+    uint32_t txIndex;   // 送信側: このフレームの送信時点の txAttempts（txSuccess + txFailed が達したら送信完了）
+    uint32_t txFailed;  // 送信側: 符号化した時点の txFailed（以降に失敗があれば基準にしない）
+    uint8_t data[ESPNOW_COMPRESS_MAX_LEN];
+} espnow_compress_base_t;
+
+// （ピア, コマンド）ごとの差分の状態
+typedef struct {
+    espnow_peer_handle_t handle;  // ESPNOW_INVALID_PEER は未使用
+    uint8_t cmd;
+    uint8_t newest;    // base[newest] が最新
+    uint8_t nextSeq;   // 送信側
+    uint8_t sinceKey;  // 送信側: 基準なしのフレームから送った数
+    bool delta;        // 送信側: 送信中のフレームが差分かどうか
+    uint32_t txFailed; // 送信側: 送信中のフレームを符号化した時点の txFailed
+    uint32_t lastUse;
+    espnow_compress_base_t base[2];
+} espnow_compress_ctx_t;
+
+// 符号化の作業領域（ハッシュチェーン）
+typedef struct {
+    uint16_t head[1 << ESPNOW_LZ_HASH_BITS];
+    uint16_t prev[ESPNOW_COMPRESS_DICT_LEN + ESPNOW_COMPRESS_MAX_LEN];
+} espnow_lz_state_t;
+
+// 圧縮の統計（バイトあたりのサイクル数は encodeCycles / rawBytes, decodeCycles / decodedBytes）
+typedef struct {
+    uint32_t frames;        // 圧縮して送ったフレーム数
+    uint32_t deltaFrames;   // うち差分のフレーム数
+    uint32_t rawBytes;      // 圧縮したペイロードの元のバイト数
+    uint32_t codedBytes;    // 同圧縮後のバイト数（espnow_compress_hdr_t 込み）
+    uint32_t skipped;       // 小さくならなかったためそのまま送った数
+    uint32_t decoded;       // 展開したフレーム数
+    uint32_t decodedBytes;  // 同展開後のバイト数
+    uint32_t decodeErrors;  // 基準が無い・符号が壊れているため破棄した数
+    uint64_t encodeCycles;  // 符号化（失敗分を含む）に要したCPUサイクル
+    uint64_t decodeCycles;
+} espnow_compress_stats_t;
+
+#endif
@@ -0,0 +1,237 @@
+#include "ESP_NowAdhoc.h"
+
+// ==================== 分割送信 ====================
+
+size_t ESP_NowAdhoc::getFragmentPayloadSize() const {
+    size_t frameSize = getESPNOWMaxPayload();
+    if (frameSize > ESPNOW_HEADER_SIZE + ESPNOW_DATA_SIZE) {
+        frameSize = ESPNOW_HEADER_SIZE + ESPNOW_DATA_SIZE;
+    }
+    if (frameSize <= ESPNOW_HEADER_SIZE + sizeof(espnow_fragment_t)) {
+        return 0;
+    }
+    return frameSize - ESPNOW_HEADER_SIZE - sizeof(espnow_fragment_t);
+}
+
+bool ESP_NowAdhoc::sendLargeToPeers(const uint8_t *data, size_t len, espnow_peer_handle_t handle,
+                                    bool toServer, bool toClient) {
+    ESP_NowAdhocLock lock(_lock, _task);
+    size_t fragSize = getFragmentPayloadSize();
+    if (!data || len == 0 || len > ESPNOW_LARGE_DATA_SIZE || fragSize == 0 || _largeTx.active) {
+        return false;
+    }
+    // クライアントのサーバー宛は主サーバーにのみ送る
+    if (handle == ESPNOW_INVALID_PEER && uplinkServer(toServer, toClient) != ESPNOW_INVALID_PEER) {
+        handle = uplinkServer(toServer, toClient);
+    }
+
+    size_t count = (len + fragSize - 1) / fragSize;
+    if (count > ESPNOW_MAX_FRAGMENTS) {
+        if (_debugEnabled) {
+            Serial.printf("[ESP_NowAdhoc] Too many fragments: %u\n", (unsigned)count);
+        }
+        return false;
+    }
+
+    // データを保持し、フラグメントは送信キューの空きに応じて feedLargeTx() で投入
+    _largeTx.active = true;
+    _largeTx.handle = handle;
+    _largeTx.toServer = toServer;
+    _largeTx.toClient = toClient;
+    _largeTx.msg_id = _nextLargeMsgId++;
+    _largeTx.total_len = len;
+    _largeTx.count = count;
+    _largeTx.next = 0;
+    memcpy(_largeTx.data, data, len);
+
+    serviceTx();
+    return true;
+}
+
+void ESP_NowAdhoc::feedLargeTx() {
+    size_t fragSize = getFragmentPayloadSize();
+
+    while (_largeTx.active) {
+        size_t targets = 0;
+        for (size_t p = 0; p < _peers.size(); p++) {
+            bool target = (_largeTx.handle != ESPNOW_INVALID_PEER)
+                              ? (_peers.handleAt(p) == _largeTx.handle)
+                              : (_peers.at(p)->isServer ? _largeTx.toServer : _largeTx.toClient);
+            if (target) {
+                targets++;
+            }
+        }
+        // 宛先がいなくなった場合は中止
+        if (targets == 0 || fragSize == 0) {
+            _largeTx.active = false;
+            break;
+        }
+        bool fanout = (_largeTx.handle == ESPNOW_INVALID_PEER) && useFanout(targets);
+        if ((fanout ? 1 : targets) > _txEntryFreeCount) {
+            break;
+        }
+
+        // 各フラグメントを一度だけ組み立てて対象ピアのキューへ入れる
+        uint8_t buf = prepareTxBuffer(CMD_FRAGMENT, _groupToken, nullptr, 0);
+        if (buf == ESPNOW_NO_BUFFER) {
+            break;
+        }
+
+        espnow_message_t *msg = &_txBuf[buf];
+        espnow_fragment_t *frag = (espnow_fragment_t *)msg->data;
+        size_t offset = _largeTx.next * fragSize;
+        size_t chunk = (_largeTx.total_len - offset < fragSize) ? _largeTx.total_len - offset : fragSize;
+
+        frag->msg_id = _largeTx.msg_id;
+        frag->index = _largeTx.next;
+        frag->count = _largeTx.count;
+        frag->total_len = _largeTx.total_len;
+        frag->offset = offset;
+        memcpy(msg->data + sizeof(espnow_fragment_t), _largeTx.data + offset, chunk);
+        msg->len = sizeof(espnow_fragment_t) + chunk;
+        _txLen[buf] = ESPNOW_HEADER_SIZE + msg->len;
+
+        if (fanout) {
+            msg->flags |= (_largeTx.toServer ? ESPNOW_FLAG_TO_SERVER : 0) |
+                          (_largeTx.toClient ? ESPNOW_FLAG_TO_CLIENT : 0);
+            enqueueTx(TX_BROADCAST_QUEUE, ESPNOW_TX_PRIO_DATA, buf);
+            _txStats.fanout++;
+        } else {
+            for (size_t p = 0; p < _peers.size(); p++) {
+                bool target = (_largeTx.handle != ESPNOW_INVALID_PEER)
+                                  ? (_peers.handleAt(p) == _largeTx.handle)
+                                  : (_peers.at(p)->isServer ? _largeTx.toServer : _largeTx.toClient);
+                if (target) {
+                    enqueueTx(_peers.slot(_peers.handleAt(p)), ESPNOW_TX_PRIO_DATA, buf);
+                }
+            }
+        }
+        releaseTxBuffer(buf);
+
+        if (++_largeTx.next >= _largeTx.count) {
+            _largeTx.active = false;
+        }
+    }
+}
+
+bool ESP_NowAdhoc::sendLarge(espnow_peer_handle_t handle, const uint8_t *data, size_t len) {
+    ESP_NowAdhocLock lock(_lock);
+    if (!_peers.get(handle)) {
+        return false;
+    }
+    return sendLargeToPeers(data, len, handle, false, false);
+}
+
+bool ESP_NowAdhoc::sendLargeToAll(const uint8_t *data, size_t len) {
+    return sendLargeToPeers(data, len, ESPNOW_INVALID_PEER, true, true);
+}
+
+bool ESP_NowAdhoc::sendLargeToServer(const uint8_t *data, size_t len) {
+    return sendLargeToPeers(data, len, ESPNOW_INVALID_PEER, true, false);
+}
+
+bool ESP_NowAdhoc::sendLargeToClients(const uint8_t *data, size_t len) {
+    return sendLargeToPeers(data, len, ESPNOW_INVALID_PEER, false, true);
+}
+
+// ==================== 再構築 ====================
+
+void ESP_NowAdhoc::processFragment(const uint8_t* mac, const espnow_message_t* msg) {
+    if (msg->len <= sizeof(espnow_fragment_t)) {
+        return;
+    }
+
+    const espnow_fragment_t *frag = (const espnow_fragment_t *)msg->data;
+    const uint8_t *chunk = (const uint8_t *)msg->data + sizeof(espnow_fragment_t);
+    size_t chunkLen = msg->len - sizeof(espnow_fragment_t);
+
+    // 範囲チェック
+    if (frag->count == 0 || frag->index >= frag->count ||
+        frag->total_len == 0 || frag->total_len > ESPNOW_LARGE_DATA_SIZE ||
+        (size_t)frag->offset + chunkLen > frag->total_len) {
+        return;
+    }
+
+    // 送信元とメッセージIDで再構築バッファを検索
+    espnow_reassembly_t *slot = nullptr;
+    espnow_reassembly_t *freeSlot = nullptr;
+    espnow_reassembly_t *oldestSlot = nullptr;
+    for (size_t i = 0; i < ESPNOW_REASSEMBLY_SLOTS; i++) {
+        espnow_reassembly_t *r = &_reassembly[i];
+        if (r->pending) {
+            continue;  // アプリケーションへの受け渡し待ち
+        }
+        if (!r->used) {
+            if (!freeSlot) {
+                freeSlot = r;
+            }
+            continue;
+        }
+        if (r->msg_id == frag->msg_id && memcmp(r->mac, mac, 6) == 0) {
+            slot = r;
+            break;
+        }
+        if (!oldestSlot || (long)(r->startMs - oldestSlot->startMs) < 0) {
+            oldestSlot = r;
+        }
+    }
+
+    if (!slot) {
+        // 空きがなければ最も古い未完成メッセージを破棄して再利用
+        slot = freeSlot ? freeSlot : oldestSlot;
+        if (!slot) {
+            return;
+        }
+        if (slot->used) {
+            trace(ESPNOW_TRACE_EV_REASSEMBLY_EVICTED, slot->mac, 0, slot->msg_id);
+        }
+
+        slot->used = true;
+        memcpy(slot->mac, mac, 6);
+        slot->msg_id = frag->msg_id;
+        slot->total_len = frag->total_len;
+        slot->count = frag->count;
+        slot->received = 0;
+        memset(slot->bitmap, 0, sizeof(slot->bitmap));
+        slot->startMs = millis();
+        armTimerBefore(TIMER_REASSEMBLY, slot->startMs + ESPNOW_REASSEMBLY_TIMEOUT + 1);
+    }
+
+    // 同じメッセージIDで形状が異なるものは不正として破棄
+    if (slot->total_len != frag->total_len || slot->count != frag->count) {
+        return;
+    }
+
+    // 重複フラグメントは無視
+    uint8_t bit = 1 << (frag->index & 7);
+    if (slot->bitmap[frag->index >> 3] & bit) {
+        return;
+    }
+    slot->bitmap[frag->index >> 3] |= bit;
+    slot->received++;
+    memcpy(slot->data + frag->offset, chunk, chunkLen);
+
+    if (slot->received == slot->count) {
+        deliverLarge(slot);
+    }
+}
+
+void ESP_NowAdhoc::checkReassemblyTimeouts(unsigned long now) {
+    disarmTimer(TIMER_REASSEMBLY);
+    for (size_t i = 0; i < ESPNOW_REASSEMBLY_SLOTS; i++) {
+        espnow_reassembly_t *r = &_reassembly[i];
+        if (r->pending) {
+            continue;
+        }
+        if (r->used && now - r->startMs <= ESPNOW_REASSEMBLY_TIMEOUT) {
+            armTimerBefore(TIMER_REASSEMBLY, r->startMs + ESPNOW_REASSEMBLY_TIMEOUT + 1);
+        } else if (r->used) {
+            trace(ESPNOW_TRACE_EV_REASSEMBLY_TIMEOUT, r->mac, r->received, r->msg_id);
+            if (_debugEnabled) {
+                Serial.printf("[ESP_NowAdhoc] Reassembly timeout (msg %u, %u/%u fragments)\n",
+                    r->msg_id, r->received, r->count);
+            }
+            r->used = false;
+        }
+    }
+}
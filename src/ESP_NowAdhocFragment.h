@@ -0,0 +1,62 @@
+#ifndef ESP_NowAdhocFragment_H
+#define ESP_NowAdhocFragment_H
+
+#include <stdint.h>
+
+// sendLarge で送信できる最大サイズ（受信側の再構築バッファサイズ）
+#ifndef ESPNOW_LARGE_DATA_SIZE
+#define ESPNOW_LARGE_DATA_SIZE 4096
+#endif
+
+// 同時に再構築できるメッセージ数（静的に確保）
+#ifndef ESPNOW_REASSEMBLY_SLOTS
+#define ESPNOW_REASSEMBLY_SLOTS 2
+#endif
+
+// 未完成メッセージを破棄するまでの時間 (ms)
+#ifndef ESPNOW_REASSEMBLY_TIMEOUT
+#define ESPNOW_REASSEMBLY_TIMEOUT 1000
+#endif
+
+// 1メッセージあたりの最大フラグメント数（count は uint8_t）
+#define ESPNOW_MAX_FRAGMENTS 255
+
+static_assert(ESPNOW_LARGE_DATA_SIZE <= 0xFFFF, "ESPNOW_LARGE_DATA_SIZE must fit in uint16_t");
+
+// CMD_FRAGMENT の data 先頭に付くフラグメントヘッダー
+typedef struct __attribute__((packed)) {
+    uint16_t msg_id;     // 送信元ごとのメッセージID
+    uint8_t index;       // フラグメント番号 (0..count-1)
+    uint8_t count;       // 総フラグメント数
+    uint16_t total_len;  // 再構築後の全長
+    uint16_t offset;     // このフラグメントの格納位置
+} espnow_fragment_t;
+
+// 再構築用バッファ
+typedef struct {
+    bool used;
+    bool pending;  // 再構築済みでアプリケーションへの受け渡し待ち（beginTask() 時）
+    uint8_t mac[6];
+    uint16_t msg_id;
+    uint16_t total_len;
+    uint8_t count;
+    uint8_t received;
+    uint8_t bitmap[(ESPNOW_MAX_FRAGMENTS + 7) / 8];  // 受信済みフラグメント
+    unsigned long startMs;
+    uint8_t data[ESPNOW_LARGE_DATA_SIZE];
+} espnow_reassembly_t;
+
+// 送信中の分割メッセージ（送信キューの空きに応じてフラグメントを順に投入する）
+typedef struct {
+    bool active;
+    espnow_peer_handle_t handle;  // 宛先ピア（ESPNOW_INVALID_PEER の場合はロールで選択）
+    bool toServer;
+    bool toClient;
+    uint16_t msg_id;
+    uint16_t total_len;
+    uint8_t count;
+    uint8_t next;    // 次にキューへ入れるフラグメント番号
+    uint8_t data[ESPNOW_LARGE_DATA_SIZE];
+} espnow_large_tx_t;
+
+#endif
@@ -0,0 +1,348 @@
+#include "ESP_NowAdhoc.h"
+
+// ==================== 経路表 ====================
+
+void ESP_NowAdhoc::setMesh(bool enable) {
+    ESP_NowAdhocLock lock(_lock);
+    _mesh = enable;
+    if (!enable) {
+        _routeCount = 0;
+    }
+}
+
+uint8_t ESP_NowAdhoc::getRouteHops(const uint8_t* mac) const {
+    if (_peers.find(mac) != ESPNOW_INVALID_PEER) {
+        return 1;
+    }
+    for (size_t i = 0; i < _routeCount; i++) {
+        if (memcmp(_routes[i].mac, mac, 6) == 0) {
+            return _routes[i].hops;
+        }
+    }
+    return 0;
+}
+
+espnow_route_t* ESP_NowAdhoc::findRoute(const uint8_t* mac) {
+    for (size_t i = 0; i < _routeCount; i++) {
+        if (memcmp(_routes[i].mac, mac, 6) == 0) {
+            return &_routes[i];
+        }
+    }
+    return nullptr;
+}
+
+// 経路の更新が途絶えたもの（次ホップが広告しなくなったもの）を削除
+void ESP_NowAdhoc::expireRoutes(unsigned long now) {
+    for (size_t i = _routeCount; i-- > 0;) {
+        if (now - _routes[i].updatedMs > _heartbeatTimeout) {
+            _routes[i] = _routes[--_routeCount];
+        }
+    }
+}
+
+// 次ホップのピアが切断された経路を削除
+void ESP_NowAdhoc::dropRoutes(espnow_peer_handle_t via) {
+    for (size_t i = _routeCount; i-- > 0;) {
+        if (_routes[i].via == via) {
+            _routes[i] = _routes[--_routeCount];
+        }
+    }
+}
+
+// 宛先への次ホップ（直接のピアを優先。クライアントは直接のサーバーに中継を任せる）
+espnow_peer_handle_t ESP_NowAdhoc::nextHop(const uint8_t* mac) {
+    espnow_peer_handle_t handle = _peers.find(mac);
+    if (handle != ESPNOW_INVALID_PEER) {
+        return handle;
+    }
+
+    if (_isServer) {
+        espnow_route_t* route = findRoute(mac);
+        return route ? route->via : ESPNOW_INVALID_PEER;
+    }
+
+    espnow_peer_handle_t primary = getPrimaryServer();
+    if (primary != ESPNOW_INVALID_PEER) {
+        return primary;
+    }
+    for (size_t i = 0; i < _peers.size(); i++) {
+        if (_peers.at(i)->isServer) {
+            return _peers.handleAt(i);
+        }
+    }
+    return ESPNOW_INVALID_PEER;
+}
+
+// ==================== 経路広告 ====================
+
+// 直接のピア（ホップ数1）と経路表の内容を距離ベクトルとして送る
+// セキュリティモード以外はブロードキャスト1フレームで、全ピアへのハートビートを兼ねる
+void ESP_NowAdhoc::sendRoutes() {
+    if (_peers.size() == 0) {
+        return;
+    }
+
+    bool broadcast = !_useSecurity && _broadcastPeer;
+    if (broadcast && _txHead[TX_BROADCAST_QUEUE][ESPNOW_TX_PRIO_HEARTBEAT] != ESPNOW_TX_NONE) {
+        return;
+    }
+
+    uint8_t buf = prepareTxBuffer(CMD_ROUTE, _groupToken, nullptr, 0);
+    if (buf == ESPNOW_NO_BUFFER) {
+        return;
+    }
+
+    espnow_message_t *msg = &_txBuf[buf];
+    size_t maxLen = getESPNOWMaxPayload() - ESPNOW_HEADER_SIZE;
+    if (maxLen > ESPNOW_DATA_SIZE) {
+        maxLen = ESPNOW_DATA_SIZE;
+    }
+    size_t capacity = (maxLen - 1 - sizeof(espnow_server_load_t)) / sizeof(espnow_route_entry_t);
+    espnow_route_entry_t *entries = (espnow_route_entry_t *)(msg->data + 1);
+    uint8_t count = 0;
+    uint8_t entryOf[ESPNOW_MAX_PEERS];  // ピアのスロット番号 -> エントリ番号
+    memset(entryOf, ESPNOW_ROUTE_DIRECT, sizeof(entryOf));
+
+    // 直接のピアが収まらない場合はビーコンと同じく ESPNOW_FLAG_PARTIAL を付け、次は続きから載せる
+    size_t peers = _peers.size();
+    size_t start = _beaconCursor < peers ? _beaconCursor : 0;
+    while (count < peers && count < capacity) {
+        size_t i = (start + count) % peers;
+        memcpy(entries[count].mac, _peers.at(i)->addr(), 6);
+        entries[count].hops = 1;
+        entries[count].via = ESPNOW_ROUTE_DIRECT;
+        entryOf[_peers.slot(_peers.handleAt(i))] = count;
+        count++;
+    }
+    if (count < peers) {
+        msg->flags |= ESPNOW_FLAG_PARTIAL;
+        _beaconCursor = (start + count) % peers;
+    }
+    for (size_t i = 0; i < _routeCount && count < capacity; i++) {
+        if (_routes[i].hops >= ESPNOW_MESH_MAX_HOPS || entryOf[_peers.slot(_routes[i].via)] == ESPNOW_ROUTE_DIRECT) {
+            continue;
+        }
+        memcpy(entries[count].mac, _routes[i].mac, 6);
+        entries[count].hops = _routes[i].hops;
+        entries[count].via = entryOf[_peers.slot(_routes[i].via)];
+        count++;
+    }
+    msg->data[0] = count;
+    msg->len = 1 + count * sizeof(espnow_route_entry_t);
+    _txLen[buf] = ESPNOW_HEADER_SIZE + msg->len;
+    appendServerLoad(buf);
+
+    if (broadcast) {
+        enqueueTx(TX_BROADCAST_QUEUE, ESPNOW_TX_PRIO_HEARTBEAT, buf);
+    } else {
+        for (size_t i = 0; i < _peers.size(); i++) {
+            espnow_peer_handle_t handle = _peers.handleAt(i);
+            if (_peers.at(i)->isServer && _txHead[_peers.slot(handle)][ESPNOW_TX_PRIO_HEARTBEAT] == ESPNOW_TX_NONE) {
+                enqueueTx(_peers.slot(handle), ESPNOW_TX_PRIO_HEARTBEAT, buf);
+            }
+        }
+    }
+    releaseTxBuffer(buf);
+
+    // 続くハートビートを省略できるよう先に送る
+    serviceTx();
+}
+
+void ESP_NowAdhoc::processRoute(espnow_peer_handle_t from, const espnow_message_t* msg) {
+    if (from == ESPNOW_INVALID_PEER || msg->len < 1) {
+        return;
+    }
+
+    uint8_t count = msg->data[0];
+    if (msg->len < 1 + count * sizeof(espnow_route_entry_t)) {
+        return;
+    }
+    processServerLoad(_peers.get(from), msg, 1 + count * sizeof(espnow_route_entry_t));
+    const espnow_route_entry_t *entries = (const espnow_route_entry_t *)(msg->data + 1);
+
+    // ビーコンと同じく、全ピアを載せた一覧に直接のピアとして載っていなければすぐに広告する
+    bool listed = false;
+    for (uint8_t i = 0; i < count; i++) {
+        if (entries[i].hops == 1 && memcmp(entries[i].mac, _selfMac, 6) == 0) {
+            listed = true;
+            break;
+        }
+    }
+    if (listed) {
+        confirmRegistered(_peers.get(from));
+    } else if (!(msg->flags & ESPNOW_FLAG_PARTIAL)) {
+        resetAdvertisement(true);
+    }
+
+    if (!_mesh || !_isServer) {
+        return;
+    }
+
+    // 距離ベクトル: より短い経路か、現在の次ホップからの更新のみ採用
+    unsigned long now = millis();
+    for (uint8_t i = 0; i < count; i++) {
+        const espnow_route_entry_t *e = &entries[i];
+        if (e->hops == 0 || memcmp(e->mac, _selfMac, 6) == 0 || _peers.find(e->mac) != ESPNOW_INVALID_PEER) {
+            continue;
+        }
+
+        // 自分を経由する経路と上限を超えた経路は到達不能として扱い、現在の次ホップからなら削除
+        uint8_t hops = e->hops + 1;
+        bool viaSelf = e->via != ESPNOW_ROUTE_DIRECT &&
+                       (e->via >= count || memcmp(entries[e->via].mac, _selfMac, 6) == 0);
+        espnow_route_t *route = findRoute(e->mac);
+        if (viaSelf || hops > ESPNOW_MESH_MAX_HOPS) {
+            if (route && route->via == from) {
+                *route = _routes[--_routeCount];
+            }
+            continue;
+        }
+
+        if (!route) {
+            if (_routeCount >= ESPNOW_MESH_ROUTES) {
+                continue;
+            }
+            route = &_routes[_routeCount++];
+            memcpy(route->mac, e->mac, 6);
+        } else if (route->via != from && hops >= route->hops) {
+            continue;
+        }
+        route->via = from;
+        route->hops = hops;
+        route->updatedMs = now;
+    }
+}
+
+// ==================== 中継 ====================
+
+// 既に処理した中継フレームなら true（未処理なら記録する）
+bool ESP_NowAdhoc::relaySeen(const uint8_t* src, uint16_t seq) {
+    for (size_t i = 0; i < ESPNOW_MESH_DUP_CACHE; i++) {
+        if (_relaySeen[i].seq == seq && memcmp(_relaySeen[i].src, src, 6) == 0) {
+            return true;
+        }
+    }
+    memcpy(_relaySeen[_relaySeenNext].src, src, 6);
+    _relaySeen[_relaySeenNext].seq = seq;
+    _relaySeenNext = (_relaySeenNext + 1) % ESPNOW_MESH_DUP_CACHE;
+    return false;
+}
+
+bool ESP_NowAdhoc::sendToMac(const uint8_t* mac, const uint8_t *data, size_t len, uint8_t cmd) {
+    ESP_NowAdhocLock lock(_lock, _task);
+
+    espnow_peer_handle_t handle = _peers.find(mac);
+    if (handle != ESPNOW_INVALID_PEER) {
+        return sendToPeer(handle, data, len, cmd);
+    }
+    if (!_mesh) {
+        return false;
+    }
+
+    handle = nextHop(mac);
+    if (handle == ESPNOW_INVALID_PEER) {
+        _meshStats.noRoute++;
+        return false;
+    }
+
+    size_t maxLen = getESPNOWMaxPayload() - ESPNOW_HEADER_SIZE;
+    if (maxLen > ESPNOW_DATA_SIZE) {
+        maxLen = ESPNOW_DATA_SIZE;
+    }
+    if ((!data && len > 0) || sizeof(espnow_relay_hdr_t) + len > maxLen) {
+        return false;
+    }
+
+    uint8_t buf = prepareTxBuffer(CMD_RELAY, _groupToken, nullptr, 0);
+    if (buf == ESPNOW_NO_BUFFER) {
+        _txStats.dropped++;
+        return false;
+    }
+
+    espnow_relay_hdr_t hdr;
+    memcpy(hdr.dst, mac, 6);
+    memcpy(hdr.src, _selfMac, 6);
+    hdr.seq = _relaySeq++;
+    hdr.ttl = ESPNOW_MESH_MAX_HOPS;
+    hdr.hops = 1;
+    hdr.cmd = cmd;
+    hdr.reserved = 0;
+
+    espnow_message_t *msg = &_txBuf[buf];
+    memcpy(msg->data, &hdr, sizeof(hdr));
+    if (len > 0) {
+        memcpy(msg->data + sizeof(hdr), data, len);
+    }
+    msg->len = sizeof(hdr) + len;
+    _txLen[buf] = ESPNOW_HEADER_SIZE + msg->len;
+
+    // 経路のループで戻ってきた自分のフレームを破棄できるよう記録
+    relaySeen(hdr.src, hdr.seq);
+
+    bool queued = enqueueTx(_peers.slot(handle), ESPNOW_TX_PRIO_DATA, buf);
+    releaseTxBuffer(buf);
+    if (queued) {
+        _meshStats.originated++;
+    }
+
+    serviceTx();
+    return queued;
+}
+
+void ESP_NowAdhoc::processRelay(espnow_peer_handle_t from, const espnow_message_t* msg) {
+    if (msg->len < sizeof(espnow_relay_hdr_t)) {
+        return;
+    }
+
+    espnow_relay_hdr_t hdr;
+    memcpy(&hdr, msg->data, sizeof(hdr));
+    if (relaySeen(hdr.src, hdr.seq)) {
+        _meshStats.duplicates++;
+        return;
+    }
+
+    // 自分宛: 元のコマンドとペイロードに戻し、送信元のMACで配送
+    if (memcmp(hdr.dst, _selfMac, 6) == 0) {
+        _meshStats.delivered++;
+        _meshStats.hops += hdr.hops;
+
+        espnow_message_t *out = &_relayDeliverBuf;
+        memcpy(out, msg, ESPNOW_HEADER_SIZE);
+        out->cmd = hdr.cmd;
+        out->flags = 0;
+        out->len = msg->len - sizeof(hdr);
+        memcpy(out->data, msg->data + sizeof(hdr), out->len);
+        deliverMessage(hdr.src, out, false);
+        return;
+    }
+
+    // 転送はメッシュモードのサーバーのみ
+    if (!_mesh || !_isServer) {
+        return;
+    }
+    if (hdr.ttl <= 1) {
+        _meshStats.ttlExpired++;
+        return;
+    }
+
+    espnow_peer_handle_t next = nextHop(hdr.dst);
+    if (next == ESPNOW_INVALID_PEER || next == from) {
+        _meshStats.noRoute++;
+        trace(ESPNOW_TRACE_EV_RELAY_NO_ROUTE, hdr.dst, 0, hdr.seq);
+        return;
+    }
+
+    uint8_t buf = prepareTxBuffer(CMD_RELAY, _groupToken, (const uint8_t *)msg->data, msg->len);
+    if (buf == ESPNOW_NO_BUFFER) {
+        _txStats.dropped++;
+        return;
+    }
+    espnow_relay_hdr_t *fwd = (espnow_relay_hdr_t *)_txBuf[buf].data;
+    fwd->ttl--;
+    fwd->hops++;
+    if (enqueueTx(_peers.slot(next), ESPNOW_TX_PRIO_DATA, buf)) {
+        _meshStats.forwarded++;
+        trace(ESPNOW_TRACE_EV_RELAY_FORWARD, hdr.dst, hdr.ttl - 1, hdr.seq);
+    }
+    releaseTxBuffer(buf);
+}
@@ -0,0 +1,77 @@
+#ifndef ESP_NowAdhocMesh_H
+#define ESP_NowAdhocMesh_H
+
+#include <stdint.h>
+
+// メッシュモード（サーバー同士で経路表を交換し、宛先MAC指定のデータを中継する）
+// setMesh() でも切り替え可能。中継はサーバーのみが行い、クライアントは直接のサーバー経由で送る
+#ifndef ESPNOW_MESH
+#define ESPNOW_MESH false
+#endif
+
+// 経路表のエントリ数（直接のピアは含まない）
+#ifndef ESPNOW_MESH_ROUTES
+#define ESPNOW_MESH_ROUTES 32
+#endif
+
+// 最大ホップ数（中継フレームのTTLと、経路のホップ数の上限を兼ねる）
+#ifndef ESPNOW_MESH_MAX_HOPS
+#define ESPNOW_MESH_MAX_HOPS 8
+#endif
+
+// 重複抑制に覚えておく中継フレーム数（送信元MAC + シーケンス番号）
+#ifndef ESPNOW_MESH_DUP_CACHE
+#define ESPNOW_MESH_DUP_CACHE 32
+#endif
+
+static_assert(ESPNOW_MESH_MAX_HOPS >= 2 && ESPNOW_MESH_MAX_HOPS < 0xFF, "ESPNOW_MESH_MAX_HOPS must be 2..254");
+
+// CMD_ROUTE の data: エントリ数(1バイト) + espnow_route_entry_t の並び
+// 直接のピア（ホップ数1）を先に載せるため、クライアントはビーコンと同じく自分が載っているか確認できる
+// 直接のピアが収まらない場合は ESPNOW_FLAG_PARTIAL を付け、広告ごとに順に載せる
+// 経路のエントリは次ホップを同じ一覧内の番号で示し、受信側は自分経由の経路を採用しない（スプリットホライズン）
+typedef struct __attribute__((packed)) {
+    uint8_t mac[6];
+    uint8_t hops;
+    uint8_t via;  // 次ホップのエントリ番号（直接のピアは ESPNOW_ROUTE_DIRECT）
+} espnow_route_entry_t;
+
+#define ESPNOW_ROUTE_DIRECT 0xFF
+
+// CMD_RELAY の data 先頭に付くヘッダー（続いて元のペイロード）
+typedef struct __attribute__((packed)) {
+    uint8_t dst[6];
+    uint8_t src[6];
+    uint16_t seq;
+    uint8_t ttl;
+    uint8_t hops;  // 送信元からの転送回数（受信時点のホップ数）
+    uint8_t cmd;   // 元のコマンド（CMD_DATA または型付きメッセージ）
+    uint8_t reserved;
+} espnow_relay_hdr_t;
+
+// 経路表のエントリ
+typedef struct {
+    uint8_t mac[6];
+    espnow_peer_handle_t via;  // 次ホップのピアハンドル
+    uint8_t hops;
+    unsigned long updatedMs;
+} espnow_route_t;
+
+typedef struct {
+    uint8_t src[6];
+    uint16_t seq;
+} espnow_relay_seen_t;
+
+// メッシュの統計
+// 平均ホップ数は hops / delivered
+typedef struct {
+    uint32_t originated;  // 中継フレームとして送信したメッセージ数
+    uint32_t forwarded;   // 他ノード宛として転送したフレーム数
+    uint32_t delivered;   // 自分宛として受け取ったメッセージ数
+    uint32_t hops;        // 受け取ったメッセージのホップ数の合計
+    uint32_t duplicates;  // 重複として破棄したフレーム数
+    uint32_t noRoute;     // 経路がなく破棄したフレーム数
+    uint32_t ttlExpired;  // TTL切れで破棄したフレーム数
+} espnow_mesh_stats_t;
+
+#endif
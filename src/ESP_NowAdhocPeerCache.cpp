@@ -0,0 +1,180 @@
+#include "ESP_NowAdhoc.h"
+#include <Preferences.h>
+
+// ==================== 設定 ====================
+
+void ESP_NowAdhoc::setPeerCache(bool enable) {
+    ESP_NowAdhocLock lock(_lock, _task);
+    _peerCache = enable;
+    if (!enable) {
+        disarmTimer(TIMER_PEER_CACHE);
+    }
+}
+
+bool ESP_NowAdhoc::clearPeerCache() {
+    ESP_NowAdhocLock lock(_lock, _task);
+    Preferences prefs;
+    if (!prefs.begin(ESPNOW_PEER_CACHE_NAMESPACE, false)) {
+        return false;
+    }
+    bool removed = prefs.remove(ESPNOW_PEER_CACHE_KEY);
+    prefs.end();
+    return removed;
+}
+
+// 保存データの先頭（読み込み時の照合にも使う）
+static espnow_peer_cache_hdr_t peerCacheHeader(uint32_t advGroupToken, uint32_t groupToken,
+                                               bool security, bool session, uint8_t count) {
+    espnow_peer_cache_hdr_t hdr;
+    hdr.version = ESPNOW_PEER_CACHE_VERSION;
+    hdr.count = count;
+    hdr.security = (security ? 0x01 : 0) | (session ? 0x02 : 0);
+    hdr.advGroupToken = advGroupToken;
+    hdr.groupToken = groupToken;
+    return hdr;
+}
+
+// ==================== 起動時の復元 ====================
+
+// begin() から呼ばれる。保存したピアを登録し直し、ユニキャストの参加要求を送る
+// （応答の登録フレームで確認し、セッションモードでは鍵を導出する）
+void ESP_NowAdhoc::restorePeerCache() {
+    if (!_peerCache) {
+        return;
+    }
+
+    uint8_t *blob = _peerCacheBlob;
+    Preferences prefs;
+    if (!prefs.begin(ESPNOW_PEER_CACHE_NAMESPACE, true)) {
+        return;
+    }
+    size_t len = prefs.getBytes(ESPNOW_PEER_CACHE_KEY, blob, sizeof(_peerCacheBlob));
+    prefs.end();
+    _peerCacheSavedMs = millis();
+
+    espnow_peer_cache_hdr_t hdr;
+    if (len < sizeof(hdr)) {
+        return;
+    }
+    memcpy(&hdr, blob, sizeof(hdr));
+    espnow_peer_cache_hdr_t expect = peerCacheHeader(_advGroupToken, _groupToken, _useSecurity, _sessionMode, hdr.count);
+    if (memcmp(&hdr, &expect, sizeof(hdr)) != 0 || hdr.count > ESPNOW_MAX_PEERS ||
+        len != sizeof(hdr) + hdr.count * sizeof(espnow_peer_cache_entry_t)) {
+        return;
+    }
+
+    for (uint8_t i = 0; i < hdr.count; i++) {
+        espnow_peer_cache_entry_t entry;
+        memcpy(&entry, blob + sizeof(hdr) + i * sizeof(entry), sizeof(entry));
+        bool peerIsServer = (entry.flags & ESPNOW_PEER_CACHE_SERVER) != 0;
+        // チャンネルが変わった・クライアントが保存したクライアントは使わない
+        if (entry.channel != _wifiChannel || (!_isServer && !peerIsServer) ||
+            _peers.find(entry.mac) != ESPNOW_INVALID_PEER) {
+            continue;
+        }
+        addPeer(entry.mac, peerIsServer, (entry.flags & ESPNOW_PEER_CACHE_SECURE) != 0, nullptr);
+        espnow_peer_handle_t handle = _peers.find(entry.mac);
+        ESP_NowAdhocPeer* peer = _peers.get(handle);
+        if (!peer) {
+            continue;
+        }
+        peer->rssi = entry.rssi;
+        peer->noiseFloor = entry.noiseFloor;
+        peer->_score.rssiMs = millis();  // 保存していた値は起動後 ESPNOW_SERVER_RSSI_MAX_AGE の間だけ評価に使う
+        peer->_score.success = entry.success;
+        peer->_cached = true;
+        _peerCacheStats.restored++;
+        sendRegistration(handle, CMD_PROBE);
+    }
+
+    // 保存していた受信強度・成功率で主サーバーを選び直す
+    if (_peerCacheStats.restored > 0) {
+        _primaryServer = ESPNOW_INVALID_PEER;
+        selectPrimaryServer(false);
+        if (_debugEnabled) {
+            Serial.printf("[ESP_NowAdhoc] Restored %lu cached peers\n", (unsigned long)_peerCacheStats.restored);
+        }
+    }
+}
+
+// 復元したピアから登録フレームが届いた
+void ESP_NowAdhoc::confirmCachedPeer(ESP_NowAdhocPeer* peer) {
+    if (!peer->_cached) {
+        return;
+    }
+    peer->_cached = false;
+    peer->lastGetMs = millis();
+    _peerCacheStats.confirmed++;
+}
+
+// ==================== 保存 ====================
+
+// ピアの追加・削除時に呼ばれる（ESPNOW_PEER_CACHE_DELAY 後に1回だけ書き込む）
+// 統計の保存し直しのために先の時刻で待っている場合は早める
+void ESP_NowAdhoc::markPeerCacheDirty() {
+    if (_peerCache) {
+        armTimerBefore(TIMER_PEER_CACHE, millis() + ESPNOW_PEER_CACHE_DELAY);
+    }
+}
+
+void ESP_NowAdhoc::savePeerCache() {
+    disarmTimer(TIMER_PEER_CACHE);
+    if (!_peerCache) {
+        return;
+    }
+
+    Preferences prefs;
+    if (!prefs.begin(ESPNOW_PEER_CACHE_NAMESPACE, false)) {
+        return;
+    }
+
+    // 保存済みのデータを読み、同じ位置のエントリと比べてから上書きする（作業領域は1つで済む）
+    // ピア構成（MAC・ロール・セキュリティ）が保存済みと同じなら、リンクの統計は
+    // ESPNOW_PEER_CACHE_REFRESH に1回だけ保存し直す（統計の変化だけでフラッシュを消耗させない）
+    uint8_t *blob = _peerCacheBlob;
+    size_t savedLen = prefs.getBytes(ESPNOW_PEER_CACHE_KEY, blob, sizeof(_peerCacheBlob));
+    bool same = true;
+    bool changed = false;
+    uint8_t count = 0;
+    for (size_t i = 0; i < _peers.size() && count < ESPNOW_MAX_PEERS; i++) {
+        ESP_NowAdhocPeer* peer = _peers.at(i);
+        // 復元後にまだ応答のないピアは、確認できるまで保存し直さない
+        if (peer->_cached) {
+            continue;
+        }
+        espnow_peer_cache_entry_t entry;
+        memcpy(entry.mac, peer->addr(), 6);
+        entry.flags = (peer->isServer ? ESPNOW_PEER_CACHE_SERVER : 0) | (peer->isSecure ? ESPNOW_PEER_CACHE_SECURE : 0);
+        entry.channel = _wifiChannel;
+        entry.rssi = peer->rssi;
+        entry.noiseFloor = peer->noiseFloor;
+        entry.success = peer->_score.success;
+        uint8_t *slot = blob + sizeof(espnow_peer_cache_hdr_t) + count * sizeof(entry);
+        same = same && memcmp(slot, &entry, 8) == 0;  // mac・flags・channel
+        changed = changed || memcmp(slot, &entry, sizeof(entry)) != 0;
+        memcpy(slot, &entry, sizeof(entry));
+        count++;
+    }
+    espnow_peer_cache_hdr_t hdr = peerCacheHeader(_advGroupToken, _groupToken, _useSecurity, _sessionMode, count);
+    size_t len = sizeof(hdr) + count * sizeof(espnow_peer_cache_entry_t);
+    same = same && savedLen == len && memcmp(blob, &hdr, sizeof(hdr)) == 0;
+    memcpy(blob, &hdr, sizeof(hdr));
+
+    unsigned long now = millis();
+    bool refresh = same && changed && now - _peerCacheSavedMs >= ESPNOW_PEER_CACHE_REFRESH;
+    if (same && !refresh) {
+        _peerCacheStats.skipped++;
+    } else if (prefs.putBytes(ESPNOW_PEER_CACHE_KEY, blob, len) == len) {
+        _peerCacheStats.writes++;
+        _peerCacheSavedMs = now;
+        trace(ESPNOW_TRACE_EV_PEER_CACHE, nullptr, 0, count);
+    }
+    prefs.end();
+
+    // ピア構成が変わらなくても統計を保存し直せるよう、次の確認を予約する
+    unsigned long next = _peerCacheSavedMs + ESPNOW_PEER_CACHE_REFRESH;
+    if ((long)(next - now) <= 0) {
+        next = now + ESPNOW_PEER_CACHE_REFRESH;
+    }
+    armTimer(TIMER_PEER_CACHE, next);
+}
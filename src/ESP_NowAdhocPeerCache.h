@@ -0,0 +1,62 @@
+#ifndef ESP_NowAdhocPeerCache_H
+#define ESP_NowAdhocPeerCache_H
+
+#include <stdint.h>
+
+// ピア一覧のNVSへの保存（setPeerCache()）
+// begin() で前回保存したピアをすぐに登録し直し、ユニキャストの参加要求で確認する
+// 応答のないピアは通常のタイムアウトで外れ、新しいピアは従来どおり広告で見つける
+// セッションモードでは復元したピアにはまだ鍵がなく、応答の登録フレームで確認されるまで
+// そのピア宛の送信は破棄される（送信関数は false を返す）
+#ifndef ESPNOW_PEER_CACHE
+#define ESPNOW_PEER_CACHE true
+#endif
+
+// ピア構成が変わってから保存するまでの時間（この間の変化はまとめて1回書き込み、フラッシュの消耗を抑える）
+#ifndef ESPNOW_PEER_CACHE_DELAY
+#define ESPNOW_PEER_CACHE_DELAY 30000
+#endif
+
+// ピア構成が同じでも、リンクの統計（受信強度・成功率）を保存し直す最短の間隔 (ms)
+#ifndef ESPNOW_PEER_CACHE_REFRESH
+#define ESPNOW_PEER_CACHE_REFRESH 3600000UL
+#endif
+
+#define ESPNOW_PEER_CACHE_NAMESPACE "espnow_adhoc"  // Preferences の名前空間
+#define ESPNOW_PEER_CACHE_KEY "peers"
+#define ESPNOW_PEER_CACHE_VERSION 1
+
+#define ESPNOW_PEER_CACHE_SERVER 0x01
+#define ESPNOW_PEER_CACHE_SECURE 0x02
+
+// 保存するピア（リンクの統計は起動直後の主サーバーの選択に使う）
+typedef struct __attribute__((packed)) {
+    uint8_t mac[6];
+    uint8_t flags;       // ESPNOW_PEER_CACHE_SERVER | ESPNOW_PEER_CACHE_SECURE
+    uint8_t channel;
+    int8_t rssi;
+    int8_t noiseFloor;
+    uint16_t success;    // 送信成功率（espnow_server_score_t と同じ）
+} espnow_peer_cache_entry_t;
+
+// 保存データの先頭（グループ・セキュリティ設定が異なる場合は読み込まない）
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint8_t count;
+    uint8_t security;    // bit0: セキュリティモード, bit1: セッションモード
+    uint32_t advGroupToken;
+    uint32_t groupToken;
+} espnow_peer_cache_hdr_t;
+
+// 保存データの最大長
+#define ESPNOW_PEER_CACHE_BLOB_SIZE (sizeof(espnow_peer_cache_hdr_t) + ESPNOW_MAX_PEERS * sizeof(espnow_peer_cache_entry_t))
+
+typedef struct {
+    uint32_t restored;   // begin() で登録し直したピア数
+    uint32_t confirmed;  // そのうち応答があったピア数
+    uint32_t expired;    // 応答がなくタイムアウトしたピア数
+    uint32_t writes;     // NVSへの書き込み回数
+    uint32_t skipped;    // 保存済みと同じ、または統計の変化のみで間隔内のため書き込まなかった回数
+} espnow_peer_cache_stats_t;
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef ESP_NowAdhocPool_H
+#define ESP_NowAdhocPool_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <new>
+#include <utility>
+
+// ピアハンドル（下位8ビットはプール内のスロット番号、上位8ビットはスロットの世代）
+// スロットを再利用するたびに世代が進むため、削除済みのピアのハンドルは後から追加したピアを指さない
+typedef uint16_t espnow_peer_handle_t;
+#define ESPNOW_INVALID_PEER 0xFFFF
+
+// 固定容量のピアプール
+// - 要素は静的領域にplacement newで構築（ヒープを使用しない）
+// - 6バイトのMACをキーとするオープンアドレス法（線形探索）のハッシュ索引で
+//   検索・追加・削除をO(1)で行う
+// - 有効なスロットを密な配列で保持し、走査はピア数に比例
+// - 空きスロットは解放した順に再利用する（同じスロットの世代が一巡するまでの間隔を延ばす）
+// - ピアごとの配列はスロット番号（slot()）で引く
+template <typename T, size_t N>
+class ESP_NowAdhocPool {
+public:
+    static_assert(N > 0 && N < 0xFF, "Pool capacity must be 1..254");
+
+    ESP_NowAdhocPool() : _freeHead(0), _freeCount(N), _count(0) {
+        for (size_t i = 0; i < N; i++) {
+            _used[i] = false;
+            _gen[i] = 0;
+            _freeList[i] = (uint8_t)i;
+        }
+        for (size_t i = 0; i < INDEX_SIZE; i++) {
+            _index[i] = SLOT_NONE;
+        }
+    }
+
+    ~ESP_NowAdhocPool() {
+        clear();
+    }
+
+    size_t size() const { return _count; }
+    size_t capacity() const { return N; }
+    bool full() const { return _freeCount == 0; }
+
+    // 密な配列による走査用（0 <= i < size()）
+    espnow_peer_handle_t handleAt(size_t i) const { return handleOf(_active[i]); }
+    T* at(size_t i) const { return atSlot(_active[i]); }
+
+    // ピアごとの配列の添字（ESPNOW_INVALID_PEER は N 以上になる）
+    static uint8_t slot(espnow_peer_handle_t handle) { return (uint8_t)handle; }
+
+    // スロット番号から現在のハンドル・要素を引く（空きスロットは ESPNOW_INVALID_PEER・nullptr）
+    espnow_peer_handle_t handleOf(uint8_t slot) const {
+        if (slot >= N || !_used[slot]) {
+            return ESPNOW_INVALID_PEER;
+        }
+        return (espnow_peer_handle_t)((_gen[slot] << 8) | slot);
+    }
+    T* atSlot(uint8_t slot) const {
+        if (slot >= N || !_used[slot]) {
+            return nullptr;
+        }
+        return reinterpret_cast<T*>(const_cast<uint8_t*>(_storage[slot]));
+    }
+
+    // 世代が異なる（削除済みのピアの）ハンドルは nullptr
+    T* get(espnow_peer_handle_t handle) const {
+        uint8_t s = slot(handle);
+        if (s >= N || !_used[s] || _gen[s] != (uint8_t)(handle >> 8)) {
+            return nullptr;
+        }
+        return atSlot(s);
+    }
+
+    espnow_peer_handle_t find(const uint8_t* mac) const {
+        size_t pos = hash(mac) & INDEX_MASK;
+        while (_index[pos] != SLOT_NONE) {
+            if (memcmp(_macs[_index[pos]], mac, 6) == 0) {
+                return handleOf(_index[pos]);
+            }
+            pos = (pos + 1) & INDEX_MASK;
+        }
+        return ESPNOW_INVALID_PEER;
+    }
+
+    // 新しい要素を構築して登録（満杯または登録済みの場合はESPNOW_INVALID_PEER）
+    template <typename... Args>
+    espnow_peer_handle_t insert(const uint8_t* mac, Args&&... args) {
+        if (_freeCount == 0 || find(mac) != ESPNOW_INVALID_PEER) {
+            return ESPNOW_INVALID_PEER;
+        }
+
+        uint8_t s = _freeList[_freeHead];
+        _freeHead = (_freeHead + 1) % N;
+        _freeCount--;
+        new (_storage[s]) T(std::forward<Args>(args)...);
+        _used[s] = true;
+        memcpy(_macs[s], mac, 6);
+
+        size_t pos = hash(mac) & INDEX_MASK;
+        while (_index[pos] != SLOT_NONE) {
+            pos = (pos + 1) & INDEX_MASK;
+        }
+        _index[pos] = s;
+
+        _activePos[s] = _count;
+        _active[_count++] = s;
+        return handleOf(s);
+    }
+
+    void remove(espnow_peer_handle_t handle) {
+        T* item = get(handle);
+        if (!item) {
+            return;
+        }
+        uint8_t s = slot(handle);
+
+        unindex(s);
+
+        // 密な配列から末尾と入れ替えて削除
+        uint8_t pos = _activePos[s];
+        uint8_t last = _active[--_count];
+        _active[pos] = last;
+        _activePos[last] = pos;
+
+        item->~T();
+        _used[s] = false;
+        _gen[s]++;
+        _freeList[(_freeHead + _freeCount++) % N] = s;
+    }
+
+    void clear() {
+        while (_count > 0) {
+            remove(handleOf(_active[_count - 1]));
+        }
+    }
+
+private:
+    static constexpr size_t indexSize(size_t n) {
+        return n <= 1 ? 1 : 2 * indexSize((n + 1) / 2);
+    }
+    // 負荷率を1/2以下に保つ
+    static const size_t INDEX_SIZE = indexSize(N * 2);
+    static const size_t INDEX_MASK = INDEX_SIZE - 1;
+    static const uint8_t SLOT_NONE = 0xFF;
+
+    static size_t hash(const uint8_t* mac) {
+        uint32_t h = 2166136261UL;
+        for (int i = 0; i < 6; i++) {
+            h = (h ^ mac[i]) * 16777619UL;
+        }
+        return h ^ (h >> 16);
+    }
+
+    // 後方シフト削除（墓標を残さない）
+    void unindex(uint8_t s) {
+        size_t pos = hash(_macs[s]) & INDEX_MASK;
+        while (_index[pos] != s) {
+            pos = (pos + 1) & INDEX_MASK;
+        }
+
+        size_t hole = pos;
+        size_t next = (hole + 1) & INDEX_MASK;
+        while (_index[next] != SLOT_NONE) {
+            size_t home = hash(_macs[_index[next]]) & INDEX_MASK;
+            // home が (hole, next] の外にある要素は穴へ移動できる
+            if (((next - home) & INDEX_MASK) >= ((next - hole) & INDEX_MASK)) {
+                _index[hole] = _index[next];
+                hole = next;
+            }
+            next = (next + 1) & INDEX_MASK;
+        }
+        _index[hole] = SLOT_NONE;
+    }
+
+    alignas(T) uint8_t _storage[N][sizeof(T)];
+    uint8_t _macs[N][6];
+    bool _used[N];
+    uint8_t _gen[N];  // スロットの世代（削除のたびに進む）
+
+    uint8_t _freeList[N];  // 空きスロットのリングバッファ
+    size_t _freeHead;
+    size_t _freeCount;
+
+    uint8_t _active[N];
+    uint8_t _activePos[N];
+    size_t _count;
+
+    uint8_t _index[INDEX_SIZE];
+};
+
+#endif
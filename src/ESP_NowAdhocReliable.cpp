@@ -0,0 +1,465 @@
+#include "ESP_NowAdhoc.h"
+
+// シーケンス番号の比較（16ビットの折り返しを考慮）
+static inline int16_t seqDiff(uint16_t a, uint16_t b) {
+    return (int16_t)(a - b);
+}
+
+// ==================== ESP_NowAdhocPeer（信頼性モード） ====================
+
+void ESP_NowAdhocPeer::resetReliable() {
+    _reliable.session = esp_random() & 0xFFFF;
+    _reliable.nextSeq = 0;
+    _reliable.base = 0;
+    for (size_t i = 0; i < ESPNOW_RELIABLE_WINDOW; i++) {
+        _reliable.tx[i].used = false;
+        _reliable.tx[i].buf = ESPNOW_NO_BUFFER;
+        _reliable.rxBuf[i] = ESPNOW_NO_BUFFER;
+    }
+    _reliable.srtt = 0;
+    _reliable.rttvar = 0;
+    _reliable.rto = ESPNOW_RELIABLE_INITIAL_RTO;
+    _reliable.rttValid = false;
+    _reliable.ackWord.store(0);
+    _reliable.lastAckWord = 0;
+    _reliable.linkLoss.store(false);
+    _reliable.rcvSynced = false;
+    _reliable.rcvSession = 0;
+    _reliable.rcvNext = 0;
+    _reliable.sent = 0;
+    _reliable.retransmits = 0;
+    _reliable.delivered = 0;
+    _reliable.duplicates = 0;
+    _reliable.failed = 0;
+}
+
+void ESP_NowAdhocPeer::releaseReliable() {
+    if (!_parent) {
+        return;
+    }
+    for (size_t i = 0; i < ESPNOW_RELIABLE_WINDOW; i++) {
+        if (_reliable.tx[i].buf != ESPNOW_NO_BUFFER) {
+            _parent->freeReliableTxBuffer(_reliable.tx[i].buf);
+            _reliable.tx[i].buf = ESPNOW_NO_BUFFER;
+        }
+        if (_reliable.rxBuf[i] != ESPNOW_NO_BUFFER) {
+            _parent->freeReliableRxBuffer(_reliable.rxBuf[i]);
+            _reliable.rxBuf[i] = ESPNOW_NO_BUFFER;
+        }
+    }
+}
+
+size_t ESP_NowAdhocPeer::reliableWindowAvailable() const {
+    return ESPNOW_RELIABLE_WINDOW - (uint16_t)(_reliable.nextSeq - _reliable.base);
+}
+
+bool ESP_NowAdhocPeer::sendReliable(const uint8_t *data, size_t len) {
+    if (!_parent) {
+        return false;
+    }
+    ESP_NowAdhocLock lock(_parent->_lock, _parent->_task);
+    if (reliableWindowAvailable() == 0) {
+        return false;
+    }
+
+    size_t payloadLen = sizeof(espnow_reliable_hdr_t) + len;
+    if (payloadLen > ESPNOW_DATA_SIZE ||
+        ESPNOW_HEADER_SIZE + payloadLen > _parent->getESPNOWMaxPayload()) {
+        return false;
+    }
+
+    uint8_t buf = _parent->allocReliableTxBuffer();
+    if (buf == ESPNOW_NO_BUFFER) {
+        return false;
+    }
+
+    // 再送に備えて送信フレームをそのままバッファに保持
+    espnow_message_t *msg = &_parent->_reliableTxBuf[buf];
+    _parent->buildMessage(msg, CMD_RELIABLE, _parent->_groupToken, nullptr, 0);
+    espnow_reliable_hdr_t *hdr = (espnow_reliable_hdr_t *)msg->data;
+    hdr->session = _reliable.session;
+    hdr->base = _reliable.base;
+    hdr->seq = _reliable.nextSeq;
+    if (len > 0) {
+        memcpy(msg->data + sizeof(espnow_reliable_hdr_t), data, len);
+    }
+    msg->len = payloadLen;
+
+    unsigned long now = millis();
+    espnow_reliable_tx_entry_t &e = _reliable.tx[_reliable.nextSeq % ESPNOW_RELIABLE_WINDOW];
+    e.used = true;
+    e.acked = false;
+    e.retransmitted = false;
+    e.fastRetransmit = false;
+    e.linkRetransmit = false;
+    e.seq = _reliable.nextSeq;
+    e.buf = buf;
+    e.retries = 0;
+    e.sentMs = now;
+    e.deadline = now + _reliable.rto;
+    _reliable.nextSeq++;
+    _reliable.sent++;
+
+    // キューに入らない場合や送信失敗時もタイマーで再送されるため成功扱い
+    _parent->queueReliable(this, ESPNOW_TX_PRIO_DATA, CMD_RELIABLE, (const uint8_t *)msg->data, msg->len);
+    _parent->armTimerBefore(ESP_NowAdhoc::TIMER_RELIABLE, e.deadline);
+    return true;
+}
+
+void ESP_NowAdhocPeer::processReliable(const espnow_message_t *msg) {
+    if (msg->len < sizeof(espnow_reliable_hdr_t)) {
+        return;
+    }
+
+    const espnow_reliable_hdr_t *hdr = (const espnow_reliable_hdr_t *)msg->data;
+    uint16_t seq = hdr->seq;
+    
+    // 新しいセッション（相手の再起動・再登録、または自分の再起動）では受信状態を作り直す
+    if (!_reliable.rcvSynced || hdr->session != _reliable.rcvSession) {
+        for (size_t i = 0; i < ESPNOW_RELIABLE_WINDOW; i++) {
+            if (_reliable.rxBuf[i] != ESPNOW_NO_BUFFER) {
+                _parent->freeReliableRxBuffer(_reliable.rxBuf[i]);
+                _reliable.rxBuf[i] = ESPNOW_NO_BUFFER;
+            }
+        }
+        _reliable.rcvSynced = true;
+        _reliable.rcvSession = hdr->session;
+        _reliable.rcvNext = hdr->base;
+    }
+
+    int16_t diff = seqDiff(seq, _reliable.rcvNext);
+
+    // アプリケーションへ渡す形（CMD_DATA + ESPNOW_FLAG_RELIABLE）に変換して格納する
+    espnow_message_t *dst = nullptr;
+    uint8_t buf = ESPNOW_NO_BUFFER;
+
+    if (diff < 0) {
+        // 受信済み（ACKの消失による再送）
+        _reliable.duplicates++;
+    } else if (diff == 0) {
+        dst = &_parent->_reliableDeliverBuf;
+    } else if (diff < ESPNOW_RELIABLE_WINDOW) {
+        uint8_t &slot = _reliable.rxBuf[seq % ESPNOW_RELIABLE_WINDOW];
+        if (slot != ESPNOW_NO_BUFFER) {
+            _reliable.duplicates++;
+        } else {
+            buf = _parent->allocReliableRxBuffer();
+            if (buf != ESPNOW_NO_BUFFER) {
+                slot = buf;
+                dst = &_parent->_reliableRxBuf[buf];
+            }
+        }
+    }
+
+    if (dst) {
+        size_t payloadLen = msg->len - sizeof(espnow_reliable_hdr_t);
+        memcpy(dst, msg, ESPNOW_HEADER_SIZE);
+        dst->cmd = CMD_DATA;
+        dst->flags |= ESPNOW_FLAG_RELIABLE;
+        dst->len = payloadLen;
+        memcpy(dst->data, msg->data + sizeof(espnow_reliable_hdr_t), payloadLen);
+    }
+
+    if (diff == 0 && dst) {
+        deliverReliable(dst);
+        _reliable.rcvNext++;
+
+        // 順序待ちのフレームを続けて配送
+        uint8_t *slot = &_reliable.rxBuf[_reliable.rcvNext % ESPNOW_RELIABLE_WINDOW];
+        while (*slot != ESPNOW_NO_BUFFER) {
+            uint8_t held = *slot;
+            *slot = ESPNOW_NO_BUFFER;
+            deliverReliable(&_parent->_reliableRxBuf[held]);
+            _parent->freeReliableRxBuffer(held);
+            _reliable.rcvNext++;
+            slot = &_reliable.rxBuf[_reliable.rcvNext % ESPNOW_RELIABLE_WINDOW];
+        }
+    }
+
+    // 重複やウィンドウ外でもACKを返す（送信側の再送を止めるため）
+    sendAck();
+}
+
+void ESP_NowAdhocPeer::deliverReliable(const espnow_message_t *msg) {
+    _reliable.delivered++;
+    _parent->deliverMessage(addr(), msg, false);
+}
+
+void ESP_NowAdhocPeer::sendAck() {
+    espnow_ack_t ack;
+    ack.session = _reliable.rcvSession;
+    ack.cum_ack = _reliable.rcvNext;
+    ack.sack = 0;
+    for (uint16_t i = 0; i + 1 < ESPNOW_RELIABLE_WINDOW; i++) {
+        uint16_t seq = _reliable.rcvNext + 1 + i;
+        if (_reliable.rxBuf[seq % ESPNOW_RELIABLE_WINDOW] != ESPNOW_NO_BUFFER) {
+            ack.sack |= (1 << i);
+        }
+    }
+
+    // 制御クラスで送り、相手のデータの後ろで待たせない（入らなかった場合は相手の再送に任せる）
+    _parent->queueReliable(this, ESPNOW_TX_PRIO_CONTROL, CMD_ACK, (const uint8_t *)&ack, sizeof(ack));
+}
+
+void ESP_NowAdhocPeer::processAck(const espnow_message_t *msg) {
+    if (msg->len < sizeof(espnow_ack_t)) {
+        return;
+    }
+
+    // 送信側の状態は update() 側で更新するため、最新のACKのみ渡す
+    const espnow_ack_t *ack = (const espnow_ack_t *)msg->data;
+    if (ack->session != _reliable.session) {
+        return;
+    }
+    _reliable.ackWord.store(((uint32_t)ack->cum_ack << 16) | ack->sack);
+    _parent->_reliableKick.store(true);
+}
+
+void ESP_NowAdhocPeer::updateRtt(unsigned long sample) {
+    // RFC 6298 に基づくRTO計算
+    if (!_reliable.rttValid) {
+        _reliable.srtt = sample;
+        _reliable.rttvar = sample / 2;
+        _reliable.rttValid = true;
+    } else {
+        unsigned long delta = (_reliable.srtt > sample) ? _reliable.srtt - sample : sample - _reliable.srtt;
+        _reliable.rttvar = (3 * _reliable.rttvar + delta) / 4;
+        _reliable.srtt = (7 * _reliable.srtt + sample) / 8;
+    }
+
+    unsigned long rto = _reliable.srtt + (4 * _reliable.rttvar > 1 ? 4 * _reliable.rttvar : 1);
+    if (rto < ESPNOW_RELIABLE_MIN_RTO) {
+        rto = ESPNOW_RELIABLE_MIN_RTO;
+    } else if (rto > ESPNOW_RELIABLE_MAX_RTO) {
+        rto = ESPNOW_RELIABLE_MAX_RTO;
+    }
+    _reliable.rto = rto;
+}
+
+void ESP_NowAdhocPeer::handleAck(uint16_t cumAck, uint16_t sack, unsigned long now) {
+    // 送信済み範囲を超えるACKは無視
+    if (seqDiff(cumAck, _reliable.nextSeq) > 0) {
+        return;
+    }
+
+    // 選択ACKで受信が確認できた最も後ろの位置
+    int highestSacked = 0;
+    for (int i = 15; i >= 0; i--) {
+        if (sack & (1 << i)) {
+            highestSacked = i + 1;
+            break;
+        }
+    }
+    
+    for (uint16_t seq = _reliable.base; seqDiff(seq, _reliable.nextSeq) < 0; seq++) {
+        espnow_reliable_tx_entry_t &e = _reliable.tx[seq % ESPNOW_RELIABLE_WINDOW];
+        if (!e.used || e.acked) {
+            continue;
+        }
+
+        int16_t offset = seqDiff(seq, cumAck);
+        bool acked = offset < 0;
+        if (offset >= 1 && offset <= 16 && (sack & (1 << (offset - 1)))) {
+            acked = true;
+        }
+        if (!acked) {
+            continue;
+        }
+
+        if (!e.retransmitted) {
+            updateRtt(now - e.sentMs);
+        }
+        e.acked = true;
+        _parent->freeReliableTxBuffer(e.buf);
+        e.buf = ESPNOW_NO_BUFFER;
+    }
+
+    // 確認済みの先頭からウィンドウを進める
+    while (seqDiff(_reliable.base, _reliable.nextSeq) < 0) {
+        espnow_reliable_tx_entry_t &e = _reliable.tx[_reliable.base % ESPNOW_RELIABLE_WINDOW];
+        if (!e.used || !e.acked) {
+            break;
+        }
+        e.used = false;
+        _reliable.base++;
+    }
+
+    // 選択ACKで後続の受信が確認できた欠落フレームは即座に再送（1回のみ）
+    uint16_t sackedEnd = cumAck + highestSacked;
+    for (uint16_t seq = _reliable.base; highestSacked > 0 && seqDiff(seq, sackedEnd) < 0; seq++) {
+        espnow_reliable_tx_entry_t &e = _reliable.tx[seq % ESPNOW_RELIABLE_WINDOW];
+        if (e.used && !e.acked && !e.fastRetransmit) {
+            e.fastRetransmit = true;
+            e.deadline = now;
+        }
+    }
+}
+
+void ESP_NowAdhocPeer::serviceReliable(unsigned long now) {
+    uint32_t ackWord = _reliable.ackWord.load();
+    if (ackWord != _reliable.lastAckWord) {
+        _reliable.lastAckWord = ackWord;
+        handleAck(ackWord >> 16, ackWord & 0xFFFF, now);
+    }
+
+    if (_reliable.base == _reliable.nextSeq) {
+        _reliable.linkLoss.store(false);
+        return;
+    }
+
+    // リンク層で送信失敗した場合は先頭の未確認フレームをタイマーを待たずに再送
+    // （リンクが切れている間に再送を繰り返さないよう、再送タイマーごとに1回まで）
+    if (_reliable.linkLoss.exchange(false)) {
+        espnow_reliable_tx_entry_t &head = _reliable.tx[_reliable.base % ESPNOW_RELIABLE_WINDOW];
+        if (head.used && !head.acked && !head.linkRetransmit && (long)(now - head.deadline) < 0) {
+            head.linkRetransmit = true;
+            head.retransmitted = true;
+            _reliable.retransmits++;
+            const espnow_message_t *msg = &_parent->_reliableTxBuf[head.buf];
+            _parent->queueReliable(this, ESPNOW_TX_PRIO_DATA, CMD_RELIABLE, (const uint8_t *)msg->data, msg->len);
+        }
+    }
+
+    bool timedOut = false;
+    for (uint16_t seq = _reliable.base; seqDiff(seq, _reliable.nextSeq) < 0; seq++) {
+        espnow_reliable_tx_entry_t &e = _reliable.tx[seq % ESPNOW_RELIABLE_WINDOW];
+        if (!e.used || e.acked || (long)(now - e.deadline) < 0) {
+            continue;
+        }
+        if (e.retries >= ESPNOW_RELIABLE_MAX_RETRIES) {
+            failReliable();
+            return;
+        }
+
+        if (!e.fastRetransmit || e.retransmitted) {
+            timedOut = true;
+        }
+        e.retransmitted = true;
+        e.linkRetransmit = false;
+        e.retries++;
+        e.sentMs = now;
+        e.deadline = now + _reliable.rto;
+        _reliable.retransmits++;
+        const espnow_message_t *msg = &_parent->_reliableTxBuf[e.buf];
+        _parent->queueReliable(this, ESPNOW_TX_PRIO_DATA, CMD_RELIABLE, (const uint8_t *)msg->data, msg->len);
+    }
+
+    // タイムアウトによる再送はRTOを指数的に延ばす
+    if (timedOut) {
+        _reliable.rto = (_reliable.rto * 2 < ESPNOW_RELIABLE_MAX_RTO) ? _reliable.rto * 2 : ESPNOW_RELIABLE_MAX_RTO;
+    }
+}
+
+// 再送の上限を超えた：未確認のフレームをすべて破棄し、新しいセッションで送り直せるようにする
+// （受信側はセッションの変化で base から受信し直す）
+void ESP_NowAdhocPeer::failReliable() {
+    uint16_t dropped = 0;
+    for (uint16_t seq = _reliable.base; seqDiff(seq, _reliable.nextSeq) < 0; seq++) {
+        espnow_reliable_tx_entry_t &e = _reliable.tx[seq % ESPNOW_RELIABLE_WINDOW];
+        if (e.used && !e.acked) {
+            dropped++;
+        }
+        if (e.buf != ESPNOW_NO_BUFFER) {
+            _parent->freeReliableTxBuffer(e.buf);
+            e.buf = ESPNOW_NO_BUFFER;
+        }
+        e.used = false;
+    }
+    _reliable.session = (_reliable.session + 1 + (esp_random() % 0xFFFF)) & 0xFFFF;
+    _reliable.base = _reliable.nextSeq;
+    _reliable.rto = ESPNOW_RELIABLE_INITIAL_RTO;
+    _reliable.rttValid = false;
+    _reliable.linkLoss.store(false);
+    _reliable.failed += dropped;
+    _parent->notifyReliableFail(addr(), dropped);
+}
+
+// 未確認フレームの最も早い再送期限（未確認フレームがなければ false）
+bool ESP_NowAdhocPeer::nextReliableDeadline(unsigned long *due) const {
+    bool found = false;
+    for (uint16_t seq = _reliable.base; seqDiff(seq, _reliable.nextSeq) < 0; seq++) {
+        const espnow_reliable_tx_entry_t &e = _reliable.tx[seq % ESPNOW_RELIABLE_WINDOW];
+        if (!e.used || e.acked) {
+            continue;
+        }
+        if (!found || (long)(e.deadline - *due) < 0) {
+            *due = e.deadline;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// ==================== ESP_NowAdhoc（信頼性モード） ====================
+
+bool ESP_NowAdhoc::sendReliable(espnow_peer_handle_t handle, const uint8_t *data, size_t len) {
+    ESP_NowAdhocLock lock(_lock, _task);
+    ESP_NowAdhocPeer* peer = _peers.get(handle);
+    if (!peer) {
+        return false;
+    }
+    return peer->sendReliable(data, len);
+}
+
+// 信頼性モードのフレーム・ACKは他の送信と同じキューを通し、優先度と同時送信数の上限に従う
+// （保持しているフレームは再送に使うため、送信用のバッファへ写して入れる）
+bool ESP_NowAdhoc::queueReliable(ESP_NowAdhocPeer* peer, uint8_t prio, uint8_t cmd, const uint8_t *data, size_t len) {
+    espnow_peer_handle_t handle = _peers.find(peer->addr());
+    if (handle == ESPNOW_INVALID_PEER) {
+        return false;
+    }
+    uint8_t buf = prepareTxBuffer(cmd, _groupToken, data, len);
+    if (buf == ESPNOW_NO_BUFFER) {
+        _txStats.dropped++;
+        return false;
+    }
+    bool queued = enqueueTx(_peers.slot(handle), prio, buf);
+    releaseTxBuffer(buf);
+
+    serviceTx();
+    return queued;
+}
+
+void ESP_NowAdhoc::setReliableFailCallback(ReliableFailCallback callback) {
+    _reliableFailCallback = callback;
+}
+
+void ESP_NowAdhoc::serviceReliable(unsigned long now) {
+    _reliableKick.store(false);
+    disarmTimer(TIMER_RELIABLE);
+    for (size_t i = 0; i < _peers.size(); i++) {
+        ESP_NowAdhocPeer* peer = _peers.at(i);
+        peer->serviceReliable(now);
+        
+        unsigned long due;
+        if (peer->nextReliableDeadline(&due)) {
+            armTimerBefore(TIMER_RELIABLE, due);
+        }
+    }
+}
+
+uint8_t ESP_NowAdhoc::allocReliableTxBuffer() {
+    if (_reliableTxFreeCount == 0) {
+        return ESPNOW_NO_BUFFER;
+    }
+    return _reliableTxFree[--_reliableTxFreeCount];
+}
+
+void ESP_NowAdhoc::freeReliableTxBuffer(uint8_t buf) {
+    if (buf < ESPNOW_RELIABLE_TX_BUFFERS) {
+        _reliableTxFree[_reliableTxFreeCount++] = buf;
+    }
+}
+
+uint8_t ESP_NowAdhoc::allocReliableRxBuffer() {
+    if (_reliableRxFreeCount == 0) {
+        return ESPNOW_NO_BUFFER;
+    }
+    return _reliableRxFree[--_reliableRxFreeCount];
+}
+
+void ESP_NowAdhoc::freeReliableRxBuffer(uint8_t buf) {
+    if (buf < ESPNOW_RELIABLE_RX_BUFFERS) {
+        _reliableRxFree[_reliableRxFreeCount++] = buf;
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef ESP_NowAdhocReliable_H
+#define ESP_NowAdhocReliable_H
+
+#include <stdint.h>
+#include <atomic>
+
+// 信頼性モードの送信ウィンドウ（未確認で送信できるフレーム数）
+#ifndef ESPNOW_RELIABLE_WINDOW
+#define ESPNOW_RELIABLE_WINDOW 8
+#endif
+
+// 再送用に保持する送信フレーム数（全ピア共有）
+#ifndef ESPNOW_RELIABLE_TX_BUFFERS
+#define ESPNOW_RELIABLE_TX_BUFFERS 8
+#endif
+
+// 順序待ちで保持する受信フレーム数（全ピア共有）
+#ifndef ESPNOW_RELIABLE_RX_BUFFERS
+#define ESPNOW_RELIABLE_RX_BUFFERS 4
+#endif
+
+// 再送タイマー (ms)
+#ifndef ESPNOW_RELIABLE_INITIAL_RTO
+#define ESPNOW_RELIABLE_INITIAL_RTO 100
+#endif
+
+#ifndef ESPNOW_RELIABLE_MIN_RTO
+#define ESPNOW_RELIABLE_MIN_RTO 20
+#endif
+
+#ifndef ESPNOW_RELIABLE_MAX_RTO
+#define ESPNOW_RELIABLE_MAX_RTO 2000
+#endif
+
+// 1フレームの再送の上限（超えると未確認のフレームをすべて破棄し、ReliableFailCallback で通知する）
+#ifndef ESPNOW_RELIABLE_MAX_RETRIES
+#define ESPNOW_RELIABLE_MAX_RETRIES 8
+#endif
+
+// 選択ACKは16ビットのため、ウィンドウは17以下
+static_assert(ESPNOW_RELIABLE_WINDOW >= 1 && ESPNOW_RELIABLE_WINDOW <= 17, "ESPNOW_RELIABLE_WINDOW must be 1..17");
+static_assert(ESPNOW_RELIABLE_TX_BUFFERS < 0xFF && ESPNOW_RELIABLE_RX_BUFFERS < 0xFF, "Too many reliable buffers");
+
+#define ESPNOW_NO_BUFFER 0xFF
+
+// CMD_RELIABLE の data 先頭に付くヘッダー
+// session はピア登録ごとに乱数で決まり、再起動や再登録で変わると受信側は状態を初期化する
+typedef struct __attribute__((packed)) {
+    uint16_t session;
+    uint16_t base;  // 送信側の最も古い未確認シーケンス番号（受信側の再同期用）
+    uint16_t seq;
+} espnow_reliable_hdr_t;
+
+// CMD_ACK の data
+typedef struct __attribute__((packed)) {
+    uint16_t session;  // 確認対象の送信セッション
+    uint16_t cum_ack;  // 次に期待するシーケンス番号（これより前はすべて受信済み）
+    uint16_t sack;     // bit i: cum_ack + 1 + i を受信済み
+} espnow_ack_t;
+
+// 送信ウィンドウのエントリ（seq % ESPNOW_RELIABLE_WINDOW の位置に格納）
+typedef struct {
+    bool used;
+    bool acked;
+    bool retransmitted;  // 再送済みのフレームはRTT計測に使わない（Karnのアルゴリズム）
+    bool fastRetransmit;
+    bool linkRetransmit;  // リンク層の送信失敗による再送（再送タイマーごとに1回、上限に数えない）
+    uint16_t seq;
+    uint8_t buf;
+    uint8_t retries;
+    unsigned long sentMs;
+    unsigned long deadline;
+} espnow_reliable_tx_entry_t;
+
+// ピアごとの信頼性モード状態
+struct espnow_reliable_t {
+    // 送信側
+    uint16_t session;
+    uint16_t nextSeq;
+    uint16_t base;  // 最も古い未確認シーケンス番号
+    espnow_reliable_tx_entry_t tx[ESPNOW_RELIABLE_WINDOW];
+    unsigned long srtt;
+    unsigned long rttvar;
+    unsigned long rto;
+    bool rttValid;
+
+    // 受信コンテキストから渡される最新ACK（cum_ack << 16 | sack）とリンク層の送信失敗
+    std::atomic<uint32_t> ackWord;
+    uint32_t lastAckWord;
+    std::atomic<bool> linkLoss;
+
+    // 受信側
+    bool rcvSynced;
+    uint16_t rcvSession;
+    uint16_t rcvNext;
+    uint8_t rxBuf[ESPNOW_RELIABLE_WINDOW];  // 順序待ちフレームのバッファ番号
+
+    // 統計
+    uint32_t sent;
+    uint32_t retransmits;
+    uint32_t delivered;
+    uint32_t duplicates;
+    uint32_t failed;  // 再送の上限を超えて破棄したフレーム数
+};
+
+#endif
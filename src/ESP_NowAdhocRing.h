@@ -0,0 +1,57 @@
+#ifndef ESP_NowAdhocRing_H
+#define ESP_NowAdhocRing_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// 単一プロデューサー・単一コンシューマーのロックフリーリングバッファ
+// - スロットは静的に確保し、書き込み側・読み出し側ともスロットを直接参照する（コピー不要）
+// - プロデューサー: acquire() でスロットを取得し、書き込み後に publish()
+// - コンシューマー: peek() でスロットを借り、処理後に release()
+template <typename T, size_t N>
+class ESP_NowAdhocRing {
+public:
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "Ring size must be a power of two");
+
+    ESP_NowAdhocRing() : _head(0), _tail(0) {}
+
+    // プロデューサー側（満杯の場合は nullptr）
+    T* acquire() {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head - _tail.load(std::memory_order_acquire) >= N) {
+            return nullptr;
+        }
+        return &_slots[head & (N - 1)];
+    }
+
+    void publish() {
+        _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // コンシューマー側（空の場合は nullptr）
+    T* peek() {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail == _head.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &_slots[tail & (N - 1)];
+    }
+
+    void release() {
+        _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    size_t size() const {
+        return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return N; }
+
+private:
+    T _slots[N];
+    std::atomic<size_t> _head;
+    std::atomic<size_t> _tail;
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include "ESP_NowAdhoc.h"
+
+// ==================== 設定 ====================
+
+void ESP_NowAdhoc::setServerSelect(bool enable) {
+    ESP_NowAdhocLock lock(_lock, _task);
+    _serverSelect = enable;
+    selectPrimaryServer(false);
+}
+
+espnow_peer_handle_t ESP_NowAdhoc::getPrimaryServer() const {
+    return (_serverSelect && !_isServer) ? _primaryServer : ESPNOW_INVALID_PEER;
+}
+
+// サーバー宛の送信先（主サーバーを使わない場合は ESPNOW_INVALID_PEER で、全サーバーへ送る）
+espnow_peer_handle_t ESP_NowAdhoc::uplinkServer(bool toServer, bool toClient) const {
+    if (!toServer || toClient) {
+        return ESPNOW_INVALID_PEER;
+    }
+    return getPrimaryServer();
+}
+
+// ==================== 評価と選択 ====================
+
+// joining: 自分がまだ接続していないサーバー（移ると自分の分だけクライアントが増える）
+// useRssi: 全候補の受信強度が新しい（1台でも古ければ全サーバーで受信強度を除いて比べる）
+int32_t ESP_NowAdhoc::serverScore(const ESP_NowAdhocPeer* peer, bool joining, bool useRssi) const {
+    int32_t rssi = useRssi ? peer->rssi : 0;
+    int32_t clients = peer->_score.clients + (joining ? 1 : 0);
+    return rssi + (int32_t)peer->_score.success * ESPNOW_SERVER_SUCCESS_WEIGHT / 256 -
+           clients * ESPNOW_SERVER_LOAD_WEIGHT;
+}
+
+// failover: 現在の主サーバーを候補から外し、評価の差によらず切り替える
+void ESP_NowAdhoc::selectPrimaryServer(bool failover) {
+    espnow_peer_handle_t current = _peers.get(_primaryServer) ? _primaryServer : ESPNOW_INVALID_PEER;
+    espnow_peer_handle_t best = ESPNOW_INVALID_PEER;
+    int32_t bestScore = INT32_MIN;
+    // 受信強度は全サーバーで ESPNOW_SERVER_RSSI_MAX_AGE 以内に測った場合のみ使う
+    unsigned long now = millis();
+    bool useRssi = true;
+    for (size_t i = 0; i < _peers.size(); i++) {
+        ESP_NowAdhocPeer* peer = _peers.at(i);
+        if (peer->isServer && (peer->rssi == 0 || now - peer->_score.rssiMs >= ESPNOW_SERVER_RSSI_MAX_AGE)) {
+            useRssi = false;
+        }
+    }
+    for (size_t i = 0; i < _peers.size(); i++) {
+        ESP_NowAdhocPeer* peer = _peers.at(i);
+        espnow_peer_handle_t handle = _peers.handleAt(i);
+        if (!peer->isServer || (failover && handle == current)) {
+            continue;
+        }
+        int32_t score = serverScore(peer, handle != current, useRssi);
+        if (score > bestScore) {
+            best = handle;
+            bestScore = score;
+        }
+    }
+
+    if (best == ESPNOW_INVALID_PEER) {
+        _primaryServer = current;
+        return;
+    }
+    int32_t currentScore = (current != ESPNOW_INVALID_PEER) ? serverScore(_peers.get(current), false, useRssi) : 0;
+    if (!failover && current != ESPNOW_INVALID_PEER && bestScore <= currentScore + ESPNOW_SERVER_HYSTERESIS) {
+        return;
+    }
+    if (best != current && current != ESPNOW_INVALID_PEER && !failover) {
+        // 同じ負荷の通知を見た全クライアントが一斉に移らないよう、主サーバーのクライアント数に応じた確率で移る
+        // 負荷を除いたリンクの差（受信強度・成功率）も含めて 2 * ESPNOW_SERVER_HYSTERESIS 以上良ければすぐに移る
+        uint8_t clients = _peers.get(current)->_score.clients;
+        int32_t gap = bestScore - currentScore;
+        int32_t linkGap = gap + ((int32_t)_peers.get(best)->_score.clients + 1 - clients) * ESPNOW_SERVER_LOAD_WEIGHT;
+        bool clearlyBetter = gap >= 2 * ESPNOW_SERVER_HYSTERESIS && linkGap >= 2 * ESPNOW_SERVER_HYSTERESIS;
+        if (!clearlyBetter && clients > 1 && esp_random() % clients != 0) {
+            return;
+        }
+        _serverSelectStats.changes++;
+    }
+    _primaryServer = best;
+}
+
+// ハートビートのタイマーから呼ばれる（直近の間隔の送信結果を成功率に反映する）
+void ESP_NowAdhoc::updateServerScores() {
+    if (_isServer) {
+        return;
+    }
+    for (size_t i = 0; i < _peers.size(); i++) {
+        ESP_NowAdhocPeer* peer = _peers.at(i);
+        if (!peer->isServer) {
+            continue;
+        }
+        espnow_server_score_t& score = peer->_score;
+        uint32_t success = peer->txSuccess.load();
+        uint32_t failed = peer->txFailed.load();
+        uint32_t ok = success - score.lastSuccess;
+        uint32_t total = ok + (failed - score.lastFailed);
+        if (total > 0) {
+            score.success = (uint16_t)((3 * (uint32_t)score.success + 256 * ok / total) / 4);
+        }
+        score.lastSuccess = success;
+        score.lastFailed = failed;
+    }
+    selectPrimaryServer(false);
+}
+
+// 主サーバーへの送信が続けて失敗した（onSent から _failoverKick で通知される）
+void ESP_NowAdhoc::checkFailover() {
+    ESP_NowAdhocPeer* peer = _peers.get(_primaryServer);
+    if (!peer || peer->_txFailStreak.load() < ESPNOW_FAILOVER_FAILURES) {
+        return;
+    }
+    // 届いていないため成功率を0とし、次に送信が成功するまで選ばれにくくする
+    peer->_score.success = 0;
+    failoverPrimary(millis() - peer->lastGetMs);
+}
+
+void ESP_NowAdhoc::failoverPrimary(unsigned long silentMs) {
+    espnow_peer_handle_t previous = _primaryServer;
+    selectPrimaryServer(true);
+    if (_primaryServer != previous) {
+        _serverSelectStats.failovers++;
+        _serverSelectStats.lastFailoverMs = silentMs;
+        if (_debugEnabled) {
+            Serial.printf("[ESP_NowAdhoc] Primary server failover after %lu ms\n", silentMs);
+        }
+    }
+}
+
+// ==================== 負荷の通知 ====================
+
+// サーバーのビーコン・経路広告・ハートビートの末尾に、最近データを送ってきたクライアント数を付ける
+void ESP_NowAdhoc::appendServerLoad(uint8_t buf) {
+    if (!_isServer) {
+        return;
+    }
+    unsigned long now = millis();
+    int clients = 0;
+    for (size_t i = 0; i < _peers.size(); i++) {
+        ESP_NowAdhocPeer* peer = _peers.at(i);
+        if (!peer->isServer && peer->_uplinkMs != 0 && now - peer->_uplinkMs < ESPNOW_SERVER_LOAD_WINDOW) {
+            clients++;
+        }
+    }
+    espnow_message_t* msg = &_txBuf[buf];
+    msg->data[msg->len] = clients < 255 ? (uint8_t)clients : 255;
+    msg->len += sizeof(espnow_server_load_t);
+    _txLen[buf] = ESPNOW_HEADER_SIZE + msg->len;
+}
+
+// offset: 負荷の前までの data の長さ（負荷が付いていなければ何もしない）
+void ESP_NowAdhoc::processServerLoad(ESP_NowAdhocPeer* peer, const espnow_message_t* msg, size_t offset) {
+    if (!peer || !peer->isServer || msg->len != offset + sizeof(espnow_server_load_t)) {
+        return;
+    }
+    peer->_score.clients = (uint8_t)msg->data[offset];
+}
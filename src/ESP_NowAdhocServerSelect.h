@@ -0,0 +1,67 @@
+#ifndef ESP_NowAdhocServerSelect_H
+#define ESP_NowAdhocServerSelect_H
+
+#include <stdint.h>
+
+// クライアントの主サーバーの選択（setServerSelect()）
+// サーバー宛の送信（sendToServer()・sendLargeToServer()・publish()・中継の引き渡し）を主サーバー1台にのみ送る
+// サーバーは受信強度・最近の送信成功率・サーバーが通知する接続クライアント数で評価し、
+// 主サーバーのタイムアウトまたは連続した送信失敗で次に良いサーバーへすぐに切り替える
+// false の場合は全サーバーへ送る
+#ifndef ESPNOW_SERVER_SELECT
+#define ESPNOW_SERVER_SELECT true
+#endif
+
+// 主サーバーへの送信がこの回数続けて失敗したら切り替える
+#ifndef ESPNOW_FAILOVER_FAILURES
+#define ESPNOW_FAILOVER_FAILURES 3
+#endif
+
+// 評価がこの値より良いサーバーがあれば切り替える（評価の揺らぎで頻繁に切り替えない）
+#ifndef ESPNOW_SERVER_HYSTERESIS
+#define ESPNOW_SERVER_HYSTERESIS 10
+#endif
+
+// 評価 = 受信強度 (dBm) + 送信成功率 (0..1) × SUCCESS_WEIGHT - クライアント数 × LOAD_WEIGHT
+// 受信強度は新しいピアのコールバックを通ったフレーム（登録フレーム、ドライバーから外したピア）でしか測れず、
+// ドライバーに登録したサーバーでは更新されない。RSSI_MAX_AGE より古い・未測定のサーバーが候補にあれば、
+// 全サーバーの評価から受信強度を除き、送信成功率と負荷だけで比べる
+#ifndef ESPNOW_SERVER_SUCCESS_WEIGHT
+#define ESPNOW_SERVER_SUCCESS_WEIGHT 40
+#endif
+
+#ifndef ESPNOW_SERVER_LOAD_WEIGHT
+#define ESPNOW_SERVER_LOAD_WEIGHT 4
+#endif
+
+// サーバーはこの時間内にユニキャストのデータを送ってきたクライアントを負荷として数える
+#ifndef ESPNOW_SERVER_LOAD_WINDOW
+#define ESPNOW_SERVER_LOAD_WINDOW (HEARTBEAT_INTERVAL * 3)
+#endif
+
+// 受信強度はこの時間 (ms) より古ければ評価に使わない
+#ifndef ESPNOW_SERVER_RSSI_MAX_AGE
+#define ESPNOW_SERVER_RSSI_MAX_AGE (HEARTBEAT_INTERVAL * 30)
+#endif
+
+// サーバーのビーコン・経路広告・ハートビートの data 末尾（古いノードは読み飛ばす）
+typedef struct __attribute__((packed)) {
+    uint8_t clients;  // 最近データを送ってきたクライアント数
+} espnow_server_load_t;
+
+// クライアントが持つサーバーごとの評価の材料
+typedef struct {
+    uint8_t clients;       // サーバーが最後に通知したクライアント数
+    uint16_t success;      // 最近の送信成功率（256 = 100%。ハートビート間隔ごとに平滑化）
+    uint32_t lastSuccess;  // 前回の平滑化の時点の txSuccess
+    uint32_t lastFailed;   // 同 txFailed
+    uint32_t rssiMs;       // 受信強度を最後に測った時刻（millis()）
+} espnow_server_score_t;
+
+typedef struct {
+    uint32_t changes;         // 評価による主サーバーの切り替え回数
+    uint32_t failovers;       // タイムアウト・連続した送信失敗による切り替え回数
+    uint32_t lastFailoverMs;  // 直近の切り替えで、元の主サーバーから最後に受信してから切り替えるまでの時間
+} espnow_server_select_stats_t;
+
+#endif
@@ -0,0 +1,259 @@
+#include "ESP_NowAdhoc.h"
+#include <Preferences.h>
+
+// 鍵導出の入力の先頭に置く用途の区別
+static const uint8_t LABEL_HELLO = 'H';
+static const uint8_t LABEL_PAIR = 'P';
+static const uint8_t LABEL_BROADCAST = 'B';
+
+// IV: 送信元MAC(6) + シーケンス番号(4) + 0(2)
+// シーケンス番号は送信側の起動ごとに全フレームで共有して増やすため、同じ鍵で同じIVは使われない
+static inline void sessionIv(uint8_t* iv, const uint8_t* mac, uint32_t seq) {
+    memcpy(iv, mac, 6);
+    memcpy(iv + 6, &seq, 4);
+    iv[10] = 0;
+    iv[11] = 0;
+}
+
+static inline bool replayFresh(const espnow_replay_t& w, uint32_t seq) {
+    if (seq > w.top) {
+        return true;
+    }
+    uint32_t age = w.top - seq;
+    return age < ESPNOW_SESSION_REPLAY_WINDOW && !(w.bitmap & (1ULL << age));
+}
+
+static inline void replayAccept(espnow_replay_t& w, uint32_t seq) {
+    if (seq > w.top) {
+        uint32_t shift = seq - w.top;
+        w.bitmap = shift < ESPNOW_SESSION_REPLAY_WINDOW ? (w.bitmap << shift) | 1 : 1;
+        w.top = seq;
+    } else {
+        w.bitmap |= 1ULL << (w.top - seq);
+    }
+}
+
+static_assert(ESPNOW_SESSION_REPLAY_WINDOW <= 64, "ESPNOW_SESSION_REPLAY_WINDOW must fit in espnow_replay_t::bitmap");
+
+// ==================== 設定 ====================
+
+bool ESP_NowAdhoc::setSessionKey(const char* secret) {
+    // 登録済みのピアの鍵を導出し直せないため begin() の前にのみ変更できる
+    if (_broadcastPeer) {
+        return false;
+    }
+    if (!secret || !*secret) {
+        _sessionMode = false;
+        memset(_sessionSecret, 0, sizeof(_sessionSecret));
+        return true;
+    }
+    if (strlen(secret) > ESPNOW_SESSION_SECRET_MAX) {
+        return false;
+    }
+    memset(_sessionSecret, 0, sizeof(_sessionSecret));
+    strncpy(_sessionSecret, secret, ESPNOW_SESSION_SECRET_MAX);
+    _sessionMode = true;
+    return true;
+}
+
+// begin() から呼ばれる（WiFi起動後でないと esp_random() が真の乱数にならない）
+void ESP_NowAdhoc::beginSession() {
+    for (size_t i = 0; i < ESPNOW_SESSION_NONCE_SIZE; i += 4) {
+        uint32_t r = esp_random();
+        memcpy(_sessionNonce + i, &r, 4);
+    }
+    _sessionTxSeq = 0;
+
+    // 起動回数を進めて保存する（保存できなければ 0 のまま。再起動前の鍵はピアのタイムアウトで消える）
+    _sessionEpoch = 0;
+    Preferences prefs;
+    if (prefs.begin(ESPNOW_PEER_CACHE_NAMESPACE, false)) {
+        uint32_t epoch = 0;
+        prefs.getBytes(ESPNOW_SESSION_EPOCH_KEY, &epoch, sizeof(epoch));
+        epoch++;
+        if (prefs.putBytes(ESPNOW_SESSION_EPOCH_KEY, &epoch, sizeof(epoch)) == sizeof(epoch)) {
+            _sessionEpoch = epoch;
+        }
+        prefs.end();
+    }
+
+    uint8_t in[1 + 6 + ESPNOW_SESSION_NONCE_SIZE];
+    in[0] = LABEL_BROADCAST;
+    memcpy(in + 1, _selfMac, 6);
+    memcpy(in + 7, _sessionNonce, ESPNOW_SESSION_NONCE_SIZE);
+    sessionDigest(in, sizeof(in), _sessionBcastKey, ESPNOW_SESSION_KEY_SIZE);
+}
+
+// HMAC-SHA256(共通鍵, in) の先頭 outLen バイト
+void ESP_NowAdhoc::sessionDigest(const uint8_t* in, size_t len, uint8_t* out, size_t outLen) const {
+    uint8_t digest[32];
+    mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
+                    (const uint8_t*)_sessionSecret, strlen(_sessionSecret), in, len, digest);
+    memcpy(out, digest, outLen);
+}
+
+// ==================== 登録フレーム ====================
+
+void ESP_NowAdhoc::appendSessionHello(uint8_t buf) {
+    espnow_message_t* msg = &_txBuf[buf];
+    espnow_session_hello_t hello;
+    memcpy(hello.nonce, _sessionNonce, ESPNOW_SESSION_NONCE_SIZE);
+    hello.epoch = _sessionEpoch;
+    hello.seq = _sessionTxSeq;
+
+    uint8_t in[1 + 6 + ESPNOW_SESSION_NONCE_SIZE + 8];
+    in[0] = LABEL_HELLO;
+    memcpy(in + 1, _selfMac, 6);
+    memcpy(in + 7, &hello, ESPNOW_SESSION_NONCE_SIZE + 8);
+    sessionDigest(in, sizeof(in), hello.tag, ESPNOW_SESSION_HELLO_TAG_SIZE);
+
+    memcpy(msg->data + msg->len, &hello, sizeof(hello));
+    msg->len += sizeof(hello);
+    msg->flags |= ESPNOW_FLAG_SESSION;
+    _txLen[buf] = ESPNOW_HEADER_SIZE + msg->len;
+}
+
+// 登録フレーム末尾の乱数を検証して取り出す（共通鍵が違えば false）
+bool ESP_NowAdhoc::checkSessionHello(const uint8_t* mac, const espnow_message_t* msg, espnow_session_hello_t* hello) const {
+    if (msg->len < sizeof(espnow_session_hello_t)) {
+        return false;
+    }
+    memcpy(hello, msg->data + msg->len - sizeof(espnow_session_hello_t), sizeof(espnow_session_hello_t));
+
+    uint8_t in[1 + 6 + ESPNOW_SESSION_NONCE_SIZE + 8];
+    in[0] = LABEL_HELLO;
+    memcpy(in + 1, mac, 6);
+    memcpy(in + 7, hello, ESPNOW_SESSION_NONCE_SIZE + 8);
+    uint8_t tag[ESPNOW_SESSION_HELLO_TAG_SIZE];
+    sessionDigest(in, sizeof(in), tag, sizeof(tag));
+
+    uint8_t diff = 0;
+    for (size_t i = 0; i < sizeof(tag); i++) {
+        diff |= tag[i] ^ hello->tag[i];
+    }
+    return diff == 0;
+}
+
+// 新しいピア・再起動したピア（起動回数が進んだ）の鍵を導出する
+// 確立済みのセッションに以前の起動の登録フレームが届いた場合（記録したフレームの再送）は false
+bool ESP_NowAdhoc::updateSession(ESP_NowAdhocPeer* peer, const espnow_session_hello_t* hello) {
+    espnow_session_peer_t& s = peer->_session;
+    if (s.ready && memcmp(s.nonce, hello->nonce, ESPNOW_SESSION_NONCE_SIZE) == 0) {
+        return true;
+    }
+    if (s.ready) {
+        // 登録フレームは鮮度を証明しないため、受信ウィンドウは新しい起動でのみ戻す
+        if (hello->epoch <= s.epoch) {
+            _sessionStats.replays++;
+            return false;
+        }
+        _sessionStats.rekeys++;
+    }
+    memcpy(s.nonce, hello->nonce, ESPNOW_SESSION_NONCE_SIZE);
+    s.epoch = hello->epoch;
+
+    // ユニキャストの鍵は MAC の小さい側から順に並べて両側で同じ入力にする
+    const uint8_t* mac = peer->addr();
+    bool selfFirst = memcmp(_selfMac, mac, 6) < 0;
+    uint8_t in[1 + 2 * (6 + ESPNOW_SESSION_NONCE_SIZE)];
+    uint8_t* first = in + 1;
+    uint8_t* second = in + 1 + 6 + ESPNOW_SESSION_NONCE_SIZE;
+    in[0] = LABEL_PAIR;
+    memcpy(selfFirst ? first : second, _selfMac, 6);
+    memcpy((selfFirst ? first : second) + 6, _sessionNonce, ESPNOW_SESSION_NONCE_SIZE);
+    memcpy(selfFirst ? second : first, mac, 6);
+    memcpy((selfFirst ? second : first) + 6, s.nonce, ESPNOW_SESSION_NONCE_SIZE);
+    sessionDigest(in, sizeof(in), s.key, ESPNOW_SESSION_KEY_SIZE);
+
+    in[0] = LABEL_BROADCAST;
+    memcpy(in + 1, mac, 6);
+    memcpy(in + 7, s.nonce, ESPNOW_SESSION_NONCE_SIZE);
+    sessionDigest(in, 1 + 6 + ESPNOW_SESSION_NONCE_SIZE, s.bcastKey, ESPNOW_SESSION_KEY_SIZE);
+
+    // 登録フレームより前に送られたフレームは受け取らない
+    s.rx.top = hello->seq;
+    s.rx.bitmap = ~0ULL;
+    s.bcastRx = s.rx;
+    s.ready = true;
+    return true;
+}
+
+// ==================== 保護と検証 ====================
+
+// sendData() から呼ばれる。保護したフレームを _sessionTxBuf に作る（送れない場合は nullptr）
+const uint8_t* ESP_NowAdhoc::sealFrame(ESP_NowAdhocPeer* peer, const uint8_t* data, size_t* len) {
+    const espnow_message_t* msg = (const espnow_message_t*)data;
+    size_t plainLen = *len - ESPNOW_HEADER_SIZE;
+    bool broadcast = (peer == _broadcastPeer);
+    if (plainLen + ESPNOW_SESSION_OVERHEAD > ESPNOW_DATA_SIZE || (!broadcast && !peer->_session.ready) ||
+        _sessionTxSeq == UINT32_MAX) {
+        return nullptr;
+    }
+
+    uint32_t start = ESP.getCycleCount();
+    uint32_t seq = ++_sessionTxSeq;
+    espnow_message_t* out = &_sessionTxBuf;
+    memcpy(out, msg, ESPNOW_HEADER_SIZE);
+    out->flags |= ESPNOW_FLAG_SESSION;
+    out->len = plainLen + ESPNOW_SESSION_OVERHEAD;
+    memcpy(out->data, &seq, 4);
+
+    uint8_t iv[12];
+    sessionIv(iv, _selfMac, seq);
+    mbedtls_gcm_setkey(&_gcm, MBEDTLS_CIPHER_ID_AES, broadcast ? _sessionBcastKey : peer->_session.key,
+                       ESPNOW_SESSION_KEY_SIZE * 8);
+    int ret = mbedtls_gcm_crypt_and_tag(&_gcm, MBEDTLS_GCM_ENCRYPT, plainLen, iv, sizeof(iv),
+                                        (const uint8_t*)out, ESPNOW_HEADER_SIZE,
+                                        (const uint8_t*)msg->data, (uint8_t*)out->data + 4,
+                                        ESPNOW_SESSION_TAG_SIZE, (uint8_t*)out->data + 4 + plainLen);
+    _sessionStats.sealCycles += ESP.getCycleCount() - start;
+    if (ret != 0) {
+        return nullptr;
+    }
+
+    _sessionStats.sealed++;
+    *len = ESPNOW_HEADER_SIZE + out->len;
+    return (const uint8_t*)out;
+}
+
+// 受信フレームを検証して復号する（結果は _sessionRxBuf。破棄する場合は nullptr）
+const espnow_message_t* ESP_NowAdhoc::openFrame(ESP_NowAdhocPeer* peer, const espnow_message_t* msg, bool broadcast) {
+    espnow_session_peer_t& s = peer->_session;
+    if (!s.ready || msg->len < ESPNOW_SESSION_OVERHEAD) {
+        _sessionStats.authFailures++;
+        trace(ESPNOW_TRACE_EV_RX_DROP, peer->addr(), ESPNOW_TRACE_DROP_AUTH, ESPNOW_HEADER_SIZE + msg->len);
+        return nullptr;
+    }
+
+    uint32_t seq;
+    memcpy(&seq, msg->data, 4);
+    espnow_replay_t& window = broadcast ? s.bcastRx : s.rx;
+    if (!replayFresh(window, seq)) {
+        _sessionStats.replays++;
+        trace(ESPNOW_TRACE_EV_RX_DROP, peer->addr(), ESPNOW_TRACE_DROP_REPLAY, ESPNOW_HEADER_SIZE + msg->len);
+        return nullptr;
+    }
+
+    uint32_t start = ESP.getCycleCount();
+    size_t plainLen = msg->len - ESPNOW_SESSION_OVERHEAD;
+    espnow_message_t* out = &_sessionRxBuf;
+    uint8_t iv[12];
+    sessionIv(iv, peer->addr(), seq);
+    mbedtls_gcm_setkey(&_gcm, MBEDTLS_CIPHER_ID_AES, broadcast ? s.bcastKey : s.key, ESPNOW_SESSION_KEY_SIZE * 8);
+    int ret = mbedtls_gcm_auth_decrypt(&_gcm, plainLen, iv, sizeof(iv), (const uint8_t*)msg, ESPNOW_HEADER_SIZE,
+                                       (const uint8_t*)msg->data + 4 + plainLen, ESPNOW_SESSION_TAG_SIZE,
+                                       (const uint8_t*)msg->data + 4, (uint8_t*)out->data);
+    _sessionStats.openCycles += ESP.getCycleCount() - start;
+    if (ret != 0) {
+        _sessionStats.authFailures++;
+        trace(ESPNOW_TRACE_EV_RX_DROP, peer->addr(), ESPNOW_TRACE_DROP_AUTH, ESPNOW_HEADER_SIZE + msg->len);
+        return nullptr;
+    }
+
+    replayAccept(window, seq);
+    memcpy(out, msg, ESPNOW_HEADER_SIZE);
+    out->flags &= ~ESPNOW_FLAG_SESSION;
+    out->len = plainLen;
+    _sessionStats.opened++;
+    return out;
+}
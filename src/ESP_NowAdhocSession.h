@@ -0,0 +1,62 @@
+#ifndef ESP_NowAdhocSession_H
+#define ESP_NowAdhocSession_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// アプリケーション層の認証付き暗号（setSessionKey()）
+// 各ノードは起動ごとの乱数を登録フレームに載せ、共通鍵と互いのMAC・乱数からピアごとのセッション鍵を導出する
+// グループ宛のフレームはすべて AES-128-GCM で保護する（ヘッダーは暗号化せず認証のみ）
+// ブロードキャストは送信元ごとの鍵（共通鍵と送信元の乱数から導出。グループの全員が導出できる）で保護する
+// 鍵は起動ごとに変わるため、以前の起動で記録されたフレームは認証に失敗する
+// 登録フレームには NVS に保存した起動回数を載せ、確立済みのセッションはより新しい起動の登録フレームでのみ
+// 鍵を導出し直す（以前の起動の登録フレームを再送されても古い鍵・受信ウィンドウに戻らない）
+
+#define ESPNOW_SESSION_SECRET_MAX 64  // 共通鍵（文字列）の最大長
+#define ESPNOW_SESSION_KEY_SIZE 16    // AES-128
+#define ESPNOW_SESSION_NONCE_SIZE 16
+#define ESPNOW_SESSION_TAG_SIZE 16
+#define ESPNOW_SESSION_HELLO_TAG_SIZE 8
+#define ESPNOW_SESSION_REPLAY_WINDOW 64  // 順序が入れ替わって届いても受け取るシーケンス番号の幅
+#define ESPNOW_SESSION_EPOCH_KEY "epoch"  // 起動回数の保存先（名前空間は ESPNOW_PEER_CACHE_NAMESPACE）
+
+// 保護したフレームの data: [シーケンス番号(4バイト)][暗号文][認証タグ]
+#define ESPNOW_SESSION_OVERHEAD (sizeof(uint32_t) + ESPNOW_SESSION_TAG_SIZE)
+
+// セッションモードの登録フレームの data（広告グループUUIDに続く）
+typedef struct __attribute__((packed)) {
+    uint8_t nonce[ESPNOW_SESSION_NONCE_SIZE];    // 起動ごとの乱数
+    uint32_t epoch;                               // 起動回数（起動ごとに増える）
+    uint32_t seq;                                 // 送信時点のシーケンス番号（これ以前のフレームは受け取らない）
+    uint8_t tag[ESPNOW_SESSION_HELLO_TAG_SIZE];  // 共通鍵によるMAC・乱数・epoch・seq の認証（共通鍵を持たないノードは登録しない）
+} espnow_session_hello_t;
+
+// 再送の検出（受け取った最大のシーケンス番号と、それ以前のウィンドウ内の受信済みビット）
+typedef struct {
+    uint32_t top;
+    uint64_t bitmap;  // bit i: top - i を受信済み
+} espnow_replay_t;
+
+// ピアごとのセッション
+typedef struct {
+    bool ready;
+    uint8_t nonce[ESPNOW_SESSION_NONCE_SIZE];   // ピアの乱数
+    uint32_t epoch;                             // ピアの起動回数
+    uint8_t key[ESPNOW_SESSION_KEY_SIZE];       // ユニキャストの鍵（両方向で共有し、IVの送信元MACで区別する）
+    uint8_t bcastKey[ESPNOW_SESSION_KEY_SIZE];  // ピアが送るブロードキャストの鍵
+    espnow_replay_t rx;
+    espnow_replay_t bcastRx;
+} espnow_session_peer_t;
+
+// セッションの統計（1フレームあたりの処理時間は sealCycles / sealed などをCPUクロックで割る）
+typedef struct {
+    uint32_t sealed;        // 保護して送ったフレーム数
+    uint32_t opened;        // 認証に成功したフレーム数
+    uint32_t authFailures;  // 認証に失敗したため破棄した数
+    uint32_t replays;       // 受信済み・ウィンドウより古いフレームと、以前の起動の登録フレームを破棄した数
+    uint32_t rekeys;        // ピアの再起動で鍵を導出し直した回数
+    uint64_t sealCycles;    // 保護（暗号化とタグ）に要したCPUサイクル
+    uint64_t openCycles;
+} espnow_session_stats_t;
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef ESP_NowAdhocStats_H
+#define ESP_NowAdhocStats_H
+
+#include <stdint.h>
+#include "ESP_NowAdhocTx.h"
+
+// ピアごとのリンク統計（getPeerStats() のスナップショット）
+// 送信成功率は txSuccess / (txSuccess + txFailed)
+typedef struct {
+    uint32_t txAttempts;   // ドライバーへ渡したフレーム数（ブロードキャストは含まない）
+    uint32_t txSuccess;    // onSent で成功したフレーム数（リンク層のACKあり）
+    uint32_t txFailed;     // onSent で失敗したフレーム数
+    uint32_t rxFrames;     // 受信フレーム数（結合フレームは1つと数える）
+    uint32_t rxBytes;      // 受信フレームのバイト数（ヘッダー込み）
+    int8_t rssi;           // 最後に測定した受信強度 (dBm)。0 は未測定
+    int8_t noiseFloor;     // 同ノイズフロア (dBm)
+    uint32_t linkRttUs;    // 送信から onSent までの平滑値 (us)。0 は未測定
+    uint32_t rttUs;        // ハートビートの往復時間の平滑値 (us)。0 は未測定
+    uint32_t jitterUs;     // 同平均偏差 (us)
+    unsigned long lastSeenMs;  // 最後にグループ宛フレームを受信してからの経過時間
+} espnow_peer_stats_t;
+
+// 受信時に破棄したフレームの統計
+typedef struct {
+    uint32_t shortFrames;  // ヘッダー不足・受信スロットを超える長さ・バージョンまたは長さの不一致
+    uint32_t wrongGroup;   // グループトークン不一致・UUIDの衝突
+    uint32_t security;     // セキュリティモードの不一致
+    uint32_t unknownPeer;  // キュー投入後に削除されたピアからのフレーム
+} espnow_drop_stats_t;
+
+// 全体の統計（getStats() のスナップショット）
+typedef struct {
+    uint16_t peers;
+    uint16_t servers;
+    uint16_t clients;
+    uint16_t driverPeers;     // ドライバーに登録中のピア数
+    uint32_t rxOverflows;     // 受信キュー満杯で破棄したフレーム数
+    uint32_t appOverflows;    // アプリケーションキュー満杯で破棄した数（beginTask() 時）
+    espnow_drop_stats_t drops;
+    espnow_tx_stats_t tx;
+} espnow_stats_t;
+
+#endif
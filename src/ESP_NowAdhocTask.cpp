@@ -0,0 +1,203 @@
+#include "ESP_NowAdhoc.h"
+#include <limits.h>
+
+// ==================== エンジンタスク ====================
+
+bool ESP_NowAdhoc::beginTask(BaseType_t core, UBaseType_t priority) {
+    if (_task) {
+        return true;
+    }
+    if (!_broadcastPeer) {
+        Serial.println("[ESP_NowAdhoc] beginTask() must be called after begin()");
+        return false;
+    }
+
+    if (!_lock) {
+        _lock = xSemaphoreCreateRecursiveMutex();
+        if (!_lock) {
+            return false;
+        }
+    }
+
+    // タスクはロックを取れるまで待つため、_task の設定前にエンジンが動くことはない
+    ESP_NowAdhocLock lock(_lock);
+    if (xTaskCreatePinnedToCore(engineTask, "ESP_NowAdhoc", ESPNOW_TASK_STACK_SIZE, this,
+                                priority, &_task, core) != pdPASS) {
+        _task = nullptr;
+        Serial.println("[ESP_NowAdhoc] Failed to create engine task");
+        return false;
+    }
+
+    if (_debugEnabled) {
+        Serial.printf("[ESP_NowAdhoc] Engine task started (core %d, priority %u)\n",
+            (int)core, (unsigned)priority);
+    }
+    return true;
+}
+
+void ESP_NowAdhoc::endTask() {
+    if (!_task) {
+        return;
+    }
+
+    // ロック中はエンジンが処理の途中で止まることはない
+    ESP_NowAdhocLock lock(_lock);
+    TaskHandle_t task = _task;
+    _task = nullptr;
+    vTaskDelete(task);
+}
+
+void ESP_NowAdhoc::engineTask(void* arg) {
+    ESP_NowAdhoc* self = static_cast<ESP_NowAdhoc*>(arg);
+
+    for (;;) {
+        unsigned long wait;
+        {
+            ESP_NowAdhocLock lock(self->_lock);
+            self->runEngine();
+            wait = self->engineDeadlineMs();
+        }
+
+        // 受信・送信完了・API呼び出しの通知か、次の期限まで待つ
+        TickType_t ticks = (wait == ULONG_MAX)
+                               ? portMAX_DELAY
+                               : (TickType_t)((wait + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS);
+        ulTaskNotifyTake(pdTRUE, ticks);
+    }
+}
+
+// WiFiタスク（受信・送信完了）とユーザー側のAPI呼び出しから呼ばれる
+void ESP_NowAdhoc::wakeEngine() {
+    TaskHandle_t task = _task;
+    if (task) {
+        xTaskNotifyGive(task);
+    }
+}
+
+// ==================== アプリケーションへの受け渡し ====================
+
+void ESP_NowAdhoc::deliverMessage(const uint8_t* mac, const espnow_message_t* msg, bool broadcast) {
+    if (!_task) {
+        invokeMessage(mac, msg, broadcast);
+        return;
+    }
+
+    espnow_app_slot_t* slot = _appQueue.acquire();
+    if (!slot) {
+        _appOverflows.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    slot->kind = ESPNOW_APP_MESSAGE;
+    memcpy(slot->mac, mac, 6);
+    slot->broadcast = broadcast;
+    memcpy(slot->data, msg, ESPNOW_HEADER_SIZE + msg->len);
+    _appQueue.publish();
+}
+
+void ESP_NowAdhoc::invokeMessage(const uint8_t* mac, const espnow_message_t* msg, bool broadcast) {
+    if (msg->cmd >= CMD_TYPED_BASE) {
+        dispatchTyped(mac, msg, broadcast);
+    } else if (msg->cmd == CMD_PUBLISH && _topicCallback) {
+        _topicCallback(mac, (uint8_t)msg->data[0], (const uint8_t*)msg->data + 1, msg->len - 1);
+    } else if (_dataCallback) {
+        _dataCallback(mac, msg, broadcast);
+    }
+}
+
+void ESP_NowAdhoc::notifyPeerEvent(const uint8_t* mac, bool isServer, bool connected) {
+    if (!_task) {
+        if (_peerEventCallback) {
+            _peerEventCallback(mac, isServer, connected);
+        }
+        return;
+    }
+
+    espnow_app_slot_t* slot = _appQueue.acquire();
+    if (!slot) {
+        _appOverflows.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    slot->kind = ESPNOW_APP_PEER_EVENT;
+    memcpy(slot->mac, mac, 6);
+    slot->isServer = isServer;
+    slot->connected = connected;
+    _appQueue.publish();
+}
+
+void ESP_NowAdhoc::notifyReliableFail(const uint8_t* mac, uint16_t dropped) {
+    if (!_task) {
+        if (_reliableFailCallback) {
+            _reliableFailCallback(mac, dropped);
+        }
+        return;
+    }
+
+    espnow_app_slot_t* slot = _appQueue.acquire();
+    if (!slot) {
+        _appOverflows.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    slot->kind = ESPNOW_APP_RELIABLE_FAIL;
+    memcpy(slot->mac, mac, 6);
+    slot->dropped = dropped;
+    _appQueue.publish();
+}
+
+// 再構築済みのデータはコピーせず、受け渡しが終わるまで再構築バッファを確保したままにする
+void ESP_NowAdhoc::deliverLarge(espnow_reassembly_t* slot) {
+    if (!_task) {
+        if (_largeDataCallback) {
+            _largeDataCallback(slot->mac, slot->data, slot->total_len);
+        }
+        slot->used = false;
+        return;
+    }
+
+    espnow_app_slot_t* app = _appQueue.acquire();
+    if (!app) {
+        _appOverflows.fetch_add(1, std::memory_order_relaxed);
+        slot->used = false;
+        return;
+    }
+    slot->pending = true;
+    app->kind = ESPNOW_APP_LARGE_DATA;
+    memcpy(app->mac, slot->mac, 6);
+    app->slot = slot - _reassembly;
+    _appQueue.publish();
+}
+
+// update() から呼ばれる（ユーザー側のタスク）
+void ESP_NowAdhoc::processAppQueue() {
+    espnow_app_slot_t* slot;
+    while ((slot = _appQueue.peek()) != nullptr) {
+        switch (slot->kind) {
+            case ESPNOW_APP_MESSAGE:
+                invokeMessage(slot->mac, &slot->msg, slot->broadcast);
+                break;
+
+            case ESPNOW_APP_PEER_EVENT:
+                if (_peerEventCallback) {
+                    _peerEventCallback(slot->mac, slot->isServer, slot->connected);
+                }
+                break;
+
+            case ESPNOW_APP_RELIABLE_FAIL:
+                if (_reliableFailCallback) {
+                    _reliableFailCallback(slot->mac, slot->dropped);
+                }
+                break;
+
+            case ESPNOW_APP_LARGE_DATA: {
+                espnow_reassembly_t* r = &_reassembly[slot->slot];
+                if (_largeDataCallback) {
+                    _largeDataCallback(r->mac, r->data, r->total_len);
+                }
+                ESP_NowAdhocLock lock(_lock);
+                r->pending = false;
+                r->used = false;
+                break;
+            }
+        }
+        _appQueue.release();
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef ESP_NowAdhocTask_H
+#define ESP_NowAdhocTask_H
+
+#include <stdint.h>
+
+// beginTask() で起動するエンジンタスクのスタックサイズ (bytes)
+#ifndef ESPNOW_TASK_STACK_SIZE
+#define ESPNOW_TASK_STACK_SIZE 8192
+#endif
+
+// エンジンタスクからアプリケーションへ渡すキューのスロット数（2のべき乗）
+#ifndef ESPNOW_APP_QUEUE_SIZE
+#define ESPNOW_APP_QUEUE_SIZE 8
+#endif
+
+// アプリケーションキューの種類
+#define ESPNOW_APP_MESSAGE 0     // DataCallback / 型付きハンドラー宛のメッセージ
+#define ESPNOW_APP_PEER_EVENT 1  // ピアの接続・切断
+#define ESPNOW_APP_LARGE_DATA 2  // 再構築済みの分割データ（再構築バッファを参照）
+#define ESPNOW_APP_RELIABLE_FAIL 3  // 信頼性モードの送信失敗
+
+#endif
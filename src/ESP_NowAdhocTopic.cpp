@@ -0,0 +1,285 @@
+#include "ESP_NowAdhoc.h"
+
+#define TOPIC_WORDS ((ESPNOW_MAX_PEERS + 31) / 32)
+
+// ==================== 購読 ====================
+
+bool ESP_NowAdhoc::subscribe(uint8_t topic) {
+    if (topic >= ESPNOW_TOPICS) {
+        return false;
+    }
+    ESP_NowAdhocLock lock(_lock, _task);
+    _topics |= (1UL << topic);
+    sendSubscriptions();
+    return true;
+}
+
+bool ESP_NowAdhoc::unsubscribe(uint8_t topic) {
+    if (topic >= ESPNOW_TOPICS) {
+        return false;
+    }
+    ESP_NowAdhocLock lock(_lock, _task);
+    _topics &= ~(1UL << topic);
+    sendSubscriptions();
+    return true;
+}
+
+size_t ESP_NowAdhoc::getSubscriberCount(uint8_t topic) const {
+    if (topic >= ESPNOW_TOPICS) {
+        return 0;
+    }
+    size_t count = 0;
+    for (size_t w = 0; w < TOPIC_WORDS; w++) {
+        count += __builtin_popcount(_topicPeers[topic][w]);
+    }
+    return count;
+}
+
+void ESP_NowAdhoc::setTopicCallback(TopicCallback callback) {
+    _topicCallback = callback;
+}
+
+// サーバーへ通知する購読（サーバーは配下のクライアントの購読を含め、他のサーバーからの転送を受ける）
+uint32_t ESP_NowAdhoc::announcedTopics() const {
+    uint32_t topics = _topics;
+    if (_isServer) {
+        for (size_t i = 0; i < _peers.size(); i++) {
+            if (!_peers.at(i)->isServer) {
+                topics |= _peers.at(i)->topics;
+            }
+        }
+    }
+    return topics;
+}
+
+// 購読が変わったサーバーと、前回の通知以降に送信失敗があったサーバーへ通知する
+// ハートビートのタイマーからも呼ばれる
+void ESP_NowAdhoc::sendSubscriptions() {
+    uint32_t topics = announcedTopics();
+    espnow_subscribe_t sub = {topics};
+    uint8_t buf = ESPNOW_NO_BUFFER;
+
+    for (size_t i = 0; i < _peers.size(); i++) {
+        ESP_NowAdhocPeer* peer = _peers.at(i);
+        if (!peer->isServer) {
+            continue;
+        }
+        bool lost = peer->_topicsLost.exchange(false);
+        if (topics == peer->_sentTopics && !(lost && topics != 0)) {
+            continue;
+        }
+
+        if (buf == ESPNOW_NO_BUFFER) {
+            buf = prepareTxBuffer(CMD_SUBSCRIBE, _groupToken, (const uint8_t *)&sub, sizeof(sub));
+            if (buf == ESPNOW_NO_BUFFER) {
+                peer->_topicsLost.store(lost);
+                return;
+            }
+        }
+        if (enqueueTx(_peers.slot(_peers.handleAt(i)), ESPNOW_TX_PRIO_CONTROL, buf)) {
+            peer->_sentTopics = topics;
+        }
+    }
+
+    if (buf != ESPNOW_NO_BUFFER) {
+        releaseTxBuffer(buf);
+        serviceTx();
+    }
+}
+
+// サーバーが自分を登録済みと分かった（自分宛のグループのフレーム・自分を載せたビーコンを受け取った）
+// 登録される前に送った通知は未登録のピアとして破棄されているため、購読があれば通知し直す
+void ESP_NowAdhoc::confirmRegistered(ESP_NowAdhocPeer* peer) {
+    if (!peer->isServer || peer->_registered) {
+        return;
+    }
+    peer->_registered = true;
+    if (peer->_sentTopics != 0) {
+        peer->_sentTopics = 0;
+        sendSubscriptions();
+    }
+}
+
+void ESP_NowAdhoc::processSubscribe(espnow_peer_handle_t from, const espnow_message_t* msg) {
+    ESP_NowAdhocPeer* peer = _peers.get(from);
+    if (!peer || msg->len < sizeof(espnow_subscribe_t)) {
+        return;
+    }
+
+    espnow_subscribe_t sub;
+    memcpy(&sub, msg->data, sizeof(sub));
+    peer->topics = sub.topics;
+    uint8_t slot = _peers.slot(from);
+    for (uint8_t t = 0; t < ESPNOW_TOPICS; t++) {
+        if (sub.topics & (1UL << t)) {
+            _topicPeers[t][slot / 32] |= (1UL << (slot % 32));
+        } else {
+            _topicPeers[t][slot / 32] &= ~(1UL << (slot % 32));
+        }
+    }
+
+    // クライアントの購読は他のサーバーへの通知に含まれる
+    if (_isServer && !peer->isServer) {
+        sendSubscriptions();
+    }
+}
+
+// 切断したピアの購読を外す（スロットは再利用される）
+void ESP_NowAdhoc::dropTopics(espnow_peer_handle_t handle) {
+    uint8_t slot = _peers.slot(handle);
+    for (uint8_t t = 0; t < ESPNOW_TOPICS; t++) {
+        _topicPeers[t][slot / 32] &= ~(1UL << (slot % 32));
+    }
+}
+
+// ==================== 発行と転送 ====================
+
+// 既に受け取った発行メッセージなら true（未受信なら記録する）
+bool ESP_NowAdhoc::topicSeen(const uint8_t* src, uint16_t seq) {
+    for (size_t i = 0; i < ESPNOW_TOPIC_DUP_CACHE; i++) {
+        if (_topicSeen[i].seq == seq && memcmp(_topicSeen[i].src, src, 6) == 0) {
+            return true;
+        }
+    }
+    memcpy(_topicSeen[_topicSeenNext].src, src, 6);
+    _topicSeen[_topicSeenNext].seq = seq;
+    _topicSeenNext = (_topicSeenNext + 1) % ESPNOW_TOPIC_DUP_CACHE;
+    return false;
+}
+
+bool ESP_NowAdhoc::publish(uint8_t topic, const uint8_t *data, size_t len) {
+    ESP_NowAdhocLock lock(_lock, _task);
+    if (topic >= ESPNOW_TOPICS) {
+        return false;
+    }
+
+    size_t maxLen = getESPNOWMaxPayload() - ESPNOW_HEADER_SIZE;
+    if (maxLen > ESPNOW_DATA_SIZE) {
+        maxLen = ESPNOW_DATA_SIZE;
+    }
+    if ((!data && len > 0) || sizeof(espnow_publish_hdr_t) + len > maxLen) {
+        return false;
+    }
+
+    uint8_t buf = prepareTxBuffer(CMD_PUBLISH, _groupToken, nullptr, 0);
+    if (buf == ESPNOW_NO_BUFFER) {
+        _txStats.dropped++;
+        return false;
+    }
+
+    espnow_publish_hdr_t hdr;
+    memcpy(hdr.src, _selfMac, 6);
+    hdr.seq = _topicSeq++;
+    hdr.topic = topic;
+
+    espnow_message_t *msg = &_txBuf[buf];
+    memcpy(msg->data, &hdr, sizeof(hdr));
+    if (len > 0) {
+        memcpy(msg->data + sizeof(hdr), data, len);
+    }
+    msg->len = sizeof(hdr) + len;
+    _txLen[buf] = ESPNOW_HEADER_SIZE + msg->len;
+
+    bool queued = fanoutPublish(buf, topic, ESPNOW_INVALID_PEER, _selfMac);
+    releaseTxBuffer(buf);
+    if (queued) {
+        _topicStats.published++;
+    }
+    serviceTx();
+    return queued;
+}
+
+// サーバーはトピックの購読者へ、クライアントはサーバー（主サーバーがあればそこ）へ送る
+// サーバーから届いたものはクライアントにのみ転送する（サーバー間で折り返さない）
+bool ESP_NowAdhoc::fanoutPublish(uint8_t buf, uint8_t topic, espnow_peer_handle_t from, const uint8_t* src) {
+    espnow_peer_handle_t origin = _peers.find(src);
+    espnow_peer_handle_t primary = uplinkServer(true, false);
+    bool fromServer = (from != ESPNOW_INVALID_PEER) && _peers.get(from) && _peers.get(from)->isServer;
+
+    uint32_t targets[TOPIC_WORDS] = {};
+    size_t count = 0;
+    for (size_t i = 0; i < _peers.size(); i++) {
+        espnow_peer_handle_t handle = _peers.handleAt(i);
+        uint8_t slot = _peers.slot(handle);
+        ESP_NowAdhocPeer* peer = _peers.at(i);
+        bool wanted = _isServer ? (_topicPeers[topic][slot / 32] & (1UL << (slot % 32))) != 0
+                                : (primary != ESPNOW_INVALID_PEER ? handle == primary : peer->isServer);
+        if (!wanted || handle == from || handle == origin || (fromServer && peer->isServer)) {
+            continue;
+        }
+        targets[slot / 32] |= (1UL << (slot % 32));
+        count++;
+    }
+    if (count == 0) {
+        return true;
+    }
+
+    // 購読者が多い場合はブロードキャスト1フレームで送る（購読していない受信側は破棄する）
+    if (useFanout(count)) {
+        bool queued = enqueueTx(TX_BROADCAST_QUEUE, ESPNOW_TX_PRIO_DATA, buf);
+        if (queued) {
+            _txStats.fanout++;
+            _topicStats.fanout++;
+            if (from != ESPNOW_INVALID_PEER) {
+                _topicStats.forwarded++;
+            }
+        }
+        return queued;
+    }
+
+    if (count > _txEntryFreeCount) {
+        _txStats.dropped += count;
+        return false;
+    }
+    for (uint8_t slot = 0; slot < ESPNOW_MAX_PEERS; slot++) {
+        if (targets[slot / 32] & (1UL << (slot % 32))) {
+            enqueueTx(slot, ESPNOW_TX_PRIO_DATA, buf);
+        }
+    }
+    if (from != ESPNOW_INVALID_PEER) {
+        _topicStats.forwarded++;
+    }
+    return true;
+}
+
+void ESP_NowAdhoc::processPublish(espnow_peer_handle_t from, const espnow_message_t* msg, bool broadcast) {
+    if (msg->len < sizeof(espnow_publish_hdr_t)) {
+        return;
+    }
+
+    espnow_publish_hdr_t hdr;
+    memcpy(&hdr, msg->data, sizeof(hdr));
+    if (hdr.topic >= ESPNOW_TOPICS) {
+        return;
+    }
+    if (memcmp(hdr.src, _selfMac, 6) == 0 || topicSeen(hdr.src, hdr.seq)) {
+        _topicStats.duplicates++;
+        return;
+    }
+
+    // 購読していればトピックとペイロードにして発行元のMACで配送
+    if (_topics & (1UL << hdr.topic)) {
+        _topicStats.delivered++;
+        espnow_message_t *out = &_topicDeliverBuf;
+        memcpy(out, msg, ESPNOW_HEADER_SIZE);
+        out->flags = 0;
+        out->len = msg->len - sizeof(hdr) + 1;
+        out->data[0] = hdr.topic;
+        memcpy(out->data + 1, msg->data + sizeof(hdr), out->len - 1);
+        deliverMessage(hdr.src, out, broadcast);
+    } else if (!_isServer) {
+        _topicStats.filtered++;
+    }
+
+    if (!_isServer) {
+        return;
+    }
+
+    uint8_t buf = prepareTxBuffer(CMD_PUBLISH, _groupToken, (const uint8_t *)msg->data, msg->len);
+    if (buf == ESPNOW_NO_BUFFER) {
+        _txStats.dropped++;
+        return;
+    }
+    fanoutPublish(buf, hdr.topic, from, hdr.src);
+    releaseTxBuffer(buf);
+}
@@ -0,0 +1,47 @@
+#ifndef ESP_NowAdhocTopic_H
+#define ESP_NowAdhocTopic_H
+
+#include <stdint.h>
+
+// トピック（subscribe() / publish()）
+// 各ノードは購読するトピックのビットマスクを CMD_SUBSCRIBE で直接のサーバーへ通知する
+// （サーバーは自分と配下のクライアントの購読をまとめて他のサーバーへ通知する）
+// サーバーはトピックごとに購読しているピアのビットマップを持ち、発行されたメッセージを購読者にのみ転送する
+#ifndef ESPNOW_TOPICS
+#define ESPNOW_TOPICS 32
+#endif
+
+// 重複の破棄に覚えておく発行メッセージ数（発行元MAC + シーケンス番号）
+#ifndef ESPNOW_TOPIC_DUP_CACHE
+#define ESPNOW_TOPIC_DUP_CACHE 16
+#endif
+
+static_assert(ESPNOW_TOPICS >= 1 && ESPNOW_TOPICS <= 32, "ESPNOW_TOPICS must be 1..32");
+
+// CMD_SUBSCRIBE の data
+typedef struct __attribute__((packed)) {
+    uint32_t topics;  // 購読するトピックのビットマスク
+} espnow_subscribe_t;
+
+// CMD_PUBLISH の data 先頭（続いてペイロード）
+typedef struct __attribute__((packed)) {
+    uint8_t src[6];  // 発行元
+    uint16_t seq;    // 発行元ごとのシーケンス番号
+    uint8_t topic;
+} espnow_publish_hdr_t;
+
+typedef struct {
+    uint8_t src[6];
+    uint16_t seq;
+} espnow_topic_seen_t;
+
+typedef struct {
+    uint32_t published;   // publish() で送ったメッセージ数
+    uint32_t forwarded;   // サーバーが購読者へ転送したメッセージ数
+    uint32_t fanout;      // うちブロードキャスト1フレームで送った数
+    uint32_t delivered;   // 購読しているトピックとして受け取った数
+    uint32_t filtered;    // 購読していないため破棄した数（ブロードキャストで届いたもの）
+    uint32_t duplicates;  // 複数の経路で届いたため破棄した数
+} espnow_topic_stats_t;
+
+#endif
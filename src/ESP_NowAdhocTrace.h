@@ -0,0 +1,158 @@
+#ifndef ESP_NowAdhocTrace_H
+#define ESP_NowAdhocTrace_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+
+// トレースのカテゴリ（ビットマスク）
+#define ESPNOW_TRACE_RX 0x01        // 受信・破棄
+#define ESPNOW_TRACE_TX 0x02        // 送信・送信完了
+#define ESPNOW_TRACE_PEER 0x04      // ピアの登録・タイムアウト・ドライバー登録の入れ替え
+#define ESPNOW_TRACE_ADV 0x08       // 広告・ビーコン
+#define ESPNOW_TRACE_DATA 0x10      // 分割送信の再構築
+#define ESPNOW_TRACE_MESH 0x20      // メッシュの中継
+#define ESPNOW_TRACE_ALL 0x3F
+
+// コンパイル時に有効にするカテゴリ（0 でトレースのコードとバッファを除外）
+// 実行時は setTraceMask() でこの中から記録するカテゴリを選ぶ
+#ifndef ESPNOW_TRACE
+#define ESPNOW_TRACE ESPNOW_TRACE_ALL
+#endif
+
+// トレースバッファのレコード数（2のべき乗。満杯時は古いレコードから上書き）
+#ifndef ESPNOW_TRACE_SIZE
+#define ESPNOW_TRACE_SIZE 64
+#endif
+
+// イベントID（上位4ビットがカテゴリのビット番号）
+// 番号を変える場合は extras/trace_decode.py の表も合わせて更新する
+#define ESPNOW_TRACE_EV_RX_HEARTBEAT 0x00   // arg0: ブロードキャスト
+#define ESPNOW_TRACE_EV_RX_DROP 0x01        // arg0: ESPNOW_TRACE_DROP_*, arg1: フレーム長
+#define ESPNOW_TRACE_EV_RX_OVERFLOW 0x02    // 受信キュー満杯, arg1: フレーム長
+#define ESPNOW_TRACE_EV_TX_DONE 0x10        // onSent, arg0: 成功, arg1: 送信からの時間 (us)
+#define ESPNOW_TRACE_EV_TX_HEARTBEAT 0x11   // ハートビートをキューに入れた
+#define ESPNOW_TRACE_EV_TX_FAILED 0x12      // send() 失敗, arg1: 破棄したメッセージ数
+#define ESPNOW_TRACE_EV_PEER_ADDED 0x20     // arg0: サーバー
+#define ESPNOW_TRACE_EV_PEER_TIMEOUT 0x21   // arg0: サーバー
+#define ESPNOW_TRACE_EV_PEER_EVICTED 0x22   // ドライバーから外した
+#define ESPNOW_TRACE_EV_PEER_CACHE 0x23     // ピア一覧をNVSへ保存した, arg1: ピア数
+#define ESPNOW_TRACE_EV_ADV 0x30            // arg0: コマンド, arg1: 広告間隔 (ms)
+#define ESPNOW_TRACE_EV_BEACON 0x31         // arg1: 載せたピア数
+#define ESPNOW_TRACE_EV_REASSEMBLY_TIMEOUT 0x40  // arg0: 受信済みフラグメント数, arg1: メッセージID
+#define ESPNOW_TRACE_EV_REASSEMBLY_EVICTED 0x41  // arg1: メッセージID
+#define ESPNOW_TRACE_EV_RELAY_FORWARD 0x50  // mac: 宛先, arg0: TTL, arg1: シーケンス番号
+#define ESPNOW_TRACE_EV_RELAY_NO_ROUTE 0x51 // mac: 宛先, arg1: シーケンス番号
+
+#define ESPNOW_TRACE_CATEGORY(event) (1 << ((event) >> 4))
+
+// ESPNOW_TRACE_EV_RX_DROP の理由
+#define ESPNOW_TRACE_DROP_SHORT 0
+#define ESPNOW_TRACE_DROP_WRONG_GROUP 1
+#define ESPNOW_TRACE_DROP_SECURITY 2
+#define ESPNOW_TRACE_DROP_UNKNOWN_PEER 3
+#define ESPNOW_TRACE_DROP_DECOMPRESS 4  // 差分の基準が無い・符号が壊れている
+#define ESPNOW_TRACE_DROP_AUTH 5        // セッションの認証に失敗
+#define ESPNOW_TRACE_DROP_REPLAY 6      // セッションの受信済み・古いシーケンス番号
+
+// トレースレコード（16バイト固定。drainTrace() の出力をそのまま書き出せばホスト側で復元できる）
+typedef struct __attribute__((packed)) {
+    uint32_t timeUs;  // micros() の下位32ビット
+    uint8_t event;    // ESPNOW_TRACE_EV_*
+    uint8_t mac[6];   // 対象のピア（なければ 0）
+    uint8_t arg0;
+    uint32_t arg1;
+} espnow_trace_record_t;
+
+static_assert(sizeof(espnow_trace_record_t) == 16, "Trace record must be 16 bytes");
+
+// 複数プロデューサー・単一コンシューマーの上書き型トレースバッファ
+// - 書き込み側は番号を fetch_add で確保してレコードを書き、完了時にスロットへ番号を付ける
+//   （WiFiタスクの送信完了とエンジンの両方から呼ばれる）
+// - 読み出し側は番号の一致を確認してコピーし、上書きされたレコードは欠落として数える
+template <size_t N>
+class ESP_NowAdhocTraceBuffer {
+public:
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "Trace buffer size must be a power of two");
+
+    ESP_NowAdhocTraceBuffer() : _head(0), _tail(0), _lost(0) {
+        for (size_t i = 0; i < N; i++) {
+            _slots[i].seq.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void record(uint32_t timeUs, uint8_t event, const uint8_t* mac, uint8_t arg0, uint32_t arg1) {
+        uint32_t n = _head.fetch_add(1, std::memory_order_relaxed);
+        slot_t& slot = _slots[n & (N - 1)];
+        slot.seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.rec.timeUs = timeUs;
+        slot.rec.event = event;
+        if (mac) {
+            memcpy(slot.rec.mac, mac, 6);
+        } else {
+            memset(slot.rec.mac, 0, 6);
+        }
+        slot.rec.arg0 = arg0;
+        slot.rec.arg1 = arg1;
+        slot.seq.store(n + 1, std::memory_order_release);
+    }
+
+    // 古い順に最大 max 件をコピーする（書き込み途中のレコードで止まる）
+    size_t drain(espnow_trace_record_t* out, size_t max) {
+        size_t count = 0;
+        while (count < max) {
+            uint32_t head = _head.load(std::memory_order_acquire);
+            if (_tail == head) {
+                break;
+            }
+            if (head - _tail > N) {
+                _lost += head - _tail - N;
+                _tail = head - N;
+            }
+
+            slot_t& slot = _slots[_tail & (N - 1)];
+            uint32_t seq = slot.seq.load(std::memory_order_acquire);
+            if (seq == 0) {
+                break;
+            }
+            if (seq != _tail + 1) {
+                // 読む前に上書きされた
+                _lost++;
+                _tail++;
+                continue;
+            }
+            out[count] = slot.rec;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) != seq) {
+                _lost++;
+                _tail++;
+                continue;
+            }
+            count++;
+            _tail++;
+        }
+        return count;
+    }
+
+    size_t size() const {
+        uint32_t pending = _head.load(std::memory_order_acquire) - _tail;
+        return pending > N ? N : pending;
+    }
+
+    uint32_t lost() const { return _lost; }
+
+private:
+    typedef struct {
+        std::atomic<uint32_t> seq;  // 書き込み番号 + 1（0 は書き込み中）
+        espnow_trace_record_t rec;
+    } slot_t;
+
+    slot_t _slots[N];
+    std::atomic<uint32_t> _head;
+    uint32_t _tail;
+    uint32_t _lost;
+};
+
+#endif
@@ -0,0 +1,256 @@
+#include "ESP_NowAdhoc.h"
+
+// ==================== フレームバッファ ====================
+
+// バッファを確保してフレームを組み立てる（参照カウントは呼び出し側の1つ）
+uint8_t ESP_NowAdhoc::prepareTxBuffer(uint8_t cmd, uint32_t groupToken, const uint8_t *data, size_t len) {
+    if (_txBufFreeCount == 0) {
+        return ESPNOW_NO_BUFFER;
+    }
+
+    uint8_t buf = _txBufFree[_txBufFreeCount - 1];
+    size_t msgLen = buildMessage(&_txBuf[buf], cmd, groupToken, data, len);
+    if (msgLen == 0) {
+        return ESPNOW_NO_BUFFER;
+    }
+
+    _txBufFreeCount--;
+    _txLen[buf] = msgLen;
+    _txRefs[buf] = 1;
+    return buf;
+}
+
+void ESP_NowAdhoc::releaseTxBuffer(uint8_t buf) {
+    if (buf >= ESPNOW_TX_BUFFERS || _txRefs[buf] == 0) {
+        return;
+    }
+    if (--_txRefs[buf] == 0) {
+        _txBufFree[_txBufFreeCount++] = buf;
+    }
+}
+
+// ==================== キュー操作 ====================
+
+bool ESP_NowAdhoc::enqueueTx(uint8_t queue, uint8_t prio, uint8_t buf) {
+    if (_txEntryFreeCount == 0) {
+        _txStats.dropped++;
+        return false;
+    }
+
+    uint8_t e = _txEntryFree[--_txEntryFreeCount];
+    _txEntries[e].buf = buf;
+    _txEntries[e].next = ESPNOW_TX_NONE;
+    _txRefs[buf]++;
+
+    if (_txTail[queue][prio] == ESPNOW_TX_NONE) {
+        _txHead[queue][prio] = e;
+    } else {
+        _txEntries[_txTail[queue][prio]].next = e;
+    }
+    _txTail[queue][prio] = e;
+    _txDepth[queue]++;
+    _txStats.enqueued++;
+    return true;
+}
+
+void ESP_NowAdhoc::popTx(uint8_t queue, uint8_t prio) {
+    uint8_t e = _txHead[queue][prio];
+    if (e == ESPNOW_TX_NONE) {
+        return;
+    }
+
+    _txHead[queue][prio] = _txEntries[e].next;
+    if (_txHead[queue][prio] == ESPNOW_TX_NONE) {
+        _txTail[queue][prio] = ESPNOW_TX_NONE;
+    }
+    _txDepth[queue]--;
+
+    releaseTxBuffer(_txEntries[e].buf);
+    _txEntryFree[_txEntryFreeCount++] = e;
+}
+
+// ピア切断時に未送信のメッセージを破棄
+void ESP_NowAdhoc::dropTxQueue(uint8_t queue) {
+    for (uint8_t p = 0; p < ESPNOW_TX_PRIO_COUNT; p++) {
+        while (_txHead[queue][p] != ESPNOW_TX_NONE) {
+            popTx(queue, p);
+            _txStats.dropped++;
+        }
+    }
+}
+
+size_t ESP_NowAdhoc::getTxQueueDepth(espnow_peer_handle_t handle) const {
+    return _peers.get(handle) ? _txDepth[_peers.slot(handle)] : 0;
+}
+
+float ESP_NowAdhoc::getTxCoalescingRatio() const {
+    return _txStats.frames ? (float)_txStats.messages / _txStats.frames : 1.0f;
+}
+
+// ==================== スケジューラー ====================
+
+static inline bool batchable(uint8_t cmd) {
+    return cmd != CMD_REGISTER && cmd != CMD_PROBE;
+}
+
+// 優先度の高いクラスから、同じクラス内はキューを巡回して次の送信先を選ぶ
+bool ESP_NowAdhoc::nextTxQueue(uint8_t *queue, uint8_t *prio) {
+    // 同期要求の応答を待つ間は送らない（自分の後続のフレームの後ろで応答が待たされないようにする）
+    _txHeld = false;
+    if (_clockQuietUntil != 0) {
+        if (esp_timer_get_time() - _clockQuietUntil < 0) {
+            _txHeld = true;
+            return false;
+        }
+        _clockQuietUntil = 0;
+    }
+
+    // 同期の要求・応答は同じクラスまでの他のフレームを先に渡し、送信中のフレームがなくなってから
+    // 渡す（自分の先のフレームの後ろで待たされた時間は片道だけに入り、時刻のずれになる）
+    uint8_t held = TX_QUEUE_COUNT;
+    for (uint8_t p = 0; p < ESPNOW_TX_PRIO_COUNT && held == TX_QUEUE_COUNT; p++) {
+        for (uint8_t i = 0; i < TX_QUEUE_COUNT; i++) {
+            uint8_t q = (_txCursor[p] + i) % TX_QUEUE_COUNT;
+            if (_txHead[q][p] == ESPNOW_TX_NONE) {
+                continue;
+            }
+            if (isClockExchange(q, _txHead[q][p])) {
+                if (held == TX_QUEUE_COUNT) {
+                    held = q;
+                    *prio = p;
+                }
+                continue;
+            }
+            _txCursor[p] = (q + 1) % TX_QUEUE_COUNT;
+            *queue = q;
+            *prio = p;
+            return true;
+        }
+    }
+    if (held != TX_QUEUE_COUNT) {
+        if (_txInflight.load() > 0) {
+            _txHeld = true;
+            return false;
+        }
+        _txCursor[*prio] = (held + 1) % TX_QUEUE_COUNT;
+        *queue = held;
+        return true;
+    }
+    return false;
+}
+
+void ESP_NowAdhoc::transmitTx(uint8_t queue, uint8_t prio) {
+    ESP_NowAdhocPeer* peer = (queue == TX_BROADCAST_QUEUE) ? _broadcastPeer : _peers.atSlot(queue);
+    if (!peer) {
+        dropTxQueue(queue);
+        return;
+    }
+
+    uint8_t e = _txHead[queue][prio];
+    uint8_t buf = _txEntries[e].buf;
+    const uint8_t *frame = (const uint8_t *)&_txBuf[buf];
+    size_t frameLen = _txLen[buf];
+    size_t count = 1;
+
+    // 同じピア宛の後続メッセージを [長さ(2バイト)][フレーム] の並びで1フレームに結合
+    // 登録フレームは結合しない（未登録の相手は結合フレームを破棄し、セッションモードでは開けない）
+    // 同期の要求・応答も結合しない（フレームが長くなった分が片道だけに入る）
+    if (queue != TX_BROADCAST_QUEUE && _txEntries[e].next != ESPNOW_TX_NONE && batchable(_txBuf[buf].cmd) &&
+        !isClockExchange(queue, e)) {
+        size_t maxFrame = getESPNOWMaxPayload();
+        if (maxFrame > sizeof(espnow_message_t)) {
+            maxFrame = sizeof(espnow_message_t);
+        }
+
+        size_t batchLen = ESPNOW_HEADER_SIZE + 2 + frameLen;
+        for (uint8_t n = _txEntries[e].next; n != ESPNOW_TX_NONE; n = _txEntries[n].next) {
+            if (batchLen + 2 + _txLen[_txEntries[n].buf] > maxFrame || !batchable(_txBuf[_txEntries[n].buf].cmd) ||
+                isClockExchange(queue, n)) {
+                break;
+            }
+            batchLen += 2 + _txLen[_txEntries[n].buf];
+            count++;
+        }
+
+        if (count > 1 && buildMessage(&_txBatch, CMD_BATCH, _groupToken, nullptr, 0) > 0) {
+            size_t offset = 0;
+            uint8_t n = e;
+            for (size_t i = 0; i < count; i++, n = _txEntries[n].next) {
+                // 結合するハートビートにも宛先ごとの時刻を記入する
+                if (_txBuf[_txEntries[n].buf].cmd == CMD_HEARTBEAT) {
+                    stampClock(peer, &_txBuf[_txEntries[n].buf]);
+                }
+                uint16_t len = _txLen[_txEntries[n].buf];
+                memcpy(_txBatch.data + offset, &len, 2);
+                memcpy(_txBatch.data + offset + 2, &_txBuf[_txEntries[n].buf], len);
+                offset += 2 + len;
+            }
+            _txBatch.len = offset;
+            frame = (const uint8_t *)&_txBatch;
+            frameLen = ESPNOW_HEADER_SIZE + offset;
+        } else {
+            count = 1;
+        }
+    }
+
+    // ハートビートには宛先ごとの時刻を送信直前に記入する
+    if (count == 1 && queue != TX_BROADCAST_QUEUE && _txBuf[buf].cmd == CMD_HEARTBEAT) {
+        stampClock(peer, &_txBuf[buf]);
+    }
+
+    // データは宛先ごとに前のペイロードとの差分で圧縮する（バッファは共有のため _txBatch に作る）
+    espnow_compress_ctx_t* compress = nullptr;
+    if (count == 1 && queue != TX_BROADCAST_QUEUE) {
+        size_t compressedLen = compressFrame(peer, _peers.handleOf(queue), &_txBuf[buf], &_txBatch, &compress);
+        if (compressedLen > 0) {
+            frame = (const uint8_t *)&_txBatch;
+            frameLen = compressedLen;
+        }
+    }
+
+    bool success = peer->sendData(frame, frameLen);
+    if (compress) {
+        commitCompress(peer, compress, &_txBuf[buf], success);
+    }
+    for (size_t i = 0; i < count; i++) {
+        popTx(queue, prio);
+    }
+
+    // 送信に失敗したメッセージは再送しない（再送が必要な場合は信頼性モードを使う）
+    if (success) {
+        _txStats.frames++;
+        _txStats.bytes += frameLen;
+        _txStats.messages += count;
+        if (count > 1) {
+            _txStats.coalesced += count;
+        }
+    } else {
+        _txStats.dropped += count;
+        trace(ESPNOW_TRACE_EV_TX_FAILED, peer->addr(), 0, count);
+    }
+}
+
+void ESP_NowAdhoc::serviceTx() {
+    // 送信完了の取りこぼしで送信が止まらないようにする
+    if (_txInflight.load() > 0 &&
+        (uint32_t)millis() - _txLastActivityMs.load() > ESPNOW_TX_INFLIGHT_TIMEOUT) {
+        _txInflight.store(0);
+    }
+
+    feedLargeTx();
+
+    uint8_t queue, prio;
+    while (_txInflight.load() < ESPNOW_TX_MAX_INFLIGHT && nextTxQueue(&queue, &prio)) {
+        transmitTx(queue, prio);
+        feedLargeTx();
+    }
+}
+
+// onSent から呼ばれる（WiFiタスク）
+void ESP_NowAdhoc::onTxComplete() {
+    int32_t n = _txInflight.load();
+    while (n > 0 && !_txInflight.compare_exchange_weak(n, n - 1)) {
+    }
+    _txLastActivityMs.store(millis());
+    wakeEngine();
+}
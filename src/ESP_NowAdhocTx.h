@@ -0,0 +1,58 @@
+#ifndef ESP_NowAdhocTx_H
+#define ESP_NowAdhocTx_H
+
+#include <stdint.h>
+
+// 送信キューのエントリ数（全ピア共有。1メッセージを複数ピアへ送る場合は宛先ごとに1つ）
+// 既定では ESPNOW_MAX_PEERS から決め、全ピア宛の送信がピアごとのハートビートと同時に入る数にする
+// （32〜254。全ピア宛の送信は全宛先分の空きがなければ失敗するため、ESPNOW_MAX_PEERS 以上が必要）
+#ifndef ESPNOW_TX_QUEUE_SIZE
+#define ESPNOW_TX_QUEUE_SIZE \
+    (ESPNOW_MAX_PEERS * 2 + 8 < 32 ? 32 : ESPNOW_MAX_PEERS * 2 + 8 > 254 ? 254 : ESPNOW_MAX_PEERS * 2 + 8)
+#endif
+
+// 送信待ちフレームのバッファ数（同じフレームは複数の宛先で共有）
+#ifndef ESPNOW_TX_BUFFERS
+#define ESPNOW_TX_BUFFERS 8
+#endif
+
+// 送信完了 (onSent) を待つ最大フレーム数（ドライバーの送信キューを溢れさせない）
+#ifndef ESPNOW_TX_MAX_INFLIGHT
+#define ESPNOW_TX_MAX_INFLIGHT 4
+#endif
+
+// 送信完了が届かない場合に送信中カウントを戻すまでの時間 (ms)
+#ifndef ESPNOW_TX_INFLIGHT_TIMEOUT
+#define ESPNOW_TX_INFLIGHT_TIMEOUT 100
+#endif
+
+static_assert(ESPNOW_TX_BUFFERS < 0xFF, "Too many TX buffers");
+static_assert(ESPNOW_TX_MAX_INFLIGHT >= 1, "ESPNOW_TX_MAX_INFLIGHT must be at least 1");
+
+// 優先度クラス（小さいほど優先。同じクラス内はピア間でラウンドロビン）
+#define ESPNOW_TX_PRIO_CONTROL 0    // 登録広告など
+#define ESPNOW_TX_PRIO_HEARTBEAT 1
+#define ESPNOW_TX_PRIO_DATA 2       // アプリケーションデータ・分割送信
+#define ESPNOW_TX_PRIO_COUNT 3
+
+#define ESPNOW_TX_NONE 0xFF
+
+// キューエントリ（バッファ番号と同じキュー内の次のエントリ）
+typedef struct {
+    uint8_t buf;
+    uint8_t next;
+} espnow_tx_entry_t;
+
+// 送信スケジューラーの統計
+// 結合率は messages / frames（1より大きいほど多くのメッセージを1フレームにまとめている）
+typedef struct {
+    uint32_t enqueued;   // キューに入れたメッセージ数（宛先ごと）
+    uint32_t messages;   // 送信したメッセージ数
+    uint32_t frames;     // 送信したフレーム数
+    uint32_t bytes;      // 送信したフレームのバイト数（ヘッダー込み。通信時間の目安）
+    uint32_t coalesced;  // CMD_BATCH にまとめて送信したメッセージ数
+    uint32_t fanout;     // ユニキャストの代わりにブロードキャスト1フレームで送ったメッセージ数
+    uint32_t dropped;    // キュー満杯・送信失敗・ピア切断で破棄したメッセージ数
+} espnow_tx_stats_t;
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef ESP_NowAdhocTyped_H
+#define ESP_NowAdhocTyped_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <type_traits>
+
+// 型付きメッセージ（send<T>() / on<T>()）
+// T は MESSAGE_ID（0..ESPNOW_TYPED_MESSAGES-1）を持つトリビアルコピー可能な構造体
+//   struct SensorReading {
+//       static constexpr uint8_t MESSAGE_ID = 1;
+//       int16_t temperature;
+//       uint16_t humidity;
+//   };
+// ワイヤー上は cmd = CMD_TYPED_BASE + MESSAGE_ID、data は sizeof(T) バイトのみ
+
+// 型付きメッセージIDの数（受信側のディスパッチテーブルの大きさ）
+#ifndef ESPNOW_TYPED_MESSAGES
+#define ESPNOW_TYPED_MESSAGES 32
+#endif
+
+// 型付きメッセージが収まる必要のあるフレーム長（ESP-NOW v1 の上限。v2のみの環境では 1470）
+#ifndef ESPNOW_FRAME_LIMIT
+#define ESPNOW_FRAME_LIMIT 250
+#endif
+
+#define CMD_TYPED_BASE 0x80
+
+static_assert(ESPNOW_TYPED_MESSAGES >= 1 && CMD_TYPED_BASE + ESPNOW_TYPED_MESSAGES <= 0x100,
+              "ESPNOW_TYPED_MESSAGES must be 1..128");
+
+// send<T>() の宛先（ピアハンドル以外）
+#define ESPNOW_TARGET_ALL 0xFE
+#define ESPNOW_TARGET_SERVERS 0xFD
+#define ESPNOW_TARGET_CLIENTS 0xFC
+
+// ディスパッチテーブルのエントリ
+// thunk が handler を元の型に戻し、data を T として渡す
+typedef void (*espnow_typed_fn_t)();
+typedef struct {
+    void (*thunk)(espnow_typed_fn_t handler, const uint8_t* mac, const void* data);
+    espnow_typed_fn_t handler;
+    uint16_t size;
+} espnow_typed_entry_t;
+
+template <typename T>
+struct ESP_NowAdhocTypedCheck {
+    static_assert(std::is_trivially_copyable<T>::value, "Typed messages must be trivially copyable");
+    static_assert(T::MESSAGE_ID < ESPNOW_TYPED_MESSAGES, "MESSAGE_ID must be below ESPNOW_TYPED_MESSAGES");
+    static_assert(alignof(T) <= 4, "Typed messages must not need more than 4-byte alignment");
+    static const bool value = true;
+};
+
+template <typename T>
+void ESP_NowAdhocTypedThunk(espnow_typed_fn_t handler, const uint8_t* mac, const void* data) {
+    typedef void (*Handler)(const uint8_t* mac, const T& msg);
+    Handler fn = reinterpret_cast<Handler>(handler);
+
+    // 受信キューのスロットはペイロードが4バイト境界に来るため通常はコピーしない
+    // （結合フレーム内など境界がずれている場合のみコピー）
+    if (((uintptr_t)data % alignof(T)) == 0) {
+        fn(mac, *reinterpret_cast<const T*>(data));
+    } else {
+        T tmp;
+        memcpy(&tmp, data, sizeof(T));
+        fn(mac, tmp);
+    }
+}
+
+#endif